@@ -0,0 +1,151 @@
+// CallbackDispatch.cpp
+
+// Benchmarks the cost of dispatching a single report to the Wiimote callbacks, for 1, 4 and 16 subscribers
+
+
+
+
+
+#include "Globals.h"
+#include <mutex>
+#include "Wiimote.h"
+
+
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+
+
+/** Exposes the Wiimote's dispatch, so that it can be measured without any transport or parsing. */
+class BenchWiimote:
+	public Wiimote
+{
+public:
+	using Wiimote::notifyStateChange;
+};
+
+
+
+
+
+/** The previous dispatch: copying the std::list of callbacks under a mutex for each report. */
+class ListDispatcher
+{
+public:
+	void addCallback(Wiimote::Callback * a_Callback)
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_Callbacks.push_back(a_Callback);
+	}
+
+	void notifyStateChange(Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
+	{
+		std::list<Wiimote::Callback *> callbacks;
+		{
+			std::lock_guard<std::mutex> lock(m_CS);
+			callbacks = m_Callbacks;
+		}
+		for (auto & cb: callbacks)
+		{
+			(*cb)(a_Wiimote, a_Sample);
+		}
+	}
+
+protected:
+	std::mutex m_CS;
+	std::list<Wiimote::Callback *> m_Callbacks;
+};
+
+
+
+
+
+/** Returns the average time per call of a_Fn, in nanoseconds. */
+template <typename Fn>
+double measure(int a_NumIterations, Fn a_Fn)
+{
+	// Warm up:
+	for (int i = 0; i < a_NumIterations / 10; ++i)
+	{
+		a_Fn();
+	}
+
+	auto start = Clock::now();
+	for (int i = 0; i < a_NumIterations; ++i)
+	{
+		a_Fn();
+	}
+	auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	return elapsed / a_NumIterations;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	int numIterations = 1000000;
+	if (argc > 1)
+	{
+		numIterations = std::max(1, atoi(argv[1]));
+	}
+
+	// All the callbacks do the same trivial work, so that the dispatch overhead dominates:
+	std::atomic<uint64_t> numCalls(0);
+	Wiimote::Callback callback = [&numCalls](Wiimote &, const Wiimote::Sample & a_Sample)
+	{
+		numCalls.fetch_add(a_Sample.m_SeqNum, std::memory_order_relaxed);
+	};
+
+	Wiimote::Sample sample = Wiimote::Sample();
+	sample.m_SeqNum = 1;
+	sample.m_Changes = Wiimote::cmIR;
+
+	printf("%12s  %16s  %16s  %16s\n", "subscribers", "list ns/report", "table ns/report", "idle ns/report");
+	const int numSubscribers[] = {1, 4, 16};
+	for (auto n: numSubscribers)
+	{
+		// All the callbacks must have distinct addresses, so that they can be removed individually:
+		std::vector<Wiimote::Callback> callbacks(n, callback);
+
+		ListDispatcher listDispatcher;
+		BenchWiimote wiimote;
+		for (auto & cb: callbacks)
+		{
+			listDispatcher.addCallback(&cb);
+			wiimote.addCallback(&cb, Wiimote::cmIR);
+		}
+
+		auto listNsec = measure(numIterations, [&]()
+			{
+				listDispatcher.notifyStateChange(wiimote, sample);
+			}
+		);
+		auto tableNsec = measure(numIterations, [&]()
+			{
+				wiimote.notifyStateChange(sample);
+			}
+		);
+
+		// A report with no IR change doesn't interest any of the callbacks:
+		auto idleSample = sample;
+		idleSample.m_Changes = Wiimote::cmAccel;
+		auto idleNsec = measure(numIterations, [&]()
+			{
+				wiimote.notifyStateChange(idleSample);
+			}
+		);
+
+		printf("%12d  %16.1f  %16.1f  %16.1f\n", n, listNsec, tableNsec, idleNsec);
+	}
+	return (numCalls.load() > 0) ? 0 : 1;
+}
+
+
+
+
@@ -0,0 +1,384 @@
+// KernelBench.cpp
+
+// Microbenchmarks of the functions that run on every report: the report parsing, the warping, and the string
+// formatting behind LOG; prints the ns/op of each, optionally also as JSON for tracking them over the releases
+
+// Usage:
+//   KernelBench [iterations=<N>] [repeats=<R>] [json=<file>]
+//     iterations: The number of operations in a single timed run of each kernel (1000000 by default).
+//     repeats:    The number of timed runs of each kernel (5 by default); the best and the median are reported.
+//     json:       Also writes the results as JSON into the file ("-" for stdout, replacing the table).
+//   The inputs are pre-generated realistic reports and points, cycled through, so that the branches aren't all
+//   predicted perfectly and the results don't depend on a single value.
+
+
+
+
+
+#include "Globals.h"
+#include <array>
+#include <random>
+#include "Wiimote.h"
+#include "Calibration.h"
+#include "Warper.h"
+
+
+
+
+
+/** The number of pre-generated inputs cycled through by each kernel; a power of two. */
+static const size_t NUM_INPUTS = 1024;
+
+/** The size of a Wiimote input report. */
+static const size_t REPORT_SIZE = 22;
+
+/** Receives the kernels' results, so that the compiler cannot optimize the kernels away. */
+static volatile uint64_t g_Sink;
+
+
+
+
+
+/** Exposes the Wiimote's parsing functions, so that they can be measured one by one. */
+class BenchWiimote:
+	public Wiimote
+{
+public:
+	using Wiimote::parseIncomingPacket;
+	using Wiimote::parseIR;
+	using Wiimote::parseButtons;
+	using Wiimote::parseAccel;
+
+	/** Sets the IR reporting mode directly in the parse state (parseIncomingPacket() sets it from the settings). */
+	void setParseIRMode(IRReportingMode a_Mode) { m_ParseState.m_IRState.m_ReportingMode = a_Mode; }
+
+	/** Sets the IR reporting mode setting, picked up by parseIncomingPacket(). */
+	void setIRReportingModeSetting(IRReportingMode a_Mode) { m_IRReportingMode = a_Mode; }
+
+	/** Returns a value depending on the whole parsed state, for g_Sink. */
+	uint64_t getParseChecksum() const
+	{
+		const auto & s = m_ParseState;
+		return
+			static_cast<uint64_t>(s.m_IRState.m_X1 + s.m_IRState.m_Y2 + s.m_IRState.m_X3 + s.m_IRState.m_Y4) +
+			(s.m_IRState.m_IsPresent4 ? 1u : 0u) +
+			static_cast<uint64_t>(s.m_AccelState.m_AccelX + s.m_AccelState.m_AccelZ) +
+			(s.m_ButtonState.m_ButtonA ? 2u : 0u);
+	}
+};
+
+
+
+
+
+/** The result of a single kernel's benchmark. */
+struct Result
+{
+	std::string m_Name;
+	double m_BestNsPerOp;
+	double m_MedianNsPerOp;
+	uint64_t m_Iterations;
+	int m_Repeats;
+};
+
+
+
+
+
+/** Measures a_Fn (called with the operation index) a_Repeats times a_NumIterations times, after a warm-up. */
+template <typename Fn>
+Result measure(const char * a_Name, uint64_t a_NumIterations, int a_Repeats, Fn a_Fn)
+{
+	for (uint64_t i = 0; i < a_NumIterations / 10; ++i)
+	{
+		a_Fn(static_cast<size_t>(i));
+	}
+
+	std::vector<double> nsPerOp;
+	for (int r = 0; r < a_Repeats; ++r)
+	{
+		auto start = Clock::now();
+		for (uint64_t i = 0; i < a_NumIterations; ++i)
+		{
+			a_Fn(static_cast<size_t>(i));
+		}
+		auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		nsPerOp.push_back(elapsed / a_NumIterations);
+	}
+	std::sort(nsPerOp.begin(), nsPerOp.end());
+	Result res;
+	res.m_Name = a_Name;
+	res.m_BestNsPerOp = nsPerOp.front();
+	res.m_MedianNsPerOp = nsPerOp[nsPerOp.size() / 2];
+	res.m_Iterations = a_NumIterations;
+	res.m_Repeats = a_Repeats;
+	return res;
+}
+
+
+
+
+
+/** Generates IR + accel reports with the dots laid out for the specified IR mode; about a quarter of the dots are absent. */
+static std::vector<std::array<unsigned char, REPORT_SIZE>> makeReports(Wiimote::IRReportingMode a_IRMode)
+{
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> byteDist(0, 255);
+	std::uniform_int_distribution<int> xDist(0, 1023);
+	std::uniform_int_distribution<int> yDist(0, 767);
+	std::vector<std::array<unsigned char, REPORT_SIZE>> res(NUM_INPUTS);
+	for (auto & r: res)
+	{
+		r.fill(0);
+		r[0] = Wiimote::irtIRAccel;
+		r[1] = static_cast<unsigned char>(byteDist(rng) & 0x1f);
+		r[2] = static_cast<unsigned char>(byteDist(rng) & 0x9f);
+		r[3] = static_cast<unsigned char>(byteDist(rng));
+		r[4] = static_cast<unsigned char>(byteDist(rng));
+		r[5] = static_cast<unsigned char>(byteDist(rng));
+		int xs[4], ys[4];
+		bool isPresent[4];
+		for (int d = 0; d < 4; ++d)
+		{
+			xs[d] = xDist(rng);
+			ys[d] = yDist(rng);
+			isPresent[d] = ((byteDist(rng) & 3) != 0);
+		}
+		if (a_IRMode == Wiimote::irrmBasic)
+		{
+			// Two pairs of dots, 5 bytes per pair:
+			for (int p = 0; p < 2; ++p)
+			{
+				auto pair = &r[6 + 5 * p];
+				auto d1 = 2 * p, d2 = 2 * p + 1;
+				pair[0] = isPresent[d1] ? static_cast<unsigned char>(xs[d1] & 0xff) : 0xff;
+				pair[1] = isPresent[d1] ? static_cast<unsigned char>(ys[d1] & 0xff) : 0xff;
+				pair[2] = static_cast<unsigned char>(
+					(((ys[d1] >> 8) & 0x03) << 6) | (((xs[d1] >> 8) & 0x03) << 4) |
+					(((ys[d2] >> 8) & 0x03) << 2) | ((xs[d2] >> 8) & 0x03)
+				);
+				pair[3] = isPresent[d2] ? static_cast<unsigned char>(xs[d2] & 0xff) : 0xff;
+				pair[4] = isPresent[d2] ? static_cast<unsigned char>(ys[d2] & 0xff) : 0xff;
+			}
+		}
+		else
+		{
+			// Four dots, 3 bytes each:
+			for (int d = 0; d < 4; ++d)
+			{
+				auto dot = &r[6 + 3 * d];
+				if (!isPresent[d])
+				{
+					dot[0] = dot[1] = dot[2] = 0xff;
+					continue;
+				}
+				dot[0] = static_cast<unsigned char>(xs[d] & 0xff);
+				dot[1] = static_cast<unsigned char>(ys[d] & 0xff);
+				dot[2] = static_cast<unsigned char>((((ys[d] >> 8) & 0x03) << 6) | (((xs[d] >> 8) & 0x03) << 4) | (byteDist(rng) & 0x0f));
+			}
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Writes the results as a JSON document into the specified file (stdout for "-").
+Returns true on success. */
+static bool writeJson(const std::string & a_FileName, const std::vector<Result> & a_Results)
+{
+	auto f = (a_FileName == "-") ? stdout : fopen(a_FileName.c_str(), "w");
+	if (f == nullptr)
+	{
+		fprintf(stderr, "Cannot open file \"%s\" for writing\n", a_FileName.c_str());
+		return false;
+	}
+	#ifdef NDEBUG
+		const char * buildType = "release";
+	#else
+		const char * buildType = "debug";
+	#endif
+	fprintf(f, "{\n\t\"benchmark\": \"KernelBench\",\n\t\"build\": \"%s\",\n\t\"unit\": \"ns/op\",\n\t\"results\":\n\t[\n", buildType);
+	for (size_t i = 0; i < a_Results.size(); ++i)
+	{
+		const auto & r = a_Results[i];
+		fprintf(f, "\t\t{\"name\": \"%s\", \"best\": %.3f, \"median\": %.3f, \"iterations\": %llu, \"repeats\": %d}%s\n",
+			r.m_Name.c_str(), r.m_BestNsPerOp, r.m_MedianNsPerOp, static_cast<unsigned long long>(r.m_Iterations), r.m_Repeats,
+			(i + 1 < a_Results.size()) ? "," : ""
+		);
+	}
+	fprintf(f, "\t]\n}\n");
+	if (f != stdout)
+	{
+		fclose(f);
+	}
+	return true;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	uint64_t numIterations = 1000000;
+	int numRepeats = 5;
+	std::string jsonFileName;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "iterations=", 11) == 0)
+		{
+			numIterations = static_cast<uint64_t>(std::max(1, atoi(argv[i] + 11)));
+		}
+		else if (strncmp(argv[i], "repeats=", 8) == 0)
+		{
+			numRepeats = std::max(1, atoi(argv[i] + 8));
+		}
+		else if (strncmp(argv[i], "json=", 5) == 0)
+		{
+			jsonFileName = argv[i] + 5;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [iterations=<N>] [repeats=<R>] [json=<file>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// The inputs:
+	auto basicReports = makeReports(Wiimote::irrmBasic);
+	auto extendedReports = makeReports(Wiimote::irrmExtended);
+	BenchWiimote wiimote;
+	Calibration calibration;
+	const int points[4][4] =  // A realistic keystoned camera view of the screen
+	{
+		{131, 94,  0,     0},
+		{905, 122, 65535, 0},
+		{872, 701, 65535, 65535},
+		{158, 664, 0,     65535},
+	};
+	for (int i = 0; i < 4; ++i)
+	{
+		calibration.setPoint(wiimote, i, points[i][0], points[i][1], points[i][2], points[i][3]);
+	}
+	Warper warper;
+	warper.setCalibration(calibration);
+	Warper::Matrix matrix;
+	matrix.squareToQuad(0, 0, 65535, 0, 65535, 65535, 0, 65535);
+	Warper::Matrix cameraToSquare;
+	cameraToSquare.quadToSquare(131, 94, 905, 122, 872, 701, 158, 664);
+	cameraToSquare.multiplyBy(matrix);
+	std::vector<Warper::Point> cameraPoints(NUM_INPUTS);
+	std::mt19937 rng(2);
+	std::uniform_int_distribution<int> xDist(131, 905);
+	std::uniform_int_distribution<int> yDist(94, 701);
+	for (auto & pt: cameraPoints)
+	{
+		pt.m_X = xDist(rng);
+		pt.m_Y = yDist(rng);
+	}
+	std::string longText(3000, 'x');  // Doesn't fit AppendVPrintf's stack buffer
+	AString str;
+	str.reserve(4096);
+
+	// The kernels:
+	std::vector<Result> results;
+	const auto mask = NUM_INPUTS - 1;
+	results.push_back(measure("Wiimote::parseIR/basic", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			wiimote.setParseIRMode(Wiimote::irrmBasic);
+			wiimote.parseIR(basicReports[a_Idx & mask].data());
+			g_Sink = wiimote.getParseChecksum();
+		}
+	));
+	results.push_back(measure("Wiimote::parseIR/extended", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			wiimote.setParseIRMode(Wiimote::irrmExtended);
+			wiimote.parseIR(extendedReports[a_Idx & mask].data());
+			g_Sink = wiimote.getParseChecksum();
+		}
+	));
+	results.push_back(measure("Wiimote::parseButtons", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			wiimote.parseButtons(extendedReports[a_Idx & mask].data());
+			g_Sink = wiimote.getParseChecksum();
+		}
+	));
+	results.push_back(measure("Wiimote::parseAccel", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			wiimote.parseAccel(extendedReports[a_Idx & mask].data());
+			g_Sink = wiimote.getParseChecksum();
+		}
+	));
+	wiimote.setIRReportingModeSetting(Wiimote::irrmExtended);
+	results.push_back(measure("Wiimote::parseIncomingPacket/IRAccel", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			wiimote.parseIncomingPacket(extendedReports[a_Idx & mask].data());
+			g_Sink = wiimote.getParseChecksum();
+		}
+	));
+	results.push_back(measure("Warper::Matrix::project/Point", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			auto pt = cameraToSquare.project(cameraPoints[a_Idx & mask]);
+			g_Sink = static_cast<uint64_t>(pt.m_X + pt.m_Y);
+		}
+	));
+	results.push_back(measure("Warper::Matrix::project/float", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			const auto & src = cameraPoints[a_Idx & mask];
+			auto pt = cameraToSquare.project(static_cast<Warper::Matrix::Number>(src.m_X), static_cast<Warper::Matrix::Number>(src.m_Y));
+			g_Sink = static_cast<uint64_t>(pt.first + pt.second);
+		}
+	));
+	results.push_back(measure("Warper::warp", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			auto pt = warper.warp(wiimote, cameraPoints[a_Idx & mask]);
+			g_Sink = static_cast<uint64_t>(pt.m_X + pt.m_Y);
+		}
+	));
+	results.push_back(measure("Printf/LOG line", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			auto s = Printf("%s(%d): %s: Wiimote \"%s\": Wrong report size: %u\n",
+				__FILE__, __LINE__, __FUNCTION__, "Wiimote #1", static_cast<unsigned>(a_Idx & 0xff)
+			);
+			g_Sink = s.size();
+		}
+	));
+	results.push_back(measure("AppendVPrintf/reused string", numIterations, numRepeats, [&](size_t a_Idx)
+		{
+			str.clear();
+			AppendPrintf(str, "Pen %d at %.1f, %.1f (%u reports)", static_cast<int>(a_Idx & 3),
+				cameraPoints[a_Idx & mask].m_X * 64.0, cameraPoints[a_Idx & mask].m_Y * 85.3, static_cast<unsigned>(a_Idx)
+			);
+			g_Sink = str.size();
+		}
+	));
+	results.push_back(measure("AppendVPrintf/long", numIterations / 10, numRepeats, [&](size_t a_Idx)
+		{
+			str.clear();
+			AppendPrintf(str, "%u: %s", static_cast<unsigned>(a_Idx), longText.c_str());
+			g_Sink = str.size();
+		}
+	));
+
+	// Report:
+	if (jsonFileName != "-")
+	{
+		printf("%-40s %12s %12s\n", "kernel", "best ns/op", "median ns/op");
+		for (const auto & r: results)
+		{
+			printf("%-40s %12.2f %12.2f\n", r.m_Name.c_str(), r.m_BestNsPerOp, r.m_MedianNsPerOp);
+		}
+	}
+	if (!jsonFileName.empty() && !writeJson(jsonFileName, results))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+
+
+
@@ -0,0 +1,664 @@
+// PipelineBench.cpp
+
+// Drives recorded or synthetic report streams through the whole report path of N virtual Wiimotes and measures it,
+// so that every change to the hot path can be checked for regressions without any hardware or desktop session
+
+// Usage:
+//   PipelineBench [devices=<N>] [reports=<M>] [capture=<file>] [mode=direct|processor]
+//     devices:   The number of virtual Wiimotes fed at once (4 by default).
+//     reports:   The number of synthetic reports fed to each Wiimote (20000 by default); ignored with a capture.
+//     capture:   A capture written by ReportLog (see ReplayCapture); virtual Wiimote i replays captured device i % count.
+//     mode:      direct (default) measures parseIncomingPacket -> callback dispatch -> Warper::warp -> a null sink,
+//                synchronously, with the per-stage latency percentiles and a checksum of the emitted events;
+//                processor measures the app's Processors posting into an InputInjector with a null sink.
+//   Each virtual Wiimote covers its own vertical stripe of the screen. The reports are fed from a single thread in the
+//   order of their (virtual) arrival times, once to warm up and then once measured. The arrival times are virtual, so
+//   that the emitted events don't depend on the machine's speed; the stages are timed with the real clock.
+//   Prints the throughput (reports per CPU-second, i.e. per core, and per wall-clock second), the heap allocations per
+//   report, and the latency percentiles. Run the same command before and after a change and compare.
+
+
+
+
+
+#include "Globals.h"
+#include <random>
+#include <new>
+#ifndef _WIN32
+	#include <time.h>
+#endif
+#include "Wiimote.h"
+#include "ReportReplay.h"
+#include "Calibration.h"
+#include "Warper.h"
+#include "Processor.h"
+#include "InputInjector.h"
+#include "OutputSink.h"
+#include "OneEuroFilter.h"
+
+
+
+
+
+/** The number of heap allocations made so far by the whole process. */
+static std::atomic<uint64_t> g_NumAllocations(0);
+
+
+
+
+
+void * operator new(size_t a_Size)
+{
+	g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+	auto res = malloc((a_Size > 0) ? a_Size : 1);
+	if (res == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return res;
+}
+
+
+
+
+
+void * operator new[](size_t a_Size)
+{
+	return operator new(a_Size);
+}
+
+
+
+
+
+// GCC sees the memory from operator new() reaching free() once this gets inlined, and cannot tell that the new is ours:
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void * a_Ptr) throw()
+{
+	free(a_Ptr);
+}
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+	#pragma GCC diagnostic pop
+#endif
+
+
+
+
+
+void operator delete[](void * a_Ptr) throw()
+{
+	operator delete(a_Ptr);
+}
+
+
+
+
+
+/** The size of the reports fed to the Wiimotes (the size of a Wiimote input report). */
+static const size_t REPORT_SIZE = 22;
+
+/** The interval between two synthetic reports of a single Wiimote (the Wiimote's 100 Hz). */
+static const int64_t SYNTHETIC_REPORT_INTERVAL_USEC = 10000;
+
+
+
+
+
+/** A single report to be fed into a virtual Wiimote. */
+struct Report
+{
+	/** The virtual arrival time, since the start of the stream. */
+	int64_t m_Time;
+
+	Wiimote::IRReportingMode m_IRMode;
+	unsigned char m_Data[REPORT_SIZE];
+	size_t m_Size;
+};
+
+typedef std::vector<Report> ReportStream;
+
+
+
+
+
+/** A single report scheduled for feeding. */
+struct Feed
+{
+	/** The virtual arrival time, since the start of the pass. */
+	int64_t m_Time;
+
+	int m_Device;
+	const Report * m_Report;
+};
+
+
+
+
+
+/** Discards the events, remembering only their count and a checksum of their contents. */
+class NullSink:
+	public OutputSink
+{
+public:
+	NullSink():
+		m_NumEvents(0),
+		m_Checksum(0)
+	{
+	}
+
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) override
+	{
+		m_NumEvents += a_Count;
+		for (size_t i = 0; i < a_Count; ++i)
+		{
+			const auto & e = a_Events[i];
+			m_Checksum = m_Checksum * 1000003 + static_cast<uint64_t>((e.m_Type << 24) ^ (e.m_PenId << 20) ^ (e.m_X << 16) ^ e.m_Y);
+		}
+		return 0;
+	}
+
+	void reset()
+	{
+		m_NumEvents = 0;
+		m_Checksum = 0;
+	}
+
+	uint64_t m_NumEvents;
+	uint64_t m_Checksum;
+};
+
+
+
+
+
+/** The durations (in nanoseconds) of a single stage, one per report, and their percentiles. */
+class StageTimes
+{
+public:
+	StageTimes(const char * a_Name, size_t a_Capacity):
+		m_Name(a_Name)
+	{
+		m_Durations.reserve(a_Capacity);
+	}
+
+	/** Adds a single duration. Doesn't allocate while within the capacity given in the constructor. */
+	void add(Clock::duration a_Duration)
+	{
+		if (m_Durations.size() < m_Durations.capacity())
+		{
+			m_Durations.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(a_Duration).count());
+		}
+	}
+
+	void clear() { m_Durations.clear(); }
+
+	/** Prints the stage's percentiles as a single table row, in microseconds. */
+	void print()
+	{
+		if (m_Durations.empty())
+		{
+			return;
+		}
+		std::sort(m_Durations.begin(), m_Durations.end());
+		printf("%-12s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+			m_Name, getPercentile(0.5), getPercentile(0.9), getPercentile(0.99), getPercentile(0.999), m_Durations.back() / 1000.0
+		);
+	}
+
+	static void printHeader()
+	{
+		printf("%-12s %10s %10s %10s %10s %10s\n", "stage [us]", "p50", "p90", "p99", "p99.9", "max");
+	}
+
+protected:
+	const char * m_Name;
+	std::vector<int64_t> m_Durations;
+
+	/** Returns the specified percentile (0 .. 1) of the sorted durations, in microseconds. */
+	double getPercentile(double a_Fraction) const
+	{
+		auto idx = static_cast<size_t>(a_Fraction * (m_Durations.size() - 1) + 0.5);
+		return m_Durations[idx] / 1000.0;
+	}
+};
+
+
+
+
+
+/** Returns the CPU time consumed by the whole process so far (all its threads). */
+static std::chrono::microseconds getProcessCpuTime()
+{
+	#ifdef _WIN32
+		FILETIME creationTime, exitTime, kernelTime, userTime;
+		if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		{
+			return std::chrono::microseconds(0);
+		}
+		auto toUsec = [](const FILETIME & a_Time)
+		{
+			return ((static_cast<uint64_t>(a_Time.dwHighDateTime) << 32) | a_Time.dwLowDateTime) / 10;  // 100 ns units
+		};
+		return std::chrono::microseconds(toUsec(kernelTime) + toUsec(userTime));
+	#else
+		timespec ts;
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+		{
+			return std::chrono::microseconds(0);
+		}
+		return std::chrono::microseconds(static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+	#endif
+}
+
+
+
+
+
+/** Writes a single IR dot into the extended-mode IR data of a report; a_Dot is 0 .. 3. */
+static void writeDot(unsigned char * a_Report, int a_Dot, bool a_IsPresent, int a_X, int a_Y)
+{
+	auto dot = a_Report + 6 + 3 * a_Dot;
+	if (!a_IsPresent)
+	{
+		dot[0] = 0xff;
+		dot[1] = 0xff;
+		dot[2] = 0xff;
+		return;
+	}
+	dot[0] = static_cast<unsigned char>(a_X & 0xff);
+	dot[1] = static_cast<unsigned char>(a_Y & 0xff);
+	dot[2] = static_cast<unsigned char>((((a_Y >> 8) & 0x03) << 6) | (((a_X >> 8) & 0x03) << 4) | 0x02);
+}
+
+
+
+
+
+/** Generates a deterministic stream of IR + accel reports of a pen drawing circles and being lifted periodically,
+with a bit of noise in both the dot's position and the accelerometers. a_Seed makes the devices' streams differ. */
+static ReportStream makeSyntheticStream(int a_NumReports, unsigned a_Seed)
+{
+	std::mt19937 rng(a_Seed);
+	std::uniform_int_distribution<int> noise(-1, 1);
+	ReportStream res(static_cast<size_t>(a_NumReports));
+	double angle = a_Seed * 0.7;
+	for (int i = 0; i < a_NumReports; ++i)
+	{
+		auto & r = res[static_cast<size_t>(i)];
+		memset(r.m_Data, 0, sizeof(r.m_Data));
+		r.m_Time = i * SYNTHETIC_REPORT_INTERVAL_USEC;
+		r.m_IRMode = Wiimote::irrmExtended;
+		r.m_Size = REPORT_SIZE;
+		r.m_Data[0] = Wiimote::irtIRAccel;
+		r.m_Data[3] = static_cast<unsigned char>(0x80 + noise(rng));
+		r.m_Data[4] = static_cast<unsigned char>(0x80 + noise(rng));
+		r.m_Data[5] = static_cast<unsigned char>(0x9a + noise(rng));
+
+		// The pen draws for 0.8 s, then is lifted for 0.2 s:
+		auto isPenDown = ((i % 100) < 80);
+		angle += 0.05;
+		auto x = static_cast<int>(512 + 300 * cos(angle)) + noise(rng);
+		auto y = static_cast<int>(384 + 250 * sin(angle * 1.3)) + noise(rng);
+		writeDot(r.m_Data, 0, isPenDown, x, y);
+		for (int d = 1; d < 4; ++d)
+		{
+			writeDot(r.m_Data, d, false, 0, 0);
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Reads all the reports of each device in the capture into a separate stream.
+Returns an empty vector on failure (logged). */
+static std::vector<ReportStream> readCapture(const std::string & a_FileName)
+{
+	std::vector<ReportStream> res;
+	ReportReplay replay;
+	if (!replay.open(a_FileName))
+	{
+		return res;
+	}
+	res.resize(replay.getWiimotes().size());
+	ReportReplay::Report captured;
+	uint64_t numTooLong = 0;
+	while (replay.readReport(captured))
+	{
+		if (captured.m_Size > REPORT_SIZE)
+		{
+			numTooLong += 1;
+			continue;
+		}
+		Report r;
+		r.m_Time = captured.m_Time.count();
+		r.m_IRMode = captured.m_IRMode;
+		memset(r.m_Data, 0, sizeof(r.m_Data));
+		memcpy(r.m_Data, captured.m_Data, captured.m_Size);
+		r.m_Size = captured.m_Size;
+		res[static_cast<size_t>(captured.m_Device)].push_back(r);
+	}
+	if ((numTooLong > 0) || (replay.getNumSkipped() > 0))
+	{
+		fprintf(stderr, "Skipped %llu malformed records and %llu over-long reports in the capture\n",
+			static_cast<unsigned long long>(replay.getNumSkipped()), static_cast<unsigned long long>(numTooLong)
+		);
+	}
+
+	// Drop the devices that sent nothing:
+	res.erase(
+		std::remove_if(res.begin(), res.end(), [](const ReportStream & a_Stream) { return a_Stream.empty(); }),
+		res.end()
+	);
+	return res;
+}
+
+
+
+
+
+/** Merges the streams of all the devices into a single feeding schedule, ordered by the arrival time.
+Device i plays the stream i % a_Streams.size(); the devices' reports are spread evenly within the report interval. */
+static std::vector<Feed> makeSchedule(const std::vector<ReportStream> & a_Streams, int a_NumDevices)
+{
+	std::vector<Feed> res;
+	for (int d = 0; d < a_NumDevices; ++d)
+	{
+		const auto & stream = a_Streams[static_cast<size_t>(d) % a_Streams.size()];
+		auto phase = SYNTHETIC_REPORT_INTERVAL_USEC * d / a_NumDevices;
+		for (const auto & r: stream)
+		{
+			Feed f;
+			f.m_Time = r.m_Time - stream.front().m_Time + phase;
+			f.m_Device = d;
+			f.m_Report = &r;
+			res.push_back(f);
+		}
+	}
+	std::stable_sort(res.begin(), res.end(),
+		[](const Feed & a_First, const Feed & a_Second)
+		{
+			return (a_First.m_Time < a_Second.m_Time);
+		}
+	);
+	return res;
+}
+
+
+
+
+
+/** Calibrates each Wiimote's whole camera view onto its own vertical stripe of the screen, so that no two overlap. */
+static void calibrateStripes(Calibration & a_Calibration, std::vector<WiimotePtr> & a_Wiimotes)
+{
+	auto num = static_cast<int>(a_Wiimotes.size());
+	for (int i = 0; i < num; ++i)
+	{
+		auto left = 65535 * i / num;
+		auto right = 65535 * (i + 1) / num - 1;
+		auto & w = *a_Wiimotes[static_cast<size_t>(i)];
+		a_Calibration.setPoint(w, 0, 0,    0,   left,  0);
+		a_Calibration.setPoint(w, 1, 1023, 0,   right, 0);
+		a_Calibration.setPoint(w, 2, 1023, 767, right, 65535);
+		a_Calibration.setPoint(w, 3, 0,    767, left,  65535);
+	}
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	int numDevices = 4;
+	int numReports = 20000;
+	std::string captureFileName;
+	auto isProcessorMode = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "devices=", 8) == 0)
+		{
+			numDevices = std::max(1, atoi(argv[i] + 8));
+		}
+		else if (strncmp(argv[i], "reports=", 8) == 0)
+		{
+			numReports = std::max(1, atoi(argv[i] + 8));
+		}
+		else if (strncmp(argv[i], "capture=", 8) == 0)
+		{
+			captureFileName = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "mode=direct") == 0)
+		{
+			isProcessorMode = false;
+		}
+		else if (strcmp(argv[i], "mode=processor") == 0)
+		{
+			isProcessorMode = true;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [devices=<N>] [reports=<M>] [capture=<file>] [mode=direct|processor]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// Prepare the report streams and the feeding schedule:
+	std::vector<ReportStream> streams;
+	if (captureFileName.empty())
+	{
+		for (int d = 0; d < numDevices; ++d)
+		{
+			streams.push_back(makeSyntheticStream(numReports, static_cast<unsigned>(d + 1)));
+		}
+	}
+	else
+	{
+		streams = readCapture(captureFileName);
+		if (streams.empty())
+		{
+			fprintf(stderr, "The capture has no reports\n");
+			return 1;
+		}
+	}
+	auto schedule = makeSchedule(streams, numDevices);
+	auto passDuration = schedule.back().m_Time + SYNTHETIC_REPORT_INTERVAL_USEC;
+
+	// Set up the virtual Wiimotes and the pipeline:
+	std::vector<WiimotePtr> wiimotes;
+	Wiimote::AccelCalibration accelCalibration = {0x80, 0x80, 0x80, 0x9a, 0x9a, 0x9a};
+	for (int d = 0; d < numDevices; ++d)
+	{
+		auto w = std::make_shared<Wiimote>();
+		w->startReplay(Printf("Virtual%d", d), accelCalibration);
+		wiimotes.push_back(w);
+	}
+	Calibration calibration;
+	calibrateStripes(calibration, wiimotes);
+	Warper warper;
+	warper.setCalibration(calibration);
+	auto sink = std::make_shared<NullSink>();
+	auto numFeeds = schedule.size();
+	StageTimes parseTimes("parse", numFeeds);
+	StageTimes dispatchTimes("dispatch", numFeeds);
+	StageTimes warpTimes("warp", numFeeds);
+	StageTimes sinkTimes("sink", numFeeds);
+	StageTimes totalTimes("total", numFeeds);
+
+	// The real time at which the report being fed has been handed to its Wiimote:
+	Clock::time_point feedTime;
+
+	// Direct mode: each Wiimote's callback warps its dots and sends them into the sink synchronously, with a pen
+	// transition whenever a dot appears or disappears:
+	std::vector<Wiimote::Callback> callbacks;
+	std::vector<char> wasPresent(static_cast<size_t>(numDevices) * 4, 0);  // 4 dots per Wiimote
+	callbacks.reserve(static_cast<size_t>(numDevices));
+	for (int d = 0; d < numDevices; ++d)
+	{
+		callbacks.push_back([&, d](Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
+			{
+				auto trace = a_Sample.m_Trace;
+				const auto & ir = a_Sample.m_State.m_IRState;
+				const int xs[4] = {ir.m_X1, ir.m_X2, ir.m_X3, ir.m_X4};
+				const int ys[4] = {ir.m_Y1, ir.m_Y2, ir.m_Y3, ir.m_Y4};
+				const bool isPresent[4] = {ir.m_IsPresent1, ir.m_IsPresent2, ir.m_IsPresent3, ir.m_IsPresent4};
+				MouseEvent events[8];
+				size_t numEvents = 0;
+				auto was = &wasPresent[static_cast<size_t>(d) * 4];
+				for (int i = 0; i < 4; ++i)
+				{
+					if (isPresent[i])
+					{
+						Warper::Point pt = {xs[i], ys[i]};
+						auto screen = warper.warp(a_Wiimote, pt);
+						MouseEvent move = {MouseEvent::metMove, screen.m_X, screen.m_Y, i};
+						events[numEvents++] = move;
+						if (!was[i])
+						{
+							MouseEvent down = {MouseEvent::metLeftDown, screen.m_X, screen.m_Y, i};
+							events[numEvents++] = down;
+						}
+					}
+					else if (was[i])
+					{
+						MouseEvent up = {MouseEvent::metLeftUp, 0, 0, i};
+						events[numEvents++] = up;
+					}
+					was[i] = isPresent[i] ? 1 : 0;
+				}
+				trace.mark(LatencyTrace::stWarped);
+				sink->send(events, numEvents);
+				trace.mark(LatencyTrace::stInjected);
+
+				parseTimes.add(trace.m_Times[LatencyTrace::stParsed] - feedTime);
+				dispatchTimes.add(trace.m_Times[LatencyTrace::stDispatched] - trace.m_Times[LatencyTrace::stParsed]);
+				warpTimes.add(trace.m_Times[LatencyTrace::stWarped] - trace.m_Times[LatencyTrace::stDispatched]);
+				sinkTimes.add(trace.m_Times[LatencyTrace::stInjected] - trace.m_Times[LatencyTrace::stWarped]);
+				totalTimes.add(trace.m_Times[LatencyTrace::stInjected] - feedTime);
+			}
+		);
+	}
+
+	// Processor mode: the pipeline set up the same way as the app does for non-overlapping Wiimotes:
+	std::unique_ptr<InputInjector> injector;
+	std::vector<ProcessorPtr> processors;
+	if (isProcessorMode)
+	{
+		injector.reset(new InputInjector(sink));
+		MotionPredictor::Config predictorConfig;
+		predictorConfig.m_Horizon = std::chrono::milliseconds(16);
+		for (const auto & w: wiimotes)
+		{
+			processors.push_back(std::make_shared<Processor>(
+				warper, *injector, wiimotes, w.get(), PenDebouncer::Config(), PointFilterPtr(new OneEuroFilter()), predictorConfig
+			));
+		}
+	}
+	else
+	{
+		for (int d = 0; d < numDevices; ++d)
+		{
+			wiimotes[static_cast<size_t>(d)]->addCallback(&callbacks[static_cast<size_t>(d)], Wiimote::cmIR | Wiimote::cmEveryReport);
+		}
+	}
+
+	// Feed the schedule twice, once to warm up and once measured; the virtual time goes on across the passes:
+	auto virtualStart = Clock::now();
+	uint64_t numAllocations = 0;
+	std::chrono::microseconds cpuTime(0);
+	Clock::duration wallTime(0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		auto isMeasured = (pass == 1);
+		if (isMeasured)
+		{
+			parseTimes.clear();
+			dispatchTimes.clear();
+			warpTimes.clear();
+			sinkTimes.clear();
+			totalTimes.clear();
+			if (!isProcessorMode)
+			{
+				sink->reset();
+			}
+		}
+		auto passStart = virtualStart + std::chrono::microseconds(pass * passDuration);
+		auto allocsBefore = g_NumAllocations.load();
+		auto cpuBefore = getProcessCpuTime();
+		auto wallBefore = Clock::now();
+		for (const auto & f: schedule)
+		{
+			const auto & r = *f.m_Report;
+			feedTime = Clock::now();
+			wiimotes[static_cast<size_t>(f.m_Device)]->replayReport(r.m_Data, r.m_Size, r.m_IRMode, passStart + std::chrono::microseconds(f.m_Time));
+			if (isProcessorMode)
+			{
+				totalTimes.add(Clock::now() - feedTime);
+			}
+		}
+		if (isMeasured)
+		{
+			wallTime = Clock::now() - wallBefore;
+			cpuTime = getProcessCpuTime() - cpuBefore;
+			numAllocations = g_NumAllocations.load() - allocsBefore;
+		}
+	}
+	if (injector != nullptr)
+	{
+		injector->stop();
+	}
+	if (!isProcessorMode)
+	{
+		for (int d = 0; d < numDevices; ++d)
+		{
+			wiimotes[static_cast<size_t>(d)]->removeCallback(&callbacks[static_cast<size_t>(d)]);
+		}
+	}
+
+	// Report:
+	auto wallSec = std::chrono::duration<double>(wallTime).count();
+	auto cpuSec = cpuTime.count() / 1e6;
+	printf("Mode %s, %d Wiimotes, %llu reports measured (%s)\n",
+		isProcessorMode ? "processor" : "direct", numDevices, static_cast<unsigned long long>(numFeeds),
+		captureFileName.empty() ? "synthetic" : captureFileName.c_str()
+	);
+	printf("Throughput: %.0f reports per CPU-second (per core), %.0f reports per wall-clock second\n",
+		(cpuSec > 0) ? (numFeeds / cpuSec) : 0.0, (wallSec > 0) ? (numFeeds / wallSec) : 0.0
+	);
+	printf("Allocations: %llu in total, %.3f per report\n",
+		static_cast<unsigned long long>(numAllocations), static_cast<double>(numAllocations) / numFeeds
+	);
+	if (isProcessorMode)
+	{
+		auto injectorStats = injector->getStats();
+		printf("Events: %llu posted, %llu sent to the sink (moves are coalesced, not comparable between runs)\n",
+			static_cast<unsigned long long>(injectorStats.m_NumPosted), static_cast<unsigned long long>(sink->m_NumEvents)
+		);
+		printf("Per-report synchronous time, parsing up to posting to the injector:\n");
+		StageTimes::printHeader();
+		totalTimes.print();
+	}
+	else
+	{
+		printf("Events: %llu, checksum %016llx (must not change unless the output is meant to)\n",
+			static_cast<unsigned long long>(sink->m_NumEvents), static_cast<unsigned long long>(sink->m_Checksum)
+		);
+		printf("Per-stage latency:\n");
+		StageTimes::printHeader();
+		parseTimes.print();
+		dispatchTimes.print();
+		warpTimes.print();
+		sinkTimes.print();
+		totalTimes.print();
+	}
+	return 0;
+}
+
+
+
+
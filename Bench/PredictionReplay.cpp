@@ -0,0 +1,330 @@
+// PredictionReplay.cpp
+
+// Replays a recorded pen trace through the MotionPredictor, to measure the accuracy and overshoot of the prediction
+
+// Usage: PredictionReplay [<capture file> [<horizon ms> ...]]
+// The capture file is the one written by CaptureSink::openFile(), recorded with the prediction disabled;
+// use "-" (or no arguments) for a built-in synthetic trace. The errors are in pixels of a 1920 px wide screen.
+
+
+
+
+
+#include "Globals.h"
+#include <random>
+#include "MotionPredictor.h"
+
+
+
+
+
+/** The screen width for converting the normalized screen coords to pixels in the output. */
+static const double SCREEN_WIDTH = 1920;
+
+/** The samples further apart than this are considered separate strokes, even without a pen-up in between. */
+static const double MAX_GAP_SEC = 0.1;
+
+static const double PI = 3.14159265358979323846;
+
+
+
+
+
+/** A single sample of the trace. */
+struct TracePoint
+{
+	/** The time of the sample, in seconds since the start of the trace. */
+	double m_Time;
+
+	/** The reported position (normalized screen coords), as fed into the predictor. */
+	double m_X, m_Y;
+
+	/** The true position; same as the reported one for the recorded traces, without the jitter for the synthetic ones. */
+	double m_TrueX, m_TrueY;
+};
+
+typedef std::vector<TracePoint> Stroke;
+
+
+
+
+
+/** Loads the strokes of pen 0 from the CaptureSink file.
+Returns false if the file cannot be read. */
+static bool loadCapture(const char * a_FileName, std::vector<Stroke> & a_Strokes)
+{
+	FILE * f = fopen(a_FileName, "r");
+	if (f == nullptr)
+	{
+		fprintf(stderr, "Cannot open the capture file %s\n", a_FileName);
+		return false;
+	}
+	Stroke stroke;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr)
+	{
+		long long usec;
+		unsigned long long batch;
+		int pen, x, y;
+		char type[16];
+		if (sscanf(line, "%lld\t%llu\t%d\t%15s\t%d\t%d", &usec, &batch, &pen, type, &x, &y) != 6)
+		{
+			continue;
+		}
+		if (pen != 0)
+		{
+			continue;
+		}
+		auto fx = static_cast<double>(x);
+		auto fy = static_cast<double>(y);
+		TracePoint pt = {usec / 1e6, fx, fy, fx, fy};
+		if (!stroke.empty() && (pt.m_Time - stroke.back().m_Time > MAX_GAP_SEC))
+		{
+			a_Strokes.push_back(std::move(stroke));
+			stroke.clear();
+		}
+		stroke.push_back(pt);
+		if (strcmp(type, "up") == 0)
+		{
+			a_Strokes.push_back(std::move(stroke));
+			stroke.clear();
+		}
+	}
+	fclose(f);
+	if (!stroke.empty())
+	{
+		a_Strokes.push_back(std::move(stroke));
+	}
+	return true;
+}
+
+
+
+
+
+/** Generates the synthetic strokes at 100 Hz: straight lines that accelerate and stop, circles, and zig-zags
+with sharp turns, with jitter of about 1 px added to the reported positions. */
+static void generateSynthetic(std::vector<Stroke> & a_Strokes)
+{
+	std::mt19937 rnd(1);
+	std::normal_distribution<double> jitter(0, 35);
+	double time = 0;
+	auto addStroke = [&](int a_NumSamples, std::function<void(double, double &, double &)> a_Path)
+	{
+		Stroke stroke;
+		for (int i = 0; i < a_NumSamples; ++i)
+		{
+			TracePoint pt;
+			pt.m_Time = time;
+			a_Path(static_cast<double>(i) / (a_NumSamples - 1), pt.m_TrueX, pt.m_TrueY);
+			pt.m_X = pt.m_TrueX + jitter(rnd);
+			pt.m_Y = pt.m_TrueY + jitter(rnd);
+			stroke.push_back(pt);
+			time += 0.01;
+		}
+		a_Strokes.push_back(std::move(stroke));
+		time += 0.5;
+	};
+	for (int rep = 0; rep < 10; ++rep)
+	{
+		// A line with a smooth start and stop, then held still:
+		addStroke(120, [](double a_T, double & a_X, double & a_Y)
+			{
+				auto s = std::min(a_T / 0.7, 1.0);
+				s = s * s * (3 - 2 * s);
+				a_X = 5000 + 50000 * s;
+				a_Y = 10000 + 30000 * s;
+			}
+		);
+
+		// A circle at a constant speed:
+		addStroke(150, [](double a_T, double & a_X, double & a_Y)
+			{
+				a_X = 32768 + 15000 * cos(a_T * 2 * PI);
+				a_Y = 32768 + 15000 * sin(a_T * 2 * PI);
+			}
+		);
+
+		// A zig-zag with sharp turns:
+		addStroke(100, [](double a_T, double & a_X, double & a_Y)
+			{
+				auto phase = a_T * 5;
+				auto tri = phase - floor(phase);
+				tri = (static_cast<int>(phase) % 2 == 0) ? tri : (1 - tri);
+				a_X = 5000 + 55000 * a_T;
+				a_Y = 20000 + 20000 * tri;
+			}
+		);
+	}
+}
+
+
+
+
+
+/** Returns the true position at the specified time, interpolated between the stroke's samples.
+Returns false if the time is past the end of the stroke. */
+static bool interpolate(const Stroke & a_Stroke, double a_Time, double & a_X, double & a_Y)
+{
+	for (size_t i = 1; i < a_Stroke.size(); ++i)
+	{
+		const auto & next = a_Stroke[i];
+		if (next.m_Time < a_Time)
+		{
+			continue;
+		}
+		const auto & prev = a_Stroke[i - 1];
+		auto dt = next.m_Time - prev.m_Time;
+		auto t = (dt > 0) ? ((a_Time - prev.m_Time) / dt) : 1;
+		a_X = prev.m_TrueX + t * (next.m_TrueX - prev.m_TrueX);
+		a_Y = prev.m_TrueY + t * (next.m_TrueY - prev.m_TrueY);
+		return true;
+	}
+	return false;
+}
+
+
+
+
+
+/** Returns the value at the specified percentile of the sorted values. */
+static double percentile(const std::vector<double> & a_Sorted, double a_Percentile)
+{
+	if (a_Sorted.empty())
+	{
+		return 0;
+	}
+	auto idx = static_cast<size_t>(a_Percentile / 100 * (a_Sorted.size() - 1) + 0.5);
+	return a_Sorted[idx];
+}
+
+
+
+
+
+/** Replays the strokes through the predictor with the specified horizon and prints a single row of the results. */
+static void replay(const std::vector<Stroke> & a_Strokes, int a_HorizonMsec)
+{
+	MotionPredictor::Config config;
+	config.m_Horizon = std::chrono::milliseconds(a_HorizonMsec);
+	MotionPredictor predictor(config);
+	auto horizonSec = a_HorizonMsec / 1000.0;
+	auto scale = SCREEN_WIDTH / 65536;
+
+	// The error of the prediction, of the plain latest sample (what the prediction is trying to improve),
+	// and the overshoot - how far the prediction got ahead of the pen, along the pen's direction of motion:
+	std::vector<double> errors, baselineErrors, overshoots;
+	for (const auto & stroke: a_Strokes)
+	{
+		predictor.reset();
+		for (const auto & pt: stroke)
+		{
+			auto start = Clock::time_point() + std::chrono::microseconds(static_cast<long long>(pt.m_Time * 1e6));
+			predictor.addSample(pt.m_X, pt.m_Y, start);
+			double actualX, actualY;
+			if (!interpolate(stroke, pt.m_Time + horizonSec, actualX, actualY))
+			{
+				break;
+			}
+			double predX, predY;
+			predictor.predict(predX, predY);
+			auto errX = predX - actualX;
+			auto errY = predY - actualY;
+			errors.push_back(sqrt(errX * errX + errY * errY) * scale);
+			auto baseX = pt.m_X - actualX;
+			auto baseY = pt.m_Y - actualY;
+			baselineErrors.push_back(sqrt(baseX * baseX + baseY * baseY) * scale);
+
+			// The direction of the pen's motion over the horizon; if the pen stands still, any motion is overshoot:
+			auto dirX = actualX - pt.m_TrueX;
+			auto dirY = actualY - pt.m_TrueY;
+			auto dirLen = sqrt(dirX * dirX + dirY * dirY);
+			if (dirLen < 1)
+			{
+				dirX = predX - pt.m_TrueX;
+				dirY = predY - pt.m_TrueY;
+				dirLen = sqrt(dirX * dirX + dirY * dirY);
+			}
+			auto overshoot = (dirLen > 0) ? ((errX * dirX + errY * dirY) / dirLen) : 0;
+			overshoots.push_back(std::max(overshoot, 0.0) * scale);
+		}
+	}
+	if (errors.empty())
+	{
+		printf("%8d  %8s\n", a_HorizonMsec, "no data");
+		return;
+	}
+
+	auto mean = [](const std::vector<double> & a_Values)
+	{
+		double sum = 0;
+		for (auto v: a_Values)
+		{
+			sum += v;
+		}
+		return sum / a_Values.size();
+	};
+	auto meanErr = mean(errors);
+	auto meanBaseline = mean(baselineErrors);
+	auto meanOvershoot = mean(overshoots);
+	std::sort(errors.begin(), errors.end());
+	std::sort(baselineErrors.begin(), baselineErrors.end());
+	std::sort(overshoots.begin(), overshoots.end());
+	printf("%8d  %8u  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f\n",
+		a_HorizonMsec, static_cast<unsigned>(errors.size()),
+		meanErr, percentile(errors, 95), errors.back(),
+		meanOvershoot, percentile(overshoots, 95),
+		meanBaseline, percentile(baselineErrors, 95)
+	);
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	std::vector<Stroke> strokes;
+	if ((argc > 1) && (strcmp(argv[1], "-") != 0))
+	{
+		if (!loadCapture(argv[1], strokes))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		generateSynthetic(strokes);
+	}
+	size_t numSamples = 0;
+	for (const auto & s: strokes)
+	{
+		numSamples += s.size();
+	}
+	printf("%u strokes, %u samples; errors in px of a %.0f px wide screen\n",
+		static_cast<unsigned>(strokes.size()), static_cast<unsigned>(numSamples), SCREEN_WIDTH
+	);
+
+	std::vector<int> horizons;
+	for (int i = 2; i < argc; ++i)
+	{
+		horizons.push_back(atoi(argv[i]));
+	}
+	if (horizons.empty())
+	{
+		horizons = {8, 16, 24, 32, 48};
+	}
+
+	printf("%8s  %8s  %8s  %8s  %8s  %8s  %8s  %8s  %8s\n",
+		"ahead ms", "samples", "err mean", "err p95", "err max", "over avg", "over p95", "lag mean", "lag p95"
+	);
+	for (auto h: horizons)
+	{
+		replay(strokes, h);
+	}
+	return 0;
+}
+
+
+
+
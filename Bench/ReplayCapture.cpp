@@ -0,0 +1,209 @@
+// ReplayCapture.cpp
+
+// Replays a raw report capture through the whole pipeline, to benchmark and regression-test it without any hardware
+
+// Usage:
+//   ReplayCapture <capture file> [realtime] [from=<seconds>] [<events file>]
+//     Replays the capture (written by ReportLog) as fast as possible, or in real time, through the Processors / PenFusions
+//     set up the same way as the app does, and prints the throughput and the emitted events' counts.
+//     The replay starts at the capture's sync point closest before the specified time, if given.
+//     The events are written into the events file (CaptureSink format), if given, for diffing against a previous run;
+//     only the real-time runs' events are comparable, as fast as possible the injector keeps just the latest move.
+//   ReplayCapture --simulate <capture file> [<seconds>]
+//     Records a capture of a SimulatedWiimote drawing strokes, calibrated to the whole camera view.
+
+
+
+
+
+#include "Globals.h"
+#include <thread>
+#include "ReportLog.h"
+#include "ReportReplay.h"
+#include "SimulatedWiimote.h"
+#include "Warper.h"
+#include "Processor.h"
+#include "PenFusion.h"
+#include "FusionSource.h"
+#include "InputInjector.h"
+#include "CaptureSink.h"
+#include "OneEuroFilter.h"
+#include "StageHistograms.h"
+
+
+
+
+
+/** Records a capture of a simulated Wiimote drawing strokes for the specified number of seconds.
+Returns the process exit code. */
+static int simulate(const std::string & a_FileName, double a_Seconds)
+{
+	// The log must outlive the Wiimote logging into it:
+	ReportLog log;
+	if (!log.create(a_FileName))
+	{
+		return 1;
+	}
+
+	auto sim = new SimulatedWiimote;
+	sim->setScript(SimulatedWiimote::makeStrokesScript(4, 0.6, 0.15));
+	sim->setReportInterval(std::chrono::milliseconds(10));
+	auto wiimote = std::make_shared<Wiimote>();
+	if (!wiimote->connect(TransportPtr(sim), "Simulated", nullptr))
+	{
+		fprintf(stderr, "Cannot connect to the simulated Wiimote\n");
+		return 1;
+	}
+	wiimote->setReportLog(&log);
+	Calibration calibration;
+	const int points[4][4] =
+	{
+		{0,    0,   0,     0},
+		{1023, 0,   65535, 0},
+		{1023, 767, 65535, 65535},
+		{0,    767, 0,     65535},
+	};
+	for (int i = 0; i < 4; ++i)
+	{
+		calibration.setPoint(*wiimote, i, points[i][0], points[i][1], points[i][2], points[i][3]);
+	}
+	log.addCalibration(calibration);
+	wiimote->setReportType(Wiimote::irtIRAccel, true).get();
+	std::this_thread::sleep_for(std::chrono::duration<double>(a_Seconds));
+	wiimote.reset();
+	printf("Recorded %llu records, %llu bytes (%llu bytes of raw reports)\n",
+		static_cast<unsigned long long>(log.getNumRecords()), static_cast<unsigned long long>(log.getNumBytes()),
+		static_cast<unsigned long long>(log.getNumReportBytes())
+	);
+	return 0;
+}
+
+
+
+
+
+/** Replays the capture through the pipeline, at the specified speed.
+Returns the process exit code. */
+static int replay(const std::string & a_FileName, ReportReplay::Speed a_Speed, double a_FromSec, const std::string & a_EventsFileName)
+{
+	ReportReplay replay;
+	if (!replay.open(a_FileName))
+	{
+		return 1;
+	}
+	if (a_FromSec > 0)
+	{
+		auto from = replay.seek(std::chrono::microseconds(static_cast<int64_t>(a_FromSec * 1e6)));
+		printf("Replaying from %.3f s of %.3f s\n", from.count() / 1e6, replay.getDuration().count() / 1e6);
+	}
+	if (!replay.getCalibration()->isUsable())
+	{
+		fprintf(stderr, "The capture has no usable calibration\n");
+		return 1;
+	}
+	auto wiimotes = replay.getWiimotes();
+
+	// Set the pipeline up the same way as the app does:
+	Warper warper;
+	warper.setCalibration(*replay.getCalibration());
+	auto sink = std::make_shared<CaptureSink>(false);
+	if (!a_EventsFileName.empty() && !sink->openFile(a_EventsFileName))
+	{
+		return 1;
+	}
+	InputInjector injector(sink);
+	std::vector<ProcessorPtr> processors;
+	std::vector<std::shared_ptr<PenFusion>> fusions;
+	std::vector<FusionSourcePtr> fusionSources;
+	MotionPredictor::Config predictorConfig;
+	predictorConfig.m_Horizon = std::chrono::milliseconds(16);
+	for (const auto & group: warper.getOverlappingGroups())
+	{
+		if (group.size() == 1)
+		{
+			processors.push_back(std::make_shared<Processor>(
+				warper, injector, wiimotes, group[0], PenDebouncer::Config(), PointFilterPtr(new OneEuroFilter()), predictorConfig
+			));
+			continue;
+		}
+		PenFusion::Config fusionConfig;
+		fusionConfig.m_Mode = PenFusion::fmInterleave;
+		auto fusion = std::make_shared<PenFusion>(
+			warper, injector, PenDebouncer::Config(), PointFilterPtr(new OneEuroFilter()), predictorConfig, fusionConfig
+		);
+		for (const auto w: group)
+		{
+			fusionSources.push_back(std::make_shared<FusionSource>(warper, *fusion, wiimotes, w));
+		}
+		fusions.push_back(fusion);
+	}
+
+	auto stats = replay.run(a_Speed);
+	injector.stop();
+
+	auto elapsedSec = stats.m_ElapsedTime.count() / 1e6;
+	auto capturedSec = stats.m_CapturedDuration.count() / 1e6;
+	printf("Replayed %llu reports from %u Wiimotes (%llu records skipped)\n",
+		static_cast<unsigned long long>(stats.m_NumReports), static_cast<unsigned>(wiimotes.size()),
+		static_cast<unsigned long long>(stats.m_NumSkipped)
+	);
+	printf("Captured %.3f s, replayed in %.3f s: %.0f reports per second, %.1fx real time\n",
+		capturedSec, elapsedSec,
+		(elapsedSec > 0) ? (stats.m_NumReports / elapsedSec) : 0.0,
+		(elapsedSec > 0) ? (capturedSec / elapsedSec) : 0.0
+	);
+	auto injectorStats = injector.getStats();
+	printf("Mouse events: %llu posted, %llu emitted in %llu batches, %llu moves dropped, %llu moves suppressed\n",
+		static_cast<unsigned long long>(injectorStats.m_NumPosted),
+		static_cast<unsigned long long>(sink->getNumEvents()),
+		static_cast<unsigned long long>(sink->getNumBatches()),
+		static_cast<unsigned long long>(injectorStats.m_NumMovesDropped),
+		static_cast<unsigned long long>(injectorStats.m_NumMovesSuppressed)
+	);
+	if (a_Speed == ReportReplay::rsRealTime)
+	{
+		printf("Pen-to-cursor latency:\n%s", injector.getLatencyStats().format().c_str());
+		printf("Processing stages' latency:\n%s", StageHistograms::get().format().c_str());
+	}
+	return 0;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	if ((argc >= 3) && (strcmp(argv[1], "--simulate") == 0))
+	{
+		return simulate(argv[2], (argc > 3) ? atof(argv[3]) : 5.0);
+	}
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage:\n\t%s <capture file> [realtime] [from=<seconds>] [<events file>]\n\t%s --simulate <capture file> [<seconds>]\n", argv[0], argv[0]);
+		return 2;
+	}
+	auto speed = ReportReplay::rsAsFastAsPossible;
+	double fromSec = 0;
+	std::string eventsFileName;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "realtime") == 0)
+		{
+			speed = ReportReplay::rsRealTime;
+		}
+		else if (strncmp(argv[i], "from=", 5) == 0)
+		{
+			fromSec = atof(argv[i] + 5);
+		}
+		else
+		{
+			eventsFileName = argv[i];
+		}
+	}
+	return replay(argv[1], speed, fromSec, eventsFileName);
+}
+
+
+
+
@@ -0,0 +1,186 @@
+// RingContention.cpp
+
+// Benchmarks publishing the Wiimote state to many concurrent readers: a mutex-guarded State vs. the SampleRing
+
+
+
+
+
+#include "Globals.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "Wiimote.h"
+#include "SampleRing.h"
+
+
+
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+
+
+/** The results of a single benchmark run. */
+struct Result
+{
+	/** Number of states published by the producer per second. */
+	double m_WritesPerSec;
+
+	/** Number of states read by all the readers together per second. */
+	double m_ReadsPerSec;
+
+	/** The longest time the producer spent publishing a single state, in nanoseconds. */
+	int64_t m_MaxWriteNsec;
+};
+
+
+
+
+
+/** The old path: the producer and all the readers share a single mutex. */
+class MutexState
+{
+public:
+	void publish(const Wiimote::State & a_State)
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_State = a_State;
+	}
+
+	Wiimote::IRState getIRState() const
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		return m_State.m_IRState;
+	}
+
+protected:
+	mutable std::mutex m_CS;
+	Wiimote::State m_State;
+};
+
+
+
+
+
+/** The new path: the producer publishes into a SampleRing, the readers read the latest sample. */
+class RingState
+{
+public:
+	void publish(const Wiimote::State & a_State)
+	{
+		Wiimote::Sample sample;
+		sample.m_State = a_State;
+		sample.m_SeqNum = m_Ring.getNumPushed();
+		m_Ring.push(sample);
+	}
+
+	Wiimote::IRState getIRState() const
+	{
+		Wiimote::Sample sample;
+		if (!m_Ring.getLatest(sample))
+		{
+			return Wiimote::IRState();
+		}
+		return sample.m_State.m_IRState;
+	}
+
+protected:
+	SampleRing<Wiimote::Sample, Wiimote::NUM_KEPT_SAMPLES> m_Ring;
+};
+
+
+
+
+
+/** Runs the producer against a_NumReaders reader threads for a_Duration, returns the measured rates. */
+template <typename Publisher>
+Result runBenchmark(int a_NumReaders, std::chrono::milliseconds a_Duration)
+{
+	Publisher publisher;
+	std::atomic<bool> shouldTerminate(false);
+	std::atomic<uint64_t> numReads(0);
+	std::atomic<int> checksum(0);
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < a_NumReaders; ++i)
+	{
+		readers.emplace_back([&]()
+			{
+				uint64_t reads = 0;
+				int sum = 0;
+				while (!shouldTerminate.load(std::memory_order_relaxed))
+				{
+					auto irState = publisher.getIRState();
+					sum += irState.m_X1;
+					reads += 1;
+				}
+				numReads += reads;
+				checksum += sum;
+			}
+		);
+	}
+
+	// Produce in the current thread:
+	Wiimote::State state = Wiimote::State();
+	uint64_t numWrites = 0;
+	int64_t maxWriteNsec = 0;
+	auto start = Clock::now();
+	auto end = start + a_Duration;
+	for (;;)
+	{
+		auto before = Clock::now();
+		if (before >= end)
+		{
+			break;
+		}
+		state.m_IRState.m_X1 = static_cast<int>(numWrites & 0x3ff);
+		publisher.publish(state);
+		auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count();
+		maxWriteNsec = std::max<int64_t>(maxWriteNsec, nsec);
+		numWrites += 1;
+	}
+	auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	shouldTerminate = true;
+	for (auto & thr: readers)
+	{
+		thr.join();
+	}
+
+	Result res;
+	res.m_WritesPerSec = static_cast<double>(numWrites) / elapsed;
+	res.m_ReadsPerSec = static_cast<double>(numReads.load()) / elapsed;
+	res.m_MaxWriteNsec = maxWriteNsec;
+	return res;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	int durationMsec = 500;
+	if (argc > 1)
+	{
+		durationMsec = std::max(1, atoi(argv[1]));
+	}
+	auto duration = std::chrono::milliseconds(durationMsec);
+
+	printf("%8s  %-6s  %14s  %14s  %14s\n", "readers", "path", "writes/s", "reads/s", "max write ns");
+	const int numReaders[] = {1, 2, 4, 8, 16};
+	for (auto n: numReaders)
+	{
+		auto mutexRes = runBenchmark<MutexState>(n, duration);
+		printf("%8d  %-6s  %14.0f  %14.0f  %14lld\n", n, "mutex", mutexRes.m_WritesPerSec, mutexRes.m_ReadsPerSec, static_cast<long long>(mutexRes.m_MaxWriteNsec));
+		auto ringRes = runBenchmark<RingState>(n, duration);
+		printf("%8d  %-6s  %14.0f  %14.0f  %14lld\n", n, "ring", ringRes.m_WritesPerSec, ringRes.m_ReadsPerSec, static_cast<long long>(ringRes.m_MaxWriteNsec));
+	}
+	return 0;
+}
+
+
+
+
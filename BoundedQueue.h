@@ -0,0 +1,154 @@
+// BoundedQueue.h
+
+// Declares the BoundedQueue class template representing a lock-free bounded multi-producer / multi-consumer FIFO queue
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+#include <type_traits>
+
+
+
+
+
+/** A fixed-capacity FIFO queue that any number of threads can push into and pop from without locking
+(Dmitry Vyukov's bounded MPMC queue). Each cell carries a sequence number telling whether it is ready for
+the producer or the consumer of the current lap, so the only contention is one CAS on the head / tail counter.
+N must be a power of two. T must be trivially copyable. */
+template <typename T, size_t N>
+class BoundedQueue
+{
+	static_assert(std::is_trivially_copyable<T>::value, "BoundedQueue only supports trivially copyable types");
+	static_assert((N >= 2) && ((N & (N - 1)) == 0), "BoundedQueue capacity must be a power of two");
+
+public:
+	BoundedQueue():
+		m_Tail(0),
+		m_Head(0)
+	{
+		for (size_t i = 0; i < N; ++i)
+		{
+			m_Cells[i].m_Seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+
+	/** Pushes the item to the back of the queue.
+	Returns false if the queue is full. */
+	bool tryPush(const T & a_Item)
+	{
+		auto pos = m_Tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			auto & cell = m_Cells[pos & (N - 1)];
+			auto seq = cell.m_Seq.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0)
+			{
+				// The cell is free in this lap, try to claim it:
+				if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.m_Data = a_Item;
+					cell.m_Seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+				// pos has been updated by compare_exchange_weak, retry
+			}
+			else if (diff < 0)
+			{
+				// The cell still holds an item from the previous lap, the queue is full
+				return false;
+			}
+			else
+			{
+				// Another producer has claimed the cell, catch up
+				pos = m_Tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+	/** Pops the item from the front of the queue into a_Item.
+	Returns false if the queue is empty. */
+	bool tryPop(T & a_Item)
+	{
+		auto pos = m_Head.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			auto & cell = m_Cells[pos & (N - 1)];
+			auto seq = cell.m_Seq.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0)
+			{
+				// The cell holds an item of this lap, try to claim it:
+				if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					a_Item = cell.m_Data;
+					cell.m_Seq.store(pos + N, std::memory_order_release);
+					return true;
+				}
+				// pos has been updated by compare_exchange_weak, retry
+			}
+			else if (diff < 0)
+			{
+				// The cell hasn't been filled in this lap yet, the queue is empty
+				return false;
+			}
+			else
+			{
+				// Another consumer has claimed the cell, catch up
+				pos = m_Head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+	/** Returns the approximate number of items in the queue (exact if there are no concurrent operations). */
+	size_t getSize() const
+	{
+		auto tail = m_Tail.load(std::memory_order_relaxed);
+		auto head = m_Head.load(std::memory_order_relaxed);
+		return (tail > head) ? (tail - head) : 0;
+	}
+
+
+	/** Returns the capacity of the queue. */
+	static size_t getCapacity() { return N; }
+
+
+protected:
+
+	/** A single cell of the queue. */
+	struct Cell
+	{
+		/** pos while free for the producer of position pos, pos + 1 while holding the item of position pos. */
+		std::atomic<size_t> m_Seq;
+
+		T m_Data;
+	};
+
+
+	/** The cells, used circularly. */
+	Cell m_Cells[N];
+
+	/** The position of the next push. Kept apart from m_Head, so that the producers and consumers don't share a cache line. */
+	std::atomic<size_t> m_Tail;
+
+	/** Padding between m_Tail and m_Head. */
+	char m_Padding[64];
+
+	/** The position of the next pop. */
+	std::atomic<size_t> m_Head;
+};
+
+
+
+
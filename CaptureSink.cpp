@@ -0,0 +1,157 @@
+// CaptureSink.cpp
+
+// Implements the CaptureSink class representing the recorder of the emitted pointer events, for tests and benchmarks
+
+
+
+
+
+#include "Globals.h"
+#include "CaptureSink.h"
+
+
+
+
+
+CaptureSink::CaptureSink(bool a_ShouldKeepInMemory):
+	m_ShouldKeepInMemory(a_ShouldKeepInMemory),
+	m_StartTime(Clock::now()),
+	m_File(nullptr),
+	m_NumEvents(0),
+	m_NumBatches(0)
+{
+}
+
+
+
+
+
+CaptureSink::~CaptureSink()
+{
+	if (m_File != nullptr)
+	{
+		fclose(m_File);
+	}
+}
+
+
+
+
+
+bool CaptureSink::openFile(const std::string & a_FileName)
+{
+	auto f = fopen(a_FileName.c_str(), "w");
+	if (f == nullptr)
+	{
+		LOG("Capture sink: cannot open file \"%s\" for writing", a_FileName.c_str());
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (m_File != nullptr)
+	{
+		fclose(m_File);
+	}
+	m_File = f;
+	return true;
+}
+
+
+
+
+
+std::vector<CaptureSink::Record> CaptureSink::getRecords() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_Records;
+}
+
+
+
+
+
+uint64_t CaptureSink::getNumEvents() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_NumEvents;
+}
+
+
+
+
+
+uint64_t CaptureSink::getNumBatches() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_NumBatches;
+}
+
+
+
+
+
+void CaptureSink::clearRecords()
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Records.clear();
+}
+
+
+
+
+
+const char * CaptureSink::getTypeName(MouseEvent::Type a_Type)
+{
+	switch (a_Type)
+	{
+		case MouseEvent::metMove:     return "move";
+		case MouseEvent::metLeftDown: return "down";
+		case MouseEvent::metLeftUp:   return "up";
+	}
+	return "unknown";
+}
+
+
+
+
+
+size_t CaptureSink::send(const MouseEvent * a_Events, size_t a_Count)
+{
+	auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(m_CS);
+	auto batchNum = m_NumBatches;
+	m_NumBatches += 1;
+	m_NumEvents += a_Count;
+	if (m_ShouldKeepInMemory)
+	{
+		for (size_t i = 0; i < a_Count; ++i)
+		{
+			Record rec;
+			rec.m_Time = now;
+			rec.m_BatchNum = batchNum;
+			rec.m_Event = a_Events[i];
+			m_Records.push_back(rec);
+		}
+	}
+	if (m_File != nullptr)
+	{
+		auto usec = std::chrono::duration_cast<std::chrono::microseconds>(now - m_StartTime).count();
+		for (size_t i = 0; i < a_Count; ++i)
+		{
+			const auto & e = a_Events[i];
+			fprintf(m_File, "%lld\t%llu\t%d\t%s\t%d\t%d\n",
+				static_cast<long long>(usec),
+				static_cast<unsigned long long>(batchNum),
+				e.m_PenId,
+				getTypeName(e.m_Type),
+				e.m_X, e.m_Y
+			);
+		}
+	}
+
+	// Nothing goes into the OS:
+	return 0;
+}
+
+
+
+
@@ -0,0 +1,97 @@
+// CaptureSink.h
+
+// Declares the CaptureSink class representing the recorder of the emitted pointer events, for tests and benchmarks
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <mutex>
+#include "OutputSink.h"
+#include "LatencyTrace.h"
+
+
+
+
+
+/** Records every pointer event given to it, with the time of emission, instead of passing it to the OS.
+The records are kept in memory and / or written into a text file, one event per line:
+"<usec since the capture start>\t<batch number>\t<pen>\t<type>\t<x>\t<y>", type being "move", "down" or "up".
+Lets the automated benchmarks check the pipeline's output and throughput without touching a real desktop.
+Thread-safe. */
+class CaptureSink:
+	public OutputSink
+{
+public:
+	/** A single recorded event. */
+	struct Record
+	{
+		/** The time when the event was given to the sink. All the events in a batch share the same time. */
+		Clock::time_point m_Time;
+
+		/** The number of the batch in which the event came, starting at 0. */
+		uint64_t m_BatchNum;
+
+		MouseEvent m_Event;
+	};
+
+
+	/** Creates a sink that keeps the records in memory if a_ShouldKeepInMemory is true.
+	Use openFile() to also write them into a file. */
+	explicit CaptureSink(bool a_ShouldKeepInMemory = true);
+
+	/** Closes the file, if open. */
+	virtual ~CaptureSink();
+
+	/** Starts writing the records into the specified file, overwriting it.
+	Returns true on success, false on failure (logged). */
+	bool openFile(const std::string & a_FileName);
+
+	/** Returns a copy of the records kept in memory. */
+	std::vector<Record> getRecords() const;
+
+	/** Returns the total number of events recorded (regardless of whether kept in memory). */
+	uint64_t getNumEvents() const;
+
+	/** Returns the total number of batches recorded. */
+	uint64_t getNumBatches() const;
+
+	/** Drops the records kept in memory. The counters and the file are not affected. */
+	void clearRecords();
+
+	/** Returns the (short, English) name of the event type, as used in the file. */
+	static const char * getTypeName(MouseEvent::Type a_Type);
+
+	// OutputSink overrides:
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) override;
+
+protected:
+
+	/** If true, the records are kept in m_Records. */
+	bool m_ShouldKeepInMemory;
+
+	/** The time of the sink's creation, the file's timestamps are relative to it. */
+	Clock::time_point m_StartTime;
+
+	/** Protects all the following members against multithreaded access. */
+	mutable std::mutex m_CS;
+
+	/** The records kept in memory. */
+	std::vector<Record> m_Records;
+
+	/** The file into which the records are written, nullptr if none. */
+	FILE * m_File;
+
+	uint64_t m_NumEvents;
+	uint64_t m_NumBatches;
+};
+
+
+
+
@@ -0,0 +1,212 @@
+// DeviceCache.cpp
+
+// Implements the DeviceCache class representing the persisted per-device settings detected while connecting the Wiimotes
+
+
+
+
+
+#include "Globals.h"
+#include "DeviceCache.h"
+#include <cstdlib>
+#ifndef _WIN32
+	#include <sys/stat.h>
+#endif
+
+
+
+
+
+/** The first line of the cache file, identifying the file format. */
+static const char CACHE_FILE_HEADER[] = "WiiWhiteboard device cache v1";
+
+
+
+
+
+DeviceCache::DeviceCache(const std::string & a_FileName):
+	m_FileName(a_FileName)
+{
+}
+
+
+
+
+
+std::string DeviceCache::getDefaultFileName()
+{
+	std::string folder;
+	#ifdef _WIN32
+		auto appData = getenv("APPDATA");
+		if (appData != nullptr)
+		{
+			folder = std::string(appData) + "\\WiiWhiteboard";
+			CreateDirectoryA(folder.c_str(), nullptr);
+			folder.push_back('\\');
+		}
+	#else
+		auto cacheHome = getenv("XDG_CACHE_HOME");
+		auto home = getenv("HOME");
+		if ((cacheHome != nullptr) && (cacheHome[0] != 0))
+		{
+			folder = cacheHome;
+		}
+		else if (home != nullptr)
+		{
+			folder = std::string(home) + "/.cache";
+			mkdir(folder.c_str(), 0755);
+		}
+		if (!folder.empty())
+		{
+			folder.append("/WiiWhiteboard");
+			mkdir(folder.c_str(), 0755);
+			folder.push_back('/');
+		}
+	#endif
+	return folder + "DeviceCache.txt";
+}
+
+
+
+
+
+bool DeviceCache::load()
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Entries.clear();
+	auto f = fopen(m_FileName.c_str(), "r");
+	if (f == nullptr)
+	{
+		return false;
+	}
+
+	// Each line is "<key>\t<altWrite>\t<X0> <Y0> <Z0> <XG> <YG> <ZG>\t<irMode>":
+	char line[4000];
+	bool isValid = ((fgets(line, sizeof(line), f) != nullptr) && (TrimString(line) == CACHE_FILE_HEADER));
+	while (isValid && (fgets(line, sizeof(line), f) != nullptr))
+	{
+		auto trimmed = TrimString(line);
+		if (trimmed.empty())
+		{
+			continue;
+		}
+		auto fields = StringSplit(trimmed, "\t");
+		unsigned cal[6];
+		int altWrite, irMode;
+		if (
+			(fields.size() != 4) ||
+			(sscanf(fields[1].c_str(), "%d", &altWrite) != 1) ||
+			(sscanf(fields[2].c_str(), "%u %u %u %u %u %u", &cal[0], &cal[1], &cal[2], &cal[3], &cal[4], &cal[5]) != 6) ||
+			(sscanf(fields[3].c_str(), "%d", &irMode) != 1)
+		)
+		{
+			isValid = false;
+			break;
+		}
+		Entry entry;
+		entry.m_UseAltWrite = (altWrite != 0);
+		entry.m_AccelCalibration.m_X0 = static_cast<unsigned char>(cal[0]);
+		entry.m_AccelCalibration.m_Y0 = static_cast<unsigned char>(cal[1]);
+		entry.m_AccelCalibration.m_Z0 = static_cast<unsigned char>(cal[2]);
+		entry.m_AccelCalibration.m_XG = static_cast<unsigned char>(cal[3]);
+		entry.m_AccelCalibration.m_YG = static_cast<unsigned char>(cal[4]);
+		entry.m_AccelCalibration.m_ZG = static_cast<unsigned char>(cal[5]);
+		entry.m_IRReportingMode = static_cast<Wiimote::IRReportingMode>(irMode);
+		m_Entries[fields[0]] = entry;
+	}
+	fclose(f);
+
+	if (!isValid)
+	{
+		LOG("Device cache \"%s\" is not valid, ignoring its contents", m_FileName.c_str());
+		m_Entries.clear();
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+bool DeviceCache::get(const std::string & a_Key, Entry & a_Entry) const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	auto itr = m_Entries.find(a_Key);
+	if (itr == m_Entries.end())
+	{
+		return false;
+	}
+	a_Entry = itr->second;
+	return true;
+}
+
+
+
+
+
+void DeviceCache::set(const std::string & a_Key, const Entry & a_Entry)
+{
+	assert(!a_Key.empty());
+	assert(a_Key.find_first_of("\t\n") == std::string::npos);  // The key mustn't break the file format
+
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Entries[a_Key] = a_Entry;
+	save();
+}
+
+
+
+
+
+void DeviceCache::invalidate(const std::string & a_Key)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (m_Entries.erase(a_Key) > 0)
+	{
+		save();
+	}
+}
+
+
+
+
+
+bool DeviceCache::save() const
+{
+	// Write into a temporary file first, so that a crash cannot leave a half-written cache behind:
+	auto tmpFileName = m_FileName + ".tmp";
+	auto f = fopen(tmpFileName.c_str(), "w");
+	if (f == nullptr)
+	{
+		LOG("Device cache \"%s\": cannot write the file", tmpFileName.c_str());
+		return false;
+	}
+	fprintf(f, "%s\n", CACHE_FILE_HEADER);
+	for (const auto & e: m_Entries)
+	{
+		const auto & cal = e.second.m_AccelCalibration;
+		fprintf(f, "%s\t%d\t%u %u %u %u %u %u\t%d\n",
+			e.first.c_str(),
+			e.second.m_UseAltWrite ? 1 : 0,
+			cal.m_X0, cal.m_Y0, cal.m_Z0, cal.m_XG, cal.m_YG, cal.m_ZG,
+			static_cast<int>(e.second.m_IRReportingMode)
+		);
+	}
+	auto isSuccess = (fclose(f) == 0);
+
+	#ifdef _WIN32
+		isSuccess = isSuccess && (MoveFileExA(tmpFileName.c_str(), m_FileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0);
+	#else
+		isSuccess = isSuccess && (rename(tmpFileName.c_str(), m_FileName.c_str()) == 0);
+	#endif
+	if (!isSuccess)
+	{
+		LOG("Device cache \"%s\": failed to save", m_FileName.c_str());
+	}
+	return isSuccess;
+}
+
+
+
+
@@ -0,0 +1,84 @@
+// DeviceCache.h
+
+// Declares the DeviceCache class representing the persisted per-device settings detected while connecting the Wiimotes
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <mutex>
+#include "Wiimote.h"
+
+
+
+
+
+/** Remembers, for each device (keyed by Transport::getStableId()), what was detected while connecting it the last time:
+the write method, the accelerometer calibration and the IR reporting mode.
+Wiimote::connect() uses the entry to skip probing the write method; any mismatch with the actual device invalidates the entry.
+Stored in a simple text file, rewritten on each change. Thread-safe. */
+class DeviceCache
+{
+public:
+	/** The settings remembered for a single device. */
+	struct Entry
+	{
+		/** True if the device needs the alternate write method (Transport::setOutputReport()). */
+		bool m_UseAltWrite;
+
+		/** The accelerometer calibration read from the device. */
+		Wiimote::AccelCalibration m_AccelCalibration;
+
+		/** The IR reporting mode last set on the device. */
+		Wiimote::IRReportingMode m_IRReportingMode;
+	};
+
+
+	/** Creates an empty cache, bound to the specified file. Use load() to read the file. */
+	explicit DeviceCache(const std::string & a_FileName);
+
+	/** Returns the default cache file name: %APPDATA%\WiiWhiteboard\DeviceCache.txt on Windows,
+	$XDG_CACHE_HOME/WiiWhiteboard/DeviceCache.txt (defaulting to ~/.cache) elsewhere.
+	Creates the folder, if needed. */
+	static std::string getDefaultFileName();
+
+	/** Loads the entries from the file, replacing the current ones.
+	Returns false if the file doesn't exist or is not a valid cache file (the cache is empty then). */
+	bool load();
+
+	/** Retrieves the entry for the specified device into a_Entry.
+	Returns false if there's no such entry. */
+	bool get(const std::string & a_Key, Entry & a_Entry) const;
+
+	/** Stores the entry for the specified device and saves the file. */
+	void set(const std::string & a_Key, const Entry & a_Entry);
+
+	/** Removes the entry for the specified device, if present, and saves the file. */
+	void invalidate(const std::string & a_Key);
+
+protected:
+
+	/** The file in which the entries are stored. */
+	std::string m_FileName;
+
+	/** Protects m_Entries against multithreaded access. */
+	mutable std::mutex m_CS;
+
+	/** The entries, keyed by the device's stable ID. Protected by m_CS. */
+	std::map<std::string, Entry> m_Entries;
+
+
+	/** Writes all the entries into the file.
+	Assumes m_CS is held by the caller. Returns true on success. */
+	bool save() const;
+};
+
+
+
+
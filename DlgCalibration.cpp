@@ -19,9 +19,9 @@ DlgCalibration::DlgCalibration(HINSTANCE a_Instance, WiimotePtrs a_Wiimotes):
 	m_Instance(a_Instance),
 	m_Wiimotes(std::move(a_Wiimotes))
 {
-	m_Callback = [this](Wiimote & a_Wiimote)
+	m_Callback = [this](Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
 	{
-		this->wiimoteCallback(a_Wiimote);
+		this->wiimoteCallback(a_Wiimote, a_Sample);
 	};
 }
 
@@ -205,10 +205,10 @@ void DlgCalibration::setCurrentCalibrationPoint(int a_CalibrationPoint)
 
 
 
-void DlgCalibration::wiimoteCallback(Wiimote & a_Wiimote)
+void DlgCalibration::wiimoteCallback(Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
 {
 	auto & oldState = getOldWiimoteState(a_Wiimote);
-	auto irState = a_Wiimote.getCurrentIRState();
+	const auto & irState = a_Sample.m_State.m_IRState;
 	if (!oldState.m_IRState.m_IsPresent1 && irState.m_IsPresent1)
 	{
 		// "Mouse click", remember the pos for calibration, normalize to primary screen ( https://msdn.microsoft.com/en-us/library/windows/desktop/ms646273%28v=vs.85%29.aspx ; Remarks section):
@@ -295,7 +295,7 @@ void DlgCalibration::hookWiimotes()
 {
 	for (auto & wiimote: m_Wiimotes)
 	{
-		wiimote->addCallback(&m_Callback);
+		wiimote->addCallback(&m_Callback, Wiimote::cmIR);
 	}
 }
 
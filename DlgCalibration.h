@@ -84,7 +84,7 @@ protected:
 	void setCurrentCalibrationPoint(int a_CurrentPoint);
 
 	/** Callback from the Wiimote. */
-	void wiimoteCallback(Wiimote & a_Wiimote);
+	void wiimoteCallback(Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample);
 
 	/** Returns the last known state of the Wiimote.
 	If there's no previously known state, creates a new empty one and returns that. */
@@ -19,9 +19,9 @@ DlgViewRawData::DlgViewRawData(HINSTANCE a_Instance, WiimotePtrs a_Wiimotes):
 	m_Wiimotes(a_Wiimotes),
 	m_Wnd(nullptr)
 {
-	m_Callback = [this](Wiimote & a_Wiimote)
+	m_Callback = [this](Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
 	{
-		this->wiimoteCallback(a_Wiimote);
+		this->wiimoteCallback(a_Wiimote, a_Sample);
 	};
 }
 
@@ -150,9 +150,9 @@ void DlgViewRawData::paintDot(bool a_IsPresent, int a_X, int a_Y, RECT * a_Windo
 
 
 
-void DlgViewRawData::wiimoteCallback(Wiimote & a_Wiimote)
+void DlgViewRawData::wiimoteCallback(Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
 {
-	m_WiimoteIRStates[&a_Wiimote] = a_Wiimote.getCurrentIRState();
+	m_WiimoteIRStates[&a_Wiimote] = a_Sample.m_State.m_IRState;
 	InvalidateRect(m_Wnd, nullptr, TRUE);
 }
 
@@ -164,7 +164,7 @@ void DlgViewRawData::hookWiimotes()
 {
 	for (auto & wiimote: m_Wiimotes)
 	{
-		wiimote->addCallback(&m_Callback);
+		wiimote->addCallback(&m_Callback, Wiimote::cmIR);
 	}
 }
 
@@ -61,7 +61,7 @@ protected:
 	void paintDot(bool a_IsPresent, int a_X, int a_Y, RECT * a_WindowRect, HDC a_DC);
 
 	/** Callback from the Wiimote when it detects a change in its state. */
-	void wiimoteCallback(Wiimote & a_Wiimote);
+	void wiimoteCallback(Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample);
 
 	/** Adds the m_Callback hook to all Wiimotes in m_Wiimotes. */
 	void hookWiimotes();
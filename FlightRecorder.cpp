@@ -0,0 +1,371 @@
+// FlightRecorder.cpp
+
+// Implements the FlightRecorder class representing the always-on memory of a Wiimote's recent reports, dumped on anomalies
+
+
+
+
+
+#include "Globals.h"
+#include "FlightRecorder.h"
+#include <cctype>
+#include <ctime>
+
+
+
+
+
+/** Returns the name with all the characters unsuitable for a file name replaced, shortened to its last part. */
+static std::string sanitizeFileName(const std::string & a_Name)
+{
+	static const size_t MAX_LENGTH = 32;
+	auto name = (a_Name.size() > MAX_LENGTH) ? a_Name.substr(a_Name.size() - MAX_LENGTH) : a_Name;
+	for (auto & ch: name)
+	{
+		if (!isalnum(static_cast<unsigned char>(ch)))
+		{
+			ch = '_';
+		}
+	}
+	return name.empty() ? std::string("Wiimote") : name;
+}
+
+
+
+
+
+/** Returns the specified wall-clock time formatted as local time with the specified strftime format. */
+static std::string formatLocalTime(std::chrono::system_clock::time_point a_Time, const char * a_Format)
+{
+	auto t = std::chrono::system_clock::to_time_t(a_Time);
+	struct tm local;
+	#ifdef _WIN32
+		localtime_s(&local, &t);
+	#else
+		localtime_r(&t, &local);
+	#endif
+	char buf[64];
+	strftime(buf, sizeof(buf), a_Format, &local);
+	return buf;
+}
+
+
+
+
+
+FlightRecorder::FlightRecorder():
+	m_LastReportType(-1),
+	m_NumDowns(0),
+	m_ShouldTerminate(false),
+	m_IsDumpPending(false),
+	m_HasTriggeredDump(false)
+{
+	m_Stats.m_NumTriggers = 0;
+	m_Stats.m_NumDumps = 0;
+}
+
+
+
+
+
+FlightRecorder::~FlightRecorder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_ShouldTerminate = true;
+		m_CV.notify_all();
+	}
+	if (m_DumpThread.joinable())
+	{
+		m_DumpThread.join();
+	}
+}
+
+
+
+
+
+void FlightRecorder::setName(const std::string & a_Name)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Name = a_Name;
+}
+
+
+
+
+
+void FlightRecorder::setConfig(const Config & a_Config)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Config = a_Config;
+	m_Config.m_ClickStormCount = std::min(m_Config.m_ClickStormCount, static_cast<int>(MAX_CLICK_STORM_COUNT));
+}
+
+
+
+
+
+void FlightRecorder::setDumpFolder(const std::string & a_Folder)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_DumpFolder = a_Folder;
+}
+
+
+
+
+
+void FlightRecorder::addReport(
+	const unsigned char * a_Report, size_t a_Size, int a_IRMode, Clock::time_point a_ArrivalTime,
+	bool a_IsParsed, const Wiimote::State & a_State
+)
+{
+	ReportRecord rec;
+	rec.m_ArrivalTime = a_ArrivalTime;
+	rec.m_Size = static_cast<unsigned char>(std::min(a_Size, sizeof(rec.m_Report)));
+	memcpy(rec.m_Report, a_Report, rec.m_Size);
+	rec.m_IRMode = static_cast<unsigned char>(a_IRMode);
+	rec.m_IsParsed = a_IsParsed;
+	rec.m_State = a_State;
+	m_Reports.push(rec);
+
+	// Check for the anomalies; the reporting mode changes (the reports' type changes) are not gaps:
+	auto lastArrivalTime = m_LastArrivalTime;
+	auto lastReportType = m_LastReportType;
+	m_LastArrivalTime = a_ArrivalTime;
+	m_LastReportType = (a_Size > 0) ? a_Report[0] : -1;
+	if (!a_IsParsed)
+	{
+		trigger(Printf("Unparseable report, type 0x%02x, %u bytes", (a_Size > 0) ? a_Report[0] : 0, static_cast<unsigned>(a_Size)));
+	}
+	else if (
+		(m_Config.m_MaxReportGap.count() > 0) &&
+		(lastReportType == m_LastReportType) &&
+		(a_ArrivalTime - lastArrivalTime > m_Config.m_MaxReportGap)
+	)
+	{
+		trigger(Printf("Gap of %.1f ms between the reports",
+			std::chrono::duration<double, std::milli>(a_ArrivalTime - lastArrivalTime).count()
+		));
+	}
+}
+
+
+
+
+
+void FlightRecorder::addEvents(const MouseEvent * a_Events, size_t a_NumEvents, Clock::time_point a_ArrivalTime)
+{
+	for (size_t i = 0; i < a_NumEvents; ++i)
+	{
+		EventRecord rec;
+		rec.m_ArrivalTime = a_ArrivalTime;
+		rec.m_Event = a_Events[i];
+		m_Events.push(rec);
+		if ((a_Events[i].m_Type != MouseEvent::metLeftDown) || (m_Config.m_ClickStormCount <= 0))
+		{
+			continue;
+		}
+
+		// Check for a click storm: the m_ClickStormCount-th last pen-down being too recent:
+		m_DownTimes[m_NumDowns % MAX_CLICK_STORM_COUNT] = a_ArrivalTime;
+		m_NumDowns += 1;
+		auto count = static_cast<uint64_t>(m_Config.m_ClickStormCount);
+		if (
+			(m_NumDowns >= count) &&
+			(a_ArrivalTime - m_DownTimes[(m_NumDowns - count) % MAX_CLICK_STORM_COUNT] <= m_Config.m_ClickStormWindow)
+		)
+		{
+			trigger(Printf("Click storm, %d pen-downs within %d ms",
+				m_Config.m_ClickStormCount, static_cast<int>(m_Config.m_ClickStormWindow.count())
+			));
+		}
+	}
+}
+
+
+
+
+
+void FlightRecorder::trigger(const std::string & a_Reason)
+{
+	auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Stats.m_NumTriggers += 1;
+	if (m_IsDumpPending || (m_HasTriggeredDump && (now - m_LastTriggeredDumpTime < m_Config.m_MinDumpInterval)))
+	{
+		return;
+	}
+	LOG("Wiimote \"%s\": anomaly: %s, dumping the flight recorder", m_Name.c_str(), a_Reason.c_str());
+	m_IsDumpPending = true;
+	m_PendingReason = a_Reason;
+	m_PendingTime = now;
+	m_LastTriggeredDumpTime = now;
+	m_HasTriggeredDump = true;
+	if (!m_DumpThread.joinable())
+	{
+		m_DumpThread = std::thread(&FlightRecorder::thrDump, this);
+	}
+	m_CV.notify_all();
+}
+
+
+
+
+
+std::string FlightRecorder::dump(const std::string & a_Reason)
+{
+	return writeDump(a_Reason, Clock::now());
+}
+
+
+
+
+
+FlightRecorder::Stats FlightRecorder::getStats() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_Stats;
+}
+
+
+
+
+
+void FlightRecorder::thrDump()
+{
+	std::unique_lock<std::mutex> lock(m_CS);
+	for (;;)
+	{
+		m_CV.wait(lock, [this]() { return (m_IsDumpPending || m_ShouldTerminate); });
+		if (m_ShouldTerminate && !m_IsDumpPending)
+		{
+			return;
+		}
+
+		// Let the aftermath get recorded, unless terminating:
+		m_CV.wait_until(lock, m_PendingTime + m_Config.m_PostTriggerDelay, [this]() { return m_ShouldTerminate; });
+		auto reason = m_PendingReason;
+		auto anomalyTime = m_PendingTime;
+		lock.unlock();
+		writeDump(reason, anomalyTime);
+		lock.lock();
+		m_IsDumpPending = false;
+	}
+}
+
+
+
+
+
+std::string FlightRecorder::writeDump(const std::string & a_Reason, Clock::time_point a_AnomalyTime)
+{
+	std::string name;
+	std::chrono::milliseconds duration;
+	std::string fileName;
+	auto wallNow = std::chrono::system_clock::now();
+	auto now = Clock::now();
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		name = m_Name;
+		duration = m_Config.m_Duration;
+		fileName = Printf("%sFlightRecorder-%s-%s-%llu.txt",
+			m_DumpFolder.c_str(), sanitizeFileName(m_Name).c_str(),
+			formatLocalTime(wallNow, "%Y%m%d-%H%M%S").c_str(), static_cast<unsigned long long>(m_Stats.m_NumDumps)
+		);
+	}
+
+	// Snapshot the rings; the reading context keeps on recording meanwhile:
+	std::vector<ReportRecord> reports(REPORT_CAPACITY);
+	reports.resize(m_Reports.getRecent(reports.data(), reports.size()));
+	std::vector<EventRecord> events(EVENT_CAPACITY);
+	events.resize(m_Events.getRecent(events.data(), events.size()));
+
+	auto f = fopen(fileName.c_str(), "w");
+	if (f == nullptr)
+	{
+		LOG("Cannot write the flight recorder dump \"%s\"", fileName.c_str());
+		return std::string();
+	}
+	auto wallAnomalyTime = wallNow - std::chrono::duration_cast<std::chrono::system_clock::duration>(now - a_AnomalyTime);
+	fprintf(f, "WiiWhiteboard flight recorder dump\n");
+	fprintf(f, "Wiimote: %s\n", name.c_str());
+	fprintf(f, "Reason: %s\n", a_Reason.c_str());
+	fprintf(f, "Time: %s; the times below are in milliseconds relative to it\n", formatLocalTime(wallAnomalyTime, "%Y-%m-%d %H:%M:%S").c_str());
+	fprintf(f, "Columns: time, \"report\", IR mode, raw bytes, buttons / IR dots / accel as parsed\n");
+	fprintf(f, "         time, \"event\", pen, move / down / up, x, y (of the report at that time)\n\n");
+
+	// Merge the reports and the events by time, each event after its report:
+	auto startTime = a_AnomalyTime - duration;
+	size_t r = 0, e = 0;
+	while ((r < reports.size()) && (reports[r].m_ArrivalTime < startTime))
+	{
+		++r;
+	}
+	while ((e < events.size()) && (events[e].m_ArrivalTime < startTime))
+	{
+		++e;
+	}
+	while ((r < reports.size()) || (e < events.size()))
+	{
+		if ((r < reports.size()) && ((e >= events.size()) || (reports[r].m_ArrivalTime <= events[e].m_ArrivalTime)))
+		{
+			const auto & rec = reports[r++];
+			std::string line = Printf("%10.1f report %d ",
+				std::chrono::duration<double, std::milli>(rec.m_ArrivalTime - a_AnomalyTime).count(), rec.m_IRMode
+			);
+			for (size_t i = 0; i < rec.m_Size; ++i)
+			{
+				AppendPrintf(line, "%02x", rec.m_Report[i]);
+			}
+			if (!rec.m_IsParsed)
+			{
+				line.append(" | unparsed");
+			}
+			else
+			{
+				const auto & bs = rec.m_State.m_ButtonState;
+				const auto & ir = rec.m_State.m_IRState;
+				const auto & acc = rec.m_State.m_AccelState;
+				AppendPrintf(line, " | %c%c | ", bs.m_ButtonA ? 'A' : '-', bs.m_ButtonB ? 'B' : '-');
+				const int xs[] = {ir.m_X1, ir.m_X2, ir.m_X3, ir.m_X4};
+				const int ys[] = {ir.m_Y1, ir.m_Y2, ir.m_Y3, ir.m_Y4};
+				const bool isPresent[] = {ir.m_IsPresent1, ir.m_IsPresent2, ir.m_IsPresent3, ir.m_IsPresent4};
+				for (int i = 0; i < 4; ++i)
+				{
+					if (isPresent[i])
+					{
+						AppendPrintf(line, "%d,%d ", xs[i], ys[i]);
+					}
+					else
+					{
+						line.append("- ");
+					}
+				}
+				AppendPrintf(line, "| %u %u %u", acc.m_AccelX, acc.m_AccelY, acc.m_AccelZ);
+			}
+			fprintf(f, "%s\n", line.c_str());
+		}
+		else
+		{
+			const auto & rec = events[e++];
+			static const char * typeNames[] = {"move", "down", "up"};
+			fprintf(f, "%10.1f event %d %s %d %d\n",
+				std::chrono::duration<double, std::milli>(rec.m_ArrivalTime - a_AnomalyTime).count(),
+				rec.m_Event.m_PenId, typeNames[rec.m_Event.m_Type], rec.m_Event.m_X, rec.m_Event.m_Y
+			);
+		}
+	}
+	fclose(f);
+
+	LOG("Wiimote \"%s\": flight recorder dumped into \"%s\"", name.c_str(), fileName.c_str());
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Stats.m_NumDumps += 1;
+	m_Stats.m_LastDumpFileName = fileName;
+	return fileName;
+}
+
+
+
+
@@ -0,0 +1,223 @@
+// FlightRecorder.h
+
+// Declares the FlightRecorder class representing the always-on memory of a Wiimote's recent reports, dumped on anomalies
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Wiimote.h"
+#include "OutputSink.h"
+#include "SampleRing.h"
+
+
+
+
+
+/** Remembers the last few seconds of a single Wiimote's raw reports, their parsed states and the output events
+produced from them, so that when a pen misbehaves, the moments before it can be examined.
+The records go into lock-free rings (SampleRing) written only from the Wiimote's reading context, so recording
+costs a copy per report and no locking. When an anomaly is detected (a gap between the reports, an unparseable
+report, a storm of clicks) or another component calls trigger(), the rings are dumped into a text file from a
+separate thread, a little later, so that the dump shows what happened after the anomaly, too. dump() writes
+the rings right away, on demand. */
+class FlightRecorder
+{
+public:
+	/** The number of reports kept; about 10 seconds at the Wiimote's 100 reports per second. */
+	static const size_t REPORT_CAPACITY = 1024;
+
+	/** The number of output events kept. */
+	static const size_t EVENT_CAPACITY = 1024;
+
+	/** The maximum number of clicks that can make up a click storm. */
+	static const int MAX_CLICK_STORM_COUNT = 32;
+
+
+	/** The settings of the recorder. */
+	struct Config
+	{
+		/** How far back from the anomaly the dump reaches. */
+		std::chrono::milliseconds m_Duration;
+
+		/** How long after the anomaly the dump is written, so that it shows the aftermath, too. */
+		std::chrono::milliseconds m_PostTriggerDelay;
+
+		/** The minimum time between two automatic dumps; the anomalies in between are only counted. */
+		std::chrono::milliseconds m_MinDumpInterval;
+
+		/** A longer gap between two consecutive reports of the same type is an anomaly; zero disables the check.
+		Only meaningful with the continuous reporting, otherwise the Wiimote only reports changes. */
+		std::chrono::milliseconds m_MaxReportGap;
+
+		/** This many pen-downs (of any pen) within m_ClickStormWindow are an anomaly; zero disables the check.
+		At most MAX_CLICK_STORM_COUNT. */
+		int m_ClickStormCount;
+
+		/** The time window for the click storm detection. */
+		std::chrono::milliseconds m_ClickStormWindow;
+
+		Config():
+			m_Duration(5000),
+			m_PostTriggerDelay(500),
+			m_MinDumpInterval(30000),
+			m_MaxReportGap(100),
+			m_ClickStormCount(8),
+			m_ClickStormWindow(1000)
+		{
+		}
+	};
+
+
+	/** The counters describing the recorder's operation. */
+	struct Stats
+	{
+		/** The number of anomalies detected or triggered. */
+		uint64_t m_NumTriggers;
+
+		/** The number of dumps written, both automatic and on demand. */
+		uint64_t m_NumDumps;
+
+		/** The name of the last dump file written, empty if none. */
+		std::string m_LastDumpFileName;
+	};
+
+
+	FlightRecorder();
+
+	/** Waits for a pending dump to be written. */
+	~FlightRecorder();
+
+	/** Sets the name of the recorded Wiimote, used in the dumps and their file names.
+	Must be called before the reports start coming. */
+	void setName(const std::string & a_Name);
+
+	/** Changes the settings. Must be called before the reports start coming. */
+	void setConfig(const Config & a_Config);
+
+	/** Sets the folder into which the dumps are written, including the trailing path separator; empty (the default)
+	for the current folder. Callable at any time. */
+	void setDumpFolder(const std::string & a_Folder);
+
+	/** Records a raw report received at a_ArrivalTime, and the state parsed from it with the specified IR mode
+	(a_IsParsed is false if the report couldn't be parsed). Checks the report for anomalies.
+	Must only be called from the Wiimote's reading context. */
+	void addReport(
+		const unsigned char * a_Report, size_t a_Size, int a_IRMode, Clock::time_point a_ArrivalTime,
+		bool a_IsParsed, const Wiimote::State & a_State
+	);
+
+	/** Records the output events produced from the report that arrived at a_ArrivalTime. Checks them for a click storm.
+	Must only be called from the Wiimote's reading context. */
+	void addEvents(const MouseEvent * a_Events, size_t a_NumEvents, Clock::time_point a_ArrivalTime);
+
+	/** Reports an anomaly: schedules a dump, unless one has been scheduled recently (then the anomaly is only counted).
+	Callable from any thread. */
+	void trigger(const std::string & a_Reason);
+
+	/** Writes the rings into a new dump file right away. Callable from any thread.
+	Returns the name of the file, or an empty string on failure (logged). */
+	std::string dump(const std::string & a_Reason);
+
+	/** Returns a snapshot of the counters. */
+	Stats getStats() const;
+
+
+protected:
+
+	/** A single recorded report. Trivially copyable, for the SampleRing. */
+	struct ReportRecord
+	{
+		Clock::time_point m_ArrivalTime;
+		unsigned char m_Report[22];
+		unsigned char m_Size;
+		unsigned char m_IRMode;
+		bool m_IsParsed;
+		Wiimote::State m_State;
+	};
+
+	/** A single recorded output event. Trivially copyable, for the SampleRing. */
+	struct EventRecord
+	{
+		/** The arrival time of the report from which the event was produced. */
+		Clock::time_point m_ArrivalTime;
+
+		MouseEvent m_Event;
+	};
+
+
+	/** The recent reports. */
+	SampleRing<ReportRecord, REPORT_CAPACITY> m_Reports;
+
+	/** The recent output events. */
+	SampleRing<EventRecord, EVENT_CAPACITY> m_Events;
+
+	/** The settings. Written only before the reports start coming, or with m_CS held. */
+	Config m_Config;
+
+	/** The name of the recorded Wiimote. */
+	std::string m_Name;
+
+	/** The folder into which the dumps are written. */
+	std::string m_DumpFolder;
+
+	/** The arrival time and type of the previous report, for the gap detection. Accessed only from the reading context. */
+	Clock::time_point m_LastArrivalTime;
+	int m_LastReportType;
+
+	/** The times of the recent pen-downs, circularly, for the click storm detection. Accessed only from the reading context. */
+	Clock::time_point m_DownTimes[MAX_CLICK_STORM_COUNT];
+
+	/** The number of pen-downs recorded so far. Accessed only from the reading context. */
+	uint64_t m_NumDowns;
+
+	/** Protects the dump state and the stats against multithreaded access. */
+	mutable std::mutex m_CS;
+
+	/** Notified when a dump is scheduled or the recorder is being destroyed. */
+	std::condition_variable m_CV;
+
+	/** The thread writing the automatic dumps; started by the first trigger(). */
+	std::thread m_DumpThread;
+
+	/** Set when the dump thread should terminate. */
+	bool m_ShouldTerminate;
+
+	/** Set while an automatic dump is scheduled but not written yet. */
+	bool m_IsDumpPending;
+
+	/** The reason and time of the scheduled dump. */
+	std::string m_PendingReason;
+	Clock::time_point m_PendingTime;
+
+	/** The time of the last automatic dump scheduled, for m_MinDumpInterval. */
+	Clock::time_point m_LastTriggeredDumpTime;
+
+	/** Set once an automatic dump has been scheduled. */
+	bool m_HasTriggeredDump;
+
+	/** The counters. */
+	Stats m_Stats;
+
+
+	/** Writes the dumps scheduled by trigger(), until terminated.
+	Executed in m_DumpThread. */
+	void thrDump();
+
+	/** Writes the records from the m_Config.m_Duration before a_AnomalyTime up to now into a new dump file.
+	Returns the name of the file, or an empty string on failure (logged). */
+	std::string writeDump(const std::string & a_Reason, Clock::time_point a_AnomalyTime);
+};
+
+
+
+
@@ -0,0 +1,89 @@
+// FusionSource.cpp
+
+// Implements the FusionSource class representing a single Wiimote's pens reported into a PenFusion
+
+
+
+
+
+#include "Globals.h"
+#include "FusionSource.h"
+#include "Warper.h"
+
+
+
+
+
+FusionSource::FusionSource(
+	const Warper & a_Warper,
+	PenFusion & a_Fusion,
+	std::vector<WiimotePtr> & a_Wiimotes,
+	const Wiimote * a_Wiimote,
+	const PenTracker::Config & a_TrackerConfig
+):
+	m_Warper(a_Warper),
+	m_Fusion(a_Fusion),
+	m_FusionSource(a_Fusion.addSource(a_Wiimote)),
+	m_Tracker(a_TrackerConfig),
+	m_IsWatchingEveryReport(false)
+{
+	for (auto & w: a_Wiimotes)
+	{
+		if (w.get() != a_Wiimote)
+		{
+			continue;
+		}
+		m_Wiimote = w;
+		m_Callback =
+		[this](Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
+		{
+			// While the fusion is settled, only the IR changes matter:
+			if (!m_IsWatchingEveryReport && ((a_Sample.m_Changes & Wiimote::cmIR) == 0))
+			{
+				return;
+			}
+
+			// Identify the pens, warp them and weight them by the inverse variance, proportional to the pixel area:
+			PenTracker::Observation observations[PenTracker::MAX_PENS];
+			m_Tracker.update(a_Sample.m_State.m_IRState, a_Sample.m_Trace.m_Times[LatencyTrace::stArrival], observations);
+			PenFusion::Observation pens[PenFusion::MAX_PENS];
+			for (int i = 0; i < PenFusion::MAX_PENS; ++i)
+			{
+				const auto & obs = observations[i];
+				auto & pen = pens[i];
+				pen.m_IsPresent = obs.m_IsPresent;
+				if (!obs.m_IsPresent)
+				{
+					continue;
+				}
+				auto screenPt = m_Warper.warp(a_Wiimote, static_cast<double>(obs.m_X), static_cast<double>(obs.m_Y));
+				auto scale = std::max(m_Warper.getLocalScale(a_Wiimote, obs.m_X, obs.m_Y), 1.0);
+				pen.m_X = screenPt.m_X;
+				pen.m_Y = screenPt.m_Y;
+				pen.m_Weight = 1 / (scale * scale);
+			}
+			m_Fusion.update(m_FusionSource, pens, a_Sample.m_Trace);
+
+			// While the fusion has a transition pending, it needs every report, even if the IR hasn't changed:
+			m_IsWatchingEveryReport = !m_Fusion.isSettled();
+		};
+		// Subscribed to every report once and for all, see Processor:
+		w->addCallback(&m_Callback, Wiimote::cmIR | Wiimote::cmEveryReport);
+	}
+}
+
+
+
+
+
+FusionSource::~FusionSource()
+{
+	if (m_Wiimote != nullptr)
+	{
+		m_Wiimote->removeCallback(&m_Callback);
+	}
+}
+
+
+
+
@@ -0,0 +1,76 @@
+// FusionSource.h
+
+// Declares the FusionSource class representing a single Wiimote's pens reported into a PenFusion
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "Wiimote.h"
+#include "PenTracker.h"
+#include "PenFusion.h"
+
+
+
+
+
+// fwd:
+class Warper;
+
+
+
+
+
+/** Feeds a single Wiimote's pens into a PenFusion: tracks the IR dots into pens, warps them into the screen coords
+and weights them by the Wiimote's precision at their location. Used instead of a Processor for the Wiimotes that
+share their screen area with other Wiimotes; the fusion then does the debouncing, smoothing and prediction. */
+class FusionSource
+{
+public:
+	FusionSource(
+		const Warper & a_Warper,
+		PenFusion & a_Fusion,
+		std::vector<WiimotePtr> & a_Wiimotes,
+		const Wiimote * a_Wiimote,
+		const PenTracker::Config & a_TrackerConfig = PenTracker::Config()
+	);
+
+	/** Unsubscribes from the Wiimote; once this returns, the callback is not running and won't be called anymore,
+	so the fusion may be destroyed. */
+	~FusionSource();
+
+	/** Returns the counters of the pen tracking. */
+	PenTracker::Stats getTrackerStats() const { return m_Tracker.getStats(); }
+
+protected:
+	const Warper & m_Warper;
+
+	PenFusion & m_Fusion;
+
+	/** The Wiimote whose pens are reported, kept alive until the callback is removed from it.
+	nullptr if the Wiimote wasn't found in the list given to the constructor. */
+	WiimotePtr m_Wiimote;
+
+	/** The source index of this Wiimote within m_Fusion. */
+	int m_FusionSource;
+
+	/** Associates the IR dots into pens with stable IDs. */
+	PenTracker m_Tracker;
+
+	/** True while the fusion has a transition pending, so the callback processes every report, not only the IR changes. */
+	bool m_IsWatchingEveryReport;
+
+	Wiimote::Callback m_Callback;
+};
+
+typedef std::shared_ptr<FusionSource> FusionSourcePtr;
+
+
+
+
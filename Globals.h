@@ -14,10 +14,20 @@
 #include <map>
 #include <cassert>
 #include <algorithm>
+#include <functional>
+#include <tuple>
+#include <chrono>
+#include <cstdint>
+#include <cstdarg>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
 
-// Windows SDK headers:
-#include <Windows.h>
-#include <tchar.h>
+#ifdef _WIN32
+	// Windows SDK headers:
+	#include <Windows.h>
+	#include <tchar.h>
+#endif
 
 
 
@@ -47,7 +57,11 @@ typedef uint8_t Byte;
 
 
 
-#define LOG(fmt, ...) OutputDebugStringA(Printf("%s(%d): %s: " fmt "\n", __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__).c_str())
+#ifdef _WIN32
+	#define LOG(fmt, ...) OutputDebugStringA(Printf("%s(%d): %s: " fmt "\n", __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__).c_str())
+#else
+	#define LOG(fmt, ...) fputs(Printf("%s(%d): %s: " fmt "\n", __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__).c_str(), stderr)
+#endif
 #define UNUSED(X) ((void)X)
 
 
@@ -0,0 +1,94 @@
+// HidDevice.h
+
+// Declares the HidDevice class representing the thin platform shim over the OS's HID device API
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include "Transport.h"
+
+
+
+
+
+/** Provides access to a single HID device, in an OS-independent way.
+The implementation is platform-specific: HidDeviceWin.cpp uses the Win32 HID API, HidDeviceLinux.cpp uses hidraw.
+The reports are delivered from a per-device thread on Windows, from the shared HidrawReactor thread on Linux. */
+class HidDevice:
+	public Transport
+{
+public:
+	HidDevice();
+
+	/** Closes the device, if still open. */
+	virtual ~HidDevice();
+
+	/** Opens the device at the specified OS path (Utf8).
+	Returns true on success, false on failure. */
+	bool open(const std::string & a_Path);
+
+	#ifndef _WIN32
+		/** Takes over an already opened FD, instead of opening a device by path.
+		Used to run against a stand-in for a real hidraw node, such as one end of a SOCK_SEQPACKET socketpair,
+		which keeps the report boundaries the same way hidraw does.
+		Returns true on success, false on failure. */
+		bool attach(int a_FD);
+	#endif
+
+	// Transport overrides:
+	virtual void startReading(ReportCallback a_OnReport, ErrorCallback a_OnError) override;
+	virtual void close() override;
+	virtual bool isOpen() const override;
+	virtual bool write(const void * a_Buffer, size_t a_Size) override;
+	virtual bool setOutputReport(const void * a_Buffer, size_t a_Size) override;
+	virtual std::chrono::microseconds getMinWriteInterval() const override;
+	virtual std::string getStableId() const override;
+
+protected:
+
+	/** The callback for the incoming reports. */
+	ReportCallback m_OnReport;
+
+	/** The callback for the read failure. */
+	ErrorCallback m_OnError;
+
+	/** The OS path of the device, as given to open(). Empty if not opened by path. */
+	std::string m_Path;
+
+	#ifdef _WIN32
+		/** OS handle for the device. */
+		HANDLE m_Handle;
+
+		/** The event used for IO completion in write operations. */
+		HANDLE m_WriteEvent;
+
+		/** The thread reading the incoming reports. */
+		std::thread m_ReadThread;
+
+		/** Flag indicating that the read thread should terminate as soon as possible. */
+		bool m_ShouldTerminate;
+
+		/** Reads the incoming reports and delivers them to m_OnReport.
+		Executed in m_ReadThread. */
+		void thrRead();
+	#else
+		/** The hidraw file descriptor, in non-blocking mode. */
+		int m_FD;
+
+		/** Reads all the reports currently available in m_FD and delivers them to m_OnReport.
+		Called by the HidrawReactor whenever m_FD becomes readable. */
+		void onReadable(uint32_t a_Events);
+	#endif
+};
+
+
+
+
@@ -0,0 +1,227 @@
+// HidDeviceLinux.cpp
+
+// Implements the HidDevice class on top of the Linux hidraw interface, serviced by the shared HidrawReactor
+
+
+
+
+
+#include "Globals.h"
+#include "HidDevice.h"
+#include "HidrawReactor.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+
+
+
+
+/** The max size of a single input report that we're interested in. */
+static const size_t MAX_REPORT_SIZE = 64;
+
+
+
+
+
+HidDevice::HidDevice():
+	m_FD(-1)
+{
+}
+
+
+
+
+
+HidDevice::~HidDevice()
+{
+	close();
+}
+
+
+
+
+
+bool HidDevice::open(const std::string & a_Path)
+{
+	assert(m_FD < 0);  // Not opened yet
+
+	m_FD = ::open(a_Path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (m_FD < 0)
+	{
+		auto err = errno;
+		LOG("HID device \"%s\": failed to open: %d (%s)", a_Path.c_str(), err, strerror(err));
+		return false;
+	}
+	m_Path = a_Path;
+	return true;
+}
+
+
+
+
+
+bool HidDevice::attach(int a_FD)
+{
+	assert(m_FD < 0);  // Not opened yet
+
+	auto flags = fcntl(a_FD, F_GETFL);
+	if ((flags < 0) || (fcntl(a_FD, F_SETFL, flags | O_NONBLOCK) < 0))
+	{
+		LOG("Failed to switch FD %d to non-blocking mode: %d (%s)", a_FD, errno, strerror(errno));
+		return false;
+	}
+	m_FD = a_FD;
+	return true;
+}
+
+
+
+
+
+void HidDevice::startReading(ReportCallback a_OnReport, ErrorCallback a_OnError)
+{
+	assert(m_FD >= 0);  // Must be open
+
+	m_OnReport = std::move(a_OnReport);
+	m_OnError = std::move(a_OnError);
+	if (!HidrawReactor::get().add(m_FD, [this](uint32_t a_Events) { onReadable(a_Events); }))
+	{
+		m_OnError();
+	}
+}
+
+
+
+
+
+void HidDevice::close()
+{
+	if (m_FD < 0)
+	{
+		return;
+	}
+	HidrawReactor::get().remove(m_FD);
+	::close(m_FD);
+	m_FD = -1;
+}
+
+
+
+
+
+bool HidDevice::isOpen() const
+{
+	return (m_FD >= 0);
+}
+
+
+
+
+
+void HidDevice::onReadable(uint32_t a_Events)
+{
+	// Drain all the reports that are available, hidraw returns exactly one report per read():
+	unsigned char buffer[MAX_REPORT_SIZE];
+	for (;;)
+	{
+		auto res = ::read(m_FD, buffer, sizeof(buffer));
+		if (res > 0)
+		{
+			m_OnReport(buffer, static_cast<size_t>(res), Clock::now());
+			if (m_FD < 0)
+			{
+				// Closed from within the callback
+				return;
+			}
+			continue;
+		}
+		if (res == 0)
+		{
+			// EOF, the device has been disconnected
+			break;
+		}
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		{
+			// All available reports processed; unless the device went away meanwhile, wait for more:
+			if ((a_Events & (EPOLLERR | EPOLLHUP)) == 0)
+			{
+				return;
+			}
+			break;
+		}
+		LOG("Failed to read from the HID device: %d (%s)", errno, strerror(errno));
+		break;
+	}
+
+	// The device has failed, stop reading from it:
+	HidrawReactor::get().remove(m_FD);
+	m_OnError();
+}
+
+
+
+
+
+bool HidDevice::write(const void * a_Buffer, size_t a_Size)
+{
+	// hidraw sends the report as-is, no padding to the max report size is needed:
+	auto res = ::write(m_FD, a_Buffer, a_Size);
+	if (res != static_cast<ssize_t>(a_Size))
+	{
+		LOG("Failed to write the output report: %d (%s)", errno, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+bool HidDevice::setOutputReport(const void * a_Buffer, size_t a_Size)
+{
+	// hidraw has no separate control-pipe method for output reports, write() is the only way:
+	return write(a_Buffer, a_Size);
+}
+
+
+
+
+
+std::chrono::microseconds HidDevice::getMinWriteInterval() const
+{
+	// The Wiimotes drop the output reports that come in too fast over some BT stacks:
+	return std::chrono::milliseconds(100);
+}
+
+
+
+
+
+std::string HidDevice::getStableId() const
+{
+	// The BT HID devices report their BT address as the "uniq" string; the hidraw node number changes across reconnects:
+	char uniq[256];
+	auto res = ioctl(m_FD, HIDIOCGRAWUNIQ(sizeof(uniq) - 1), uniq);
+	if (res > 0)
+	{
+		uniq[std::min<size_t>(static_cast<size_t>(res), sizeof(uniq) - 1)] = 0;
+		if (uniq[0] != 0)
+		{
+			return std::string("uniq:") + uniq;
+		}
+	}
+	return m_Path;
+}
+
+
+
+
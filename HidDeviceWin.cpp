@@ -0,0 +1,245 @@
+// HidDeviceWin.cpp
+
+// Implements the HidDevice class on top of the Win32 HID API
+
+
+
+
+
+#include "Globals.h"
+#include "HidDevice.h"
+#include <hidsdi.h>
+
+
+
+
+
+/** The size of the input and output reports, as used by the Win32 HID driver. Shorter output reports are zero-padded. */
+static const size_t REPORT_SIZE = 22;
+
+
+
+
+
+HidDevice::HidDevice():
+	m_Handle(INVALID_HANDLE_VALUE),
+	m_WriteEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr)),
+	m_ShouldTerminate(false)
+{
+}
+
+
+
+
+
+HidDevice::~HidDevice()
+{
+	close();
+	CloseHandle(m_WriteEvent);
+}
+
+
+
+
+
+bool HidDevice::open(const std::string & a_Path)
+{
+	assert(m_Handle == INVALID_HANDLE_VALUE);  // Not opened yet
+
+	// Convert the path to UTF-16:
+	WCHAR pathUtf16[12000];
+	auto res = MultiByteToWideChar(CP_UTF8, 0, a_Path.c_str(), static_cast<int>(a_Path.size()), pathUtf16, ARRAYCOUNT(pathUtf16) - 1);
+	pathUtf16[(res >= 0) ? res : 0] = 0;
+
+	// Need to use OVERLAPPED IO, because in non-OVERLAPPED we get deadlocked by the OS if the Wiimote breaks the bluetooth connection
+	m_Handle = CreateFileW(pathUtf16, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+	if (m_Handle == INVALID_HANDLE_VALUE)
+	{
+		auto gle = GetLastError();
+		LOG("HID device \"%s\": failed to open OS handle: %d (0x%x)", a_Path.c_str(), gle, gle);
+		return false;
+	}
+	m_ShouldTerminate = false;
+	m_Path = a_Path;
+	return true;
+}
+
+
+
+
+
+void HidDevice::startReading(ReportCallback a_OnReport, ErrorCallback a_OnError)
+{
+	assert(m_Handle != INVALID_HANDLE_VALUE);  // Must be open
+	assert(!m_ReadThread.joinable());          // Must not be reading already
+
+	m_OnReport = std::move(a_OnReport);
+	m_OnError = std::move(a_OnError);
+	m_ReadThread = std::thread(&HidDevice::thrRead, this);
+}
+
+
+
+
+
+void HidDevice::close()
+{
+	if (m_Handle == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	// Notify the Reader thread to terminate, and wait for it to do so:
+	m_ShouldTerminate = true;
+	CancelIoEx(m_Handle, nullptr);
+	if (m_ReadThread.joinable())
+	{
+		if (m_ReadThread.get_id() == std::this_thread::get_id())
+		{
+			// Closing from within a callback, the thread will terminate on its own once the callback returns
+			m_ReadThread.detach();
+		}
+		else
+		{
+			m_ReadThread.join();
+		}
+	}
+	CloseHandle(m_Handle);
+	m_Handle = INVALID_HANDLE_VALUE;
+}
+
+
+
+
+
+bool HidDevice::isOpen() const
+{
+	return (m_Handle != INVALID_HANDLE_VALUE);
+}
+
+
+
+
+
+void HidDevice::thrRead()
+{
+	auto evtRead = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	while (!m_ShouldTerminate)
+	{
+		unsigned char buffer[REPORT_SIZE];
+		DWORD br = 0;
+		OVERLAPPED ovl;
+		memset(&ovl, 0, sizeof(ovl));
+		ovl.hEvent = evtRead;
+		if (!ReadFile(m_Handle, &buffer, sizeof(buffer), &br, &ovl))
+		{
+			auto gle = GetLastError();
+			if (gle != ERROR_IO_PENDING)
+			{
+				LOG("ReadFile() failed: %d (0x%x)", gle, gle);
+				break;
+			}
+			if (!GetOverlappedResult(m_Handle, &ovl, &br, TRUE))
+			{
+				auto gle = GetLastError();
+				LOG("Failed to wait for read data: %d (0x%x)", gle, gle);
+				break;
+			}
+		}
+		m_OnReport(buffer, br, Clock::now());
+	}
+	CloseHandle(evtRead);
+
+	if (!m_ShouldTerminate)
+	{
+		m_OnError();
+	}
+}
+
+
+
+
+
+bool HidDevice::write(const void * a_Buffer, size_t a_Size)
+{
+	char buf[REPORT_SIZE];
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, a_Buffer, std::min(a_Size, sizeof(buf)));
+
+	DWORD bw;
+	OVERLAPPED ovl;
+	memset(&ovl, 0, sizeof(ovl));
+	ovl.hEvent = m_WriteEvent;
+	if (!WriteFile(m_Handle, buf, static_cast<DWORD>(sizeof(buf)), &bw, &ovl))
+	{
+		auto gle = GetLastError();
+		if (gle != ERROR_IO_PENDING)
+		{
+			LOG("Failed to WriteFile: %d (0x%x)", gle, gle);
+			return false;
+		}
+		if (!GetOverlappedResult(m_Handle, &ovl, &bw, TRUE))
+		{
+			auto gle = GetLastError();
+			LOG("Failed to GetOverlappedResult: %d (0x%x)", gle, gle);
+			return false;
+		}
+	}
+	if (bw != sizeof(buf))
+	{
+		LOG("Failed to write buffer, %u bytes written out of %u", bw, static_cast<unsigned>(sizeof(buf)));
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+bool HidDevice::setOutputReport(const void * a_Buffer, size_t a_Size)
+{
+	char buf[REPORT_SIZE];
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, a_Buffer, std::min(a_Size, sizeof(buf)));
+	auto res = !!HidD_SetOutputReport(m_Handle, buf, sizeof(buf));
+	if (!res)
+	{
+		auto gle = GetLastError();
+		LOG("Failed to SetOutputReport: %d (0x%x)", gle, gle);
+	}
+	return res;
+}
+
+
+
+
+
+std::chrono::microseconds HidDevice::getMinWriteInterval() const
+{
+	// The Wiimotes drop the output reports that come in too fast over some BT stacks:
+	return std::chrono::milliseconds(100);
+}
+
+
+
+
+
+std::string HidDevice::getStableId() const
+{
+	// The BT HID devices report their BT address as the serial number:
+	WCHAR serial[128] = {};
+	if (HidD_GetSerialNumberString(m_Handle, serial, sizeof(serial) - sizeof(WCHAR)) && (serial[0] != 0))
+	{
+		char serialUtf8[512];
+		WideCharToMultiByte(CP_UTF8, 0, serial, -1, serialUtf8, ARRAYCOUNT(serialUtf8), nullptr, nullptr);
+		return std::string("serial:") + serialUtf8;
+	}
+
+	// The device path contains the device instance ID, which is stable for a paired device:
+	return m_Path;
+}
+
+
+
+
@@ -0,0 +1,170 @@
+// HidrawReactor.cpp
+
+// Implements the HidrawReactor class representing the single epoll-driven thread that services all the hidraw devices (Linux only)
+
+
+
+
+
+#include "Globals.h"
+#include "HidrawReactor.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+
+
+
+/** The max number of ready FDs handled per single wakeup. */
+static const int MAX_EVENTS = 64;
+
+
+
+
+
+HidrawReactor & HidrawReactor::get()
+{
+	static HidrawReactor singleton;
+	return singleton;
+}
+
+
+
+
+
+HidrawReactor::HidrawReactor():
+	m_EpollFD(epoll_create1(EPOLL_CLOEXEC)),
+	m_WakeupFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+	m_ShouldTerminate(false),
+	m_NumWakeups(0),
+	m_NumDispatches(0)
+{
+	if ((m_EpollFD < 0) || (m_WakeupFD < 0))
+	{
+		LOG("Failed to create the epoll / eventfd instances: %d (%s)", errno, strerror(errno));
+		return;
+	}
+	epoll_event evt;
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLIN;
+	evt.data.fd = m_WakeupFD;
+	epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, m_WakeupFD, &evt);
+}
+
+
+
+
+
+HidrawReactor::~HidrawReactor()
+{
+	if (m_Thread.joinable())
+	{
+		m_ShouldTerminate = true;
+		uint64_t one = 1;
+		if (write(m_WakeupFD, &one, sizeof(one)) == sizeof(one))
+		{
+			m_Thread.join();
+		}
+		else
+		{
+			m_Thread.detach();
+		}
+	}
+	close(m_WakeupFD);
+	close(m_EpollFD);
+}
+
+
+
+
+
+bool HidrawReactor::add(int a_FD, Handler a_Handler)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_CS);
+	if (m_EpollFD < 0)
+	{
+		return false;
+	}
+	m_Handlers[a_FD] = std::move(a_Handler);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLIN;
+	evt.data.fd = a_FD;
+	if (epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, a_FD, &evt) != 0)
+	{
+		LOG("Failed to add FD %d to epoll: %d (%s)", a_FD, errno, strerror(errno));
+		m_Handlers.erase(a_FD);
+		return false;
+	}
+
+	// Start the reactor thread on the first use:
+	if (!m_Thread.joinable())
+	{
+		m_Thread = std::thread(&HidrawReactor::thrReactor, this);
+	}
+	return true;
+}
+
+
+
+
+
+void HidrawReactor::remove(int a_FD)
+{
+	// Taking the lock waits for any handler currently being dispatched:
+	std::lock_guard<std::recursive_mutex> lock(m_CS);
+	epoll_ctl(m_EpollFD, EPOLL_CTL_DEL, a_FD, nullptr);
+	m_Handlers.erase(a_FD);
+}
+
+
+
+
+
+void HidrawReactor::thrReactor()
+{
+	epoll_event events[MAX_EVENTS];
+	while (!m_ShouldTerminate)
+	{
+		auto numEvents = epoll_wait(m_EpollFD, events, MAX_EVENTS, -1);
+		if (numEvents < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			LOG("epoll_wait() failed: %d (%s)", errno, strerror(errno));
+			return;
+		}
+		++m_NumWakeups;
+
+		std::lock_guard<std::recursive_mutex> lock(m_CS);
+		for (int i = 0; i < numEvents; ++i)
+		{
+			auto fd = events[i].data.fd;
+			if (fd == m_WakeupFD)
+			{
+				continue;
+			}
+
+			// The FD may have been removed by a handler earlier in this batch, look it up again:
+			auto itr = m_Handlers.find(fd);
+			if (itr == m_Handlers.end())
+			{
+				continue;
+			}
+			++m_NumDispatches;
+
+			// Call a copy of the handler, it may remove itself (and thus destroy the original) while running:
+			auto handler = itr->second;
+			handler(events[i].events);
+		}
+	}
+}
+
+
+
+
@@ -0,0 +1,88 @@
+// HidrawReactor.h
+
+// Declares the HidrawReactor class representing the single epoll-driven thread that services all the hidraw devices (Linux only)
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+
+
+
+
+/** Services all the registered file descriptors from a single thread, using epoll.
+Whenever an FD becomes readable, its handler is expected to drain all the reports available, so that a single
+wakeup services every ready report of every device. The number of threads doesn't grow with the number of devices.
+The reactor thread is started on the first add() and runs until the process terminates. */
+class HidrawReactor
+{
+public:
+	/** The handler called when a registered FD becomes ready. The parameter is the epoll event mask (EPOLLIN, EPOLLHUP, ...). */
+	typedef std::function<void (uint32_t a_Events)> Handler;
+
+
+	/** Returns the singleton instance. */
+	static HidrawReactor & get();
+
+	/** Registers the FD for reading; a_Handler is called from the reactor thread whenever the FD is ready.
+	Returns true on success, false on failure. */
+	bool add(int a_FD, Handler a_Handler);
+
+	/** Unregisters the FD.
+	Once this returns, the FD's handler is not running and won't be called anymore.
+	Can be called from within a handler. */
+	void remove(int a_FD);
+
+	/** Returns the number of epoll wakeups so far. Together with the reports count this tells how well the wakeups are batched. */
+	uint64_t getNumWakeups() const { return m_NumWakeups; }
+
+	/** Returns the number of handler invocations so far. */
+	uint64_t getNumDispatches() const { return m_NumDispatches; }
+
+protected:
+
+	/** The epoll instance. */
+	int m_EpollFD;
+
+	/** Eventfd used to wake up the reactor thread for termination. */
+	int m_WakeupFD;
+
+	/** The reactor thread. */
+	std::thread m_Thread;
+
+	/** Flag indicating that the reactor thread should terminate as soon as possible. */
+	std::atomic<bool> m_ShouldTerminate;
+
+	/** Protects m_Handlers; held while dispatching, so that remove() can wait for a running handler to finish.
+	Recursive, so that handlers may call remove() (and add()) themselves. */
+	std::recursive_mutex m_CS;
+
+	/** The handlers for the registered FDs. */
+	std::map<int, Handler> m_Handlers;
+
+	/** Statistics, see getNumWakeups() and getNumDispatches(). */
+	std::atomic<uint64_t> m_NumWakeups;
+	std::atomic<uint64_t> m_NumDispatches;
+
+
+	HidrawReactor();
+	~HidrawReactor();
+
+	/** Waits for the registered FDs to become ready and calls their handlers.
+	Executed in m_Thread. */
+	void thrReactor();
+};
+
+
+
+
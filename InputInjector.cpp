@@ -0,0 +1,359 @@
+// InputInjector.cpp
+
+// Implements the InputInjector class representing the dedicated thread that emits the mouse events into an output sink
+
+
+
+
+
+#include "Globals.h"
+#include "InputInjector.h"
+#include "StageHistograms.h"
+
+
+
+
+
+/** How long the injection thread sleeps at most when there are no events, as a safety net against a lost wakeup. */
+static const std::chrono::milliseconds MAX_IDLE_WAIT(100);
+
+
+
+
+
+InputInjector::InputInjector(OutputSinkPtr a_Sink):
+	m_Sink(std::move(a_Sink)),
+	m_NumSources(0),
+	m_NextSeq(0),
+	m_IsWaiting(false),
+	m_ShouldTerminate(false),
+	m_NumInjected(0),
+	m_NumMovesDropped(0),
+	m_NumButtonQueueFull(0),
+	m_MaxBatchSize(0),
+	m_NumMovesSuppressed(0),
+	m_NumSyscalls(0),
+	m_NumSyscallsSaved(0),
+	m_StartTime(Clock::now())
+{
+	for (auto & src: m_Sources)
+	{
+		std::fill(std::begin(src.m_NumMovesPosted), std::end(src.m_NumMovesPosted), 0);
+		src.m_NumButtonsPosted = 0;
+	}
+	m_Thread = std::thread(&InputInjector::thrInject, this);
+}
+
+
+
+
+
+InputInjector::~InputInjector()
+{
+	stop();
+}
+
+
+
+
+
+int InputInjector::addSource()
+{
+	auto idx = m_NumSources.load();
+	do
+	{
+		if (idx >= static_cast<int>(MAX_SOURCES))
+		{
+			LOG("InputInjector: too many sources, the events will be dropped");
+			return -1;
+		}
+	} while (!m_NumSources.compare_exchange_weak(idx, idx + 1));
+	return idx;
+}
+
+
+
+
+
+void InputInjector::post(int a_Source, const MouseEvent * a_Events, size_t a_Count, const LatencyTrace & a_Trace)
+{
+	if ((a_Source < 0) || (a_Source >= m_NumSources.load(std::memory_order_relaxed)) || m_ShouldTerminate.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	for (size_t i = 0; i < a_Count; ++i)
+	{
+		postOne(a_Source, a_Events[i], a_Trace);
+	}
+	wakeUp();
+}
+
+
+
+
+
+void InputInjector::postOne(int a_Source, const MouseEvent & a_Event, const LatencyTrace & a_Trace)
+{
+	auto & src = m_Sources[a_Source];
+	QueuedEvent evt;
+	evt.m_Event = a_Event;
+	evt.m_Trace = a_Trace;
+	evt.m_Seq = m_NextSeq.fetch_add(1);
+	evt.m_Source = a_Source;
+	evt.m_NumButtonsBefore = src.m_NumButtonsPosted;
+	if (a_Event.m_Type == MouseEvent::metMove)
+	{
+		// Overwrite the pen's previous move, if the injection thread hasn't picked it up yet:
+		auto pen = std::min(std::max(a_Event.m_PenId, 0), MouseEvent::MAX_PENS - 1);
+		src.m_NumMovesPosted[pen] += 1;
+		evt.m_MoveNum = src.m_NumMovesPosted[pen];
+		src.m_Moves[pen].push(evt);
+	}
+	else
+	{
+		// Button transitions must never be lost; if the queue is full, spill over into the source's overflow list,
+		// and keep using it until it is drained, so that the source's transitions stay in order:
+		src.m_NumButtonsPosted += 1;
+		evt.m_MoveNum = 0;
+		if (!src.m_ButtonOverflow.isDrained() || !m_Buttons.tryPush(evt))
+		{
+			m_NumButtonQueueFull.fetch_add(1, std::memory_order_relaxed);
+			src.m_ButtonOverflow.push(evt);
+		}
+	}
+}
+
+
+
+
+
+void InputInjector::stop()
+{
+	std::lock_guard<std::mutex> stopLock(m_StopCS);
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_ShouldTerminate = true;
+		m_CV.notify_all();
+	}
+	if (m_Thread.joinable())
+	{
+		m_Thread.join();
+	}
+}
+
+
+
+
+
+InputInjector::Stats InputInjector::getStats() const
+{
+	Stats res;
+	res.m_NumPosted = m_NextSeq.load();
+	res.m_NumInjected = m_NumInjected.load();
+	res.m_NumMovesDropped = m_NumMovesDropped.load();
+	res.m_NumButtonQueueFull = m_NumButtonQueueFull.load();
+	res.m_ButtonQueueDepth = m_Buttons.getSize();
+	res.m_MaxBatchSize = m_MaxBatchSize.load();
+	res.m_NumMovesSuppressed = m_NumMovesSuppressed.load();
+	res.m_NumSyscalls = m_NumSyscalls.load();
+	res.m_NumSyscallsSaved = m_NumSyscallsSaved.load();
+	auto elapsedSec = std::chrono::duration<double>(Clock::now() - m_StartTime).count();
+	res.m_SyscallsSavedPerSec = (elapsedSec > 0) ? (res.m_NumSyscallsSaved / elapsedSec) : 0;
+	return res;
+}
+
+
+
+
+
+void InputInjector::wakeUp()
+{
+	// Pairs with the injection thread setting m_IsWaiting before re-checking for the events (both seq_cst):
+	if (m_IsWaiting.load())
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_CV.notify_one();
+	}
+}
+
+
+
+
+
+void InputInjector::thrInject()
+{
+	// The number of the last move taken from each source and pen, to detect the new ones and count the dropped ones:
+	uint64_t lastMoveNum[MAX_SOURCES][MouseEvent::MAX_PENS] = {};
+
+	// The number of button transitions taken from each source:
+	uint64_t numButtonsTaken[MAX_SOURCES] = {};
+
+	// The number of events accounted for (injected or dropped); when equal to m_NextSeq, there's nothing pending:
+	uint64_t numAccounted = 0;
+
+	// The last position sent to the sink for each pen, for suppressing the moves that wouldn't move the pen:
+	struct
+	{
+		bool m_IsValid;
+		int m_X, m_Y;
+	} lastPos[MouseEvent::MAX_PENS] = {};
+
+	std::vector<QueuedEvent> batch;
+	batch.reserve(MAX_SOURCES * MouseEvent::MAX_PENS + BUTTON_QUEUE_CAPACITY);
+	std::vector<MouseEvent> events;
+	events.reserve(batch.capacity());
+	for (;;)
+	{
+		// Read the flag before collecting, so that all the events posted before stop() are collected before terminating:
+		auto shouldTerminate = m_ShouldTerminate.load();
+
+		// Collect the button transitions:
+		batch.clear();
+		QueuedEvent evt;
+		while ((batch.size() < BUTTON_QUEUE_CAPACITY) && m_Buttons.tryPop(evt))
+		{
+			numButtonsTaken[evt.m_Source] += 1;
+			batch.push_back(evt);
+		}
+
+		// Collect the overflown button transitions, each only once all the source's earlier ones have been collected
+		// (the ones still in the queue are picked up in a later round):
+		auto numSources = m_NumSources.load();
+		for (int i = 0; i < numSources; ++i)
+		{
+			auto & overflow = m_Sources[i].m_ButtonOverflow;
+			const QueuedEvent * front;
+			while (((front = overflow.front()) != nullptr) && (front->m_NumButtonsBefore == numButtonsTaken[i]))
+			{
+				batch.push_back(*front);
+				overflow.pop();
+				numButtonsTaken[i] += 1;
+			}
+		}
+
+		// Collect the latest move of each source and pen, unless it would overtake a button transition not collected yet
+		// (the queue may still be filling up); such a move is picked up in a later round:
+		for (int i = 0; i < numSources; ++i)
+		{
+			for (int pen = 0; pen < MouseEvent::MAX_PENS; ++pen)
+			{
+				auto & lastNum = lastMoveNum[i][pen];
+				if (
+					!m_Sources[i].m_Moves[pen].getLatest(evt) ||
+					(evt.m_MoveNum == lastNum) ||
+					(evt.m_NumButtonsBefore > numButtonsTaken[i])
+				)
+				{
+					continue;
+				}
+				auto numDropped = evt.m_MoveNum - lastNum - 1;
+				if (numDropped > 0)
+				{
+					m_NumMovesDropped.fetch_add(numDropped, std::memory_order_relaxed);
+					numAccounted += numDropped;
+				}
+				lastNum = evt.m_MoveNum;
+				batch.push_back(evt);
+			}
+		}
+
+		if (batch.empty())
+		{
+			if (shouldTerminate)
+			{
+				return;
+			}
+
+			// Sleep until a producer posts something:
+			std::unique_lock<std::mutex> lock(m_CS);
+			m_IsWaiting = true;
+			if ((m_NextSeq.load() == numAccounted) && !m_ShouldTerminate.load())
+			{
+				m_CV.wait_for(lock, MAX_IDLE_WAIT);
+			}
+			m_IsWaiting = false;
+			continue;
+		}
+
+		// Sort into the posting order:
+		std::sort(batch.begin(), batch.end(),
+			[](const QueuedEvent & a_First, const QueuedEvent & a_Second)
+			{
+				return (a_First.m_Seq < a_Second.m_Seq);
+			}
+		);
+
+		// Drop the moves that wouldn't change the pointer position, then inject the rest with a single send():
+		events.clear();
+		size_t numSuppressed = 0;
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			const auto & e = batch[i].m_Event;
+			auto pen = std::min(std::max(e.m_PenId, 0), MouseEvent::MAX_PENS - 1);
+			if (e.m_Type == MouseEvent::metMove)
+			{
+				auto isAtLastPos = (lastPos[pen].m_IsValid && (e.m_X == lastPos[pen].m_X) && (e.m_Y == lastPos[pen].m_Y));
+				auto isBeforeButtonAtSamePos = (
+					(i + 1 < batch.size()) &&
+					(batch[i + 1].m_Event.m_Type != MouseEvent::metMove) &&
+					(batch[i + 1].m_Event.m_PenId == e.m_PenId) &&
+					(batch[i + 1].m_Event.m_X == e.m_X) &&
+					(batch[i + 1].m_Event.m_Y == e.m_Y)
+				);
+				if (isAtLastPos || isBeforeButtonAtSamePos)
+				{
+					numSuppressed += 1;
+					continue;
+				}
+			}
+			events.push_back(e);
+			lastPos[pen].m_IsValid = true;
+			lastPos[pen].m_X = e.m_X;
+			lastPos[pen].m_Y = e.m_Y;
+		}
+		size_t numSyscalls = 0;
+		if (!events.empty())
+		{
+			auto sendStart = Clock::now();
+			numSyscalls = m_Sink->send(events.data(), events.size());
+			auto sendDuration = Clock::now() - sendStart;
+
+			// The batch's injection counts once for each device whose events it contains, and once in the aggregate:
+			auto & histograms = StageHistograms::get();
+			histograms.record(-1, StageHistograms::hsInject, sendDuration);
+			uint32_t devicesRecorded = 0;
+			static_assert(StageHistograms::MAX_DEVICES <= 32, "The devices' mask is too small");
+			for (const auto & e: batch)
+			{
+				auto device = e.m_Trace.m_Device;
+				if ((device < 0) || (device >= StageHistograms::MAX_DEVICES) || ((devicesRecorded & (1u << device)) != 0))
+				{
+					continue;
+				}
+				devicesRecorded |= (1u << device);
+				histograms.recordDevice(device, StageHistograms::hsInject, sendDuration);
+			}
+		}
+		for (auto & e: batch)
+		{
+			e.m_Trace.mark(LatencyTrace::stInjected);
+			if (e.m_Trace.has(LatencyTrace::stArrival))
+			{
+				m_LatencyStats.add(e.m_Trace);
+			}
+		}
+		numAccounted += batch.size();
+		m_NumInjected.fetch_add(batch.size(), std::memory_order_relaxed);
+		m_NumMovesSuppressed.fetch_add(numSuppressed, std::memory_order_relaxed);
+		m_NumSyscalls.fetch_add(numSyscalls, std::memory_order_relaxed);
+		m_NumSyscallsSaved.fetch_add(batch.size() - numSyscalls, std::memory_order_relaxed);
+		if (batch.size() > m_MaxBatchSize.load(std::memory_order_relaxed))
+		{
+			m_MaxBatchSize.store(batch.size(), std::memory_order_relaxed);
+		}
+	}
+}
+
+
+
+
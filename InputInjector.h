@@ -0,0 +1,214 @@
+// InputInjector.h
+
+// Declares the InputInjector class representing the dedicated thread that emits the mouse events into an output sink
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "OutputSink.h"
+#include "LatencyTrace.h"
+#include "BoundedQueue.h"
+#include "SampleRing.h"
+#include "OverflowList.h"
+
+
+
+
+
+/** Emits the mouse events into the output sink (normally the OS input) from its own thread, so that the
+(possibly slow) OS call never blocks the Wiimote read threads that produce the events.
+Each producer (a Processor) is a separate source, registered via addSource() and posting from a single thread.
+The button transitions go through a lock-free FIFO queue and are never dropped; if the queue is full, they spill
+over into the source's own overflow list, so that the producer (a Wiimote read thread) never waits. The moves go through a mailbox per source and pen that only
+keeps the pen's latest move: if the injection thread falls behind, the older moves are dropped, because only the
+latest pointer position matters. The events are injected in the order in which they were posted, across all sources.
+All the events pending when the injection thread wakes up (from all sources) are injected as a single batch, with
+a single call to the sink; the moves that wouldn't change anything (to the pen's current position, or to the
+position of the pen's button transition right after them) are suppressed. */
+class InputInjector
+{
+public:
+	/** The maximum number of sources (one per Wiimote). */
+	static const size_t MAX_SOURCES = 16;
+
+	/** The capacity of the button transitions' queue. */
+	static const size_t BUTTON_QUEUE_CAPACITY = 256;
+
+
+	/** The counters describing the injector's operation. */
+	struct Stats
+	{
+		/** The number of events posted so far. */
+		uint64_t m_NumPosted;
+
+		/** The number of events processed by the injection thread so far (injected into the OS or suppressed). */
+		uint64_t m_NumInjected;
+
+		/** The number of moves dropped because a newer move from the same source superseded them. */
+		uint64_t m_NumMovesDropped;
+
+		/** The number of button transitions that went to their source's overflow list, because the button queue was full
+		(or the source's earlier transitions were still in the overflow list). */
+		uint64_t m_NumButtonQueueFull;
+
+		/** The number of button transitions currently waiting in the queue. */
+		size_t m_ButtonQueueDepth;
+
+		/** The maximum number of events injected in a single batch, i.e. the maximum that was pending at once. */
+		size_t m_MaxBatchSize;
+
+		/** The number of moves that were not injected because they wouldn't have moved the pointer. */
+		uint64_t m_NumMovesSuppressed;
+
+		/** The number of OS calls made to inject the events, as reported by the sink. */
+		uint64_t m_NumSyscalls;
+
+		/** The number of OS calls saved by batching and suppressing, compared to one call per event. */
+		uint64_t m_NumSyscallsSaved;
+
+		/** The average number of OS calls saved per second, over the injector's lifetime. */
+		double m_SyscallsSavedPerSec;
+	};
+
+
+	/** Creates the injector emitting into the specified sink and starts its thread. */
+	explicit InputInjector(OutputSinkPtr a_Sink);
+
+	/** Stops the injector, see stop(). */
+	~InputInjector();
+
+	/** Registers a new source of events and returns its index, to be used with post().
+	Returns -1 if there are already MAX_SOURCES sources. */
+	int addSource();
+
+	/** Queues the events from the specified source for injection; they should be all the events produced by a
+	single report, so that they get injected in the same batch. a_Trace travels along with the events, the
+	stInjected stage is stamped on the injection thread.
+	Must only be called from a single thread for each source. Wait-free for moves, lock-free for button transitions;
+	never waits for the injection thread. */
+	void post(int a_Source, const MouseEvent * a_Events, size_t a_Count, const LatencyTrace & a_Trace);
+
+	/** Injects all the events that are still queued and stops the thread.
+	Events posted afterwards are dropped. Safe to call multiple times. */
+	void stop();
+
+	/** Returns a snapshot of the counters. */
+	Stats getStats() const;
+
+	/** Returns the latency statistics of the injected events, from the arrival of their report up to each stage. */
+	const LatencyStats & getLatencyStats() const { return m_LatencyStats; }
+
+protected:
+
+	/** A single event travelling from a producer to the injection thread. Trivially copyable. */
+	struct QueuedEvent
+	{
+		MouseEvent m_Event;
+
+		/** The timestamps of the report that produced the event. */
+		LatencyTrace m_Trace;
+
+		/** The global posting order, across all the sources. */
+		uint64_t m_Seq;
+
+		/** The source that posted the event. */
+		int m_Source;
+
+		/** For moves, the per-source and per-pen number of the move (starting at 1), used to count the dropped ones. */
+		uint64_t m_MoveNum;
+
+		/** For moves, the number of button transitions the source had posted before the move.
+		The move is only injected once all of them have been injected, so that it cannot overtake them. */
+		uint64_t m_NumButtonsBefore;
+	};
+
+	/** The per-source state. */
+	struct Source
+	{
+		/** The mailboxes holding the latest move posted by the source, for each pen. */
+		SampleRing<QueuedEvent, 2> m_Moves[MouseEvent::MAX_PENS];
+
+		/** The number of moves posted by the source so far, for each pen. Only accessed by the source's producer thread. */
+		uint64_t m_NumMovesPosted[MouseEvent::MAX_PENS];
+
+		/** The number of button transitions posted by the source so far. Only accessed by the source's producer thread. */
+		uint64_t m_NumButtonsPosted;
+
+		/** The button transitions that didn't fit into m_Buttons. Once a transition goes here, the source's later ones
+		follow it until the injection thread has taken them all, so that they stay in order. */
+		OverflowList<QueuedEvent> m_ButtonOverflow;
+	};
+
+
+	/** The sink into which the events are emitted. */
+	OutputSinkPtr m_Sink;
+
+	/** The sources, the first m_NumSources are in use. */
+	Source m_Sources[MAX_SOURCES];
+
+	/** The number of registered sources. */
+	std::atomic<int> m_NumSources;
+
+	/** The button transitions waiting to be injected. */
+	BoundedQueue<QueuedEvent, BUTTON_QUEUE_CAPACITY> m_Buttons;
+
+	/** The sequence number for the next posted event; also the number of events posted so far. */
+	std::atomic<uint64_t> m_NextSeq;
+
+	/** Set while the injection thread is (about to be) sleeping, so that the producers know to wake it up. */
+	std::atomic<bool> m_IsWaiting;
+
+	/** Set when the injection thread should terminate. */
+	std::atomic<bool> m_ShouldTerminate;
+
+	/** Protects the sleeping of the injection thread, so that no wakeup gets lost. */
+	std::mutex m_CS;
+
+	/** Notified when there are new events while the injection thread is sleeping. */
+	std::condition_variable m_CV;
+
+	/** The injection thread. */
+	std::thread m_Thread;
+
+	/** Serializes stop() calls. */
+	std::mutex m_StopCS;
+
+	std::atomic<uint64_t> m_NumInjected;
+	std::atomic<uint64_t> m_NumMovesDropped;
+	std::atomic<uint64_t> m_NumButtonQueueFull;
+	std::atomic<size_t> m_MaxBatchSize;
+	std::atomic<uint64_t> m_NumMovesSuppressed;
+	std::atomic<uint64_t> m_NumSyscalls;
+	std::atomic<uint64_t> m_NumSyscallsSaved;
+
+	/** The time when the injector was created, for the per-second rates. */
+	Clock::time_point m_StartTime;
+
+	/** The latency statistics of the injected events. */
+	LatencyStats m_LatencyStats;
+
+
+	/** Queues a single event from the specified source, without waking the injection thread up. */
+	void postOne(int a_Source, const MouseEvent & a_Event, const LatencyTrace & a_Trace);
+
+	/** Wakes the injection thread up, if it is sleeping. */
+	void wakeUp();
+
+	/** Collects and injects the pending events until terminated.
+	Executed in m_Thread. */
+	void thrInject();
+};
+
+
+
+
@@ -0,0 +1,157 @@
+// KalmanFilter.cpp
+
+// Implements the KalmanFilter class representing the constant-velocity Kalman filter of a pen's position
+
+
+
+
+
+#include "Globals.h"
+#include "KalmanFilter.h"
+
+
+
+
+
+/** The initial variance of the velocity, in (IR camera pixels per second) squared: the pen may start at any speed. */
+static const double INITIAL_VELOCITY_VARIANCE = 1e6;
+
+
+
+
+
+/** Advances the covariance (a_P00, a_P01, a_P11) of the position-velocity estimate by a_Dt and corrects it with
+a measurement; returns the Kalman gains for the position (a_K0) and velocity (a_K1). */
+static void updateCovariance(
+	double & a_P00, double & a_P01, double & a_P11,
+	double a_ProcessNoise, double a_MeasurementNoise, double a_Dt,
+	double & a_K0, double & a_K1
+)
+{
+	// Predict:
+	auto dt2 = a_Dt * a_Dt;
+	auto p00 = a_P00 + a_Dt * 2 * a_P01 + dt2 * a_P11 + a_ProcessNoise * dt2 * a_Dt / 3;
+	auto p01 = a_P01 + a_Dt * a_P11 + a_ProcessNoise * dt2 / 2;
+	auto p11 = a_P11 + a_ProcessNoise * a_Dt;
+
+	// Correct:
+	auto s = p00 + a_MeasurementNoise;
+	a_K0 = p00 / s;
+	a_K1 = p01 / s;
+	a_P00 = (1 - a_K0) * p00;
+	a_P01 = (1 - a_K0) * p01;
+	a_P11 = p11 - a_K1 * p01;
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// KalmanFilter::Params:
+
+KalmanFilter::Params::Params():
+	m_ProcessNoise(20000),
+	m_MeasurementNoise(4)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// KalmanFilter:
+
+KalmanFilter::KalmanFilter(const Params & a_Params):
+	m_MaxAddedLatency(0),
+	m_HasState(false),
+	m_X(0),
+	m_VX(0),
+	m_Y(0),
+	m_VY(0),
+	m_P00(0),
+	m_P01(0),
+	m_P11(0)
+{
+	setParams(a_Params);
+}
+
+
+
+
+
+void KalmanFilter::setParams(const Params & a_Params)
+{
+	m_Params = a_Params;
+
+	// Simulate a single axis at the nominal interval: let a resting pen settle the covariance, then let it suddenly
+	// start moving at a unit speed; the largest distance behind the pen is the worst-case lag:
+	auto dt = std::chrono::duration<double>(NOMINAL_INTERVAL).count();
+	double p00 = m_Params.m_MeasurementNoise, p01 = 0, p11 = INITIAL_VELOCITY_VARIANCE;
+	double k0, k1;
+	for (int i = 0; i < 1000; ++i)
+	{
+		updateCovariance(p00, p01, p11, m_Params.m_ProcessNoise, m_Params.m_MeasurementNoise, dt, k0, k1);
+	}
+	double x = 0, v = 0, maxLag = 0;
+	for (int i = 1; i <= 1000; ++i)
+	{
+		updateCovariance(p00, p01, p11, m_Params.m_ProcessNoise, m_Params.m_MeasurementNoise, dt, k0, k1);
+		auto pos = i * dt;
+		x += v * dt;
+		auto err = pos - x;
+		x += k0 * err;
+		v += k1 * err;
+		maxLag = std::max(maxLag, pos - x);
+	}
+	m_MaxAddedLatency = std::chrono::microseconds(static_cast<int64_t>(maxLag * 1e6));
+}
+
+
+
+
+
+void KalmanFilter::filter(double & a_X, double & a_Y, double a_Dt)
+{
+	if (!m_HasState || (a_Dt <= 0))
+	{
+		m_HasState = true;
+		m_X = a_X;
+		m_Y = a_Y;
+		m_VX = 0;
+		m_VY = 0;
+		m_P00 = m_Params.m_MeasurementNoise;
+		m_P01 = 0;
+		m_P11 = INITIAL_VELOCITY_VARIANCE;
+		return;
+	}
+	step(a_X, a_Y, a_Dt);
+}
+
+
+
+
+
+void KalmanFilter::step(double & a_X, double & a_Y, double a_Dt)
+{
+	double k0, k1;
+	updateCovariance(m_P00, m_P01, m_P11, m_Params.m_ProcessNoise, m_Params.m_MeasurementNoise, a_Dt, k0, k1);
+
+	// Predict the state, then correct it with the measurement:
+	m_X += m_VX * a_Dt;
+	m_Y += m_VY * a_Dt;
+	auto errX = a_X - m_X;
+	auto errY = a_Y - m_Y;
+	m_X += k0 * errX;
+	m_Y += k0 * errY;
+	m_VX += k1 * errX;
+	m_VY += k1 * errY;
+
+	a_X = m_X;
+	a_Y = m_Y;
+}
+
+
+
+
@@ -0,0 +1,82 @@
+// KalmanFilter.h
+
+// Declares the KalmanFilter class representing the constant-velocity Kalman filter of a pen's position
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "PointFilter.h"
+
+
+
+
+
+/** A Kalman filter with a constant-velocity motion model (position and velocity per axis, driven by white-noise
+acceleration), using the actual interval between the samples. Unlike a plain low-pass filter, it doesn't lag
+behind a pen moving at a constant speed; it lags only while the pen accelerates.
+The worst-case added latency is the maximum lag after the pen suddenly starts moving, at the nominal report interval. */
+class KalmanFilter:
+	public PointFilter
+{
+public:
+	struct Params
+	{
+		/** The spectral density of the acceleration noise, in IR camera pixels squared per second cubed.
+		Higher means following the pen's acceleration faster (less lag), but less smoothing. */
+		double m_ProcessNoise;
+
+		/** The variance of the measured position, in IR camera pixels squared (the jitter). */
+		double m_MeasurementNoise;
+
+		/** The defaults: 20000 px^2/s^3 and 4 px^2 (2 px jitter); about 14 ms worst-case latency at 100 Hz. */
+		Params();
+	};
+
+
+	explicit KalmanFilter(const Params & a_Params = Params());
+
+	/** Replaces the parameters. Takes effect from the next sample on. */
+	void setParams(const Params & a_Params);
+
+	// PointFilter overrides:
+	virtual std::chrono::microseconds getMaxAddedLatency() const override { return m_MaxAddedLatency; }
+	virtual const char * getName() const override { return "Kalman"; }
+	virtual PointFilterPtr clone() const override { return PointFilterPtr(new KalmanFilter(m_Params)); }
+
+protected:
+
+	Params m_Params;
+
+	/** The worst-case added latency for m_Params, calculated in setParams(). */
+	std::chrono::microseconds m_MaxAddedLatency;
+
+	/** If true, the state is valid. */
+	bool m_HasState;
+
+	/** The estimated position and velocity on each axis. */
+	double m_X, m_VX;
+	double m_Y, m_VY;
+
+	/** The covariance of the estimate (position, velocity); the same for both axes, since they share the noise
+	parameters and sampling times. */
+	double m_P00, m_P01, m_P11;
+
+
+	/** Advances the state by a_Dt and corrects it with the measured a_X, a_Y. */
+	void step(double & a_X, double & a_Y, double a_Dt);
+
+	// PointFilter overrides:
+	virtual void filter(double & a_X, double & a_Y, double a_Dt) override;
+	virtual void resetFilter() override { m_HasState = false; }
+};
+
+
+
+
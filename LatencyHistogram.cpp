@@ -0,0 +1,225 @@
+// LatencyHistogram.cpp
+
+// Implements the LatencyHistogram class representing a fixed-memory, log-bucketed histogram of durations with wait-free recording
+
+
+
+
+
+#include "Globals.h"
+#include "LatencyHistogram.h"
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+
+
+
+
+/** Returns the index of the highest set bit of a non-zero value. */
+static int getHighestBit(uint64_t a_Value)
+{
+	#ifdef _MSC_VER
+		// _BitScanReverse64 is x64-only, go through the 32-bit halves:
+		unsigned long idx;
+		auto high = static_cast<unsigned long>(a_Value >> 32);
+		if (high != 0)
+		{
+			_BitScanReverse(&idx, high);
+			return static_cast<int>(idx) + 32;
+		}
+		_BitScanReverse(&idx, static_cast<unsigned long>(a_Value));
+		return static_cast<int>(idx);
+	#else
+		return 63 - __builtin_clzll(a_Value);
+	#endif
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram::Snapshot:
+
+LatencyHistogram::Snapshot::Snapshot():
+	m_Count(0)
+{
+	std::fill(std::begin(m_Counts), std::end(m_Counts), 0);
+}
+
+
+
+
+
+double LatencyHistogram::Snapshot::getPercentileUsec(double a_Fraction) const
+{
+	if (m_Count == 0)
+	{
+		return 0;
+	}
+
+	// The rank of the value, counting from 1; the bucket where the running count reaches it contains the value:
+	auto rank = static_cast<uint64_t>(std::ceil(std::min(std::max(a_Fraction, 0.0), 1.0) * m_Count));
+	rank = std::max<uint64_t>(rank, 1);
+	uint64_t sum = 0;
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		sum += m_Counts[i];
+		if (sum >= rank)
+		{
+			return (getBucketLowerBound(i) + getBucketWidth(i) - 1) / 1000.0;
+		}
+	}
+	return getMaxUsec();
+}
+
+
+
+
+
+double LatencyHistogram::Snapshot::getMaxUsec() const
+{
+	for (int i = NUM_BUCKETS - 1; i >= 0; --i)
+	{
+		if (m_Counts[i] > 0)
+		{
+			return (getBucketLowerBound(i) + getBucketWidth(i) - 1) / 1000.0;
+		}
+	}
+	return 0;
+}
+
+
+
+
+
+double LatencyHistogram::Snapshot::getMeanUsec() const
+{
+	if (m_Count == 0)
+	{
+		return 0;
+	}
+	double sum = 0;
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		if (m_Counts[i] > 0)
+		{
+			sum += m_Counts[i] * (getBucketLowerBound(i) + (getBucketWidth(i) - 1) / 2.0);
+		}
+	}
+	return sum / m_Count / 1000.0;
+}
+
+
+
+
+
+void LatencyHistogram::Snapshot::add(const Snapshot & a_Other)
+{
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		m_Counts[i] += a_Other.m_Counts[i];
+	}
+	m_Count += a_Other.m_Count;
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram:
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (auto & c: m_Counts)
+	{
+		c.store(0, std::memory_order_relaxed);
+	}
+}
+
+
+
+
+
+void LatencyHistogram::record(Clock::duration a_Duration)
+{
+	auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(a_Duration).count();
+	auto idx = getBucketIndex((nsec > 0) ? static_cast<uint64_t>(nsec) : 0);
+	m_Counts[idx].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+
+
+
+LatencyHistogram::Snapshot LatencyHistogram::getSnapshot() const
+{
+	Snapshot res;
+	for (int i = 0; i < NUM_BUCKETS; ++i)
+	{
+		res.m_Counts[i] = m_Counts[i].load(std::memory_order_relaxed);
+		res.m_Count += res.m_Counts[i];
+	}
+	return res;
+}
+
+
+
+
+
+void LatencyHistogram::reset()
+{
+	for (auto & c: m_Counts)
+	{
+		c.store(0, std::memory_order_relaxed);
+	}
+}
+
+
+
+
+
+int LatencyHistogram::getBucketIndex(uint64_t a_ValueNsec)
+{
+	// The values below SUB_BUCKETS have a bucket each, then each power of two gets SUB_BUCKETS buckets:
+	if (a_ValueNsec < static_cast<uint64_t>(SUB_BUCKETS))
+	{
+		return static_cast<int>(a_ValueNsec);
+	}
+	auto shift = getHighestBit(a_ValueNsec) - SUB_BUCKET_BITS;
+	auto idx = (shift + 1) * SUB_BUCKETS + static_cast<int>((a_ValueNsec >> shift) & (SUB_BUCKETS - 1));
+	return std::min(idx, NUM_BUCKETS - 1);
+}
+
+
+
+
+
+uint64_t LatencyHistogram::getBucketLowerBound(int a_BucketIndex)
+{
+	if (a_BucketIndex < SUB_BUCKETS)
+	{
+		return static_cast<uint64_t>(a_BucketIndex);
+	}
+	auto shift = a_BucketIndex / SUB_BUCKETS - 1;
+	return static_cast<uint64_t>(SUB_BUCKETS + a_BucketIndex % SUB_BUCKETS) << shift;
+}
+
+
+
+
+
+uint64_t LatencyHistogram::getBucketWidth(int a_BucketIndex)
+{
+	if (a_BucketIndex < SUB_BUCKETS)
+	{
+		return 1;
+	}
+	return static_cast<uint64_t>(1) << (a_BucketIndex / SUB_BUCKETS - 1);
+}
+
+
+
+
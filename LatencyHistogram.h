@@ -0,0 +1,104 @@
+// LatencyHistogram.h
+
+// Declares the LatencyHistogram class representing a fixed-memory, log-bucketed histogram of durations with wait-free recording
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+#include "LatencyTrace.h"
+
+
+
+
+
+/** Counts durations in logarithmic buckets, the way HDR histograms do: each power of two (in nanoseconds) is split
+into SUB_BUCKETS linear buckets, so that every recorded value is kept with a relative precision of 1 / SUB_BUCKETS,
+from 1 ns up to MAX_VALUE_NSEC (the longer durations are counted in the last bucket).
+The memory is fixed (NUM_BUCKETS counters). Recording is wait-free, a single relaxed atomic increment, so that it can
+be done from the reading threads on every report; a snapshot can be taken from any thread at any time, without
+stopping the recording (it may miss the values being recorded concurrently). */
+class LatencyHistogram
+{
+public:
+	/** The number of bits of the linear buckets within each power of two. */
+	static const int SUB_BUCKET_BITS = 4;
+
+	/** The number of linear buckets within each power of two. */
+	static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+	/** The number of bits of the longest duration (in nanoseconds) that gets its own bucket; 2^36 ns is about 68 s. */
+	static const int MAX_VALUE_BITS = 36;
+
+	/** The total number of buckets. */
+	static const int NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+
+	/** A copy of the histogram's counters, taken at a single moment. */
+	class Snapshot
+	{
+	public:
+		/** Creates an empty snapshot. */
+		Snapshot();
+
+		/** Returns the number of durations counted. */
+		uint64_t getCount() const { return m_Count; }
+
+		/** Returns the duration (in microseconds) that the specified fraction (0 .. 1) of the counted durations
+		doesn't exceed, e.g. 0.99 for the 99th percentile; the upper bound of the bucket that contains it.
+		Returns 0 if the snapshot is empty. */
+		double getPercentileUsec(double a_Fraction) const;
+
+		/** Returns the upper bound of the longest counted duration, in microseconds; 0 if empty. */
+		double getMaxUsec() const;
+
+		/** Returns the approximate mean of the counted durations (from the buckets' midpoints), in microseconds. */
+		double getMeanUsec() const;
+
+		/** Adds the counters of another snapshot into this one, e.g. for summing up several devices. */
+		void add(const Snapshot & a_Other);
+
+	protected:
+		friend class LatencyHistogram;
+
+		uint64_t m_Counts[NUM_BUCKETS];
+
+		/** The sum of m_Counts. */
+		uint64_t m_Count;
+	};
+
+
+	LatencyHistogram();
+
+	/** Counts a single duration. Wait-free; negative durations count as zero. */
+	void record(Clock::duration a_Duration);
+
+	/** Returns a copy of the current counters. Doesn't block the recording. */
+	Snapshot getSnapshot() const;
+
+	/** Zeroes all the counters. The values recorded concurrently may or may not survive. */
+	void reset();
+
+	/** Returns the index of the bucket counting the specified duration, in nanoseconds. */
+	static int getBucketIndex(uint64_t a_ValueNsec);
+
+	/** Returns the lowest duration, in nanoseconds, counted in the specified bucket. */
+	static uint64_t getBucketLowerBound(int a_BucketIndex);
+
+	/** Returns the number of nanoseconds that the specified bucket spans. */
+	static uint64_t getBucketWidth(int a_BucketIndex);
+
+protected:
+	std::atomic<uint64_t> m_Counts[NUM_BUCKETS];
+};
+
+
+
+
@@ -0,0 +1,173 @@
+// LatencyTrace.cpp
+
+// Implements the LatencyTrace, DurationStats and LatencyStats helpers for measuring the report processing latency
+
+
+
+
+
+#include "Globals.h"
+#include "LatencyTrace.h"
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyTrace:
+
+const char * LatencyTrace::getStageName(Stage a_Stage)
+{
+	switch (a_Stage)
+	{
+		case stArrival:    return "arrival";
+		case stParsed:     return "parsed";
+		case stDispatched: return "dispatched";
+		case stWarped:     return "warped";
+		case stInjected:   return "injected";
+	}
+	return "unknown";
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// DurationStats:
+
+DurationStats::DurationStats():
+	m_Count(0),
+	m_SumNsec(0),
+	m_SumSqUsec(0),
+	m_MinNsec(std::numeric_limits<int64_t>::max()),
+	m_MaxNsec(std::numeric_limits<int64_t>::min())
+{
+}
+
+
+
+
+
+void DurationStats::add(Clock::duration a_Duration)
+{
+	auto nsec = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(a_Duration).count());
+	auto usec = static_cast<double>(nsec) / 1000;
+	m_Count.fetch_add(1, std::memory_order_relaxed);
+	m_SumNsec.fetch_add(nsec, std::memory_order_relaxed);
+
+	auto sumSq = m_SumSqUsec.load(std::memory_order_relaxed);
+	while (!m_SumSqUsec.compare_exchange_weak(sumSq, sumSq + usec * usec, std::memory_order_relaxed))
+	{
+		// sumSq has been updated by compare_exchange_weak, retry
+	}
+
+	auto minNsec = m_MinNsec.load(std::memory_order_relaxed);
+	while ((nsec < minNsec) && !m_MinNsec.compare_exchange_weak(minNsec, nsec, std::memory_order_relaxed))
+	{
+		// minNsec has been updated by compare_exchange_weak, retry
+	}
+
+	auto maxNsec = m_MaxNsec.load(std::memory_order_relaxed);
+	while ((nsec > maxNsec) && !m_MaxNsec.compare_exchange_weak(maxNsec, nsec, std::memory_order_relaxed))
+	{
+		// maxNsec has been updated by compare_exchange_weak, retry
+	}
+}
+
+
+
+
+
+DurationStats::Summary DurationStats::getSummary() const
+{
+	Summary res;
+	res.m_Count = m_Count.load(std::memory_order_relaxed);
+	if (res.m_Count == 0)
+	{
+		res.m_MinUsec = 0;
+		res.m_MaxUsec = 0;
+		res.m_MeanUsec = 0;
+		res.m_StdDevUsec = 0;
+		return res;
+	}
+	auto count = static_cast<double>(res.m_Count);
+	res.m_MinUsec = static_cast<double>(m_MinNsec.load(std::memory_order_relaxed)) / 1000;
+	res.m_MaxUsec = static_cast<double>(m_MaxNsec.load(std::memory_order_relaxed)) / 1000;
+	res.m_MeanUsec = static_cast<double>(m_SumNsec.load(std::memory_order_relaxed)) / 1000 / count;
+	auto variance = m_SumSqUsec.load(std::memory_order_relaxed) / count - res.m_MeanUsec * res.m_MeanUsec;
+	res.m_StdDevUsec = (variance > 0) ? sqrt(variance) : 0;
+	return res;
+}
+
+
+
+
+
+void DurationStats::reset()
+{
+	m_Count = 0;
+	m_SumNsec = 0;
+	m_SumSqUsec = 0;
+	m_MinNsec = std::numeric_limits<int64_t>::max();
+	m_MaxNsec = std::numeric_limits<int64_t>::min();
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyStats:
+
+void LatencyStats::add(const LatencyTrace & a_Trace)
+{
+	if (!a_Trace.has(LatencyTrace::stArrival))
+	{
+		return;
+	}
+	for (int i = LatencyTrace::stArrival + 1; i < LatencyTrace::NUM_STAGES; ++i)
+	{
+		auto stage = static_cast<LatencyTrace::Stage>(i);
+		if (a_Trace.has(stage))
+		{
+			m_Stages[i].add(a_Trace.getSinceArrival(stage));
+		}
+	}
+}
+
+
+
+
+
+void LatencyStats::reset()
+{
+	for (auto & s: m_Stages)
+	{
+		s.reset();
+	}
+}
+
+
+
+
+
+std::string LatencyStats::format() const
+{
+	std::string res;
+	for (int i = LatencyTrace::stArrival + 1; i < LatencyTrace::NUM_STAGES; ++i)
+	{
+		auto stage = static_cast<LatencyTrace::Stage>(i);
+		auto summary = m_Stages[i].getSummary();
+		AppendPrintf(res, "arrival -> %-10s: %8llu samples, min %9.1f us, mean %9.1f us, max %9.1f us, stddev %9.1f us\n",
+			LatencyTrace::getStageName(stage),
+			static_cast<unsigned long long>(summary.m_Count),
+			summary.m_MinUsec, summary.m_MeanUsec, summary.m_MaxUsec, summary.m_StdDevUsec
+		);
+	}
+	return res;
+}
+
+
+
+
@@ -0,0 +1,148 @@
+// LatencyTrace.h
+
+// Declares the LatencyTrace struct representing the timestamps of a single report as it passes through the processing stages,
+// and the DurationStats and LatencyStats classes that aggregate the measured durations
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+
+
+
+
+
+/** The clock used for all the timestamps on the report path. Monotonic, high-resolution. */
+typedef std::chrono::steady_clock Clock;
+
+
+
+
+
+/** The timestamps of a single report, one for each stage of the processing it has passed through so far.
+Stamped by the transport upon arrival, then by each downstream stage. Trivially copyable. */
+struct LatencyTrace
+{
+	/** The stages of the processing, in the order in which the report passes them. */
+	enum Stage
+	{
+		stArrival = 0,  ///< The transport has received the report from the OS / simulation
+		stParsed,       ///< The Wiimote has parsed the report
+		stDispatched,   ///< The Wiimote has started calling the callbacks with the report
+		stWarped,       ///< The Processor has warped the IR coords into the screen coords
+		stInjected,     ///< The mouse input has been injected into the OS
+
+		stMax = stInjected,
+	};
+
+	static const int NUM_STAGES = stMax + 1;
+
+
+	/** The time at which the report has passed each stage; a default-constructed (zero) time_point means "not yet". */
+	Clock::time_point m_Times[NUM_STAGES];
+
+	/** The slot of the device that has sent the report, in StageHistograms; -1 if none. */
+	int m_Device;
+
+
+	LatencyTrace():
+		m_Device(-1)
+	{
+	}
+
+
+	/** Records the current time for the specified stage. */
+	void mark(Stage a_Stage) { m_Times[a_Stage] = Clock::now(); }
+
+	/** Returns true if the specified stage has been recorded. */
+	bool has(Stage a_Stage) const { return (m_Times[a_Stage] != Clock::time_point()); }
+
+	/** Returns the time from the arrival to the specified stage.
+	Both stages must have been recorded. */
+	Clock::duration getSinceArrival(Stage a_Stage) const { return m_Times[a_Stage] - m_Times[stArrival]; }
+
+	/** Returns the (short, English) name of the stage, for logging and reports. */
+	static const char * getStageName(Stage a_Stage);
+};
+
+
+
+
+
+/** Aggregates durations (count, min, max, mean, standard deviation).
+Thread-safe and lock-free; the values may be slightly inconsistent with each other while being updated concurrently. */
+class DurationStats
+{
+public:
+	/** A snapshot of the aggregated values. All the durations are in microseconds. */
+	struct Summary
+	{
+		uint64_t m_Count;
+		double m_MinUsec;
+		double m_MaxUsec;
+		double m_MeanUsec;
+		double m_StdDevUsec;
+	};
+
+
+	DurationStats();
+
+	/** Adds a single duration. */
+	void add(Clock::duration a_Duration);
+
+	/** Returns the snapshot of the aggregated values. All the values are zero if nothing has been added yet. */
+	Summary getSummary() const;
+
+	/** Removes all the aggregated values. */
+	void reset();
+
+protected:
+
+	std::atomic<uint64_t> m_Count;
+
+	/** The sum of all the durations, in nanoseconds. */
+	std::atomic<int64_t> m_SumNsec;
+
+	/** The sum of the squares of all the durations, in microseconds squared (to avoid overflow). */
+	std::atomic<double> m_SumSqUsec;
+
+	std::atomic<int64_t> m_MinNsec;
+	std::atomic<int64_t> m_MaxNsec;
+};
+
+
+
+
+
+/** Aggregates the LatencyTraces: for each stage, the duration from the report's arrival to that stage. */
+class LatencyStats
+{
+public:
+	/** Adds the durations of all the stages recorded in the trace. */
+	void add(const LatencyTrace & a_Trace);
+
+	/** Returns the summary of the durations from the arrival to the specified stage. */
+	DurationStats::Summary getSummary(LatencyTrace::Stage a_Stage) const { return m_Stages[a_Stage].getSummary(); }
+
+	/** Removes all the aggregated values. */
+	void reset();
+
+	/** Returns a multi-line human-readable report of all the stages, for logging. */
+	std::string format() const;
+
+protected:
+
+	/** The durations from the arrival to each stage. The stArrival item is unused. */
+	DurationStats m_Stages[LatencyTrace::NUM_STAGES];
+};
+
+
+
+
@@ -11,6 +11,48 @@
 #include "DlgCalibration.h"
 #include "Warper.h"
 #include "Processor.h"
+#include "PenFusion.h"
+#include "FusionSource.h"
+#include "InputInjector.h"
+#include "SendInputSink.h"
+#include "OneEuroFilter.h"
+#include "DeviceCache.h"
+#include "ReportLog.h"
+#include "FlightRecorder.h"
+#include "StageHistograms.h"
+
+
+
+
+
+/** The maximum number of Wiimotes that are being connected and initialized at the same time. */
+static const size_t MAX_PARALLEL_STARTS = 8;
+
+/** The command line option for capturing the raw reports into a file, followed by the file name. */
+static const char CAPTURE_OPTION[] = "--capture ";
+
+/** The ID of the global hotkey (Ctrl + Alt + D) that dumps the Wiimotes' flight recorders. */
+static const int HOTKEY_DUMP_FLIGHT_RECORDERS = 1;
+
+
+
+
+
+/** Returns the name of the file into which the raw reports are to be captured, as given on the command line,
+or an empty string if capturing was not requested. */
+static std::string getCaptureFileName(LPCSTR a_CmdLine)
+{
+	std::string cmdLine(a_CmdLine);
+	auto pos = cmdLine.find(CAPTURE_OPTION);
+	if (pos == std::string::npos)
+	{
+		return std::string();
+	}
+	auto fileName = cmdLine.substr(pos + sizeof(CAPTURE_OPTION) - 1);
+	fileName.erase(0, fileName.find_first_not_of(" \""));
+	fileName.erase(fileName.find_last_not_of(" \"") + 1);
+	return fileName;
+}
 
 
 
@@ -29,21 +71,31 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		return 1;
 	}
 
-	// Start each Wiimote:
+	// Start all the Wiimotes in parallel, using the settings remembered from the last run; each one's LEDs show its number:
 	LOG("Starting Wiimotes...");
-	int i = 1;
+	auto deviceCacheFileName = DeviceCache::getDefaultFileName();
+	DeviceCache deviceCache(deviceCacheFileName);
+	deviceCache.load();
+	ReportLog reportLog;  // Declared before the Wiimotes, so that it outlives them
+	auto dataFolder = deviceCacheFileName.substr(0, deviceCacheFileName.find_last_of("\\/") + 1);
+	auto results = mgr.startWiimotes(ids,
+		[&dataFolder](Wiimote & a_Wiimote, size_t a_Index)
+		{
+			a_Wiimote.getFlightRecorder().setDumpFolder(dataFolder);
+			auto i = a_Index + 1;
+			a_Wiimote.setLeds(((i & 0x01) != 0), ((i & 0x02) != 0), ((i & 0x04) != 0), ((i & 0x08) != 0));
+			return a_Wiimote.setReportType(Wiimote::irtIRAccel, true).get();
+		},
+		MAX_PARALLEL_STARTS,
+		&deviceCache
+	);
 	WiimotePtrs wiimotes;
-	for (const auto & id: ids)
+	for (const auto & r: results)
 	{
-		auto wiimote = std::make_shared<Wiimote>();
-		if (!wiimote->connect(id, nullptr))
+		if (r.m_Wiimote != nullptr)
 		{
-			continue;
+			wiimotes.push_back(r.m_Wiimote);
 		}
-		wiimote->setLeds(((i & 0x01) != 0), ((i & 0x02) != 0), ((i & 0x04) != 0), ((i & 0x08) != 0));
-		wiimote->setReportType(Wiimote::irtIRAccel, true);
-		wiimotes.push_back(wiimote);
-		i = i + 1;
 	}
 	LOG("%u wiimotes have been successfully connected", static_cast<unsigned>(wiimotes.size()));
 	if (wiimotes.empty())
@@ -62,21 +114,69 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		return 3;
 	}
 
+	// Capture the raw reports, if requested:
+	auto captureFileName = getCaptureFileName(lpCmdLine);
+	if (!captureFileName.empty() && reportLog.create(captureFileName))
+	{
+		LOG("Capturing the raw reports into \"%s\"", captureFileName.c_str());
+		for (const auto & w: wiimotes)
+		{
+			w->setReportLog(&reportLog);
+		}
+		reportLog.addCalibration(*calibration);
+	}
+
 	// Set up the warper and callbacks:
 	Warper warper;
 	warper.setCalibration(*calibration);
+	InputInjector injector(std::make_shared<SendInputSink>());
 	std::vector<ProcessorPtr> processors;
-	for (const auto w: warper.getWarpableWiimotes())
+	std::vector<std::shared_ptr<PenFusion>> fusions;
+	std::vector<FusionSourcePtr> fusionSources;
+	MotionPredictor::Config predictorConfig;
+	predictorConfig.m_Horizon = std::chrono::milliseconds(16);
+	for (const auto & group: warper.getOverlappingGroups())
 	{
-		processors.push_back(std::make_shared<Processor>(warper, wiimotes, w));
+		// A Wiimote alone on its screen area is processed on its own, several Wiimotes sharing one are fused:
+		if (group.size() == 1)
+		{
+			processors.push_back(std::make_shared<Processor>(
+				warper, injector, wiimotes, group[0], PenDebouncer::Config(), PointFilterPtr(new OneEuroFilter()), predictorConfig
+			));
+			continue;
+		}
+		LOG("Fusing %u Wiimotes calibrated for the same screen area", static_cast<unsigned>(group.size()));
+		PenFusion::Config fusionConfig;
+		fusionConfig.m_Mode = PenFusion::fmInterleave;
+		auto fusion = std::make_shared<PenFusion>(
+			warper, injector, PenDebouncer::Config(), PointFilterPtr(new OneEuroFilter()), predictorConfig, fusionConfig
+		);
+		for (const auto w: group)
+		{
+			fusionSources.push_back(std::make_shared<FusionSource>(warper, *fusion, wiimotes, w));
+		}
+		fusions.push_back(fusion);
 	}
 
 	// Lurk in the background and emulate mouse
 	LOG("Running...");
 	HWND mainWnd = CreateWindow(TEXT("STATIC"), TEXT("STATIC"), WS_POPUPWINDOW, 0, 0, 0, 0, nullptr, nullptr, hInstance, 0);
+	if (!RegisterHotKey(nullptr, HOTKEY_DUMP_FLIGHT_RECORDERS, MOD_CONTROL | MOD_ALT, 'D'))
+	{
+		LOG("Cannot register the Ctrl+Alt+D hotkey for dumping the flight recorders");
+	}
 	MSG msg;
 	while (GetMessage(&msg, 0, 0, 0))
 	{
+		if ((msg.message == WM_HOTKEY) && (msg.wParam == HOTKEY_DUMP_FLIGHT_RECORDERS))
+		{
+			for (const auto & w: wiimotes)
+			{
+				w->getFlightRecorder().dump("Requested by the user");
+			}
+			LOG("Processing stages' latency so far:\n%s", StageHistograms::get().format().c_str());
+			continue;
+		}
 		if (IsDialogMessage(mainWnd, &msg))
 		{
 			continue;
@@ -84,7 +184,108 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
 	}
+	UnregisterHotKey(nullptr, HOTKEY_DUMP_FLIGHT_RECORDERS);
 	DestroyWindow(mainWnd);
+
+	// Report the processors' counters, then destroy them, so that they unsubscribe from the Wiimotes (which outlive
+	// everything here) before the injector that they post into is stopped:
+	for (const auto & p: processors)
+	{
+		for (int pen = 0; pen < PenTracker::MAX_PENS; ++pen)
+		{
+			auto filter = p->getFilter(pen);
+			if ((filter == nullptr) || (filter->getLagStats().m_Count == 0))
+			{
+				continue;
+			}
+			auto lag = filter->getLagStats();
+			LOG("Pen %d filter %s: worst-case added latency %.1f ms, measured lag: %llu samples, mean %.1f ms, max %.1f ms",
+				pen, filter->getName(),
+				filter->getMaxAddedLatency().count() / 1000.0,
+				static_cast<unsigned long long>(lag.m_Count),
+				lag.m_MeanUsec / 1000, lag.m_MaxUsec / 1000
+			);
+		}
+		auto trackerStats = p->getTrackerStats();
+		LOG("Pen tracking: %llu tracks, %llu camera slot swaps followed, %llu dots ignored",
+			static_cast<unsigned long long>(trackerStats.m_NumTracksStarted),
+			static_cast<unsigned long long>(trackerStats.m_NumSlotSwaps),
+			static_cast<unsigned long long>(trackerStats.m_NumDotsIgnored)
+		);
+		auto predictionStats = p->getPredictionStats();
+		LOG("Motion prediction: %.1f ms ahead, %llu moves predicted, %llu clamped to the screen",
+			p->getPredictorConfig().m_Horizon.count() / 1000.0,
+			static_cast<unsigned long long>(predictionStats.m_NumPredicted),
+			static_cast<unsigned long long>(predictionStats.m_NumClamped)
+		);
+		auto debounceStats = p->getDebounceStats();
+		LOG("Pen debouncing: %llu glitches ignored, %llu dropouts bridged, %llu transitions suppressed",
+			static_cast<unsigned long long>(debounceStats.m_NumGlitchesIgnored),
+			static_cast<unsigned long long>(debounceStats.m_NumDropoutsBridged),
+			static_cast<unsigned long long>(debounceStats.m_NumSuppressedTransitions)
+		);
+	}
+	processors.clear();
+
+	// Likewise for the fusion sources, before their fusions and the injector:
+	fusionSources.clear();
+
+	// Report the measured latencies and the injector's counters:
+	injector.stop();
+	auto injectorStats = injector.getStats();
+	LOG("Pen-to-cursor latency:\n%s", injector.getLatencyStats().format().c_str());
+	LOG("Processing stages' latency:\n%s", StageHistograms::get().format().c_str());
+	for (const auto & f: fusions)
+	{
+		auto fusionStats = f->getStats();
+		auto debounceStats = f->getDebounceStats();
+		LOG("Pen fusion: %llu reports (%.1f per second), %llu out of order, %llu seeing a pen by several Wiimotes, %llu pens merged, %llu occlusions bridged, %llu pen transitions suppressed by debouncing",
+			static_cast<unsigned long long>(fusionStats.m_NumReports),
+			fusionStats.m_ReportsPerSec,
+			static_cast<unsigned long long>(fusionStats.m_NumOutOfOrder),
+			static_cast<unsigned long long>(fusionStats.m_NumFusedReports),
+			static_cast<unsigned long long>(fusionStats.m_NumMerges),
+			static_cast<unsigned long long>(fusionStats.m_NumOcclusionsBridged),
+			static_cast<unsigned long long>(debounceStats.m_NumSuppressedTransitions)
+		);
+		for (int i = 1; i < f->getNumSources(); ++i)
+		{
+			LOG("Pen fusion: Wiimote %d latency relative to the first one: %.1f ms", i, f->getSourceOffset(i).count() / 1000.0);
+		}
+	}
+	LOG("Mouse events: %llu posted, %llu processed, %llu moves dropped, %llu moves suppressed, button queue full %llu times, max batch %u",
+		static_cast<unsigned long long>(injectorStats.m_NumPosted),
+		static_cast<unsigned long long>(injectorStats.m_NumInjected),
+		static_cast<unsigned long long>(injectorStats.m_NumMovesDropped),
+		static_cast<unsigned long long>(injectorStats.m_NumMovesSuppressed),
+		static_cast<unsigned long long>(injectorStats.m_NumButtonQueueFull),
+		static_cast<unsigned>(injectorStats.m_MaxBatchSize)
+	);
+	LOG("SendInput: %llu calls, %llu calls saved (%.1f per second)",
+		static_cast<unsigned long long>(injectorStats.m_NumSyscalls),
+		static_cast<unsigned long long>(injectorStats.m_NumSyscallsSaved),
+		injectorStats.m_SyscallsSavedPerSec
+	);
+	if (reportLog.getNumRecords() > 0)
+	{
+		LOG("Report capture: %llu records, %llu bytes",
+			static_cast<unsigned long long>(reportLog.getNumRecords()),
+			static_cast<unsigned long long>(reportLog.getNumBytes())
+		);
+	}
+	for (size_t i = 0; i < wiimotes.size(); ++i)
+	{
+		auto recorderStats = wiimotes[i]->getFlightRecorder().getStats();
+		if (recorderStats.m_NumTriggers > 0)
+		{
+			LOG("Flight recorder of Wiimote %u: %llu anomalies, %llu dumps, the last one in \"%s\"",
+				static_cast<unsigned>(i + 1),
+				static_cast<unsigned long long>(recorderStats.m_NumTriggers),
+				static_cast<unsigned long long>(recorderStats.m_NumDumps),
+				recorderStats.m_LastDumpFileName.c_str()
+			);
+		}
+	}
 	return 0;
 }
 
@@ -0,0 +1,93 @@
+// MappedFile.h
+
+// Declares the MappedFile class representing a file memory-mapped into the process' address space
+
+
+
+
+
+#pragma once
+
+
+
+
+
+/** A file mapped into memory as a whole, either read-only, or read-write with the ability to grow.
+The implementation is platform-specific: MappedFileWin.cpp uses file mappings, MappedFileLinux.cpp uses mmap().
+Not thread-safe, the users serialize the access themselves. */
+class MappedFile
+{
+public:
+	/** The value for close() telling it to keep the file's size as it is. */
+	static const size_t KEEP_SIZE = static_cast<size_t>(-1);
+
+
+	MappedFile();
+
+	/** Closes the file, if open, keeping its size. */
+	~MappedFile();
+
+	/** Creates (or overwrites) the specified file with the specified size and maps it read-write.
+	Returns true on success, false on failure (logged). */
+	bool create(const std::string & a_FileName, size_t a_Size);
+
+	/** Maps the whole of an existing file read-only.
+	Returns true on success, false on failure (logged). */
+	bool open(const std::string & a_FileName);
+
+	/** Grows (or shrinks) a file opened by create() to the specified size and maps it again.
+	The data pointer changes, the contents up to the smaller of the two sizes are kept.
+	Returns true on success; on failure (logged) the file is closed. */
+	bool resize(size_t a_Size);
+
+	/** Unmaps and closes the file. A file opened by create() is truncated to a_FinalSize, unless it is KEEP_SIZE. */
+	void close(size_t a_FinalSize = KEEP_SIZE);
+
+	/** Returns true if the file is open. */
+	bool isOpen() const { return (m_Data != nullptr); }
+
+	/** Returns the mapped contents of the file, nullptr if not open. */
+	unsigned char * getData() { return m_Data; }
+	const unsigned char * getData() const { return m_Data; }
+
+	/** Returns the size of the mapped contents. */
+	size_t getSize() const { return m_Size; }
+
+
+protected:
+
+	#ifdef _WIN32
+		/** The OS handle of the open file. */
+		HANDLE m_File;
+
+		/** The OS handle of the file's mapping. */
+		HANDLE m_Mapping;
+	#else
+		/** The descriptor of the open file, -1 if not open. */
+		int m_FD;
+	#endif
+
+	/** The mapped contents, nullptr if not open. */
+	unsigned char * m_Data;
+
+	/** The size of the mapped contents. */
+	size_t m_Size;
+
+	/** Set if the file has been opened by create(). */
+	bool m_IsWritable;
+
+	/** The name of the file, for the logs. */
+	std::string m_FileName;
+
+
+	/** Maps m_Size bytes of the open file into m_Data.
+	Returns true on success, false on failure (logged). */
+	bool map();
+
+	/** Unmaps m_Data, keeping the file open. */
+	void unmap();
+};
+
+
+
+
@@ -0,0 +1,163 @@
+// MappedFileLinux.cpp
+
+// Implements the MappedFile class on top of the POSIX mmap()
+
+
+
+
+
+#include "Globals.h"
+#include "MappedFile.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+
+
+MappedFile::MappedFile():
+	m_FD(-1),
+	m_Data(nullptr),
+	m_Size(0),
+	m_IsWritable(false)
+{
+}
+
+
+
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+
+
+
+
+bool MappedFile::create(const std::string & a_FileName, size_t a_Size)
+{
+	assert(!isOpen());
+	m_FileName = a_FileName;
+	m_FD = ::open(a_FileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_FD < 0)
+	{
+		LOG("Cannot create file \"%s\": %s", a_FileName.c_str(), strerror(errno));
+		return false;
+	}
+	m_IsWritable = true;
+	if (ftruncate(m_FD, static_cast<off_t>(a_Size)) != 0)
+	{
+		LOG("Cannot set the size of file \"%s\": %s", a_FileName.c_str(), strerror(errno));
+		close();
+		return false;
+	}
+	m_Size = a_Size;
+	return map();
+}
+
+
+
+
+
+bool MappedFile::open(const std::string & a_FileName)
+{
+	assert(!isOpen());
+	m_FileName = a_FileName;
+	m_FD = ::open(a_FileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_FD < 0)
+	{
+		LOG("Cannot open file \"%s\": %s", a_FileName.c_str(), strerror(errno));
+		return false;
+	}
+	m_IsWritable = false;
+	struct stat st;
+	if ((fstat(m_FD, &st) != 0) || (st.st_size == 0))
+	{
+		LOG("Cannot map file \"%s\", it is empty or inaccessible", a_FileName.c_str());
+		close();
+		return false;
+	}
+	m_Size = static_cast<size_t>(st.st_size);
+	return map();
+}
+
+
+
+
+
+bool MappedFile::resize(size_t a_Size)
+{
+	assert(isOpen() && m_IsWritable);
+	unmap();
+	if (ftruncate(m_FD, static_cast<off_t>(a_Size)) != 0)
+	{
+		LOG("Cannot resize file \"%s\": %s", m_FileName.c_str(), strerror(errno));
+		close();
+		return false;
+	}
+	m_Size = a_Size;
+	return map();
+}
+
+
+
+
+
+void MappedFile::close(size_t a_FinalSize)
+{
+	unmap();
+	if (m_FD < 0)
+	{
+		return;
+	}
+	if (m_IsWritable && (a_FinalSize != KEEP_SIZE))
+	{
+		if (ftruncate(m_FD, static_cast<off_t>(a_FinalSize)) != 0)
+		{
+			LOG("Cannot truncate file \"%s\": %s", m_FileName.c_str(), strerror(errno));
+		}
+	}
+	::close(m_FD);
+	m_FD = -1;
+	m_Size = 0;
+}
+
+
+
+
+
+bool MappedFile::map()
+{
+	auto prot = m_IsWritable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	auto data = mmap(nullptr, m_Size, prot, MAP_SHARED, m_FD, 0);
+	if (data == MAP_FAILED)
+	{
+		LOG("Cannot map file \"%s\": %s", m_FileName.c_str(), strerror(errno));
+		close();
+		return false;
+	}
+	m_Data = static_cast<unsigned char *>(data);
+	return true;
+}
+
+
+
+
+
+void MappedFile::unmap()
+{
+	if (m_Data != nullptr)
+	{
+		munmap(m_Data, m_Size);
+		m_Data = nullptr;
+	}
+}
+
+
+
+
@@ -0,0 +1,171 @@
+// MappedFileWin.cpp
+
+// Implements the MappedFile class on top of the Win32 file mappings
+
+
+
+
+
+#include "Globals.h"
+#include "MappedFile.h"
+
+
+
+
+
+MappedFile::MappedFile():
+	m_File(INVALID_HANDLE_VALUE),
+	m_Mapping(nullptr),
+	m_Data(nullptr),
+	m_Size(0),
+	m_IsWritable(false)
+{
+}
+
+
+
+
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+
+
+
+
+bool MappedFile::create(const std::string & a_FileName, size_t a_Size)
+{
+	assert(!isOpen());
+	m_FileName = a_FileName;
+	m_File = CreateFileA(a_FileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		LOG("Cannot create file \"%s\": error %u", a_FileName.c_str(), static_cast<unsigned>(GetLastError()));
+		return false;
+	}
+	m_IsWritable = true;
+	m_Size = a_Size;
+	return map();
+}
+
+
+
+
+
+bool MappedFile::open(const std::string & a_FileName)
+{
+	assert(!isOpen());
+	m_FileName = a_FileName;
+	m_File = CreateFileA(a_FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		LOG("Cannot open file \"%s\": error %u", a_FileName.c_str(), static_cast<unsigned>(GetLastError()));
+		return false;
+	}
+	m_IsWritable = false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_File, &size) || (size.QuadPart == 0))
+	{
+		LOG("Cannot map file \"%s\", it is empty or inaccessible", a_FileName.c_str());
+		close();
+		return false;
+	}
+	m_Size = static_cast<size_t>(size.QuadPart);
+	return map();
+}
+
+
+
+
+
+bool MappedFile::resize(size_t a_Size)
+{
+	// Mapping a writable file with a bigger size grows the file:
+	assert(isOpen() && m_IsWritable);
+	unmap();
+	if (a_Size < m_Size)
+	{
+		LARGE_INTEGER pos;
+		pos.QuadPart = static_cast<LONGLONG>(a_Size);
+		SetFilePointerEx(m_File, pos, nullptr, FILE_BEGIN);
+		SetEndOfFile(m_File);
+	}
+	m_Size = a_Size;
+	return map();
+}
+
+
+
+
+
+void MappedFile::close(size_t a_FinalSize)
+{
+	unmap();
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	if (m_IsWritable && (a_FinalSize != KEEP_SIZE))
+	{
+		LARGE_INTEGER pos;
+		pos.QuadPart = static_cast<LONGLONG>(a_FinalSize);
+		if (!SetFilePointerEx(m_File, pos, nullptr, FILE_BEGIN) || !SetEndOfFile(m_File))
+		{
+			LOG("Cannot truncate file \"%s\": error %u", m_FileName.c_str(), static_cast<unsigned>(GetLastError()));
+		}
+	}
+	CloseHandle(m_File);
+	m_File = INVALID_HANDLE_VALUE;
+	m_Size = 0;
+}
+
+
+
+
+
+bool MappedFile::map()
+{
+	auto size = static_cast<uint64_t>(m_Size);
+	m_Mapping = CreateFileMappingA(
+		m_File, nullptr, m_IsWritable ? PAGE_READWRITE : PAGE_READONLY,
+		static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xffffffff), nullptr
+	);
+	if (m_Mapping == nullptr)
+	{
+		LOG("Cannot map file \"%s\": error %u", m_FileName.c_str(), static_cast<unsigned>(GetLastError()));
+		close();
+		return false;
+	}
+	m_Data = static_cast<unsigned char *>(MapViewOfFile(m_Mapping, m_IsWritable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, m_Size));
+	if (m_Data == nullptr)
+	{
+		LOG("Cannot map a view of file \"%s\": error %u", m_FileName.c_str(), static_cast<unsigned>(GetLastError()));
+		close();
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+void MappedFile::unmap()
+{
+	if (m_Data != nullptr)
+	{
+		UnmapViewOfFile(m_Data);
+		m_Data = nullptr;
+	}
+	if (m_Mapping != nullptr)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = nullptr;
+	}
+}
+
+
+
+
@@ -0,0 +1,119 @@
+// MotionPredictor.cpp
+
+// Implements the MotionPredictor class representing the extrapolation of a pen's position forward in time
+
+
+
+
+
+#include "Globals.h"
+#include "MotionPredictor.h"
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MotionPredictor::Config:
+
+MotionPredictor::Config::Config():
+	m_Horizon(0),
+	m_Window(50000)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MotionPredictor:
+
+MotionPredictor::MotionPredictor(const Config & a_Config):
+	m_Config(a_Config),
+	m_Next(0),
+	m_NumSamples(0)
+{
+}
+
+
+
+
+
+void MotionPredictor::addSample(double a_X, double a_Y, Clock::time_point a_Time)
+{
+	auto & sample = m_Samples[m_Next];
+	sample.m_X = a_X;
+	sample.m_Y = a_Y;
+	sample.m_Time = a_Time;
+	m_Next = (m_Next + 1) % MAX_SAMPLES;
+	m_NumSamples = std::min(m_NumSamples + 1, static_cast<int>(MAX_SAMPLES));
+}
+
+
+
+
+
+bool MotionPredictor::predict(double & a_X, double & a_Y) const
+{
+	if (m_NumSamples == 0)
+	{
+		return false;
+	}
+	const auto & latest = getSample(0);
+	a_X = latest.m_X;
+	a_Y = latest.m_Y;
+	double vx, vy;
+	if (isEnabled() && estimateVelocity(vx, vy))
+	{
+		auto horizon = std::chrono::duration<double>(m_Config.m_Horizon).count();
+		a_X += vx * horizon;
+		a_Y += vy * horizon;
+	}
+	return true;
+}
+
+
+
+
+
+bool MotionPredictor::estimateVelocity(double & a_VX, double & a_VY) const
+{
+	// Least-squares fit of x(t) and y(t) by a line, over the samples within the window;
+	// the times are relative to the latest sample, for precision:
+	const auto & latest = getSample(0);
+	double sumT = 0, sumTT = 0, sumX = 0, sumTX = 0, sumY = 0, sumTY = 0;
+	int n = 0;
+	for (int age = 0; age < m_NumSamples; ++age)
+	{
+		const auto & s = getSample(age);
+		if (latest.m_Time - s.m_Time > m_Config.m_Window)
+		{
+			break;
+		}
+		auto t = std::chrono::duration<double>(s.m_Time - latest.m_Time).count();
+		sumT += t;
+		sumTT += t * t;
+		sumX += s.m_X;
+		sumTX += t * s.m_X;
+		sumY += s.m_Y;
+		sumTY += t * s.m_Y;
+		n += 1;
+	}
+	if (n < 2)
+	{
+		return false;
+	}
+	auto denom = n * sumTT - sumT * sumT;
+	if (denom <= 1e-12)
+	{
+		return false;
+	}
+	a_VX = (n * sumTX - sumT * sumX) / denom;
+	a_VY = (n * sumTY - sumT * sumY) / denom;
+	return true;
+}
+
+
+
+
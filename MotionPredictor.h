@@ -0,0 +1,100 @@
+// MotionPredictor.h
+
+// Declares the MotionPredictor class representing the extrapolation of a pen's position forward in time
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "LatencyTrace.h"
+
+
+
+
+
+/** Extrapolates a single pen's position forward by a configurable horizon, to hide the latency between the pen
+and the cursor (Bluetooth, processing, injection, the app's repaint).
+The velocity is estimated by a least-squares line fit over the recent samples (by their arrival times),
+which averages out the jitter; the prediction is the latest sample moved by the velocity times the horizon.
+The prediction overshoots when the pen stops or turns, more so with longer horizons; Bench/PredictionReplay
+measures the accuracy and overshoot on recorded traces.
+Allocation-free. Used from a single thread. */
+class MotionPredictor
+{
+public:
+	struct Config
+	{
+		/** How far ahead to predict. Zero disables the prediction. */
+		std::chrono::microseconds m_Horizon;
+
+		/** The samples older than this (relative to the latest one) are not used for the velocity estimate. */
+		std::chrono::microseconds m_Window;
+
+		/** The defaults: prediction disabled, 50 ms window (5 samples at 100 Hz). */
+		Config();
+	};
+
+
+	/** The maximum number of samples used for the velocity estimate, regardless of the window. */
+	static const int MAX_SAMPLES = 8;
+
+
+	explicit MotionPredictor(const Config & a_Config = Config());
+
+	/** Adds a sample of the pen's position, sampled at a_Time. The samples must come in time order. */
+	void addSample(double a_X, double a_Y, Clock::time_point a_Time);
+
+	/** Returns the predicted position, a_Horizon ahead of the latest sample, in a_X, a_Y.
+	If there's not enough samples for a velocity estimate yet, returns the latest sample's position.
+	Returns false (and doesn't touch a_X, a_Y) if there are no samples at all. */
+	bool predict(double & a_X, double & a_Y) const;
+
+	/** Estimates the pen's velocity from the samples within the window, in units per second.
+	Returns false if there's not enough samples (less than two, or all at the same time). */
+	bool estimateVelocity(double & a_VX, double & a_VY) const;
+
+	/** Forgets all the samples. To be called when the pen goes up. */
+	void reset() { m_NumSamples = 0; }
+
+	/** Returns true if the prediction is enabled (non-zero horizon). */
+	bool isEnabled() const { return (m_Config.m_Horizon.count() > 0); }
+
+	const Config & getConfig() const { return m_Config; }
+
+	void setConfig(const Config & a_Config) { m_Config = a_Config; }
+
+protected:
+
+	/** A single sample of the pen's position. */
+	struct Sample
+	{
+		double m_X, m_Y;
+		Clock::time_point m_Time;
+	};
+
+
+	Config m_Config;
+
+	/** The recent samples, used circularly; the latest one is at (m_Next + MAX_SAMPLES - 1) % MAX_SAMPLES. */
+	Sample m_Samples[MAX_SAMPLES];
+
+	/** The index into m_Samples where the next sample will go. */
+	int m_Next;
+
+	/** The number of valid samples in m_Samples. */
+	int m_NumSamples;
+
+
+	/** Returns the sample a_Age samples back from the latest one (0 = the latest). */
+	const Sample & getSample(int a_Age) const { return m_Samples[(m_Next + 2 * MAX_SAMPLES - 1 - a_Age) % MAX_SAMPLES]; }
+};
+
+
+
+
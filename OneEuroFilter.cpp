@@ -0,0 +1,103 @@
+// OneEuroFilter.cpp
+
+// Implements the OneEuroFilter class representing the One-Euro (speed-adaptive low-pass) filter of a pen's position
+
+
+
+
+
+#include "Globals.h"
+#include "OneEuroFilter.h"
+
+
+
+
+
+static const double PI = 3.14159265358979323846;
+
+
+
+
+
+/** Returns the smoothing factor of a first-order low-pass filter with the specified cutoff frequency, for the specified sampling interval. */
+static double smoothingFactor(double a_Cutoff, double a_Dt)
+{
+	auto tau = 1 / (2 * PI * a_Cutoff);
+	return 1 / (1 + tau / a_Dt);
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// OneEuroFilter::Params:
+
+OneEuroFilter::Params::Params():
+	m_MinCutoff(3),
+	m_Beta(0.02),
+	m_DerivativeCutoff(1)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// OneEuroFilter:
+
+OneEuroFilter::OneEuroFilter(const Params & a_Params):
+	m_Params(a_Params),
+	m_HasPrev(false),
+	m_PrevX(0),
+	m_PrevY(0),
+	m_PrevDX(0),
+	m_PrevDY(0)
+{
+}
+
+
+
+
+
+std::chrono::microseconds OneEuroFilter::getMaxAddedLatency() const
+{
+	// The discrete filter with the smoothing factor from smoothingFactor() lags by exactly tau, independent of the interval:
+	auto tau = 1 / (2 * PI * m_Params.m_MinCutoff);
+	return std::chrono::microseconds(static_cast<int64_t>(tau * 1e6));
+}
+
+
+
+
+
+void OneEuroFilter::filter(double & a_X, double & a_Y, double a_Dt)
+{
+	if (!m_HasPrev || (a_Dt <= 0))
+	{
+		m_HasPrev = true;
+		m_PrevX = a_X;
+		m_PrevY = a_Y;
+		m_PrevDX = 0;
+		m_PrevDY = 0;
+		return;
+	}
+
+	// Smooth the derivative:
+	auto derivAlpha = smoothingFactor(m_Params.m_DerivativeCutoff, a_Dt);
+	m_PrevDX += derivAlpha * ((a_X - m_PrevX) / a_Dt - m_PrevDX);
+	m_PrevDY += derivAlpha * ((a_Y - m_PrevY) / a_Dt - m_PrevDY);
+
+	// Smooth the position, with the cutoff adapted to the speed:
+	auto speed = std::hypot(m_PrevDX, m_PrevDY);
+	auto alpha = smoothingFactor(m_Params.m_MinCutoff + m_Params.m_Beta * speed, a_Dt);
+	m_PrevX += alpha * (a_X - m_PrevX);
+	m_PrevY += alpha * (a_Y - m_PrevY);
+	a_X = m_PrevX;
+	a_Y = m_PrevY;
+}
+
+
+
+
@@ -0,0 +1,76 @@
+// OneEuroFilter.h
+
+// Declares the OneEuroFilter class representing the One-Euro (speed-adaptive low-pass) filter of a pen's position
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "PointFilter.h"
+
+
+
+
+
+/** The One-Euro filter (Casiez, Roussel, Vogel, 2012): a first-order low-pass filter whose cutoff frequency rises
+with the pen's speed. A slow or resting pen gets heavily smoothed (no jitter), a fast pen gets little smoothing
+(little lag). The speed is taken from the low-passed derivative, common for both axes, so that the stroke keeps its shape.
+The worst-case added latency is the time constant at the minimum cutoff, reached when the pen moves slowly. */
+class OneEuroFilter:
+	public PointFilter
+{
+public:
+	struct Params
+	{
+		/** The cutoff frequency for a resting pen, in Hz. Lower means less jitter, but more lag for slow motion. */
+		double m_MinCutoff;
+
+		/** How much the cutoff frequency rises with the speed, in Hz per (IR camera pixel per second). */
+		double m_Beta;
+
+		/** The cutoff frequency for the low-pass filter of the speed, in Hz. */
+		double m_DerivativeCutoff;
+
+		/** The defaults: 3 Hz (53 ms worst-case latency), 0.02, 1 Hz; tuned for the Wiimote camera's jitter at 100 Hz. */
+		Params();
+	};
+
+
+	explicit OneEuroFilter(const Params & a_Params = Params());
+
+	/** Replaces the parameters. Takes effect from the next sample on. */
+	void setParams(const Params & a_Params) { m_Params = a_Params; }
+
+	// PointFilter overrides:
+	virtual std::chrono::microseconds getMaxAddedLatency() const override;
+	virtual const char * getName() const override { return "One-Euro"; }
+	virtual PointFilterPtr clone() const override { return PointFilterPtr(new OneEuroFilter(m_Params)); }
+
+protected:
+
+	Params m_Params;
+
+	/** If true, the following values are valid. */
+	bool m_HasPrev;
+
+	/** The previous filtered position. */
+	double m_PrevX, m_PrevY;
+
+	/** The previous filtered derivative (velocity), in IR camera pixels per second. */
+	double m_PrevDX, m_PrevDY;
+
+
+	// PointFilter overrides:
+	virtual void filter(double & a_X, double & a_Y, double a_Dt) override;
+	virtual void resetFilter() override { m_HasPrev = false; }
+};
+
+
+
+
@@ -0,0 +1,178 @@
+// OutputQueue.cpp
+
+// Implements the OutputQueue class representing the asynchronous, paced queue of output reports for a single device
+
+
+
+
+
+#include "Globals.h"
+#include "OutputQueue.h"
+
+
+
+
+
+OutputQueue::OutputQueue(Writer a_Writer, std::chrono::microseconds a_Interval):
+	m_Writer(std::move(a_Writer)),
+	m_IntervalUsec(a_Interval.count()),
+	m_ShouldTerminate(false),
+	m_NumCoalesced(0)
+{
+	m_Thread = std::thread(&OutputQueue::thrWrite, this);
+}
+
+
+
+
+
+OutputQueue::~OutputQueue()
+{
+	stop();
+}
+
+
+
+
+
+std::future<bool> OutputQueue::push(const void * a_Report, size_t a_Size, int a_CoalesceKey)
+{
+	auto report = reinterpret_cast<const unsigned char *>(a_Report);
+	Item item;
+	item.m_Data.assign(report, report + a_Size);
+	item.m_CoalesceKey = a_CoalesceKey;
+	item.m_QueuedTime = Clock::now();
+	item.m_Promises.resize(1);
+	auto res = item.m_Promises.back().get_future();
+
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (m_ShouldTerminate)
+	{
+		item.m_Promises.back().set_value(false);
+		return res;
+	}
+
+	// Drop the superseded report, taking over its promises and queue time:
+	if (a_CoalesceKey != 0)
+	{
+		for (auto itr = m_Items.begin(), end = m_Items.end(); itr != end; ++itr)
+		{
+			if (itr->m_CoalesceKey != a_CoalesceKey)
+			{
+				continue;
+			}
+			for (auto & p: itr->m_Promises)
+			{
+				item.m_Promises.push_back(std::move(p));
+			}
+			item.m_QueuedTime = itr->m_QueuedTime;
+			m_Items.erase(itr);
+			++m_NumCoalesced;
+			break;  // There's at most one queued report per key
+		}
+	}
+
+	// The report goes to the back of the queue even if it superseded another, so that it stays ordered after everything queued before it:
+	m_Items.push_back(std::move(item));
+	m_CV.notify_all();
+	return res;
+}
+
+
+
+
+
+void OutputQueue::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_ShouldTerminate = true;
+		m_CV.notify_all();
+	}
+	if (m_Thread.joinable())
+	{
+		m_Thread.join();
+	}
+
+	// Fail all the reports that didn't make it:
+	std::list<Item> items;
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		std::swap(items, m_Items);
+	}
+	for (auto & item: items)
+	{
+		for (auto & p: item.m_Promises)
+		{
+			p.set_value(false);
+		}
+	}
+}
+
+
+
+
+
+void OutputQueue::setInterval(std::chrono::microseconds a_Interval)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_IntervalUsec = a_Interval.count();
+	m_CV.notify_all();
+}
+
+
+
+
+
+void OutputQueue::thrWrite()
+{
+	Clock::time_point lastWriteTime;  // Zero = no write yet
+	std::unique_lock<std::mutex> lock(m_CS);
+	for (;;)
+	{
+		// Wait for a report:
+		m_CV.wait(lock, [this]() { return m_ShouldTerminate || !m_Items.empty(); });
+		if (m_ShouldTerminate)
+		{
+			return;
+		}
+
+		// Wait for the pacing interval to pass since the last write (the interval may change while waiting):
+		if (lastWriteTime != Clock::time_point())
+		{
+			auto nextWriteTime = lastWriteTime + std::chrono::microseconds(m_IntervalUsec.load());
+			while (!m_ShouldTerminate && (Clock::now() < nextWriteTime))
+			{
+				m_CV.wait_until(lock, nextWriteTime);
+				nextWriteTime = lastWriteTime + std::chrono::microseconds(m_IntervalUsec.load());
+			}
+			if (m_ShouldTerminate)
+			{
+				return;
+			}
+		}
+
+		// Write the oldest report, without holding the lock:
+		assert(!m_Items.empty());  // Only this thread removes items while running
+		auto item = std::move(m_Items.front());
+		m_Items.pop_front();
+		lock.unlock();
+		auto now = Clock::now();
+		if (lastWriteTime != Clock::time_point())
+		{
+			m_WriteIntervals.add(now - lastWriteTime);
+		}
+		m_QueueDelays.add(now - item.m_QueuedTime);
+		lastWriteTime = now;
+		auto isSuccess = m_Writer(item.m_Data.data(), item.m_Data.size());
+		for (auto & p: item.m_Promises)
+		{
+			p.set_value(isSuccess);
+		}
+		lock.lock();
+	}
+}
+
+
+
+
@@ -0,0 +1,125 @@
+// OutputQueue.h
+
+// Declares the OutputQueue class representing the asynchronous, paced queue of output reports for a single device
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include "LatencyTrace.h"
+
+
+
+
+
+/** Sends the output reports to a single device from its own thread, keeping at least the specified interval
+between two consecutive writes (the Wiimotes drop the reports that come too fast over some BT stacks).
+The callers never wait; each queued report has a future that is resolved with the write's result.
+A report may supersede the earlier queued report with the same (non-zero) coalescing key, such as two LED updates
+in a row; the superseded report is not sent at all and its future resolves with the result of the superseding one. */
+class OutputQueue
+{
+public:
+	/** The function that writes a single report to the device. Returns true on success.
+	Called from the queue's thread only. */
+	typedef std::function<bool (const unsigned char * a_Report, size_t a_Size)> Writer;
+
+
+	/** Creates the queue and starts its thread, writing through a_Writer with at least a_Interval between the writes. */
+	OutputQueue(Writer a_Writer, std::chrono::microseconds a_Interval);
+
+	/** Stops the queue, see stop(). */
+	~OutputQueue();
+
+	/** Queues the report for writing.
+	If a_CoalesceKey is non-zero, any report with the same key that is still queued is dropped in favor of this one.
+	Returns the future that is resolved once the report is written (true) or fails / is discarded (false). */
+	std::future<bool> push(const void * a_Report, size_t a_Size, int a_CoalesceKey = 0);
+
+	/** Stops the thread. The reports still queued are discarded, their futures resolve to false.
+	Safe to call multiple times. */
+	void stop();
+
+	/** Sets the minimum interval between two consecutive writes. Takes effect from the next write on. */
+	void setInterval(std::chrono::microseconds a_Interval);
+
+	/** Returns the minimum interval between two consecutive writes. */
+	std::chrono::microseconds getInterval() const { return std::chrono::microseconds(m_IntervalUsec.load()); }
+
+	/** Returns the statistics of the actual intervals between the consecutive writes. */
+	DurationStats::Summary getWriteIntervalStats() const { return m_WriteIntervals.getSummary(); }
+
+	/** Returns the statistics of the time the reports spent in the queue, from push() to the start of their write. */
+	DurationStats::Summary getQueueDelayStats() const { return m_QueueDelays.getSummary(); }
+
+	/** Returns the number of reports that have been dropped because a newer one superseded them. */
+	uint64_t getNumCoalesced() const { return m_NumCoalesced.load(); }
+
+protected:
+
+	/** A single queued report. */
+	struct Item
+	{
+		std::vector<unsigned char> m_Data;
+
+		/** The coalescing key, 0 if the report never gets coalesced. */
+		int m_CoalesceKey;
+
+		/** The time when the report was queued (the first one, if it superseded others). */
+		Clock::time_point m_QueuedTime;
+
+		/** The promises to resolve once the report is written; more than one if the report superseded others. */
+		std::vector<std::promise<bool>> m_Promises;
+	};
+
+
+	/** The function doing the actual writes. */
+	Writer m_Writer;
+
+	/** The minimum interval between two consecutive writes, in microseconds. */
+	std::atomic<int64_t> m_IntervalUsec;
+
+	/** Protects m_Items and m_ShouldTerminate against multithreaded access. */
+	std::mutex m_CS;
+
+	/** Notified when a report is queued, the interval changes, or the thread should terminate. */
+	std::condition_variable m_CV;
+
+	/** The queued reports, in the order in which they will be written. Protected by m_CS. */
+	std::list<Item> m_Items;
+
+	/** Flag indicating that the thread should terminate as soon as possible. Protected by m_CS. */
+	bool m_ShouldTerminate;
+
+	/** The thread doing the writes. */
+	std::thread m_Thread;
+
+	/** The actual intervals between the consecutive writes. */
+	DurationStats m_WriteIntervals;
+
+	/** The time the reports spent in the queue. */
+	DurationStats m_QueueDelays;
+
+	/** The number of reports dropped because a newer one superseded them. */
+	std::atomic<uint64_t> m_NumCoalesced;
+
+
+	/** Writes the queued reports, pacing them.
+	Executed in m_Thread. */
+	void thrWrite();
+};
+
+
+
+
@@ -0,0 +1,63 @@
+// OutputSink.h
+
+// Declares the MouseEvent struct representing a single synthesized pointer event, and the OutputSink interface
+// representing the destination of those events (the OS input, or a capture)
+
+
+
+
+
+#pragma once
+
+
+
+
+
+/** A single synthesized pointer event. */
+struct MouseEvent
+{
+	enum Type
+	{
+		metMove,
+		metLeftDown,
+		metLeftUp,
+	};
+
+	/** The maximum number of pens that the sinks track separately. */
+	static const int MAX_PENS = 4;
+
+	Type m_Type;
+
+	/** The absolute position of the event, normalized to 0 .. 65535 over the primary screen.
+	Button events move the pointer to their position as well. */
+	int m_X, m_Y;
+
+	/** The pen that generated the event, 0 .. MAX_PENS - 1. A sink with a single pointer (SendInput) ignores it,
+	a multitouch sink maps each pen to its own contact. */
+	int m_PenId;
+};
+
+
+
+
+
+/** The destination of the synthesized pointer events: the OS input on each platform (SendInputSink, UinputSink),
+or a recorder for tests and benchmarks (CaptureSink).
+The events are given in batches; a sink emits each batch with as few OS calls as possible.
+InputInjector calls send() from its single thread. */
+class OutputSink
+{
+public:
+	virtual ~OutputSink() {}
+
+	/** Emits the specified events, in order.
+	Returns the number of OS calls made; zero if none of the events reached the OS (all dropped, or a sink that
+	doesn't emit into the OS). */
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) = 0;
+};
+
+typedef std::shared_ptr<OutputSink> OutputSinkPtr;
+
+
+
+
@@ -0,0 +1,134 @@
+// OverflowList.h
+
+// Declares the OverflowList class template representing an unbounded single-producer / single-consumer FIFO list
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+
+
+
+
+
+/** An unbounded FIFO list with a single producer thread and a single consumer thread, neither of which ever waits
+for the other (Dmitry Vyukov's unbounded SPSC queue). Meant as the spill-over for a bounded queue that must not
+lose items: the producer only appends, the consumer only takes from the front.
+The nodes taken by the consumer are reused by the producer, so the list only allocates when it grows beyond
+its previous largest size. */
+template <typename T>
+class OverflowList
+{
+public:
+	OverflowList()
+	{
+		auto dummy = new Node;
+		dummy->m_Next.store(nullptr, std::memory_order_relaxed);
+		m_Head.store(dummy, std::memory_order_relaxed);
+		m_Tail = dummy;
+		m_First = dummy;
+		m_HeadCopy = dummy;
+	}
+
+
+	~OverflowList()
+	{
+		auto node = m_First;
+		while (node != nullptr)
+		{
+			auto next = node->m_Next.load(std::memory_order_relaxed);
+			delete node;
+			node = next;
+		}
+	}
+
+
+	/** Appends the item to the back of the list. Producer only. */
+	void push(const T & a_Item)
+	{
+		auto node = allocNode();
+		node->m_Item = a_Item;
+		node->m_Next.store(nullptr, std::memory_order_relaxed);
+		m_Tail->m_Next.store(node, std::memory_order_release);
+		m_Tail = node;
+	}
+
+
+	/** Returns true if the consumer has taken all the items pushed so far. Producer only. */
+	bool isDrained() const
+	{
+		return (m_Head.load(std::memory_order_acquire) == m_Tail);
+	}
+
+
+	/** Returns the item at the front of the list, nullptr if the list is empty.
+	The item stays valid until pop() is called. Consumer only. */
+	const T * front() const
+	{
+		auto next = m_Head.load(std::memory_order_relaxed)->m_Next.load(std::memory_order_acquire);
+		return (next == nullptr) ? nullptr : &next->m_Item;
+	}
+
+
+	/** Removes the item at the front of the list. The list must not be empty (front() returned non-null). Consumer only. */
+	void pop()
+	{
+		auto head = m_Head.load(std::memory_order_relaxed);
+		m_Head.store(head->m_Next.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+
+
+protected:
+
+	/** A single node of the list. */
+	struct Node
+	{
+		std::atomic<Node *> m_Next;
+		T m_Item;
+	};
+
+
+	/** The node before the front item (the front item itself has already been taken). Written only by the consumer. */
+	std::atomic<Node *> m_Head;
+
+	/** Padding between m_Head and the producer's members, so that the two threads don't share a cache line. */
+	char m_Padding[64];
+
+	/** The last node of the list. Producer only. */
+	Node * m_Tail;
+
+	/** The oldest node, the nodes from here up to m_HeadCopy have been taken by the consumer and can be reused.
+	Producer only. */
+	Node * m_First;
+
+	/** The value of m_Head when the producer last looked, so that it needn't read m_Head for every reused node. */
+	Node * m_HeadCopy;
+
+
+	/** Returns a node for a new item, reusing the ones already taken by the consumer if possible. Producer only. */
+	Node * allocNode()
+	{
+		if (m_First == m_HeadCopy)
+		{
+			m_HeadCopy = m_Head.load(std::memory_order_acquire);
+		}
+		if (m_First != m_HeadCopy)
+		{
+			auto node = m_First;
+			m_First = m_First->m_Next.load(std::memory_order_relaxed);
+			return node;
+		}
+		return new Node;
+	}
+};
+
+
+
+
@@ -0,0 +1,161 @@
+// PenDebouncer.cpp
+
+// Implements the PenDebouncer class representing the state machine that turns a single pen's raw IR visibility
+// into debounced pen-down / pen-up transitions
+
+
+
+
+
+#include "Globals.h"
+#include "PenDebouncer.h"
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenDebouncer::Config:
+
+PenDebouncer::Config::Config():
+	m_MinDownFrames(2),
+	m_MinDownTime(0),
+	m_MinUpFrames(1),
+	m_MinUpTime(30000)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenDebouncer:
+
+PenDebouncer::PenDebouncer(const Config & a_Config):
+	m_Config(a_Config),
+	m_State(stUp),
+	m_NumPendingFrames(0),
+	m_X(0),
+	m_Y(0),
+	m_NumGlitchesIgnored(0),
+	m_NumDropoutsBridged(0)
+{
+}
+
+
+
+
+
+PenDebouncer::Action PenDebouncer::update(bool a_IsPresent, int a_X, int a_Y, Clock::time_point a_Time)
+{
+	if (a_IsPresent)
+	{
+		m_X = a_X;
+		m_Y = a_Y;
+	}
+
+	switch (m_State)
+	{
+		case stUp:
+		{
+			if (!a_IsPresent)
+			{
+				return actNone;
+			}
+			startPending(stPendingDown, a_Time);
+			break;  // Evaluate the pending state right away, the thresholds may be zero
+		}
+		case stPendingDown:
+		{
+			if (!a_IsPresent)
+			{
+				// Gone before going down, a glitch:
+				m_State = stUp;
+				m_NumGlitchesIgnored.fetch_add(1, std::memory_order_relaxed);
+				return actNone;
+			}
+			m_NumPendingFrames += 1;
+			break;
+		}
+		case stDown:
+		{
+			if (a_IsPresent)
+			{
+				return actMove;
+			}
+			startPending(stPendingUp, a_Time);
+			break;  // Evaluate the pending state right away, the thresholds may be zero
+		}
+		case stPendingUp:
+		{
+			if (a_IsPresent)
+			{
+				// Back before going up, bridge the dropout:
+				m_State = stDown;
+				m_NumDropoutsBridged.fetch_add(1, std::memory_order_relaxed);
+				return actMove;
+			}
+			m_NumPendingFrames += 1;
+			break;
+		}
+	}
+
+	// Decide the pending state:
+	if (m_State == stPendingDown)
+	{
+		if (hasPendingLasted(m_Config.m_MinDownFrames, m_Config.m_MinDownTime, a_Time))
+		{
+			m_State = stDown;
+			return actDown;
+		}
+		return actMove;  // Hover until decided
+	}
+	assert(m_State == stPendingUp);
+	if (hasPendingLasted(m_Config.m_MinUpFrames, m_Config.m_MinUpTime, a_Time))
+	{
+		m_State = stUp;
+		return actUp;
+	}
+	return actNone;  // Hold the last position until decided
+}
+
+
+
+
+
+PenDebouncer::Stats PenDebouncer::getStats() const
+{
+	Stats res;
+	res.m_NumGlitchesIgnored = m_NumGlitchesIgnored.load();
+	res.m_NumDropoutsBridged = m_NumDropoutsBridged.load();
+	res.m_NumSuppressedTransitions = 2 * (res.m_NumGlitchesIgnored + res.m_NumDropoutsBridged);
+	return res;
+}
+
+
+
+
+
+void PenDebouncer::startPending(State a_State, Clock::time_point a_Time)
+{
+	m_State = a_State;
+	m_NumPendingFrames = 1;
+	m_PendingSince = a_Time;
+}
+
+
+
+
+
+bool PenDebouncer::hasPendingLasted(unsigned a_MinFrames, std::chrono::microseconds a_MinTime, Clock::time_point a_Time) const
+{
+	return (
+		(m_NumPendingFrames >= a_MinFrames) &&
+		(a_Time - m_PendingSince >= a_MinTime)
+	);
+}
+
+
+
+
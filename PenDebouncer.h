@@ -0,0 +1,136 @@
+// PenDebouncer.h
+
+// Declares the PenDebouncer class representing the state machine that turns a single pen's raw IR visibility
+// into debounced pen-down / pen-up transitions
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+#include "LatencyTrace.h"
+
+
+
+
+
+/** Debounces the visibility of a single IR pen, so that a marginal pen doesn't produce click storms.
+The pen only goes down after it has been seen for the configured number of frames and time, and only goes up
+after it has been missing for the configured number of frames and time; a shorter dropout is bridged (the pen stays
+down at its last position) and a shorter glitch is ignored (the pen only hovers).
+Fed with every report (frame) from a single thread; the counters may be read from any thread. */
+class PenDebouncer
+{
+public:
+	/** The hysteresis settings. Both the frame count and the time must be reached for a transition; zero disables either. */
+	struct Config
+	{
+		/** The number of consecutive frames in which the pen must be seen before it goes down. */
+		unsigned m_MinDownFrames;
+
+		/** The time for which the pen must be seen before it goes down, measured from its first frame. */
+		std::chrono::microseconds m_MinDownTime;
+
+		/** The number of consecutive frames in which the pen must be missing before it goes up. */
+		unsigned m_MinUpFrames;
+
+		/** The time for which the pen must be missing before it goes up, measured from its first missing frame. */
+		std::chrono::microseconds m_MinUpTime;
+
+		/** The defaults: down on the 2nd frame seen, up on the missing frame at least 30 ms after the first missing one
+		(the 4th consecutive missing frame at 100 Hz), so that dropouts of up to 3 frames are bridged. */
+		Config();
+	};
+
+
+	/** The action resulting from a single frame. */
+	enum Action
+	{
+		actNone,  ///< Nothing to emit
+		actMove,  ///< Move to getX(), getY() (the pen is down, or hovering before going down)
+		actDown,  ///< The pen has gone down at getX(), getY()
+		actUp,    ///< The pen has gone up at getX(), getY() (its last seen position)
+	};
+
+
+	/** The counters of the suppressed transitions. */
+	struct Stats
+	{
+		/** The number of appearances too short to put the pen down (each saved a down and an up). */
+		uint64_t m_NumGlitchesIgnored;
+
+		/** The number of dropouts too short to lift the pen (each saved an up and a down). */
+		uint64_t m_NumDropoutsBridged;
+
+		/** The total number of suppressed transitions, compared to following the raw visibility. */
+		uint64_t m_NumSuppressedTransitions;
+	};
+
+
+	explicit PenDebouncer(const Config & a_Config = Config());
+
+	/** Processes a single frame: whether the pen is seen, its position (valid only if seen) and the frame's arrival time.
+	Returns the action to emit. */
+	Action update(bool a_IsPresent, int a_X, int a_Y, Clock::time_point a_Time);
+
+	/** Returns true if the pen is settled (up or down), false if a transition is pending, and so the next frames
+	must be fed even if they don't change anything, for the transition to be decided. */
+	bool isSettled() const { return (m_State == stUp) || (m_State == stDown); }
+
+	/** Returns true if the pen is down (including a bridged dropout). */
+	bool isDown() const { return (m_State == stDown) || (m_State == stPendingUp); }
+
+	/** The position for the last returned action. */
+	int getX() const { return m_X; }
+	int getY() const { return m_Y; }
+
+	/** Returns a snapshot of the counters. */
+	Stats getStats() const;
+
+	/** Replaces the settings. Takes effect from the next frame on. */
+	void setConfig(const Config & a_Config) { m_Config = a_Config; }
+
+protected:
+
+	enum State
+	{
+		stUp,           ///< The pen is up and missing
+		stPendingDown,  ///< The pen is up, but has been seen; goes down if seen for long enough
+		stDown,         ///< The pen is down and seen
+		stPendingUp,    ///< The pen is down, but has been missing; goes up if missing for long enough
+	};
+
+
+	Config m_Config;
+
+	State m_State;
+
+	/** The number of frames spent in the current pending state. */
+	unsigned m_NumPendingFrames;
+
+	/** The time of the first frame of the current pending state. */
+	Clock::time_point m_PendingSince;
+
+	/** The last seen position of the pen. */
+	int m_X, m_Y;
+
+	std::atomic<uint64_t> m_NumGlitchesIgnored;
+	std::atomic<uint64_t> m_NumDropoutsBridged;
+
+
+	/** Starts a pending state at the specified frame. */
+	void startPending(State a_State, Clock::time_point a_Time);
+
+	/** Returns true if the current pending state has lasted for the specified frames and time, including the specified frame. */
+	bool hasPendingLasted(unsigned a_MinFrames, std::chrono::microseconds a_MinTime, Clock::time_point a_Time) const;
+};
+
+
+
+
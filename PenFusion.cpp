@@ -0,0 +1,615 @@
+// PenFusion.cpp
+
+// Implements the PenFusion class representing the merging of the pens seen by several Wiimotes aimed at the same screen
+
+
+
+
+
+#include "Globals.h"
+#include "PenFusion.h"
+#include "InputInjector.h"
+#include "FlightRecorder.h"
+#include "StageHistograms.h"
+
+
+
+
+
+/** The shortest interval between two observations of a pen used for estimating its velocity, in seconds;
+the shorter ones would amplify the jitter. */
+static const double MIN_VELOCITY_DT = 0.002;
+
+/** The nominal size of an IR camera pixel on the screen (for a Wiimote covering the whole screen).
+The fused pens are filtered in the units of the camera pixels, for which the filters' params are tuned. */
+static const double FILTER_SCALE = 64;
+
+/** The slowest pen speed (normalized screen coords per second) at which the latency offsets are estimated;
+the slower the pen, the more the position noise dominates the lag. */
+static const double MIN_OFFSET_SPEED = 10000;
+
+/** The fraction of the measured offset error that is applied per report. */
+static const double OFFSET_GAIN = 0.05;
+
+/** The largest offset error measured from a single report that is accepted, in seconds; larger ones are clipped. */
+static const double MAX_OFFSET_STEP = 0.005;
+
+/** The largest offset that can be estimated, in seconds. */
+static const double MAX_OFFSET = 0.05;
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenFusion::Config:
+
+PenFusion::Config::Config():
+	m_Mode(fmAverage),
+	m_MergeDistance(2000),
+	m_MaxAge(30000),
+	m_MaxMissingTime(100000),
+	m_ShouldEstimateOffsets(true)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenFusion:
+
+PenFusion::PenFusion(
+	const Warper & a_Warper,
+	InputInjector & a_Injector,
+	const PenDebouncer::Config & a_DebounceConfig,
+	PointFilterPtr a_Filter,
+	const MotionPredictor::Config & a_PredictorConfig,
+	const Config & a_Config
+):
+	m_Warper(a_Warper),
+	m_Injector(a_Injector),
+	m_InjectorSource(a_Injector.addSource()),
+	m_Config(a_Config),
+	m_NumSources(0),
+	m_IsSettled(true),
+	m_NumFusedReports(0),
+	m_NumMerges(0),
+	m_NumOcclusionsBridged(0),
+	m_NumReports(0),
+	m_NumOutOfOrder(0),
+	m_StartTime(Clock::now())
+{
+	for (auto & src: m_Sources)
+	{
+		src.m_Wiimote = nullptr;
+		src.m_Offset = 0;
+		for (auto & pen: src.m_Pens)
+		{
+			pen.m_Observation.m_IsPresent = false;
+			pen.m_FusedPen = -1;
+		}
+	}
+	for (auto & pen: m_FusedPens)
+	{
+		pen.m_IsActive = false;
+		std::fill(std::begin(pen.m_Members), std::end(pen.m_Members), -1);
+		pen.m_MainWiimote = nullptr;
+		pen.m_Debouncer.setConfig(a_DebounceConfig);
+		if (a_Filter != nullptr)
+		{
+			pen.m_Filter = a_Filter->clone();
+		}
+		pen.m_Predictor.setConfig(a_PredictorConfig);
+		pen.m_LastX = 0;
+		pen.m_LastY = 0;
+	}
+}
+
+
+
+
+
+int PenFusion::addSource(const Wiimote * a_Wiimote)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (m_NumSources >= MAX_SOURCES)
+	{
+		LOG("PenFusion: too many sources, the Wiimote will be ignored");
+		return -1;
+	}
+	m_Sources[m_NumSources].m_Wiimote = a_Wiimote;
+	return m_NumSources++;
+}
+
+
+
+
+
+void PenFusion::update(int a_Source, const Observation (& a_Pens)[MAX_PENS], const LatencyTrace & a_Trace)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if ((a_Source < 0) || (a_Source >= m_NumSources))
+	{
+		return;
+	}
+
+	// Store the source's report, timed by the arrival corrected by the source's latency, with the pens' velocities:
+	auto & src = m_Sources[a_Source];
+	auto time = a_Trace.m_Times[LatencyTrace::stArrival] - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(src.m_Offset));
+	auto dt = std::chrono::duration<double>(time - src.m_LastTime).count();
+	for (int i = 0; i < MAX_PENS; ++i)
+	{
+		auto & pen = src.m_Pens[i];
+		const auto & obs = a_Pens[i];
+		if (!obs.m_IsPresent || !pen.m_Observation.m_IsPresent)
+		{
+			pen.m_VX = 0;
+			pen.m_VY = 0;
+		}
+		else if (dt >= MIN_VELOCITY_DT)
+		{
+			pen.m_VX = (obs.m_X - pen.m_Observation.m_X) / dt;
+			pen.m_VY = (obs.m_Y - pen.m_Observation.m_Y) / dt;
+		}
+		pen.m_Observation = obs;
+	}
+	src.m_LastTime = time;
+	if (m_Config.m_ShouldEstimateOffsets && (a_Source > 0))
+	{
+		estimateOffset(a_Source, time);
+	}
+
+	// Keep the fused stream in the time order; a report taken before the last fused one is fused at its time:
+	if (time < m_LastFusedTime)
+	{
+		m_NumOutOfOrder.fetch_add(1, std::memory_order_relaxed);
+		time = m_LastFusedTime;
+	}
+	m_LastFusedTime = time;
+	m_NumReports.fetch_add(1, std::memory_order_relaxed);
+
+	// Fuse, then process the fused pens:
+	if (updateMembership(time))
+	{
+		m_NumFusedReports.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (m_Config.m_Mode == fmInterleave)
+	{
+		// The pens seen by the reporting source are where it sees them (extrapolated, if the report is out of order):
+		for (auto & fused: m_FusedPens)
+		{
+			auto member = fused.m_Members[a_Source];
+			if (fused.m_IsActive && (member >= 0) && getSourcePenPos(a_Source, member, time, fused.m_X, fused.m_Y))
+			{
+				fused.m_MainWiimote = src.m_Wiimote;
+			}
+		}
+	}
+	MouseEvent events[2 * MAX_PENS];
+	size_t numEvents = 0;
+	bool isSettled = true;
+	for (int i = 0; i < MAX_PENS; ++i)
+	{
+		processPen(i, time, events, numEvents);
+		isSettled = isSettled && m_FusedPens[i].m_Debouncer.isSettled();
+	}
+	m_IsSettled = isSettled;
+	if (numEvents > 0)
+	{
+		// The events are recorded by the reporting Wiimote, this is its reading context:
+		src.m_Wiimote->getFlightRecorder().addEvents(events, numEvents, a_Trace.m_Times[LatencyTrace::stArrival]);
+		auto trace = a_Trace;
+		trace.mark(LatencyTrace::stWarped);
+		StageHistograms::get().record(
+			trace.m_Device, StageHistograms::hsWarp,
+			trace.m_Times[LatencyTrace::stWarped] - trace.m_Times[LatencyTrace::stDispatched]
+		);
+		m_Injector.post(m_InjectorSource, events, numEvents, trace);
+	}
+}
+
+
+
+
+
+PenFusion::Stats PenFusion::getStats() const
+{
+	Stats res;
+	res.m_NumFusedReports = m_NumFusedReports.load();
+	res.m_NumMerges = m_NumMerges.load();
+	res.m_NumOcclusionsBridged = m_NumOcclusionsBridged.load();
+	res.m_NumReports = m_NumReports.load();
+	res.m_NumOutOfOrder = m_NumOutOfOrder.load();
+	auto elapsedSec = std::chrono::duration<double>(Clock::now() - m_StartTime).count();
+	res.m_ReportsPerSec = (elapsedSec > 0) ? (res.m_NumReports / elapsedSec) : 0;
+	return res;
+}
+
+
+
+
+
+PenDebouncer::Stats PenFusion::getDebounceStats() const
+{
+	PenDebouncer::Stats res = {};
+	for (const auto & pen: m_FusedPens)
+	{
+		auto stats = pen.m_Debouncer.getStats();
+		res.m_NumGlitchesIgnored += stats.m_NumGlitchesIgnored;
+		res.m_NumDropoutsBridged += stats.m_NumDropoutsBridged;
+		res.m_NumSuppressedTransitions += stats.m_NumSuppressedTransitions;
+	}
+	return res;
+}
+
+
+
+
+
+int PenFusion::getNumSources() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_NumSources;
+}
+
+
+
+
+
+std::chrono::microseconds PenFusion::getSourceOffset(int a_Source) const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if ((a_Source < 0) || (a_Source >= m_NumSources))
+	{
+		return std::chrono::microseconds(0);
+	}
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double>(m_Sources[a_Source].m_Offset));
+}
+
+
+
+
+
+bool PenFusion::getSourcePenPos(int a_Source, int a_Pen, Clock::time_point a_Time, double & a_X, double & a_Y) const
+{
+	const auto & src = m_Sources[a_Source];
+	const auto & pen = src.m_Pens[a_Pen];
+	if (!pen.m_Observation.m_IsPresent)
+	{
+		return false;
+	}
+	auto age = a_Time - src.m_LastTime;
+	if (age > m_Config.m_MaxAge)
+	{
+		return false;
+	}
+	auto ageSec = std::chrono::duration<double>(age).count();
+	a_X = pen.m_Observation.m_X + pen.m_VX * ageSec;
+	a_Y = pen.m_Observation.m_Y + pen.m_VY * ageSec;
+	return true;
+}
+
+
+
+
+
+void PenFusion::estimateOffset(int a_Source, Clock::time_point a_Time)
+{
+	// If the source's offset is too small by d, its report is timed d later than it was taken, and so the first
+	// source's pen, extrapolated to the report's time, is ahead of the source's pen by its velocity times d.
+	// A constant calibration mismatch between the two Wiimotes averages out as the pen moves in different directions.
+	auto & src = m_Sources[a_Source];
+	for (const auto & pen: src.m_Pens)
+	{
+		if (!pen.m_Observation.m_IsPresent || (pen.m_FusedPen < 0))
+		{
+			continue;
+		}
+		auto refPenIdx = m_FusedPens[pen.m_FusedPen].m_Members[0];
+		double refX, refY;
+		if ((refPenIdx < 0) || !getSourcePenPos(0, refPenIdx, a_Time, refX, refY))
+		{
+			continue;
+		}
+		const auto & refPen = m_Sources[0].m_Pens[refPenIdx];
+		auto speed2 = refPen.m_VX * refPen.m_VX + refPen.m_VY * refPen.m_VY;
+		if (speed2 < MIN_OFFSET_SPEED * MIN_OFFSET_SPEED)
+		{
+			continue;
+		}
+		auto error = ((refX - pen.m_Observation.m_X) * refPen.m_VX + (refY - pen.m_Observation.m_Y) * refPen.m_VY) / speed2;
+		error = std::min(std::max(error, -MAX_OFFSET_STEP), MAX_OFFSET_STEP);
+		src.m_Offset = std::min(std::max(src.m_Offset + OFFSET_GAIN * error, -MAX_OFFSET), MAX_OFFSET);
+	}
+}
+
+
+
+
+
+bool PenFusion::updateMembership(Clock::time_point a_Time)
+{
+	auto merge2 = m_Config.m_MergeDistance * m_Config.m_MergeDistance;
+	bool isAnyFused = false;
+	for (int f = 0; f < MAX_PENS; ++f)
+	{
+		auto & fused = m_FusedPens[f];
+		if (!fused.m_IsActive)
+		{
+			continue;
+		}
+
+		// Remove the members no longer seen:
+		int numMembers = 0;
+		int numLost = 0;
+		double x[MAX_SOURCES], y[MAX_SOURCES];
+		for (int s = 0; s < m_NumSources; ++s)
+		{
+			auto member = fused.m_Members[s];
+			if (member < 0)
+			{
+				continue;
+			}
+			if (!getSourcePenPos(s, member, a_Time, x[s], y[s]))
+			{
+				m_Sources[s].m_Pens[member].m_FusedPen = -1;
+				fused.m_Members[s] = -1;
+				numLost += 1;
+				continue;
+			}
+			numMembers += 1;
+		}
+		if ((numLost > 0) && (numMembers > 0))
+		{
+			m_NumOcclusionsBridged.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// Remove the members that have drifted away from the others, the farthest (and lightest) first; the members
+		// may drift apart temporarily when the pen turns sharply, so they only leave at twice the merge distance:
+		while (numMembers > 1)
+		{
+			int worst = -1;
+			double worstDist2 = 0, worstWeight = 0;
+			for (int s = 0; s < m_NumSources; ++s)
+			{
+				auto member = fused.m_Members[s];
+				if (member < 0)
+				{
+					continue;
+				}
+				double sumW = 0, sumX = 0, sumY = 0;
+				for (int o = 0; o < m_NumSources; ++o)
+				{
+					if ((o == s) || (fused.m_Members[o] < 0))
+					{
+						continue;
+					}
+					auto w = m_Sources[o].m_Pens[fused.m_Members[o]].m_Observation.m_Weight;
+					sumW += w;
+					sumX += w * x[o];
+					sumY += w * y[o];
+				}
+				auto dx = x[s] - sumX / sumW;
+				auto dy = y[s] - sumY / sumW;
+				auto dist2 = dx * dx + dy * dy;
+				auto weight = m_Sources[s].m_Pens[member].m_Observation.m_Weight;
+				if ((worst < 0) || (dist2 > worstDist2) || ((dist2 == worstDist2) && (weight < worstWeight)))
+				{
+					worst = s;
+					worstDist2 = dist2;
+					worstWeight = weight;
+				}
+			}
+			if (worstDist2 <= 4 * merge2)
+			{
+				break;
+			}
+			m_Sources[worst].m_Pens[fused.m_Members[worst]].m_FusedPen = -1;
+			fused.m_Members[worst] = -1;
+			numMembers -= 1;
+		}
+
+		if (calcFusedPos(fused, a_Time, fused.m_X, fused.m_Y) > 0)
+		{
+			fused.m_LastSeen = a_Time;
+		}
+	}
+
+	// Add the sources' pens that aren't members yet, to the nearest fused pen or a new one:
+	for (int s = 0; s < m_NumSources; ++s)
+	{
+		for (int p = 0; p < MAX_PENS; ++p)
+		{
+			double x, y;
+			auto & srcPen = m_Sources[s].m_Pens[p];
+			if ((srcPen.m_FusedPen >= 0) || !getSourcePenPos(s, p, a_Time, x, y))
+			{
+				continue;
+			}
+			int nearest = -1;
+			double nearestDist2 = merge2;
+			for (int f = 0; f < MAX_PENS; ++f)
+			{
+				const auto & fused = m_FusedPens[f];
+				if (!fused.m_IsActive || (fused.m_Members[s] >= 0))
+				{
+					continue;
+				}
+				auto dx = x - fused.m_X;
+				auto dy = y - fused.m_Y;
+				auto dist2 = dx * dx + dy * dy;
+				if (dist2 <= nearestDist2)
+				{
+					nearest = f;
+					nearestDist2 = dist2;
+				}
+			}
+			if (nearest >= 0)
+			{
+				auto & fused = m_FusedPens[nearest];
+				if (std::any_of(std::begin(fused.m_Members), std::end(fused.m_Members), [](int a_Member) { return (a_Member >= 0); }))
+				{
+					m_NumMerges.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			else
+			{
+				auto fused = std::find_if(std::begin(m_FusedPens), std::end(m_FusedPens), [](const FusedPen & a_Pen) { return !a_Pen.m_IsActive; });
+				if (fused == std::end(m_FusedPens))
+				{
+					continue;
+				}
+				nearest = static_cast<int>(fused - std::begin(m_FusedPens));
+				fused->m_IsActive = true;
+			}
+			auto & fused = m_FusedPens[nearest];
+			fused.m_Members[s] = p;
+			srcPen.m_FusedPen = nearest;
+			calcFusedPos(fused, a_Time, fused.m_X, fused.m_Y);
+			fused.m_LastSeen = a_Time;
+		}
+	}
+
+	// End the fused pens missing for too long:
+	for (auto & fused: m_FusedPens)
+	{
+		if (!fused.m_IsActive)
+		{
+			continue;
+		}
+		int numMembers = static_cast<int>(std::count_if(std::begin(fused.m_Members), std::end(fused.m_Members), [](int a_Member) { return (a_Member >= 0); }));
+		isAnyFused = isAnyFused || (numMembers > 1);
+		if ((numMembers == 0) && (a_Time - fused.m_LastSeen > m_Config.m_MaxMissingTime))
+		{
+			fused.m_IsActive = false;
+		}
+	}
+	return isAnyFused;
+}
+
+
+
+
+
+int PenFusion::calcFusedPos(FusedPen & a_Pen, Clock::time_point a_Time, double & a_X, double & a_Y)
+{
+	double sumW = 0, sumX = 0, sumY = 0, maxW = 0;
+	int numMembers = 0;
+	for (int s = 0; s < m_NumSources; ++s)
+	{
+		auto member = a_Pen.m_Members[s];
+		double x, y;
+		if ((member < 0) || !getSourcePenPos(s, member, a_Time, x, y))
+		{
+			continue;
+		}
+		auto w = m_Sources[s].m_Pens[member].m_Observation.m_Weight;
+		sumW += w;
+		sumX += w * x;
+		sumY += w * y;
+		numMembers += 1;
+		if (w > maxW)
+		{
+			maxW = w;
+			a_Pen.m_MainWiimote = m_Sources[s].m_Wiimote;
+		}
+	}
+	if ((numMembers > 0) && (sumW > 0))
+	{
+		a_X = sumX / sumW;
+		a_Y = sumY / sumW;
+	}
+	return numMembers;
+}
+
+
+
+
+
+void PenFusion::processPen(int a_PenId, Clock::time_point a_Time, MouseEvent * a_Events, size_t & a_NumEvents)
+{
+	auto & pen = m_FusedPens[a_PenId];
+	auto isPresent = pen.m_IsActive && (pen.m_LastSeen == a_Time);
+	auto x = static_cast<int>(std::floor(pen.m_X + 0.5));
+	auto y = static_cast<int>(std::floor(pen.m_Y + 0.5));
+	auto action = pen.m_Debouncer.update(isPresent, x, y, a_Time);
+	if (action == PenDebouncer::actNone)
+	{
+		return;
+	}
+
+	// Smooth the position (in the camera pixel units); the pen goes up where it was last seen, and the next stroke starts anew:
+	if (action != PenDebouncer::actUp)
+	{
+		pen.m_LastX = pen.m_Debouncer.getX();
+		pen.m_LastY = pen.m_Debouncer.getY();
+		if (pen.m_Filter != nullptr)
+		{
+			pen.m_LastX /= FILTER_SCALE;
+			pen.m_LastY /= FILTER_SCALE;
+			pen.m_Filter->process(pen.m_LastX, pen.m_LastY, a_Time);
+			pen.m_LastX *= FILTER_SCALE;
+			pen.m_LastY *= FILTER_SCALE;
+		}
+		pen.m_Predictor.addSample(pen.m_LastX, pen.m_LastY, a_Time);
+	}
+	else
+	{
+		if (pen.m_Filter != nullptr)
+		{
+			pen.m_Filter->reset();
+		}
+		pen.m_Predictor.reset();
+	}
+	Warper::Point pt =
+	{
+		static_cast<int>(std::floor(pen.m_LastX + 0.5)),
+		static_cast<int>(std::floor(pen.m_LastY + 0.5))
+	};
+
+	auto addEvent = [&](MouseEvent::Type a_Type, Warper::Point a_Pt)
+	{
+		auto & evt = a_Events[a_NumEvents++];
+		evt.m_Type = a_Type;
+		evt.m_X = a_Pt.m_X;
+		evt.m_Y = a_Pt.m_Y;
+		evt.m_PenId = a_PenId;
+	};
+	switch (action)
+	{
+		case PenDebouncer::actNone: break;
+		case PenDebouncer::actMove:
+		{
+			// Only the moves are predicted, the button transitions happen where the pen really is:
+			double px, py;
+			if (pen.m_Predictor.isEnabled() && pen.m_Predictor.predict(px, py))
+			{
+				if (pen.m_MainWiimote != nullptr)
+				{
+					m_Warper.clampToScreenQuad(*pen.m_MainWiimote, px, py);
+				}
+				pt.m_X = static_cast<int>(std::floor(px + 0.5));
+				pt.m_Y = static_cast<int>(std::floor(py + 0.5));
+			}
+			addEvent(MouseEvent::metMove, pt);
+			break;
+		}
+		case PenDebouncer::actDown:
+		{
+			addEvent(MouseEvent::metMove, pt);
+			addEvent(MouseEvent::metLeftDown, pt);
+			break;
+		}
+		case PenDebouncer::actUp:
+		{
+			addEvent(MouseEvent::metLeftUp, pt);
+			break;
+		}
+	}
+}
+
+
+
+
@@ -0,0 +1,284 @@
+// PenFusion.h
+
+// Declares the PenFusion class representing the merging of the pens seen by several Wiimotes aimed at the same screen
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <mutex>
+#include "OutputSink.h"
+#include "PenDebouncer.h"
+#include "PointFilter.h"
+#include "MotionPredictor.h"
+#include "Warper.h"
+
+
+
+
+
+// fwd:
+class InputInjector;
+
+
+
+
+
+/** Merges the pens seen by several Wiimotes calibrated for the same screen area into a single set of pens, so that
+two Wiimotes seeing the same pen produce a single cursor, and so that a pen keeps working while one of the Wiimotes
+has its view blocked (e.g. by the presenter's body).
+Each Wiimote (source) reports its pens, already tracked (stable per-source IDs) and warped into the screen coords,
+along with the weight of each observation, the inverse square of the Wiimote's local scale (see Warper::getLocalScale()),
+so that a Wiimote that sees the location in more detail counts more.
+The sources report asynchronously, at different phases; each report is fused with the latest reports of the other
+sources, extrapolated by their pens' velocities to the report's time (if not older than the configured age), so two
+Wiimotes give a pen stream of twice the report rate. The reports are timed by their arrival, corrected by each
+source's latency relative to the first source. The latency is estimated automatically whenever a moving pen is seen
+by both: the source's pen lags behind (or leads) the first source's pen along the direction of motion by the speed
+times the error of the offset. The fused stream is kept in the time order; a report that, after the correction,
+is older than the last fused one is fused at the last fused one's time. A source's pen joins the
+fused pen that is nearest to it within the merge distance, unless the fused pen already has a pen from that source;
+otherwise it starts a new fused pen. A fused pen's position is the weighted average of its members' positions; a member
+that drifts farther than twice the merge distance from the others leaves the pen. A fused pen that loses all its members is
+kept for a while, so that the pen can rejoin it when seen again.
+The fused pens then go through the same debouncing, smoothing and prediction as the pens of a single Wiimote
+(see Processor), and the resulting events are posted to the injector as a single source.
+Thread-safe, the sources may report from different threads. */
+class PenFusion
+{
+public:
+	/** The maximum number of sources (Wiimotes). */
+	static const int MAX_SOURCES = 8;
+
+	/** The maximum number of pens, both per source and fused. */
+	static const int MAX_PENS = MouseEvent::MAX_PENS;
+
+
+	/** How a fused pen's position is calculated from the sources that see it. */
+	enum Mode
+	{
+		/** The weighted average of all the sources' positions, each extrapolated to the report's time.
+		The most precise and smooth, but each fused position is mostly made of the extrapolated positions. */
+		fmAverage,
+
+		/** The position seen by the reporting source (extrapolated to the fused time, if the report is out of order),
+		if it sees the pen; the other sources' reports are used only if it doesn't. Each fused position is a fresh measurement, interleaving the sources' streams. */
+		fmInterleave,
+	};
+
+
+	struct Config
+	{
+		Mode m_Mode;
+
+		/** The farthest distance (normalized screen coords) between two sources' pens for them to be considered the same pen. */
+		double m_MergeDistance;
+
+		/** The oldest report of a source that is still fused with the other sources' reports. */
+		std::chrono::microseconds m_MaxAge;
+
+		/** How long a fused pen is kept after it has lost all its members. */
+		std::chrono::microseconds m_MaxMissingTime;
+
+		/** If true, the sources' latency offsets are estimated, otherwise all are assumed to be the same. */
+		bool m_ShouldEstimateOffsets;
+
+		/** The defaults: averaging, merge within 2000 units (60 px on a 1920 px screen), reports up to 30 ms old,
+		fused pens kept for 100 ms, offsets estimated. */
+		Config();
+	};
+
+
+	/** A single pen's observation by a single source, in a single report. */
+	struct Observation
+	{
+		/** True if the source sees the pen. */
+		bool m_IsPresent;
+
+		/** The pen's position, in the normalized screen coords. Valid only if present. */
+		double m_X, m_Y;
+
+		/** The weight of the observation, inversely proportional to its variance. Valid only if present. */
+		double m_Weight;
+	};
+
+
+	/** The counters describing the fusion. */
+	struct Stats
+	{
+		/** The number of reports in which at least one fused pen was seen by more than one source. */
+		uint64_t m_NumFusedReports;
+
+		/** The number of times a source's pen joined a fused pen already seen by another source. */
+		uint64_t m_NumMerges;
+
+		/** The number of times a fused pen lost a source, but was still seen by another source;
+		each would have been a pen-up without the fusion. */
+		uint64_t m_NumOcclusionsBridged;
+
+		/** The number of reports fused (in the time order), i.e. the number of fused positions for each pen. */
+		uint64_t m_NumReports;
+
+		/** The number of reports that arrived out of the time order (after the latency correction). */
+		uint64_t m_NumOutOfOrder;
+
+		/** The average number of fused reports per second, over the fusion's lifetime; the effective report rate. */
+		double m_ReportsPerSec;
+	};
+
+
+	/** Creates the fusion posting into the specified injector, with the specified processing of the fused pens
+	(each fused pen gets its own debouncer, predictor and clone of a_Filter, if given). */
+	PenFusion(
+		const Warper & a_Warper,
+		InputInjector & a_Injector,
+		const PenDebouncer::Config & a_DebounceConfig = PenDebouncer::Config(),
+		PointFilterPtr a_Filter = PointFilterPtr(),
+		const MotionPredictor::Config & a_PredictorConfig = MotionPredictor::Config(),
+		const Config & a_Config = Config()
+	);
+
+	/** Registers a new source, the specified Wiimote, and returns its index, to be used with update().
+	Returns -1 if there are already MAX_SOURCES sources. */
+	int addSource(const Wiimote * a_Wiimote);
+
+	/** Fuses the specified source's report of its pens, arriving at a_Trace's stArrival, with the other sources'
+	latest reports, and posts the resulting events for the fused pens. */
+	void update(int a_Source, const Observation (& a_Pens)[MAX_PENS], const LatencyTrace & a_Trace);
+
+	/** Returns true if all the fused pens are settled (see PenDebouncer::isSettled()). If not, the sources should
+	report every frame, even if nothing changes, so that the pending transitions get decided. */
+	bool isSettled() const { return m_IsSettled.load(); }
+
+	/** Returns the counters of the fusion. */
+	Stats getStats() const;
+
+	/** Returns the counters of the pen transitions suppressed by the debouncing, summed over all the fused pens. */
+	PenDebouncer::Stats getDebounceStats() const;
+
+	/** Returns the number of the registered sources. */
+	int getNumSources() const;
+
+	/** Returns the estimated latency of the specified source, relative to the first source. */
+	std::chrono::microseconds getSourceOffset(int a_Source) const;
+
+protected:
+
+	/** The latest report of a single pen by a single source. */
+	struct SourcePen
+	{
+		Observation m_Observation;
+
+		/** The velocity of the pen (normalized screen coords per second), from its two latest observations. */
+		double m_VX, m_VY;
+
+		/** The index of the fused pen of which this pen is a member, -1 if none. */
+		int m_FusedPen;
+	};
+
+
+	/** The state of a single source. */
+	struct Source
+	{
+		const Wiimote * m_Wiimote;
+
+		/** The time of the source's latest report, corrected by m_Offset. */
+		Clock::time_point m_LastTime;
+
+		/** The estimated latency of the source, relative to the first source, in seconds. */
+		double m_Offset;
+
+		/** The pens from the latest report. */
+		SourcePen m_Pens[MAX_PENS];
+	};
+
+
+	/** A single fused pen. */
+	struct FusedPen
+	{
+		/** True if the pen is in use (seen, or missing only briefly); the inactive pens' IDs are free. */
+		bool m_IsActive;
+
+		/** For each source, the index of its pen that is a member of this fused pen, -1 if none. */
+		int m_Members[MAX_SOURCES];
+
+		/** The last fused position. */
+		double m_X, m_Y;
+
+		/** The time when the pen was last seen by any source. */
+		Clock::time_point m_LastSeen;
+
+		/** The Wiimote with the most weight in the last fused position, used for clamping the prediction. */
+		const Wiimote * m_MainWiimote;
+
+		PenDebouncer m_Debouncer;
+		PointFilterPtr m_Filter;
+		MotionPredictor m_Predictor;
+
+		/** The last position of the pen after filtering, used for the pen-up. */
+		double m_LastX, m_LastY;
+	};
+
+
+	const Warper & m_Warper;
+
+	InputInjector & m_Injector;
+
+	/** The source index of the fusion within m_Injector. */
+	int m_InjectorSource;
+
+	Config m_Config;
+
+	/** Protects all the state below, except for the atomics. */
+	mutable std::mutex m_CS;
+
+	Source m_Sources[MAX_SOURCES];
+
+	int m_NumSources;
+
+	FusedPen m_FusedPens[MAX_PENS];
+
+	std::atomic<bool> m_IsSettled;
+	std::atomic<uint64_t> m_NumFusedReports;
+	std::atomic<uint64_t> m_NumMerges;
+	std::atomic<uint64_t> m_NumOcclusionsBridged;
+	std::atomic<uint64_t> m_NumReports;
+	std::atomic<uint64_t> m_NumOutOfOrder;
+
+	/** The (corrected) time of the last fused report, to keep the fused stream in the time order. */
+	Clock::time_point m_LastFusedTime;
+
+	/** The time when the fusion was created, for the per-second rates. */
+	Clock::time_point m_StartTime;
+
+
+	/** Returns the position of the specified source's pen, extrapolated to a_Time.
+	Returns false if the pen is not present in the source's latest report, or the report is too old. */
+	bool getSourcePenPos(int a_Source, int a_Pen, Clock::time_point a_Time, double & a_X, double & a_Y) const;
+
+	/** Refines the specified source's latency offset by comparing its (new) pens with the first source's pens
+	that are members of the same fused pens, at a_Time. */
+	void estimateOffset(int a_Source, Clock::time_point a_Time);
+
+	/** Updates the membership of the fused pens for a_Time: removes the members no longer seen and those that have
+	drifted away, adds the sources' pens that aren't members yet, and calculates the fused positions.
+	Returns true if any fused pen has more than one member. */
+	bool updateMembership(Clock::time_point a_Time);
+
+	/** Calculates the fused pen's position from its members' positions at a_Time, into a_X, a_Y.
+	Returns the number of members contributing. */
+	int calcFusedPos(FusedPen & a_Pen, Clock::time_point a_Time, double & a_X, double & a_Y);
+
+	/** Processes the specified fused pen's position in a single report, appending the resulting events to a_Events. */
+	void processPen(int a_PenId, Clock::time_point a_Time, MouseEvent * a_Events, size_t & a_NumEvents);
+};
+
+
+
+
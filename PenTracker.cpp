@@ -0,0 +1,279 @@
+// PenTracker.cpp
+
+// Implements the PenTracker class representing the frame-to-frame association of the IR dots into pens with stable IDs
+
+
+
+
+
+#include "Globals.h"
+#include "PenTracker.h"
+
+
+
+
+
+/** The shortest interval between two sightings of a pen used for estimating its velocity, in seconds;
+the shorter ones would amplify the camera's jitter. */
+static const double MIN_VELOCITY_DT = 0.002;
+
+
+
+
+
+/** The exhaustive search for the optimal assignment of the dots to the tracks.
+Enumerates all the assignments depth-first, track by track; each track takes one of the free gated dots, or none.
+Leaving a track or a dot unassigned costs gate2 each, so any gated pair is cheaper than leaving both unassigned. */
+struct AssignmentSearch
+{
+	int m_NumTracks, m_NumDots;
+
+	/** The squared gate distance. */
+	double m_Gate2;
+
+	/** The squared distances between the tracks and the dots, negative where outside the gate. */
+	double m_Dist2[PenTracker::MAX_PENS][PenTracker::MAX_PENS];
+
+	/** The assignment being built; for each track, the index of its dot, or -1. */
+	int m_Assignment[PenTracker::MAX_PENS];
+
+	bool m_IsDotTaken[PenTracker::MAX_PENS];
+
+	/** The best assignment found so far, and its cost (negative if none yet). */
+	int m_BestAssignment[PenTracker::MAX_PENS];
+	double m_BestCost;
+
+
+	AssignmentSearch(int a_NumTracks, int a_NumDots, double a_Gate2):
+		m_NumTracks(a_NumTracks),
+		m_NumDots(a_NumDots),
+		m_Gate2(a_Gate2),
+		m_BestCost(-1)
+	{
+		assert((m_NumTracks >= 0) && (m_NumTracks <= PenTracker::MAX_PENS));
+		assert((m_NumDots >= 0) && (m_NumDots <= PenTracker::MAX_PENS));
+		std::fill(std::begin(m_IsDotTaken), std::end(m_IsDotTaken), false);
+		std::fill(std::begin(m_BestAssignment), std::end(m_BestAssignment), -1);
+	}
+
+
+	/** Assigns the tracks from a_Track on, given the cost and number of pairs of the tracks before it. */
+	void search(int a_Track, double a_Cost, int a_NumMatched)
+	{
+		// The MAX_PENS check is implied by the asserts, but lets the compiler see that the arrays are indexed in bounds:
+		if ((a_Track >= m_NumTracks) || (a_Track >= PenTracker::MAX_PENS))
+		{
+			auto cost = a_Cost + m_Gate2 * (m_NumTracks - a_NumMatched + m_NumDots - a_NumMatched);
+			if ((m_BestCost < 0) || (cost < m_BestCost))
+			{
+				m_BestCost = cost;
+				std::copy(m_Assignment, m_Assignment + m_NumTracks, m_BestAssignment);
+			}
+			return;
+		}
+		m_Assignment[a_Track] = -1;
+		search(a_Track + 1, a_Cost, a_NumMatched);
+		for (int d = 0; d < m_NumDots; ++d)
+		{
+			if (m_IsDotTaken[d] || (m_Dist2[a_Track][d] < 0))
+			{
+				continue;
+			}
+			m_IsDotTaken[d] = true;
+			m_Assignment[a_Track] = d;
+			search(a_Track + 1, a_Cost + m_Dist2[a_Track][d], a_NumMatched + 1);
+			m_IsDotTaken[d] = false;
+		}
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenTracker::Config:
+
+PenTracker::Config::Config():
+	m_GateDistance(150),
+	m_MaxMissingTime(100000)
+{
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PenTracker:
+
+PenTracker::PenTracker(const Config & a_Config):
+	m_Config(a_Config),
+	m_NumTracksStarted(0),
+	m_NumSlotSwaps(0),
+	m_NumDotsIgnored(0)
+{
+	for (auto & track: m_Tracks)
+	{
+		track.m_IsActive = false;
+	}
+}
+
+
+
+
+
+void PenTracker::update(const Wiimote::IRState & a_IRState, Clock::time_point a_Time, Observation (& a_Pens)[MAX_PENS])
+{
+	// Collect the visible dots:
+	struct Dot
+	{
+		int m_X, m_Y;
+		int m_Slot;
+	};
+	const Dot slots[] =
+	{
+		{a_IRState.m_X1, a_IRState.m_Y1, 0},
+		{a_IRState.m_X2, a_IRState.m_Y2, 1},
+		{a_IRState.m_X3, a_IRState.m_Y3, 2},
+		{a_IRState.m_X4, a_IRState.m_Y4, 3},
+	};
+	const bool isPresent[] = {a_IRState.m_IsPresent1, a_IRState.m_IsPresent2, a_IRState.m_IsPresent3, a_IRState.m_IsPresent4};
+	Dot dots[MAX_PENS];
+	int numDots = 0;
+	for (int i = 0; i < MAX_PENS; ++i)
+	{
+		if (isPresent[i])
+		{
+			dots[numDots++] = slots[i];
+		}
+	}
+
+	// End the tracks missing for too long, collect the rest with their expected positions:
+	int tracks[MAX_PENS];
+	double expectedX[MAX_PENS], expectedY[MAX_PENS];
+	int numTracks = 0;
+	for (int i = 0; i < MAX_PENS; ++i)
+	{
+		auto & track = m_Tracks[i];
+		if (!track.m_IsActive)
+		{
+			continue;
+		}
+		auto missingFor = a_Time - track.m_LastSeen;
+		if (missingFor > m_Config.m_MaxMissingTime)
+		{
+			track.m_IsActive = false;
+			continue;
+		}
+		auto dt = std::chrono::duration<double>(missingFor).count();
+		tracks[numTracks] = i;
+		expectedX[numTracks] = track.m_X + track.m_VX * dt;
+		expectedY[numTracks] = track.m_Y + track.m_VY * dt;
+		numTracks += 1;
+	}
+
+	// Find the optimal assignment, with the squared distances between the tracks and the dots:
+	AssignmentSearch assignments(numTracks, numDots, m_Config.m_GateDistance * m_Config.m_GateDistance);
+	for (int t = 0; t < numTracks; ++t)
+	{
+		for (int d = 0; d < numDots; ++d)
+		{
+			auto dx = dots[d].m_X - expectedX[t];
+			auto dy = dots[d].m_Y - expectedY[t];
+			auto dd = dx * dx + dy * dy;
+			assignments.m_Dist2[t][d] = (dd <= assignments.m_Gate2) ? dd : -1;
+		}
+	}
+	assignments.search(0, 0, 0);
+	const auto & bestAssignment = assignments.m_BestAssignment;
+
+	// Update the matched tracks:
+	for (auto & pen: a_Pens)
+	{
+		pen.m_IsPresent = false;
+	}
+	bool isDotAssigned[MAX_PENS] = {};
+	for (int t = 0; t < numTracks; ++t)
+	{
+		if (bestAssignment[t] < 0)
+		{
+			continue;
+		}
+		const auto & dot = dots[bestAssignment[t]];
+		isDotAssigned[bestAssignment[t]] = true;
+		auto & track = m_Tracks[tracks[t]];
+		auto dt = std::chrono::duration<double>(a_Time - track.m_LastSeen).count();
+		if (dt >= MIN_VELOCITY_DT)
+		{
+			track.m_VX = (dot.m_X - track.m_X) / dt;
+			track.m_VY = (dot.m_Y - track.m_Y) / dt;
+		}
+		if (dot.m_Slot != track.m_Slot)
+		{
+			m_NumSlotSwaps.fetch_add(1, std::memory_order_relaxed);
+		}
+		track.m_X = dot.m_X;
+		track.m_Y = dot.m_Y;
+		track.m_LastSeen = a_Time;
+		track.m_Slot = dot.m_Slot;
+		auto & pen = a_Pens[tracks[t]];
+		pen.m_IsPresent = true;
+		pen.m_X = dot.m_X;
+		pen.m_Y = dot.m_Y;
+	}
+
+	// Start new tracks for the unassigned dots, with the lowest free pen IDs:
+	for (int d = 0; d < numDots; ++d)
+	{
+		if (isDotAssigned[d])
+		{
+			continue;
+		}
+		auto track = std::find_if(std::begin(m_Tracks), std::end(m_Tracks), [](const Track & a_Track) { return !a_Track.m_IsActive; });
+		if (track == std::end(m_Tracks))
+		{
+			m_NumDotsIgnored.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		const auto & dot = dots[d];
+		track->m_IsActive = true;
+		track->m_X = dot.m_X;
+		track->m_Y = dot.m_Y;
+		track->m_VX = 0;
+		track->m_VY = 0;
+		track->m_LastSeen = a_Time;
+		track->m_Slot = dot.m_Slot;
+		m_NumTracksStarted.fetch_add(1, std::memory_order_relaxed);
+		auto & pen = a_Pens[track - std::begin(m_Tracks)];
+		pen.m_IsPresent = true;
+		pen.m_X = dot.m_X;
+		pen.m_Y = dot.m_Y;
+	}
+}
+
+
+
+
+
+bool PenTracker::hasTracks() const
+{
+	return std::any_of(std::begin(m_Tracks), std::end(m_Tracks), [](const Track & a_Track) { return a_Track.m_IsActive; });
+}
+
+
+
+
+
+PenTracker::Stats PenTracker::getStats() const
+{
+	Stats res;
+	res.m_NumTracksStarted = m_NumTracksStarted.load();
+	res.m_NumSlotSwaps = m_NumSlotSwaps.load();
+	res.m_NumDotsIgnored = m_NumDotsIgnored.load();
+	return res;
+}
+
+
+
+
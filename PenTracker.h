@@ -0,0 +1,131 @@
+// PenTracker.h
+
+// Declares the PenTracker class representing the frame-to-frame association of the IR dots into pens with stable IDs
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+#include "Wiimote.h"
+#include "OutputSink.h"
+
+
+
+
+
+/** Associates the (up to four) IR dots seen by the camera in each frame with the pens seen in the previous frames,
+so that each pen keeps its ID even when the camera reports it in a different slot, and so that more than one pen
+can be used at once.
+Each pen is a track with its last position and velocity. In each frame, the visible dots are assigned to the
+tracks optimally: the assignment with the least total squared distance between the dots and the tracks' expected
+positions, where a dot farther than the gate distance cannot be assigned to a track at all, and leaving a track
+or a dot unassigned costs as much as the gate distance. With at most four tracks and four dots, all the
+assignments are enumerated, so the time per frame is bounded (at most 209 assignments).
+A dot not assigned to any track starts a new track with the lowest free pen ID; a track that hasn't been seen for
+the configured time ends and frees its ID. A track that is missing only briefly keeps its ID, so that the
+debouncing downstream can bridge the dropout.
+Fed with every report (frame) from a single thread; the counters may be read from any thread. */
+class PenTracker
+{
+public:
+	/** The number of pens that can be tracked at once, one per IR dot. */
+	static const int MAX_PENS = MouseEvent::MAX_PENS;
+
+
+	struct Config
+	{
+		/** The farthest distance (in the IR camera coords) between a track's expected position and a dot
+		for the dot to be considered the same pen. */
+		double m_GateDistance;
+
+		/** How long a track may be missing before it ends and its pen ID is freed. */
+		std::chrono::microseconds m_MaxMissingTime;
+
+		/** The defaults: 150 camera px gate, tracks end after 100 ms of absence. */
+		Config();
+	};
+
+
+	/** A single pen's observation in a frame. */
+	struct Observation
+	{
+		/** True if the pen was seen in the frame. */
+		bool m_IsPresent;
+
+		/** The position of the pen (IR camera coords), valid only if present. */
+		int m_X, m_Y;
+	};
+
+
+	/** The counters describing the tracking. */
+	struct Stats
+	{
+		/** The number of tracks started. */
+		uint64_t m_NumTracksStarted;
+
+		/** The number of times a pen was reported by the camera in a different slot than in the previous frame;
+		each would have been a jump or a spurious click without the tracking. */
+		uint64_t m_NumSlotSwaps;
+
+		/** The number of dots ignored because all the pen IDs were taken by the (briefly missing) tracks. */
+		uint64_t m_NumDotsIgnored;
+	};
+
+
+	explicit PenTracker(const Config & a_Config = Config());
+
+	/** Processes a single frame: associates the IR state's dots with the tracks, arriving at a_Time.
+	a_Pens receives the observation of each pen ID. */
+	void update(const Wiimote::IRState & a_IRState, Clock::time_point a_Time, Observation (& a_Pens)[MAX_PENS]);
+
+	/** Returns true if any of the tracks is active (seen, or missing only briefly). */
+	bool hasTracks() const;
+
+	/** Returns a snapshot of the counters. */
+	Stats getStats() const;
+
+	/** Replaces the settings. Takes effect from the next frame on. */
+	void setConfig(const Config & a_Config) { m_Config = a_Config; }
+
+protected:
+
+	/** A single pen's track. */
+	struct Track
+	{
+		/** True if the track is active; the inactive tracks' pen IDs are free. */
+		bool m_IsActive;
+
+		/** The last seen position. */
+		double m_X, m_Y;
+
+		/** The velocity, in camera px per second, estimated from the last two positions. */
+		double m_VX, m_VY;
+
+		/** The time when the track was last seen. */
+		Clock::time_point m_LastSeen;
+
+		/** The camera slot (0 - 3) in which the pen was last seen. */
+		int m_Slot;
+	};
+
+
+	Config m_Config;
+
+	/** The tracks, indexed by the pen ID. */
+	Track m_Tracks[MAX_PENS];
+
+	std::atomic<uint64_t> m_NumTracksStarted;
+	std::atomic<uint64_t> m_NumSlotSwaps;
+	std::atomic<uint64_t> m_NumDotsIgnored;
+};
+
+
+
+
@@ -0,0 +1,92 @@
+// PointFilter.cpp
+
+// Implements the PointFilter class representing the base for the filters that smooth a pen's position
+
+
+
+
+
+#include "Globals.h"
+#include "PointFilter.h"
+
+
+
+
+
+/** The minimum pen speed, in IR camera pixels per second, for the lag to be measured; at lower speeds the jitter dominates. */
+static const double MIN_LAG_SPEED = 100;
+
+/** The longest gap between two samples that is still considered continuous motion; a longer gap restarts the filter. */
+static const double MAX_DT = 0.25;
+
+
+
+
+
+const std::chrono::microseconds PointFilter::NOMINAL_INTERVAL(10000);
+
+
+
+
+
+PointFilter::PointFilter():
+	m_HasLast(false),
+	m_LastX(0),
+	m_LastY(0)
+{
+}
+
+
+
+
+
+void PointFilter::process(double & a_X, double & a_Y, Clock::time_point a_Time)
+{
+	auto rawX = a_X;
+	auto rawY = a_Y;
+	double dt = 0;
+	if (m_HasLast)
+	{
+		dt = std::chrono::duration<double>(a_Time - m_LastTime).count();
+		if (dt > MAX_DT)
+		{
+			resetFilter();
+			dt = 0;
+		}
+		else if (dt <= 0)
+		{
+			// Reports stamped with the same time (batched by the OS), assume the nominal interval:
+			dt = std::chrono::duration<double>(NOMINAL_INTERVAL).count();
+		}
+	}
+	filter(a_X, a_Y, dt);
+
+	// Measure the lag; the speed is taken from the filtered positions, the raw ones are dominated by the jitter:
+	if (dt > 0)
+	{
+		auto speed = std::hypot(a_X - m_LastX, a_Y - m_LastY) / dt;
+		if (speed >= MIN_LAG_SPEED)
+		{
+			auto lagSec = std::hypot(rawX - a_X, rawY - a_Y) / speed;
+			m_Lag.add(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(lagSec)));
+		}
+	}
+	m_HasLast = true;
+	m_LastX = a_X;
+	m_LastY = a_Y;
+	m_LastTime = a_Time;
+}
+
+
+
+
+
+void PointFilter::reset()
+{
+	m_HasLast = false;
+	resetFilter();
+}
+
+
+
+
@@ -0,0 +1,84 @@
+// PointFilter.h
+
+// Declares the PointFilter class representing the base for the filters that smooth a pen's position
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "LatencyTrace.h"
+
+
+
+
+
+/** The base for the filters that smooth the jitter out of a single pen's position, in the IR camera coords,
+before it is warped to the screen.
+The filters use the reports' arrival times, so they handle irregular report intervals, and do no allocations
+per sample. Each filter reports its worst-case added latency, and the base measures the actual lag:
+for each sample taken while the pen is moving, the distance between the raw and filtered position divided by
+the pen's (filtered) speed. Used from a single thread; the lag statistics may be read from any thread. */
+class PointFilter
+{
+public:
+	PointFilter();
+
+	virtual ~PointFilter() {}
+
+	/** Filters the pen's position a_X, a_Y (in place), sampled at a_Time. */
+	void process(double & a_X, double & a_Y, Clock::time_point a_Time);
+
+	/** Forgets the pen's history, the next sample starts anew. To be called when the pen goes up. */
+	void reset();
+
+	/** Returns the statistics of the measured lag. */
+	DurationStats::Summary getLagStats() const { return m_Lag.getSummary(); }
+
+	/** Returns the worst-case latency that the filter adds, at the nominal report interval. */
+	virtual std::chrono::microseconds getMaxAddedLatency() const = 0;
+
+	/** Returns the (short, English) name of the filter, for logging. */
+	virtual const char * getName() const = 0;
+
+	/** Returns a new filter of the same kind and with the same params, but with no history and no statistics.
+	Used for creating a separate filter for each pen. */
+	virtual std::unique_ptr<PointFilter> clone() const = 0;
+
+
+	/** The nominal interval between two reports (100 Hz), used when the actual one is not known. */
+	static const std::chrono::microseconds NOMINAL_INTERVAL;
+
+protected:
+
+	/** If true, m_LastX, m_LastY and m_LastTime are valid. */
+	bool m_HasLast;
+
+	/** The previous filtered position, for the lag measurement. */
+	double m_LastX, m_LastY;
+
+	/** The time of the previous sample. */
+	Clock::time_point m_LastTime;
+
+	/** The measured lag. */
+	DurationStats m_Lag;
+
+
+	/** Filters the position in place. a_Dt is the time since the previous sample, in seconds,
+	zero for the first sample after creation or reset(). */
+	virtual void filter(double & a_X, double & a_Y, double a_Dt) = 0;
+
+	/** Forgets the filter-specific history. */
+	virtual void resetFilter() = 0;
+};
+
+typedef std::unique_ptr<PointFilter> PointFilterPtr;
+
+
+
+
@@ -9,42 +9,95 @@
 #include "Globals.h"
 #include "Processor.h"
 #include "Warper.h"
-
-
-
-
-
-Processor::Processor(const Warper & a_Warper, std::vector<WiimotePtr> & a_Wiimotes, const Wiimote * a_Wiimote):
-	m_Warper(a_Warper)
+#include "InputInjector.h"
+#include "FlightRecorder.h"
+#include "StageHistograms.h"
+
+
+
+
+
+Processor::Processor(
+	const Warper & a_Warper,
+	InputInjector & a_Injector,
+	std::vector<WiimotePtr> & a_Wiimotes,
+	const Wiimote * a_Wiimote,
+	const PenDebouncer::Config & a_DebounceConfig,
+	PointFilterPtr a_Filter,
+	const MotionPredictor::Config & a_PredictorConfig,
+	const PenTracker::Config & a_TrackerConfig
+):
+	m_Warper(a_Warper),
+	m_Injector(a_Injector),
+	m_InjectorSource(a_Injector.addSource()),
+	m_Tracker(a_TrackerConfig),
+	m_IsWatchingEveryReport(false),
+	m_NumPredicted(0),
+	m_NumPredictionsClamped(0)
 {
+	for (auto & pen: m_Pens)
+	{
+		pen.m_Debouncer.setConfig(a_DebounceConfig);
+		if (a_Filter != nullptr)
+		{
+			pen.m_Filter = a_Filter->clone();
+		}
+		pen.m_Predictor.setConfig(a_PredictorConfig);
+		pen.m_LastX = 0;
+		pen.m_LastY = 0;
+	}
+
 	// Set up the callbacks:
 	for (auto & w: a_Wiimotes)
 	{
 		if (w.get() == a_Wiimote)
 		{
+			m_Wiimote = w;
 			m_Callback =
-			[this](Wiimote & a_Wiimote)
+			[this](Wiimote & a_Wiimote, const Wiimote::Sample & a_Sample)
 			{
-				auto irState = a_Wiimote.getCurrentIRState();
-				if (irState.m_IsPresent1)
+				// While the debouncers are settled, only the IR changes matter:
+				if (!m_IsWatchingEveryReport && ((a_Sample.m_Changes & Wiimote::cmIR) == 0))
 				{
-					// The dot is visible, move the mouse:
-					auto screenPt = m_Warper.warp(a_Wiimote, {irState.m_X1, irState.m_Y1});
-					sendMouseInput(MOUSEEVENTF_MOVE, screenPt);
-					if (!m_OldState.m_IsPresent1)
-					{
-						sendMouseInput(MOUSEEVENTF_LEFTDOWN, screenPt);
-					}
+					return;
 				}
-				else if (m_OldState.m_IsPresent1)
+				auto trace = a_Sample.m_Trace;
+				auto arrivalTime = trace.m_Times[LatencyTrace::stArrival];
+
+				// Identify the pens, then process each one separately:
+				PenTracker::Observation observations[PenTracker::MAX_PENS];
+				m_Tracker.update(a_Sample.m_State.m_IRState, arrivalTime, observations);
+				MouseEvent events[2 * PenTracker::MAX_PENS];
+				size_t numEvents = 0;
+				bool isWarped = false;
+				bool isSettled = true;
+				for (int i = 0; i < PenTracker::MAX_PENS; ++i)
 				{
-					// The dot stopped being visible, emit a MouseUp
-					auto screenPt = m_Warper.warp(a_Wiimote, {m_OldState.m_X1, m_OldState.m_Y1});
-					sendMouseInput(MOUSEEVENTF_LEFTUP, screenPt);
+					isWarped = processPen(a_Wiimote, i, observations[i], arrivalTime, events, numEvents) || isWarped;
+					isSettled = isSettled && m_Pens[i].m_Debouncer.isSettled();
+				}
+				if (isWarped)
+				{
+					trace.mark(LatencyTrace::stWarped);
+					StageHistograms::get().record(
+						trace.m_Device, StageHistograms::hsWarp,
+						trace.m_Times[LatencyTrace::stWarped] - trace.m_Times[LatencyTrace::stDispatched]
+					);
+				}
+
+				// While a transition is pending, the debouncers need every report, even if the IR hasn't changed:
+				m_IsWatchingEveryReport = !isSettled;
+
+				// Queue all the report's events at once, so that they get injected together:
+				if (numEvents > 0)
+				{
+					a_Wiimote.getFlightRecorder().addEvents(events, numEvents, arrivalTime);
+					m_Injector.post(m_InjectorSource, events, numEvents, trace);
 				}
-				m_OldState = irState;
 			};
-			w->addCallback(&m_Callback);
+			// Subscribed to every report once and for all, the callback itself skips the reports it doesn't need;
+			// changing the interest on each pen transition would copy the subscriber table on the reader thread:
+			w->addCallback(&m_Callback, Wiimote::cmIR | Wiimote::cmEveryReport);
 		}
 	}
 }
@@ -53,17 +106,146 @@ Processor::Processor(const Warper & a_Warper, std::vector<WiimotePtr> & a_Wiimot
 
 
 
-void Processor::sendMouseInput(DWORD a_Flags, POINT a_Pos)
+Processor::~Processor()
+{
+	if (m_Wiimote != nullptr)
+	{
+		m_Wiimote->removeCallback(&m_Callback);
+	}
+}
+
+
+
+
+
+PenDebouncer::Stats Processor::getDebounceStats() const
+{
+	PenDebouncer::Stats res = {};
+	for (const auto & pen: m_Pens)
+	{
+		auto stats = pen.m_Debouncer.getStats();
+		res.m_NumGlitchesIgnored += stats.m_NumGlitchesIgnored;
+		res.m_NumDropoutsBridged += stats.m_NumDropoutsBridged;
+		res.m_NumSuppressedTransitions += stats.m_NumSuppressedTransitions;
+	}
+	return res;
+}
+
+
+
+
+
+Processor::PredictionStats Processor::getPredictionStats() const
+{
+	PredictionStats res;
+	res.m_NumPredicted = m_NumPredicted.load();
+	res.m_NumClamped = m_NumPredictionsClamped.load();
+	return res;
+}
+
+
+
+
+
+bool Processor::processPen(
+	Wiimote & a_Wiimote, int a_PenId, const PenTracker::Observation & a_Observation, Clock::time_point a_Time,
+	MouseEvent * a_Events, size_t & a_NumEvents
+)
+{
+	auto & pen = m_Pens[a_PenId];
+	auto action = pen.m_Debouncer.update(a_Observation.m_IsPresent, a_Observation.m_X, a_Observation.m_Y, a_Time);
+	if (action == PenDebouncer::actNone)
+	{
+		return false;
+	}
+
+	// Smooth the position; the pen goes up where it was last seen, and the next stroke starts anew:
+	if (action != PenDebouncer::actUp)
+	{
+		pen.m_LastX = pen.m_Debouncer.getX();
+		pen.m_LastY = pen.m_Debouncer.getY();
+		if (pen.m_Filter != nullptr)
+		{
+			pen.m_Filter->process(pen.m_LastX, pen.m_LastY, a_Time);
+		}
+	}
+	else if (pen.m_Filter != nullptr)
+	{
+		pen.m_Filter->reset();
+	}
+	auto screenPt = m_Warper.warp(a_Wiimote, pen.m_LastX, pen.m_LastY);
+
+	// Only the moves are predicted, the button transitions happen where the pen really is:
+	if (action == PenDebouncer::actUp)
+	{
+		pen.m_Predictor.reset();
+	}
+	else if (pen.m_Predictor.isEnabled())
+	{
+		pen.m_Predictor.addSample(screenPt.m_X, screenPt.m_Y, a_Time);
+	}
+	switch (action)
+	{
+		case PenDebouncer::actNone: break;
+		case PenDebouncer::actMove:
+		{
+			auto movePt = predict(a_Wiimote, pen, screenPt);
+			addMouseInput(a_Events, a_NumEvents, MouseEvent::metMove, a_PenId, movePt.m_X, movePt.m_Y);
+			break;
+		}
+		case PenDebouncer::actDown:
+		{
+			addMouseInput(a_Events, a_NumEvents, MouseEvent::metMove, a_PenId, screenPt.m_X, screenPt.m_Y);
+			addMouseInput(a_Events, a_NumEvents, MouseEvent::metLeftDown, a_PenId, screenPt.m_X, screenPt.m_Y);
+			break;
+		}
+		case PenDebouncer::actUp:
+		{
+			addMouseInput(a_Events, a_NumEvents, MouseEvent::metLeftUp, a_PenId, screenPt.m_X, screenPt.m_Y);
+			break;
+		}
+	}
+	return true;
+}
+
+
+
+
+
+Warper::Point Processor::predict(const Wiimote & a_Wiimote, Pen & a_Pen, Warper::Point a_ScreenPt)
+{
+	double x, y;
+	if (!a_Pen.m_Predictor.isEnabled() || !a_Pen.m_Predictor.predict(x, y))
+	{
+		return a_ScreenPt;
+	}
+
+	// The prediction overshoots when the pen stops or turns near the edge, keep it within the calibrated area:
+	if (m_Warper.clampToScreenQuad(a_Wiimote, x, y))
+	{
+		m_NumPredictionsClamped.fetch_add(1, std::memory_order_relaxed);
+	}
+	m_NumPredicted.fetch_add(1, std::memory_order_relaxed);
+	Warper::Point res =
+	{
+		static_cast<int>(std::floor(x + 0.5)),
+		static_cast<int>(std::floor(y + 0.5))
+	};
+	return res;
+}
+
+
+
+
+
+void Processor::addMouseInput(MouseEvent * a_Events, size_t & a_NumEvents, MouseEvent::Type a_Type, int a_PenId, int a_X, int a_Y)
 {
-	INPUT input;
-	input.type = INPUT_MOUSE;
-	input.mi.dwFlags = MOUSEEVENTF_ABSOLUTE | a_Flags;
-	input.mi.dx = a_Pos.x;
-	input.mi.dy = a_Pos.y;
-	input.mi.dwExtraInfo = 0;
-	input.mi.mouseData = 0;
-	input.mi.time = 0;
-	SendInput(1, &input, sizeof(INPUT));
+	auto & evt = a_Events[a_NumEvents];
+	evt.m_Type = a_Type;
+	evt.m_X = a_X;
+	evt.m_Y = a_Y;
+	evt.m_PenId = a_PenId;
+	a_NumEvents += 1;
 }
 
 
@@ -13,13 +13,19 @@
 
 
 #include "Wiimote.h"
+#include "OutputSink.h"
+#include "PenTracker.h"
+#include "PenDebouncer.h"
+#include "PointFilter.h"
+#include "MotionPredictor.h"
+#include "Warper.h"
 
 
 
 
 
 // fwd:
-class Warper;
+class InputInjector;
 
 
 
@@ -28,18 +34,109 @@ class Warper;
 class Processor
 {
 public:
-	Processor(const Warper & a_Warper, std::vector<WiimotePtr> & a_Wiimotes, const Wiimote * a_Wiimote);
+	/** The counters describing the motion prediction. */
+	struct PredictionStats
+	{
+		/** The number of moves emitted at a predicted position. */
+		uint64_t m_NumPredicted;
+
+		/** The number of predicted positions that were outside the calibrated screen quad and had to be clamped. */
+		uint64_t m_NumClamped;
+	};
+
+
+	/** Creates the processor for the specified Wiimote. Each pen gets its own debouncer, predictor, and a clone
+	of a_Filter (if given). */
+	Processor(
+		const Warper & a_Warper,
+		InputInjector & a_Injector,
+		std::vector<WiimotePtr> & a_Wiimotes,
+		const Wiimote * a_Wiimote,
+		const PenDebouncer::Config & a_DebounceConfig = PenDebouncer::Config(),
+		PointFilterPtr a_Filter = PointFilterPtr(),
+		const MotionPredictor::Config & a_PredictorConfig = MotionPredictor::Config(),
+		const PenTracker::Config & a_TrackerConfig = PenTracker::Config()
+	);
+
+	/** Unsubscribes from the Wiimote; once this returns, the callback is not running and won't be called anymore. */
+	~Processor();
+
+	/** Returns the counters of the pen transitions suppressed by the debouncing, summed over all the pens. */
+	PenDebouncer::Stats getDebounceStats() const;
+
+	/** Returns the filter smoothing the specified pen's position, nullptr if none. */
+	const PointFilter * getFilter(int a_PenId) const { return m_Pens[a_PenId].m_Filter.get(); }
+
+	/** Returns the motion prediction's config. */
+	const MotionPredictor::Config & getPredictorConfig() const { return m_Pens[0].m_Predictor.getConfig(); }
+
+	/** Returns the counters of the motion prediction. */
+	PredictionStats getPredictionStats() const;
+
+	/** Returns the counters of the pen tracking. */
+	PenTracker::Stats getTrackerStats() const { return m_Tracker.getStats(); }
 
 protected:
+
+	/** The state of a single pen, as identified by the tracker. */
+	struct Pen
+	{
+		/** Debounces the pen's visibility into the pen-down / pen-up transitions. */
+		PenDebouncer m_Debouncer;
+
+		/** The filter smoothing the pen's position (in the IR camera coords) before warping, nullptr if none. */
+		PointFilterPtr m_Filter;
+
+		/** Extrapolates the warped pen position forward, to hide the latency; only used for the moves. */
+		MotionPredictor m_Predictor;
+
+		/** The last position of the pen after filtering, used for the pen-up. */
+		double m_LastX, m_LastY;
+	};
+
+
 	const Warper & m_Warper;
 
-	Wiimote::IRState m_OldState;
+	/** The Wiimote whose reports are processed, kept alive until the callback is removed from it.
+	nullptr if the Wiimote wasn't found in the list given to the constructor. */
+	WiimotePtr m_Wiimote;
+
+	/** The injector that injects the mouse events from its own thread. */
+	InputInjector & m_Injector;
+
+	/** The source index of this processor within m_Injector. */
+	int m_InjectorSource;
+
+	/** Associates the IR dots into pens with stable IDs. */
+	PenTracker m_Tracker;
+
+	/** The pens, indexed by the pen ID assigned by m_Tracker. */
+	Pen m_Pens[PenTracker::MAX_PENS];
+
+	/** True while a debouncer has a transition pending, so the callback processes every report, not only the IR changes. */
+	bool m_IsWatchingEveryReport;
+
+	std::atomic<uint64_t> m_NumPredicted;
+	std::atomic<uint64_t> m_NumPredictionsClamped;
 
 	Wiimote::Callback m_Callback;
 
-	/** Sends the mouse input event with the specified flags and position.
-	Always adds the MOUSEEVENTF_ABSOLUTE flag. */
-	void sendMouseInput(DWORD a_Flags, POINT a_Pos);
+
+	/** Processes the specified pen's observation in a single frame, arriving at a_Time.
+	Appends the resulting mouse events to a_Events (see addMouseInput()).
+	Returns true if the pen's position has been warped. */
+	bool processPen(
+		Wiimote & a_Wiimote, int a_PenId, const PenTracker::Observation & a_Observation, Clock::time_point a_Time,
+		MouseEvent * a_Events, size_t & a_NumEvents
+	);
+
+	/** Returns the position for a move of the specified pen at a_ScreenPt: the predicted position, clamped to the
+	screen quad, if the prediction is enabled, a_ScreenPt otherwise. */
+	Warper::Point predict(const Wiimote & a_Wiimote, Pen & a_Pen, Warper::Point a_ScreenPt);
+
+	/** Appends the mouse input event of the specified type and pen at the specified position (normalized screen coords)
+	to a_Events, at index a_NumEvents, and increments a_NumEvents. */
+	static void addMouseInput(MouseEvent * a_Events, size_t & a_NumEvents, MouseEvent::Type a_Type, int a_PenId, int a_X, int a_Y);
 };
 
 typedef std::shared_ptr<Processor> ProcessorPtr;
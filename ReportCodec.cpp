@@ -0,0 +1,208 @@
+// ReportCodec.cpp
+
+// Implements the ReportCodec class representing the compact encoding of the records in the report captures
+
+
+
+
+
+#include "Globals.h"
+#include "ReportCodec.h"
+
+
+
+
+
+/** The maximum count of a single token. */
+static const size_t MAX_TOKEN_COUNT = 64;
+
+
+
+
+
+size_t ReportCodec::writeVarInt(uint64_t a_Value, unsigned char * a_Out)
+{
+	size_t res = 0;
+	while (a_Value >= 0x80)
+	{
+		a_Out[res++] = static_cast<unsigned char>(a_Value | 0x80);
+		a_Value >>= 7;
+	}
+	a_Out[res++] = static_cast<unsigned char>(a_Value);
+	return res;
+}
+
+
+
+
+
+bool ReportCodec::readVarInt(const unsigned char *& a_Pos, const unsigned char * a_End, uint64_t & a_Value)
+{
+	a_Value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		if (a_Pos >= a_End)
+		{
+			return false;
+		}
+		auto b = *a_Pos++;
+		a_Value |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+
+
+
+size_t ReportCodec::writeRecordHeader(const RecordHeader & a_Header, unsigned char * a_Out)
+{
+	a_Out[0] = static_cast<unsigned char>(a_Header.m_Type);
+	a_Out[1] = static_cast<unsigned char>(a_Header.m_Device);
+	auto zigzag = (static_cast<uint64_t>(a_Header.m_TimeDelta) << 1) ^ static_cast<uint64_t>(a_Header.m_TimeDelta >> 63);
+	size_t res = 2;
+	res += writeVarInt(zigzag, a_Out + res);
+	res += writeVarInt(a_Header.m_Size, a_Out + res);
+	return res;
+}
+
+
+
+
+
+bool ReportCodec::readRecordHeader(const unsigned char *& a_Pos, const unsigned char * a_End, RecordHeader & a_Header)
+{
+	if (a_Pos + 2 > a_End)
+	{
+		return false;
+	}
+	a_Header.m_Type = a_Pos[0];
+	a_Header.m_Device = a_Pos[1];
+	a_Pos += 2;
+	uint64_t zigzag, size;
+	if (!readVarInt(a_Pos, a_End, zigzag) || !readVarInt(a_Pos, a_End, size))
+	{
+		return false;
+	}
+	if (size > static_cast<uint64_t>(a_End - a_Pos))
+	{
+		return false;
+	}
+	a_Header.m_TimeDelta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+	a_Header.m_Size = static_cast<size_t>(size);
+	return true;
+}
+
+
+
+
+
+size_t ReportCodec::encodeReport(const unsigned char * a_Report, const unsigned char * a_Reference, size_t a_Size, unsigned char * a_Out)
+{
+	size_t res = 0;
+	size_t i = 0;
+	while (i < a_Size)
+	{
+		size_t end = i + 1;
+		if (a_Report[i] == a_Reference[i])
+		{
+			// A run of unchanged bytes; omitted altogether if it reaches the end:
+			while ((end < a_Size) && (a_Report[end] == a_Reference[end]))
+			{
+				++end;
+			}
+			if (end == a_Size)
+			{
+				break;
+			}
+			for (auto count = end - i; count > 0; count -= std::min(count, MAX_TOKEN_COUNT))
+			{
+				a_Out[res++] = static_cast<unsigned char>(tokSkip | (std::min(count, MAX_TOKEN_COUNT) - 1));
+			}
+		}
+		else if (a_Report[i] == 0xff)
+		{
+			// A run of 0xff filler (absent dots):
+			while ((end < a_Size) && (a_Report[end] == 0xff))
+			{
+				++end;
+			}
+			for (auto count = end - i; count > 0; count -= std::min(count, MAX_TOKEN_COUNT))
+			{
+				a_Out[res++] = static_cast<unsigned char>(tokFill | (std::min(count, MAX_TOKEN_COUNT) - 1));
+			}
+		}
+		else
+		{
+			// A run of changed bytes, copied verbatim:
+			while ((end < a_Size) && (end - i < MAX_TOKEN_COUNT) && (a_Report[end] != a_Reference[end]) && (a_Report[end] != 0xff))
+			{
+				++end;
+			}
+			a_Out[res++] = static_cast<unsigned char>(tokLiteral | (end - i - 1));
+			memcpy(a_Out + res, a_Report + i, end - i);
+			res += end - i;
+		}
+		i = end;
+	}
+	return res;
+}
+
+
+
+
+
+bool ReportCodec::decodeReport(const unsigned char * a_Code, size_t a_CodeSize, const unsigned char * a_Reference, size_t a_Size, unsigned char * a_Report)
+{
+	if (a_Report != a_Reference)
+	{
+		memcpy(a_Report, a_Reference, a_Size);
+	}
+	size_t i = 0;
+	auto end = a_Code + a_CodeSize;
+	while (a_Code < end)
+	{
+		auto token = *a_Code++;
+		size_t count = static_cast<size_t>(token & 0x3f) + 1;
+		if (i + count > a_Size)
+		{
+			return false;
+		}
+		switch (token & 0xc0)
+		{
+			case tokSkip:
+			{
+				break;
+			}
+			case tokLiteral:
+			{
+				if (count > static_cast<size_t>(end - a_Code))
+				{
+					return false;
+				}
+				memcpy(a_Report + i, a_Code, count);
+				a_Code += count;
+				break;
+			}
+			case tokFill:
+			{
+				memset(a_Report + i, 0xff, count);
+				break;
+			}
+			default:
+			{
+				return false;
+			}
+		}
+		i += count;
+	}
+	return true;
+}
+
+
+
+
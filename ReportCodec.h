@@ -0,0 +1,90 @@
+// ReportCodec.h
+
+// Declares the ReportCodec class representing the compact encoding of the records in the report captures
+
+
+
+
+
+#pragma once
+
+
+
+
+
+/** The compact encoding of the report captures' records, shared by the writer (ReportLog) and the reader (ReportReplay).
+
+Each record starts with a header:
+	u8 type, u8 device, varint time delta (zigzag-coded, microseconds since the previous record), varint payload size.
+The numbers are varints of 7 bits per byte, the lowest first, the top bit set on all but the last byte.
+
+The reports are coded against a reference report of the same size: the device's previous report for the delta
+records, all zeroes for the key records. The code is a sequence of tokens, each a single byte with the operation
+in the top two bits and the count minus one (1 .. 64) in the bottom six bits:
+	- tokSkip: the next count bytes are the same as in the reference;
+	- tokLiteral: the next count bytes follow the token;
+	- tokFill: the next count bytes are all 0xff (the absent IR dots).
+The bytes after the last token are the same as in the reference. An unchanged report is thus coded as no tokens at all,
+a moving pen with the other dots absent usually as a few literal bytes of the dot and the accelerometer. */
+class ReportCodec
+{
+public:
+	/** The decoded header of a single record. */
+	struct RecordHeader
+	{
+		int m_Type;
+		int m_Device;
+
+		/** The time since the previous record, in microseconds; may be negative, the devices append concurrently. */
+		int64_t m_TimeDelta;
+
+		/** The number of payload bytes following the header. */
+		size_t m_Size;
+	};
+
+
+	/** The maximum size of an encoded record header. */
+	static const size_t MAX_RECORD_HEADER_SIZE = 2 + 10 + 10;
+
+	/** The maximum size of the tokens coding a report of the specified size
+	(single changed bytes alternating with the other tokens, in the worst case). */
+	static size_t getMaxCodedSize(size_t a_ReportSize) { return 2 * a_ReportSize; }
+
+
+	/** Writes the varint-coded number into a_Out, returns the number of bytes written (at most 10). */
+	static size_t writeVarInt(uint64_t a_Value, unsigned char * a_Out);
+
+	/** Reads a varint-coded number from a_Pos, not reading past a_End, and advances a_Pos past it.
+	Returns false if the number is truncated or too long. */
+	static bool readVarInt(const unsigned char *& a_Pos, const unsigned char * a_End, uint64_t & a_Value);
+
+	/** Writes the record header into a_Out (at least MAX_RECORD_HEADER_SIZE bytes), returns the number of bytes written. */
+	static size_t writeRecordHeader(const RecordHeader & a_Header, unsigned char * a_Out);
+
+	/** Reads a record header from a_Pos, not reading past a_End, and advances a_Pos past it.
+	Returns false if the header or its payload is truncated. */
+	static bool readRecordHeader(const unsigned char *& a_Pos, const unsigned char * a_End, RecordHeader & a_Header);
+
+	/** Codes a_Report against a_Reference, both a_Size bytes, into a_Out (at least getMaxCodedSize() bytes).
+	Returns the number of bytes written. */
+	static size_t encodeReport(const unsigned char * a_Report, const unsigned char * a_Reference, size_t a_Size, unsigned char * a_Out);
+
+	/** Decodes the tokens against a_Reference, both a_Size bytes, into a_Report (may be the same as a_Reference).
+	Returns false if the tokens are malformed or exceed a_Size. */
+	static bool decodeReport(const unsigned char * a_Code, size_t a_CodeSize, const unsigned char * a_Reference, size_t a_Size, unsigned char * a_Report);
+
+
+protected:
+
+	/** The token operations, in the top two bits of the token. */
+	enum
+	{
+		tokSkip    = 0x00,
+		tokLiteral = 0x40,
+		tokFill    = 0x80,
+	};
+};
+
+
+
+
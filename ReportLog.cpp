@@ -0,0 +1,346 @@
+// ReportLog.cpp
+
+// Implements the ReportLog class representing the capture of the raw Wiimote reports into a binary file
+
+
+
+
+
+#include "Globals.h"
+#include "ReportLog.h"
+#include "Calibration.h"
+#include <cstddef>
+
+
+
+
+
+/** The size of the file when created, and the step in which it grows. */
+static const size_t FILE_CHUNK_SIZE = 1024 * 1024;
+
+/** The size of the accelerometer calibration at the start of the rtDevice payload. */
+static const size_t ACCEL_CALIBRATION_SIZE = 6;
+
+/** The maximum size of a single report that is logged; the longer ones are truncated. */
+static const size_t MAX_REPORT_SIZE = 255;
+
+
+
+
+
+const char ReportLog::FILE_MAGIC[4] = {'W', 'W', 'R', 'L'};
+const char ReportLog::TRAILER_MAGIC[4] = {'W', 'W', 'R', 'I'};
+
+
+
+
+
+ReportLog::ReportLog():
+	m_Used(0),
+	m_NumRecords(0),
+	m_NumReportBytes(0),
+	m_LastTime(0),
+	m_LastSyncTime(-1)
+{
+}
+
+
+
+
+
+ReportLog::~ReportLog()
+{
+	close();
+}
+
+
+
+
+
+bool ReportLog::create(const std::string & a_FileName)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (!m_File.create(a_FileName, FILE_CHUNK_SIZE))
+	{
+		return false;
+	}
+	FileHeader header;
+	memcpy(header.m_Magic, FILE_MAGIC, sizeof(header.m_Magic));
+	header.m_Version = FILE_VERSION;
+	header.m_DataSize = 0;
+	header.m_TrailerOffset = 0;
+	memcpy(m_File.getData(), &header, sizeof(header));
+	m_Used = sizeof(header);
+	m_Devices.clear();
+	m_NumRecords = 0;
+	m_NumReportBytes = 0;
+	m_StartTime = Clock::now();
+	m_LastTime = 0;
+	m_LastSyncTime = -1;
+	m_Metadata.clear();
+	m_Index.clear();
+	return true;
+}
+
+
+
+
+
+void ReportLog::close()
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (!m_File.isOpen())
+	{
+		return;
+	}
+
+	// Write the trailer after the records:
+	TrailerHeader trailer;
+	memcpy(trailer.m_Magic, TRAILER_MAGIC, sizeof(trailer.m_Magic));
+	trailer.m_MetadataSize = static_cast<uint32_t>(m_Metadata.size());
+	trailer.m_NumIndexEntries = m_Index.size();
+	trailer.m_EndTime = m_LastTime;
+	auto indexSize = m_Index.size() * sizeof(IndexEntry);
+	auto trailerOffset = m_Used;
+	if (reserveLocked(sizeof(trailer) + m_Metadata.size() + indexSize))
+	{
+		auto dst = m_File.getData() + trailerOffset;
+		memcpy(dst, &trailer, sizeof(trailer));
+		dst += sizeof(trailer);
+		if (!m_Metadata.empty())
+		{
+			memcpy(dst, m_Metadata.data(), m_Metadata.size());
+			dst += m_Metadata.size();
+		}
+		if (!m_Index.empty())
+		{
+			memcpy(dst, m_Index.data(), indexSize);
+		}
+		uint64_t offset = trailerOffset;
+		memcpy(m_File.getData() + offsetof(FileHeader, m_TrailerOffset), &offset, sizeof(offset));
+		m_Used += sizeof(trailer) + m_Metadata.size() + indexSize;
+	}
+	if (m_File.isOpen())
+	{
+		m_File.close(m_Used);
+	}
+}
+
+
+
+
+
+int ReportLog::addDevice(const std::string & a_Name, const Wiimote::AccelCalibration & a_AccelCalibration)
+{
+	auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(m_CS);
+	if (!m_File.isOpen() || (m_Devices.size() >= static_cast<size_t>(MAX_DEVICES)))
+	{
+		return -1;
+	}
+	unsigned char payload[ACCEL_CALIBRATION_SIZE + 249];
+	payload[0] = a_AccelCalibration.m_X0;
+	payload[1] = a_AccelCalibration.m_Y0;
+	payload[2] = a_AccelCalibration.m_Z0;
+	payload[3] = a_AccelCalibration.m_XG;
+	payload[4] = a_AccelCalibration.m_YG;
+	payload[5] = a_AccelCalibration.m_ZG;
+	auto nameSize = std::min(a_Name.size(), sizeof(payload) - ACCEL_CALIBRATION_SIZE);
+	memcpy(payload + ACCEL_CALIBRATION_SIZE, a_Name.data(), nameSize);
+	auto device = static_cast<int>(m_Devices.size());
+	Device dev;
+	dev.m_LastIRMode = 0;
+	dev.m_HasLastReport = false;
+	m_Devices.push_back(dev);
+	appendLocked(rtDevice, device, toLogTime(now), payload, ACCEL_CALIBRATION_SIZE + nameSize, true);
+	return device;
+}
+
+
+
+
+
+void ReportLog::addReport(int a_Device, int a_IRMode, const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	if ((a_Device < 0) || (a_Device >= static_cast<int>(m_Devices.size())) || !m_File.isOpen())
+	{
+		return;
+	}
+	auto time = toLogTime(a_ArrivalTime);
+	auto size = std::min(a_Size, MAX_REPORT_SIZE);
+	m_NumReportBytes += size;
+
+	// Start a new sync point, if due; all the devices' next reports will be key reports:
+	if ((m_LastSyncTime < 0) || (time - m_LastSyncTime >= SYNC_INTERVAL_USEC))
+	{
+		IndexEntry entry;
+		entry.m_Time = time;
+		entry.m_Offset = m_Used;
+		appendLocked(rtSync, 0, time, &time, sizeof(time));
+		m_Index.push_back(entry);
+		m_LastSyncTime = time;
+		for (auto & d: m_Devices)
+		{
+			d.m_HasLastReport = false;
+		}
+	}
+
+	// Code the report against the previous one, or against zeroes if there is no usable previous one:
+	auto & dev = m_Devices[a_Device];
+	unsigned char payload[2 + 2 * MAX_REPORT_SIZE];
+	size_t payloadSize;
+	if (dev.m_HasLastReport && (dev.m_LastIRMode == a_IRMode) && (dev.m_LastReport.size() == size))
+	{
+		payloadSize = ReportCodec::encodeReport(a_Report, dev.m_LastReport.data(), size, payload);
+		appendLocked(rtDeltaReport, a_Device, time, payload, payloadSize);
+	}
+	else
+	{
+		static const unsigned char zeroes[MAX_REPORT_SIZE] = {};
+		payload[0] = static_cast<unsigned char>(a_IRMode);
+		payload[1] = static_cast<unsigned char>(size);
+		payloadSize = 2 + ReportCodec::encodeReport(a_Report, zeroes, size, payload + 2);
+		appendLocked(rtKeyReport, a_Device, time, payload, payloadSize);
+	}
+	dev.m_LastReport.assign(a_Report, a_Report + size);
+	dev.m_LastIRMode = a_IRMode;
+	dev.m_HasLastReport = true;
+}
+
+
+
+
+
+void ReportLog::addCalibration(const Calibration & a_Calibration)
+{
+	auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(m_CS);
+	for (const auto & m: a_Calibration.getMappings())
+	{
+		auto device = m.first->getReportLogDevice();
+		if ((device < 0) || (device >= static_cast<int>(m_Devices.size())))
+		{
+			continue;
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			const auto & pt = m.second.m_Points[i];
+			if (!pt.m_IsValid)
+			{
+				continue;
+			}
+			unsigned char payload[1 + 4 * sizeof(int32_t)];
+			int32_t coords[4] = {pt.m_WiimoteX, pt.m_WiimoteY, pt.m_ScreenX, pt.m_ScreenY};
+			payload[0] = static_cast<unsigned char>(i);
+			memcpy(payload + 1, coords, sizeof(coords));
+			appendLocked(rtCalibration, device, toLogTime(now), payload, sizeof(payload), true);
+		}
+	}
+}
+
+
+
+
+
+uint64_t ReportLog::getNumRecords() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_NumRecords;
+}
+
+
+
+
+
+uint64_t ReportLog::getNumBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_Used;
+}
+
+
+
+
+
+uint64_t ReportLog::getNumReportBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	return m_NumReportBytes;
+}
+
+
+
+
+
+void ReportLog::appendLocked(RecordType a_Type, int a_Device, int64_t a_Time, const void * a_Payload, size_t a_Size, bool a_Metadata)
+{
+	if (!m_File.isOpen())
+	{
+		return;
+	}
+
+	ReportCodec::RecordHeader header;
+	header.m_Type = a_Type;
+	header.m_Device = a_Device;
+	header.m_TimeDelta = a_Time - m_LastTime;
+	header.m_Size = a_Size;
+	unsigned char headerBytes[ReportCodec::MAX_RECORD_HEADER_SIZE];
+	auto headerSize = ReportCodec::writeRecordHeader(header, headerBytes);
+	if (!reserveLocked(headerSize + a_Size))
+	{
+		return;
+	}
+	auto dst = m_File.getData() + m_Used;
+	memcpy(dst, headerBytes, headerSize);
+	memcpy(dst + headerSize, a_Payload, a_Size);
+	m_Used += headerSize + a_Size;
+	m_NumRecords += 1;
+	m_LastTime = a_Time;
+
+	// Publish the record in the file header:
+	uint64_t dataSize = m_Used - sizeof(FileHeader);
+	memcpy(m_File.getData() + offsetof(FileHeader, m_DataSize), &dataSize, sizeof(dataSize));
+
+	// Keep a copy for the trailer; the time is meaningless there:
+	if (a_Metadata)
+	{
+		header.m_TimeDelta = 0;
+		auto copySize = ReportCodec::writeRecordHeader(header, headerBytes);
+		m_Metadata.insert(m_Metadata.end(), headerBytes, headerBytes + copySize);
+		auto payload = static_cast<const unsigned char *>(a_Payload);
+		m_Metadata.insert(m_Metadata.end(), payload, payload + a_Size);
+	}
+}
+
+
+
+
+
+bool ReportLog::reserveLocked(size_t a_Size)
+{
+	if (m_Used + a_Size <= m_File.getSize())
+	{
+		return true;
+	}
+	auto newSize = m_File.getSize() + std::max(FILE_CHUNK_SIZE, a_Size);
+	if (!m_File.resize(newSize))
+	{
+		LOG("Cannot grow the report log, the capture stops here");
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+int64_t ReportLog::toLogTime(Clock::time_point a_Time) const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(a_Time - m_StartTime).count();
+}
+
+
+
+
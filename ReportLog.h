@@ -0,0 +1,230 @@
+// ReportLog.h
+
+// Declares the ReportLog class representing the capture of the raw Wiimote reports into a binary file
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <mutex>
+#include "MappedFile.h"
+#include "ReportCodec.h"
+#include "Wiimote.h"
+
+
+
+
+
+class Calibration;
+
+
+
+
+
+/** Appends the raw input reports of the Wiimotes, with their arrival times and device identities, into a compact
+binary file, so that a session can be replayed later through the whole pipeline (see ReportReplay).
+The file is memory-mapped and grows in chunks, so appending a report is a copy into memory, with no OS call
+in the common case. The header's data size is updated after each record, so a crashed session's capture stays readable.
+The reports are delta-coded against the device's previous report (see ReportCodec), so that a long capture of many
+Wiimotes stays small; a sync record every SYNC_INTERVAL_USEC restarts the coding, so that the replay can start there.
+
+The file format (all numbers little-endian):
+	FileHeader, then the records back to back (see ReportCodec for the record header), then the trailer.
+	- rtDevice: the record's device is the new device's index, the payload is the 6 bytes of the accelerometer
+		calibration (X0, Y0, Z0, XG, YG, ZG) followed by the device's name.
+	- rtCalibration: the payload is the calibration point index (u8) and 4 int32 numbers:
+		Wiimote X, Wiimote Y, screen X, screen Y.
+	- rtKeyReport: the payload is the IR reporting mode in effect (u8), the report size (u8) and the report coded
+		against all zeroes.
+	- rtDeltaReport: the payload is the report coded against the device's previous report, with the same IR mode.
+	- rtSync: the payload is the record's time (int64); the devices' next reports are key reports.
+The record times are microseconds since the creation of the log, each record stores the delta from the previous one.
+The trailer, written by close(), consists of the TrailerHeader, a copy of all the rtDevice and rtCalibration records
+and the IndexEntry of each rtSync record, so that the reader needn't scan the whole file. If the trailer is missing
+(the capture was not closed), the reader rebuilds it by scanning the records.
+Thread-safe; each Wiimote appends from its own reading context. */
+class ReportLog
+{
+public:
+	/** The types of the records in the file. */
+	enum RecordType
+	{
+		rtDevice = 1,
+		rtKeyReport = 2,
+		rtCalibration = 3,
+		rtDeltaReport = 4,
+		rtSync = 5,
+	};
+
+
+	// The on-disk structures are packed, they're only ever accessed through memcpy():
+	#pragma pack(push, 1)
+
+	/** The header at the start of the file. */
+	struct FileHeader
+	{
+		/** FILE_MAGIC */
+		char m_Magic[4];
+
+		/** FILE_VERSION */
+		uint32_t m_Version;
+
+		/** The number of bytes of the records following the header. */
+		uint64_t m_DataSize;
+
+		/** The offset of the trailer from the start of the file, 0 if the log has not been closed. */
+		uint64_t m_TrailerOffset;
+	};
+
+
+	/** The header of the trailer. */
+	struct TrailerHeader
+	{
+		/** TRAILER_MAGIC */
+		char m_Magic[4];
+
+		/** The number of bytes of the copied rtDevice and rtCalibration records following this header. */
+		uint32_t m_MetadataSize;
+
+		/** The number of IndexEntry items following the records. */
+		uint64_t m_NumIndexEntries;
+
+		/** The time of the last record. */
+		int64_t m_EndTime;
+	};
+
+
+	/** A single entry of the seek index. */
+	struct IndexEntry
+	{
+		/** The time of the rtSync record. */
+		int64_t m_Time;
+
+		/** The offset of the rtSync record from the start of the file. */
+		uint64_t m_Offset;
+	};
+
+	#pragma pack(pop)
+
+
+	/** The magic bytes identifying the file format. */
+	static const char FILE_MAGIC[4];
+
+	/** The magic bytes identifying the trailer. */
+	static const char TRAILER_MAGIC[4];
+
+	/** The version of the file format. */
+	static const uint32_t FILE_VERSION = 2;
+
+	/** The maximum number of devices in a single log (the device index is a single byte). */
+	static const int MAX_DEVICES = 255;
+
+	/** The interval between the sync records, in microseconds; the granularity of seeking. */
+	static const int64_t SYNC_INTERVAL_USEC = 1000000;
+
+
+	ReportLog();
+
+	/** Closes the file, see close(). */
+	~ReportLog();
+
+	/** Creates (or overwrites) the specified file and starts the log's time.
+	Returns true on success, false on failure (logged). */
+	bool create(const std::string & a_FileName);
+
+	/** Writes the trailer and the final size of the file and closes it. Any further records are dropped. */
+	void close();
+
+	/** Adds a new device to the log and returns its index for the other records.
+	Returns -1 if the log is not open or already has MAX_DEVICES devices. */
+	int addDevice(const std::string & a_Name, const Wiimote::AccelCalibration & a_AccelCalibration);
+
+	/** Appends the raw report received from the specified device at the specified time.
+	a_IRMode is the IR reporting mode with which the report is to be parsed. */
+	void addReport(int a_Device, int a_IRMode, const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime);
+
+	/** Appends the points of the calibration, for all the Wiimotes that are logging into this log. */
+	void addCalibration(const Calibration & a_Calibration);
+
+	/** Returns the number of records written so far. */
+	uint64_t getNumRecords() const;
+
+	/** Returns the number of bytes written so far, including the file header. */
+	uint64_t getNumBytes() const;
+
+	/** Returns the total size of the reports logged so far, before coding them. */
+	uint64_t getNumReportBytes() const;
+
+
+protected:
+
+	/** The coding state of a single device. */
+	struct Device
+	{
+		/** The device's previous report, the reference for coding the next one. */
+		std::vector<unsigned char> m_LastReport;
+
+		/** The IR mode of the previous report. */
+		int m_LastIRMode;
+
+		/** Set if m_LastReport is valid, i.e. there has been a report since the last sync. */
+		bool m_HasLastReport;
+	};
+
+
+	/** Protects all the members against multithreaded access. */
+	mutable std::mutex m_CS;
+
+	/** The mapped file. */
+	MappedFile m_File;
+
+	/** The number of bytes used in m_File, including the file header. */
+	size_t m_Used;
+
+	/** The coding state of the devices added so far. */
+	std::vector<Device> m_Devices;
+
+	/** The number of records written so far. */
+	uint64_t m_NumRecords;
+
+	/** The total size of the reports logged so far, before coding. */
+	uint64_t m_NumReportBytes;
+
+	/** The time when the log was created, the records' times are relative to it. */
+	Clock::time_point m_StartTime;
+
+	/** The time of the last record written, in microseconds since m_StartTime. */
+	int64_t m_LastTime;
+
+	/** The time of the last sync record, in microseconds since m_StartTime; -1 if there hasn't been any. */
+	int64_t m_LastSyncTime;
+
+	/** The copies of the rtDevice and rtCalibration records, for the trailer. */
+	std::vector<unsigned char> m_Metadata;
+
+	/** The seek index, for the trailer. */
+	std::vector<IndexEntry> m_Index;
+
+
+	/** Appends a single record with the specified payload, growing the file as needed.
+	If a_Metadata is true, the record is also copied into m_Metadata.
+	Must be called with m_CS held. */
+	void appendLocked(RecordType a_Type, int a_Device, int64_t a_Time, const void * a_Payload, size_t a_Size, bool a_Metadata = false);
+
+	/** Makes sure there are at least a_Size more bytes mapped after m_Used, growing the file if needed.
+	Returns false if the file cannot grow (logged). Must be called with m_CS held. */
+	bool reserveLocked(size_t a_Size);
+
+	/** Returns the specified time as microseconds since m_StartTime. */
+	int64_t toLogTime(Clock::time_point a_Time) const;
+};
+
+
+
+
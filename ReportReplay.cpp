@@ -0,0 +1,434 @@
+// ReportReplay.cpp
+
+// Implements the ReportReplay class representing the driver feeding a captured report log back through the Wiimotes
+
+
+
+
+
+#include "Globals.h"
+#include "ReportReplay.h"
+#include <thread>
+
+
+
+
+
+/** The size of the accelerometer calibration at the start of the rtDevice payload. */
+static const size_t ACCEL_CALIBRATION_SIZE = 6;
+
+
+
+
+
+ReportReplay::ReportReplay():
+	m_DataEnd(0),
+	m_Calibration(std::make_shared<Calibration>()),
+	m_Duration(0),
+	m_StartOffset(0),
+	m_StartTime(0),
+	m_ShouldStop(false),
+	m_ReadOffset(0),
+	m_ReadTime(0),
+	m_NumSkipped(0)
+{
+}
+
+
+
+
+
+bool ReportReplay::open(const std::string & a_FileName)
+{
+	m_File.close();
+	m_Wiimotes.clear();
+	m_Calibration = std::make_shared<Calibration>();
+	m_Index.clear();
+	m_Duration = std::chrono::microseconds(0);
+	if (!m_File.open(a_FileName))
+	{
+		return false;
+	}
+
+	// Check the header:
+	ReportLog::FileHeader header;
+	if (m_File.getSize() < sizeof(header))
+	{
+		LOG("File \"%s\" is not a report capture, it is too small", a_FileName.c_str());
+		m_File.close();
+		return false;
+	}
+	memcpy(&header, m_File.getData(), sizeof(header));
+	if ((memcmp(header.m_Magic, ReportLog::FILE_MAGIC, sizeof(header.m_Magic)) != 0) || (header.m_Version != ReportLog::FILE_VERSION))
+	{
+		LOG("File \"%s\" is not a report capture of a supported version", a_FileName.c_str());
+		m_File.close();
+		return false;
+	}
+	m_DataEnd = static_cast<size_t>(std::min<uint64_t>(sizeof(header) + header.m_DataSize, m_File.getSize()));
+	m_StartOffset = sizeof(header);
+	m_StartTime = 0;
+
+	// Create the devices, read the calibration and the index, preferably from the trailer:
+	if (!readTrailer(header))
+	{
+		LOG("File \"%s\" has no index (the capture hasn't been closed), rebuilding it", a_FileName.c_str());
+		m_Wiimotes.clear();
+		m_Calibration = std::make_shared<Calibration>();
+		m_Index.clear();
+		scanRecords();
+	}
+	LOG("Opened report capture \"%s\": %u devices, %.1f seconds, %u bytes of records",
+		a_FileName.c_str(), static_cast<unsigned>(m_Wiimotes.size()), m_Duration.count() / 1e6,
+		static_cast<unsigned>(m_DataEnd - sizeof(header))
+	);
+	rewind();
+	return true;
+}
+
+
+
+
+
+std::chrono::microseconds ReportReplay::seek(std::chrono::microseconds a_Time)
+{
+	m_StartOffset = sizeof(ReportLog::FileHeader);
+	m_StartTime = 0;
+	auto itr = std::upper_bound(m_Index.begin(), m_Index.end(), a_Time.count(),
+		[](int64_t a_Time, const ReportLog::IndexEntry & a_Entry)
+		{
+			return (a_Time < a_Entry.m_Time);
+		}
+	);
+	if (itr == m_Index.begin())
+	{
+		rewind();
+		return std::chrono::microseconds(0);
+	}
+	--itr;
+
+	// The sync record's time delta is relative to the record before it, so the time base is taken from its payload:
+	m_StartOffset = static_cast<size_t>(itr->m_Offset);
+	size_t offset = m_StartOffset;
+	int64_t time = 0;
+	Record rec;
+	if (
+		!readRecord(offset, m_DataEnd, time, rec) ||
+		(rec.m_Type != ReportLog::rtSync) ||
+		(rec.m_Size != sizeof(int64_t))
+	)
+	{
+		LOG("The capture's index doesn't match its records, replaying from the start");
+		m_StartOffset = sizeof(ReportLog::FileHeader);
+		rewind();
+		return std::chrono::microseconds(0);
+	}
+	int64_t syncTime;
+	memcpy(&syncTime, rec.m_Payload, sizeof(syncTime));
+	m_StartTime = syncTime - time;  // time is the sync record's time delta
+	rewind();
+	return std::chrono::microseconds(syncTime);
+}
+
+
+
+
+
+ReportReplay::Stats ReportReplay::run(Speed a_Speed)
+{
+	Stats res;
+	res.m_NumReports = 0;
+	res.m_NumSkipped = 0;
+	res.m_CapturedDuration = std::chrono::microseconds(0);
+	res.m_ElapsedTime = std::chrono::microseconds(0);
+	m_ShouldStop = false;
+	rewind();
+
+	// The captured times are mapped onto the replay's time so that the first report arrives right now:
+	auto startTime = Clock::now();
+	auto hasFirst = false;
+	std::chrono::microseconds firstTime(0);
+	Report report;
+	while (!m_ShouldStop.load(std::memory_order_relaxed) && readReport(report))
+	{
+		if (!hasFirst)
+		{
+			firstTime = report.m_Time;
+			hasFirst = true;
+		}
+		auto arrivalTime = startTime + (report.m_Time - firstTime);
+		if (a_Speed == rsRealTime)
+		{
+			std::this_thread::sleep_until(arrivalTime);
+			arrivalTime = Clock::now();
+		}
+		m_Wiimotes[report.m_Device]->replayReport(report.m_Data, report.m_Size, report.m_IRMode, arrivalTime);
+		res.m_NumReports += 1;
+		res.m_CapturedDuration = report.m_Time - firstTime;
+	}
+	res.m_NumSkipped = m_NumSkipped;
+	res.m_ElapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime);
+	return res;
+}
+
+
+
+
+
+void ReportReplay::rewind()
+{
+	m_Devices.resize(m_Wiimotes.size());
+	for (auto & d: m_Devices)
+	{
+		d.m_IRMode = Wiimote::irrmOff;
+		d.m_HasLastReport = false;
+	}
+	m_ReadOffset = m_StartOffset;
+	m_ReadTime = m_StartTime;
+	m_NumSkipped = 0;
+}
+
+
+
+
+
+bool ReportReplay::readReport(Report & a_Report)
+{
+	Record rec;
+	while (readRecord(m_ReadOffset, m_DataEnd, m_ReadTime, rec))
+	{
+		size_t size = 0;
+		switch (rec.m_Type)
+		{
+			case ReportLog::rtKeyReport:
+			{
+				static const unsigned char zeroes[sizeof(m_Report)] = {};
+				if (
+					(rec.m_Device >= static_cast<int>(m_Devices.size())) ||
+					(rec.m_Size < 2) ||
+					!ReportCodec::decodeReport(rec.m_Payload + 2, rec.m_Size - 2, zeroes, rec.m_Payload[1], m_Report)
+				)
+				{
+					m_NumSkipped += 1;
+					continue;
+				}
+				size = rec.m_Payload[1];
+				auto & dev = m_Devices[rec.m_Device];
+				dev.m_IRMode = static_cast<Wiimote::IRReportingMode>(rec.m_Payload[0]);
+				dev.m_LastReport.assign(m_Report, m_Report + size);
+				dev.m_HasLastReport = true;
+				break;
+			}
+			case ReportLog::rtDeltaReport:
+			{
+				if (
+					(rec.m_Device >= static_cast<int>(m_Devices.size())) ||
+					!m_Devices[rec.m_Device].m_HasLastReport
+				)
+				{
+					m_NumSkipped += 1;
+					continue;
+				}
+				auto & dev = m_Devices[rec.m_Device];
+				size = dev.m_LastReport.size();
+				if (!ReportCodec::decodeReport(rec.m_Payload, rec.m_Size, dev.m_LastReport.data(), size, dev.m_LastReport.data()))
+				{
+					dev.m_HasLastReport = false;
+					m_NumSkipped += 1;
+					continue;
+				}
+				memcpy(m_Report, dev.m_LastReport.data(), size);
+				break;
+			}
+			case ReportLog::rtSync:
+			{
+				for (auto & d: m_Devices)
+				{
+					d.m_HasLastReport = false;
+				}
+				continue;
+			}
+			case ReportLog::rtDevice:
+			case ReportLog::rtCalibration:
+			{
+				continue;
+			}
+			default:
+			{
+				m_NumSkipped += 1;
+				continue;
+			}
+		}
+		a_Report.m_Device = rec.m_Device;
+		a_Report.m_Time = std::chrono::microseconds(rec.m_Time);
+		a_Report.m_IRMode = m_Devices[rec.m_Device].m_IRMode;
+		a_Report.m_Data = m_Report;
+		a_Report.m_Size = size;
+		return true;
+	}
+	return false;
+}
+
+
+
+
+
+bool ReportReplay::readRecord(size_t & a_Offset, size_t a_End, int64_t & a_Time, Record & a_Record) const
+{
+	auto pos = m_File.getData() + a_Offset;
+	auto end = m_File.getData() + a_End;
+	ReportCodec::RecordHeader header;
+	if ((a_Offset >= a_End) || !ReportCodec::readRecordHeader(pos, end, header))
+	{
+		return false;
+	}
+	a_Time += header.m_TimeDelta;
+	a_Record.m_Type = header.m_Type;
+	a_Record.m_Device = header.m_Device;
+	a_Record.m_Time = a_Time;
+	a_Record.m_Payload = pos;
+	a_Record.m_Size = header.m_Size;
+	a_Offset = static_cast<size_t>(pos - m_File.getData()) + header.m_Size;
+	return true;
+}
+
+
+
+
+
+bool ReportReplay::readTrailer(const ReportLog::FileHeader & a_Header)
+{
+	ReportLog::TrailerHeader trailer;
+	auto trailerOffset = a_Header.m_TrailerOffset;
+	if ((trailerOffset == 0) || (trailerOffset != m_DataEnd) || (trailerOffset + sizeof(trailer) > m_File.getSize()))
+	{
+		return false;
+	}
+	memcpy(&trailer, m_File.getData() + trailerOffset, sizeof(trailer));
+	auto metadataOffset = static_cast<size_t>(trailerOffset + sizeof(trailer));
+	auto metadataEnd = metadataOffset + trailer.m_MetadataSize;
+	if (
+		(memcmp(trailer.m_Magic, ReportLog::TRAILER_MAGIC, sizeof(trailer.m_Magic)) != 0) ||
+		(metadataEnd > m_File.getSize()) ||
+		(trailer.m_NumIndexEntries > (m_File.getSize() - metadataEnd) / sizeof(ReportLog::IndexEntry))
+	)
+	{
+		return false;
+	}
+
+	// The copies of the device and calibration records:
+	size_t offset = metadataOffset;
+	int64_t time = 0;
+	Record rec;
+	while (readRecord(offset, metadataEnd, time, rec))
+	{
+		processMetadata(rec);
+	}
+
+	// The index:
+	m_Index.resize(static_cast<size_t>(trailer.m_NumIndexEntries));
+	if (!m_Index.empty())
+	{
+		memcpy(m_Index.data(), m_File.getData() + metadataEnd, m_Index.size() * sizeof(ReportLog::IndexEntry));
+	}
+	m_Duration = std::chrono::microseconds(trailer.m_EndTime);
+	return true;
+}
+
+
+
+
+
+void ReportReplay::scanRecords()
+{
+	size_t offset = sizeof(ReportLog::FileHeader);
+	int64_t time = 0;
+	Record rec;
+	for (;;)
+	{
+		auto recordOffset = offset;
+		if (!readRecord(offset, m_DataEnd, time, rec))
+		{
+			break;
+		}
+		switch (rec.m_Type)
+		{
+			case ReportLog::rtDevice:
+			case ReportLog::rtCalibration:
+			{
+				processMetadata(rec);
+				break;
+			}
+			case ReportLog::rtSync:
+			{
+				ReportLog::IndexEntry entry;
+				entry.m_Time = rec.m_Time;
+				entry.m_Offset = recordOffset;
+				m_Index.push_back(entry);
+				break;
+			}
+			default:
+			{
+				break;
+			}
+		}
+		m_Duration = std::chrono::microseconds(rec.m_Time);
+	}
+}
+
+
+
+
+
+void ReportReplay::processMetadata(const Record & a_Record)
+{
+	switch (a_Record.m_Type)
+	{
+		case ReportLog::rtDevice:
+		{
+			if ((a_Record.m_Device != static_cast<int>(m_Wiimotes.size())) || (a_Record.m_Size < ACCEL_CALIBRATION_SIZE))
+			{
+				LOG("Malformed device record in the capture, ignoring");
+				break;
+			}
+			Wiimote::AccelCalibration accelCalibration;
+			accelCalibration.m_X0 = a_Record.m_Payload[0];
+			accelCalibration.m_Y0 = a_Record.m_Payload[1];
+			accelCalibration.m_Z0 = a_Record.m_Payload[2];
+			accelCalibration.m_XG = a_Record.m_Payload[3];
+			accelCalibration.m_YG = a_Record.m_Payload[4];
+			accelCalibration.m_ZG = a_Record.m_Payload[5];
+			auto wiimote = std::make_shared<Wiimote>();
+			wiimote->startReplay(
+				std::string(reinterpret_cast<const char *>(a_Record.m_Payload) + ACCEL_CALIBRATION_SIZE, a_Record.m_Size - ACCEL_CALIBRATION_SIZE),
+				accelCalibration
+			);
+			m_Wiimotes.push_back(wiimote);
+			break;
+		}
+		case ReportLog::rtCalibration:
+		{
+			int32_t coords[4];
+			if (
+				(a_Record.m_Device >= static_cast<int>(m_Wiimotes.size())) ||
+				(a_Record.m_Size != 1 + sizeof(coords)) ||
+				(a_Record.m_Payload[0] >= 4)
+			)
+			{
+				LOG("Malformed calibration record in the capture, ignoring");
+				break;
+			}
+			memcpy(coords, a_Record.m_Payload + 1, sizeof(coords));
+			m_Calibration->setPoint(*m_Wiimotes[a_Record.m_Device], a_Record.m_Payload[0], coords[0], coords[1], coords[2], coords[3]);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+
+
@@ -0,0 +1,206 @@
+// ReportReplay.h
+
+// Declares the ReportReplay class representing the driver feeding a captured report log back through the Wiimotes
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "MappedFile.h"
+#include "ReportLog.h"
+#include "Calibration.h"
+
+
+
+
+
+/** Replays a capture written by ReportLog: creates an unconnected Wiimote for each captured device and feeds
+the captured reports into them, through the regular parsing and callbacks, so that the whole pipeline
+(Processor, PenFusion, InputInjector) runs just as it did in the captured session.
+The reports are replayed either in real time, keeping the captured intervals, or as fast as possible. Either way,
+the reports' arrival times keep the captured intervals, so that the time-dependent stages behave as captured;
+only in real time are the latencies measured from the arrival meaningful.
+The replay can start at any of the capture's sync points (one per ReportLog::SYNC_INTERVAL_USEC), see seek(). */
+class ReportReplay
+{
+public:
+	/** The speed of the replay. */
+	enum Speed
+	{
+		rsRealTime,          ///< Keep the captured intervals between the reports
+		rsAsFastAsPossible,  ///< Feed the next report as soon as the previous one has been processed
+	};
+
+
+	/** The results of a single run(). */
+	struct Stats
+	{
+		/** The number of reports replayed. */
+		uint64_t m_NumReports;
+
+		/** The number of records that were skipped (unknown type or device, or malformed). */
+		uint64_t m_NumSkipped;
+
+		/** The captured time between the first and the last replayed report. */
+		std::chrono::microseconds m_CapturedDuration;
+
+		/** The wall-clock time the replay took. */
+		std::chrono::microseconds m_ElapsedTime;
+	};
+
+
+	/** A single decoded report, as returned by readReport(). */
+	struct Report
+	{
+		/** The index of the device (into getWiimotes()) that sent the report. */
+		int m_Device;
+
+		/** The time of the report, since the start of the capture. */
+		std::chrono::microseconds m_Time;
+
+		/** The IR mode the device was in when sending the report. */
+		Wiimote::IRReportingMode m_IRMode;
+
+		/** The report data, valid until the next readReport() or rewind() call. */
+		const unsigned char * m_Data;
+
+		size_t m_Size;
+	};
+
+
+	ReportReplay();
+
+	/** Opens the specified capture, creates its Wiimotes and reads its calibration.
+	Returns true on success, false on failure (logged). */
+	bool open(const std::string & a_FileName);
+
+	/** Returns the Wiimotes replaying the captured devices, in the order of the capture. */
+	const WiimotePtrs & getWiimotes() const { return m_Wiimotes; }
+
+	/** Returns the calibration captured for the Wiimotes. Not usable if the capture has none. */
+	const CalibrationPtr & getCalibration() const { return m_Calibration; }
+
+	/** Returns the time of the capture's last record, since the start of the capture. */
+	std::chrono::microseconds getDuration() const { return m_Duration; }
+
+	/** Makes the next run() start at the last sync point at or before the specified time since the start of the capture
+	(or at the very start, if there is none), and rewinds readReport() there. Returns the time at which the replay will start. */
+	std::chrono::microseconds seek(std::chrono::microseconds a_Time);
+
+	/** Feeds the captured reports into the Wiimotes, from the calling thread, at the specified speed, starting at the
+	position set by seek() (the start of the capture by default).
+	Returns when all have been fed or stop() is called. May be called repeatedly to replay again. */
+	Stats run(Speed a_Speed);
+
+	/** Moves the reading position of readReport() to the position set by seek() (the start of the capture by default). */
+	void rewind();
+
+	/** Decodes the next report at the reading position into a_Report, without feeding it into its Wiimote, so that
+	the caller may drive the reports on its own. Returns false once there are no more reports.
+	Must not be used while run() is in progress. */
+	bool readReport(Report & a_Report);
+
+	/** Returns the number of records that readReport() has skipped since the last rewind() (unknown type or device, or malformed). */
+	uint64_t getNumSkipped() const { return m_NumSkipped; }
+
+	/** Makes a run() in progress return as soon as possible. Callable from any thread. */
+	void stop() { m_ShouldStop = true; }
+
+
+protected:
+
+	/** A single record parsed from the file. */
+	struct Record
+	{
+		int m_Type;
+		int m_Device;
+
+		/** The time of the record, in microseconds since the start of the capture. */
+		int64_t m_Time;
+
+		const unsigned char * m_Payload;
+		size_t m_Size;
+	};
+
+	/** The decoding state of a single device. */
+	struct Device
+	{
+		/** The last decoded report, the reference for the next delta report. */
+		std::vector<unsigned char> m_LastReport;
+
+		/** The IR mode of the last decoded report. */
+		Wiimote::IRReportingMode m_IRMode;
+
+		/** Set if m_LastReport is valid, i.e. there has been a key report since the last sync. */
+		bool m_HasLastReport;
+	};
+
+
+	/** The mapped capture. */
+	MappedFile m_File;
+
+	/** The size of the valid data (header and records) in m_File. */
+	size_t m_DataEnd;
+
+	/** The Wiimotes replaying the captured devices, indexed by the device index. */
+	WiimotePtrs m_Wiimotes;
+
+	/** The captured calibration. */
+	CalibrationPtr m_Calibration;
+
+	/** The seek index, from the trailer or rebuilt by scanning the records. */
+	std::vector<ReportLog::IndexEntry> m_Index;
+
+	/** The time of the capture's last record. */
+	std::chrono::microseconds m_Duration;
+
+	/** The offset of the record at which the next run() starts. */
+	size_t m_StartOffset;
+
+	/** The time of the last record before m_StartOffset (the base of the first record's time delta). */
+	int64_t m_StartTime;
+
+	/** Set by stop() to make run() return. */
+	std::atomic<bool> m_ShouldStop;
+
+	/** The decoding state of each device, indexed by the device index. */
+	std::vector<Device> m_Devices;
+
+	/** The offset of the record that readReport() reads next. */
+	size_t m_ReadOffset;
+
+	/** The time of the last record before m_ReadOffset. */
+	int64_t m_ReadTime;
+
+	/** The number of records skipped by readReport() since the last rewind(). */
+	uint64_t m_NumSkipped;
+
+	/** The buffer for the report returned by readReport(). */
+	unsigned char m_Report[255];
+
+
+	/** Parses the record at a_Offset in m_File, up to a_End, into a_Record and moves a_Offset past it.
+	a_Time is the time of the previous record, updated to the time of this one.
+	Returns false at a_End or if the record is truncated. */
+	bool readRecord(size_t & a_Offset, size_t a_End, int64_t & a_Time, Record & a_Record) const;
+
+	/** Reads the trailer written by a closed ReportLog: the device and calibration records and the seek index.
+	Returns false if there is no valid trailer. */
+	bool readTrailer(const ReportLog::FileHeader & a_Header);
+
+	/** Scans all the records for the device and calibration records and rebuilds the seek index. */
+	void scanRecords();
+
+	/** Processes a device or calibration record, creating the Wiimote or setting its calibration point. */
+	void processMetadata(const Record & a_Record);
+};
+
+
+
+
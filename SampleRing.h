@@ -0,0 +1,180 @@
+// SampleRing.h
+
+// Declares the SampleRing class template representing a lock-free single-producer / multi-consumer ring of the most recent samples
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <atomic>
+#include <type_traits>
+
+
+
+
+
+/** Keeps the last N samples published by a single producer thread, so that any number of consumer threads can read
+the latest sample, or the last few samples, without locking.
+Each slot is guarded by a sequence number (a seqlock): the producer never waits for the consumers, and a consumer
+that gets overtaken by the producer while copying a slot simply retries (or skips that, now too old, sample).
+The data is copied through relaxed atomic words, so that the concurrent access is well-defined.
+T must be trivially copyable. */
+template <typename T, size_t N>
+class SampleRing
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SampleRing only supports trivially copyable types");
+	static_assert(N >= 2, "SampleRing needs at least two slots");
+
+public:
+	SampleRing():
+		m_NumPushed(0)
+	{
+		for (size_t i = 0; i < N; ++i)
+		{
+			m_Slots[i].m_Seq.store(0, std::memory_order_relaxed);
+			for (size_t w = 0; w < NUM_WORDS; ++w)
+			{
+				m_Slots[i].m_Words[w].store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+
+	/** Publishes a new sample, overwriting the oldest one.
+	Must only ever be called from a single (producer) thread. Wait-free. */
+	void push(const T & a_Sample)
+	{
+		auto idx = m_NumPushed.load(std::memory_order_relaxed);
+		auto & slot = m_Slots[idx % N];
+
+		// Mark the slot as being written (odd sequence number):
+		slot.m_Seq.store(2 * idx + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		uint64_t words[NUM_WORDS];
+		words[NUM_WORDS - 1] = 0;
+		memcpy(words, &a_Sample, sizeof(T));
+		for (size_t w = 0; w < NUM_WORDS; ++w)
+		{
+			slot.m_Words[w].store(words[w], std::memory_order_relaxed);
+		}
+
+		// Mark the slot as complete, holding sample number idx:
+		slot.m_Seq.store(2 * idx + 2, std::memory_order_release);
+		m_NumPushed.store(idx + 1, std::memory_order_release);
+	}
+
+
+	/** Copies the most recently published sample into a_Sample.
+	Returns false if nothing has been published yet. */
+	bool getLatest(T & a_Sample) const
+	{
+		for (;;)
+		{
+			auto numPushed = m_NumPushed.load(std::memory_order_acquire);
+			if (numPushed == 0)
+			{
+				return false;
+			}
+			if (read(numPushed - 1, a_Sample))
+			{
+				return true;
+			}
+			// Overtaken by the producer while copying, retry with the new latest sample
+		}
+	}
+
+
+	/** Copies up to a_MaxCount most recently published samples into a_Samples, the oldest one first.
+	Returns the number of samples copied; can be less than requested if not enough samples have been published yet,
+	or if the producer has overwritten the oldest ones while copying. */
+	size_t getRecent(T * a_Samples, size_t a_MaxCount) const
+	{
+		auto numPushed = m_NumPushed.load(std::memory_order_acquire);
+		size_t count = static_cast<size_t>(std::min<uint64_t>(std::min<uint64_t>(a_MaxCount, N), numPushed));
+
+		// Read the newest samples first, they're the least likely to get overwritten:
+		size_t numRead = 0;
+		while (numRead < count)
+		{
+			if (!read(numPushed - 1 - numRead, a_Samples[count - 1 - numRead]))
+			{
+				break;
+			}
+			numRead += 1;
+		}
+
+		// If some of the oldest ones got overwritten, move the rest to the front:
+		if (numRead < count)
+		{
+			std::copy(a_Samples + count - numRead, a_Samples + count, a_Samples);
+		}
+		return numRead;
+	}
+
+
+	/** Returns the total number of samples published so far. */
+	uint64_t getNumPushed() const
+	{
+		return m_NumPushed.load(std::memory_order_acquire);
+	}
+
+
+protected:
+
+	/** The number of 64-bit words needed to hold a single sample. */
+	static const size_t NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	/** A single slot of the ring. */
+	struct Slot
+	{
+		/** 2 * idx + 1 while sample number idx is being written, 2 * idx + 2 once it is complete. */
+		std::atomic<uint64_t> m_Seq;
+
+		/** The sample data. */
+		std::atomic<uint64_t> m_Words[NUM_WORDS];
+	};
+
+
+	/** The number of samples published so far. The next sample goes into slot m_NumPushed % N. */
+	std::atomic<uint64_t> m_NumPushed;
+
+	/** The slots. */
+	Slot m_Slots[N];
+
+
+	/** Copies the sample number a_Idx into a_Sample.
+	Returns false if the sample has been (or is being) overwritten by the producer. */
+	bool read(uint64_t a_Idx, T & a_Sample) const
+	{
+		const auto & slot = m_Slots[a_Idx % N];
+		auto seq1 = slot.m_Seq.load(std::memory_order_acquire);
+		if (seq1 != 2 * a_Idx + 2)
+		{
+			return false;
+		}
+		uint64_t words[NUM_WORDS];
+		for (size_t w = 0; w < NUM_WORDS; ++w)
+		{
+			words[w] = slot.m_Words[w].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		auto seq2 = slot.m_Seq.load(std::memory_order_relaxed);
+		if (seq2 != seq1)
+		{
+			return false;
+		}
+		memcpy(&a_Sample, words, sizeof(T));
+		return true;
+	}
+};
+
+
+
+
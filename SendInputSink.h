@@ -0,0 +1,41 @@
+// SendInputSink.h
+
+// Declares the SendInputSink class representing the output of the pointer events into the Windows input via SendInput()
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "OutputSink.h"
+
+
+
+
+
+/** Injects the pointer events into the Windows input as absolute mouse input, using SendInput().
+There's only a single system pointer, so while a pen is down, it is the only one driving the pointer and the other
+pens' events are dropped; while no pen is down, the moves of any pen go through. */
+class SendInputSink:
+	public OutputSink
+{
+public:
+	SendInputSink();
+
+	// OutputSink overrides:
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) override;
+
+protected:
+
+	/** The pen that is down and drives the pointer, -1 if no pen is down. */
+	int m_PrimaryPen;
+};
+
+
+
+
@@ -0,0 +1,80 @@
+// SendInputSinkWin.cpp
+
+// Implements the SendInputSink class representing the output of the pointer events into the Windows input via SendInput()
+
+
+
+
+
+#include "Globals.h"
+#include "SendInputSink.h"
+
+
+
+
+
+/** The maximum number of events sent in a single SendInput() call; larger batches are split. */
+static const size_t MAX_INPUTS_PER_CALL = 64;
+
+
+
+
+
+SendInputSink::SendInputSink():
+	m_PrimaryPen(-1)
+{
+}
+
+
+
+
+
+size_t SendInputSink::send(const MouseEvent * a_Events, size_t a_Count)
+{
+	INPUT inputs[MAX_INPUTS_PER_CALL];
+	size_t numCalls = 0;
+	while (a_Count > 0)
+	{
+		auto count = std::min(a_Count, MAX_INPUTS_PER_CALL);
+		UINT numInputs = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			// Only the primary pen drives the pointer while it is down; the other pens' ups have no matching downs:
+			const auto & evt = a_Events[i];
+			auto isOtherPen = (evt.m_PenId != m_PrimaryPen);
+			if (isOtherPen && ((m_PrimaryPen >= 0) || (evt.m_Type == MouseEvent::metLeftUp)))
+			{
+				continue;
+			}
+
+			// The buttons move the pointer to their position as well, so that no separate move is needed before them:
+			DWORD flags = MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_MOVE;
+			switch (evt.m_Type)
+			{
+				case MouseEvent::metMove:     break;
+				case MouseEvent::metLeftDown: flags |= MOUSEEVENTF_LEFTDOWN; m_PrimaryPen = evt.m_PenId; break;
+				case MouseEvent::metLeftUp:   flags |= MOUSEEVENTF_LEFTUP;   m_PrimaryPen = -1;           break;
+			}
+			auto & input = inputs[numInputs++];
+			input.type = INPUT_MOUSE;
+			input.mi.dwFlags = flags;
+			input.mi.dx = evt.m_X;
+			input.mi.dy = evt.m_Y;
+			input.mi.dwExtraInfo = 0;
+			input.mi.mouseData = 0;
+			input.mi.time = 0;
+		}
+		if (numInputs > 0)
+		{
+			SendInput(numInputs, inputs, sizeof(INPUT));
+			numCalls += 1;
+		}
+		a_Events += count;
+		a_Count -= count;
+	}
+	return numCalls;
+}
+
+
+
+
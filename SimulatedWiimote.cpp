@@ -0,0 +1,650 @@
+// SimulatedWiimote.cpp
+
+// Implements the SimulatedWiimote class representing an in-process stand-in for a real Wiimote controller
+
+
+
+
+
+#include "Globals.h"
+#include "SimulatedWiimote.h"
+
+
+
+
+
+/** The size of the simulated EEPROM. */
+static const size_t EEPROM_SIZE = 0x1700;
+
+/** The location of the accelerometer calibration in the EEPROM. */
+static const int EEPROM_ACCEL_CALIBRATION = 0x0016;
+
+/** The register in which the IR camera mode is written. */
+static const int IR_REGISTER_MODE = 0x33;
+
+/** The output report types understood by the simulation. */
+enum
+{
+	ortLEDs        = 0x11,
+	ortType        = 0x12,
+	ortIR          = 0x13,
+	ortStatus      = 0x15,
+	ortWriteMemory = 0x16,
+	ortReadMemory  = 0x17,
+	ortIR2         = 0x1a,
+};
+
+/** The input report types generated by the simulation. */
+enum
+{
+	irtStatus       = 0x20,
+	irtReadData     = 0x21,
+	irtButtons      = 0x30,
+	irtButtonsAccel = 0x31,
+	irtIRAccel      = 0x33,
+};
+
+/** The IR camera modes, as written into the IR_REGISTER_MODE register. */
+enum
+{
+	irModeBasic    = 0x01,
+	irModeExtended = 0x03,
+};
+
+/** The error code in the irtReadData reply for reading non-existent memory. */
+static const unsigned char READ_ERROR_NONEXISTENT = 0x08;
+
+
+
+
+
+SimulatedWiimote::SimulatedWiimote():
+	m_ReportIntervalUsec(10000),
+	m_Eeprom(EEPROM_SIZE),
+	m_ReportType(0),
+	m_IsContinuous(false),
+	m_IsIRClockEnabled(false),
+	m_IsIRLogicEnabled(false),
+	m_IRMode(0),
+	m_Leds(0),
+	m_HasQueuedReports(false),
+	m_ShouldTerminate(false),
+	m_IsOpen(true),
+	m_NumReportsSent(0)
+{
+	memset(m_IRRegisters, 0, sizeof(m_IRRegisters));
+
+	// Fill in a plausible accelerometer calibration: zero points, LSBs, 1G points, LSBs:
+	static const unsigned char accelCalibration[] = { 0x80, 0x80, 0x80, 0x00, 0x9a, 0x9a, 0x9a, 0x00 };
+	memcpy(m_Eeprom.data() + EEPROM_ACCEL_CALIBRATION, accelCalibration, sizeof(accelCalibration));
+}
+
+
+
+
+
+SimulatedWiimote::~SimulatedWiimote()
+{
+	close();
+}
+
+
+
+
+
+void SimulatedWiimote::setReportInterval(std::chrono::microseconds a_Interval)
+{
+	m_ReportIntervalUsec = static_cast<int64_t>(a_Interval.count());
+	m_CV.notify_all();
+}
+
+
+
+
+
+void SimulatedWiimote::setScript(Script a_Script)
+{
+	assert(!m_Thread.joinable());  // Must not be running yet
+	m_Script = std::move(a_Script);
+}
+
+
+
+
+
+SimulatedWiimote::Script SimulatedWiimote::makeCircleScript(double a_CenterX, double a_CenterY, double a_Radius, double a_Period, int a_NumSteps)
+{
+	Script res;
+	res.reserve(static_cast<size_t>(a_NumSteps) + 1);
+	for (int i = 0; i <= a_NumSteps; ++i)
+	{
+		double angle = 2 * 3.14159265358979 * i / a_NumSteps;
+		Keyframe kf = {};
+		kf.m_Time = a_Period * i / a_NumSteps;
+		kf.m_Dots[0].m_IsPresent = true;
+		kf.m_Dots[0].m_X = a_CenterX + a_Radius * std::cos(angle);
+		kf.m_Dots[0].m_Y = a_CenterY + a_Radius * std::sin(angle);
+		res.push_back(kf);
+	}
+	return res;
+}
+
+
+
+
+
+SimulatedWiimote::Script SimulatedWiimote::makeStrokesScript(int a_NumStrokes, double a_StrokeDuration, double a_GapDuration)
+{
+	Script res;
+	double time = 0;
+	for (int i = 0; i < a_NumStrokes; ++i)
+	{
+		// Spread the strokes evenly over the camera's view:
+		double y = 768.0 * (i + 1) / (a_NumStrokes + 1);
+		Keyframe kf = {};
+		kf.m_Time = time;
+		kf.m_Dots[0].m_IsPresent = true;
+		kf.m_Dots[0].m_X = 100;
+		kf.m_Dots[0].m_Y = y;
+		res.push_back(kf);
+		time += a_StrokeDuration;
+
+		// The end of the stroke, the pen is lifted here:
+		kf.m_Time = time;
+		kf.m_Dots[0].m_IsPresent = false;
+		kf.m_Dots[0].m_X = 923;
+		res.push_back(kf);
+		time += a_GapDuration;
+	}
+
+	// The final keyframe only marks the loop length:
+	Keyframe kf = {};
+	kf.m_Time = time;
+	res.push_back(kf);
+	return res;
+}
+
+
+
+
+
+void SimulatedWiimote::startReading(ReportCallback a_OnReport, ErrorCallback a_OnError)
+{
+	assert(!m_Thread.joinable());  // Must not be reading already
+
+	m_OnReport = std::move(a_OnReport);
+	m_OnError = std::move(a_OnError);
+	m_Thread = std::thread(&SimulatedWiimote::thrSimulate, this);
+}
+
+
+
+
+
+void SimulatedWiimote::close()
+{
+	m_IsOpen = false;
+	if (!m_Thread.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_ShouldTerminate = true;
+	}
+	m_CV.notify_all();
+	if (m_Thread.get_id() == std::this_thread::get_id())
+	{
+		// Closing from within a callback, the thread will terminate on its own once the callback returns
+		m_Thread.detach();
+	}
+	else
+	{
+		m_Thread.join();
+	}
+}
+
+
+
+
+
+bool SimulatedWiimote::isOpen() const
+{
+	return m_IsOpen;
+}
+
+
+
+
+
+bool SimulatedWiimote::write(const void * a_Buffer, size_t a_Size)
+{
+	if (!m_IsOpen || (a_Size == 0))
+	{
+		return false;
+	}
+	processOutputReport(reinterpret_cast<const unsigned char *>(a_Buffer), a_Size);
+	return true;
+}
+
+
+
+
+
+bool SimulatedWiimote::setOutputReport(const void * a_Buffer, size_t a_Size)
+{
+	// Both methods behave the same in the simulation:
+	return write(a_Buffer, a_Size);
+}
+
+
+
+
+
+std::chrono::microseconds SimulatedWiimote::getMinWriteInterval() const
+{
+	// The simulation handles any rate:
+	return std::chrono::microseconds(0);
+}
+
+
+
+
+
+std::string SimulatedWiimote::getStableId() const
+{
+	return m_StableId;
+}
+
+
+
+
+
+void SimulatedWiimote::thrSimulate()
+{
+	auto startTime = std::chrono::steady_clock::now();
+	auto nextReportTime = startTime;
+	unsigned char lastReport[REPORT_SIZE];
+	size_t lastReportSize = 0;
+	while (!m_ShouldTerminate)
+	{
+		// Wait for the next report time, unless running as fast as possible:
+		auto interval = std::chrono::microseconds(m_ReportIntervalUsec.load());
+		if (interval.count() > 0)
+		{
+			std::unique_lock<std::mutex> lock(m_CS);
+			m_CV.wait_until(lock, nextReportTime, [this]() { return (m_ShouldTerminate || m_HasQueuedReports); });
+			if (m_ShouldTerminate)
+			{
+				break;
+			}
+		}
+
+		// Send the replies first, they're not subject to the report rate:
+		if (m_HasQueuedReports)
+		{
+			sendQueuedReports();
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (now < nextReportTime)
+		{
+			continue;
+		}
+
+		// Compose and send the streamed report:
+		unsigned char report[REPORT_SIZE];
+		double scriptTime = std::chrono::duration<double>(now - startTime).count();
+		auto size = composeStreamedReport(report, scriptTime);
+		if (
+			(size > 0) &&
+			(m_IsContinuous || (size != lastReportSize) || (memcmp(report, lastReport, size) != 0))
+		)
+		{
+			m_OnReport(report, size, Clock::now());
+			++m_NumReportsSent;
+			memcpy(lastReport, report, size);
+			lastReportSize = size;
+		}
+
+		// Schedule the next report; if lagging way behind (debugger, overloaded machine), don't try to catch up in a burst:
+		nextReportTime += interval;
+		if (nextReportTime + 10 * interval < now)
+		{
+			nextReportTime = now;
+		}
+	}
+}
+
+
+
+
+
+void SimulatedWiimote::sendQueuedReports()
+{
+	std::vector<QueuedReport> reports;
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		std::swap(reports, m_QueuedReports);
+		m_HasQueuedReports = false;
+	}
+	for (const auto & r: reports)
+	{
+		m_OnReport(r.m_Data, r.m_Size, Clock::now());
+		++m_NumReportsSent;
+	}
+}
+
+
+
+
+
+void SimulatedWiimote::processOutputReport(const unsigned char * a_Report, size_t a_Size)
+{
+	switch (a_Report[0])
+	{
+		case ortLEDs:
+		{
+			if (a_Size >= 2)
+			{
+				m_Leds = a_Report[1] & 0xf0;
+			}
+			break;
+		}
+		case ortType:
+		{
+			if (a_Size >= 3)
+			{
+				m_IsContinuous = ((a_Report[1] & 0x04) != 0);
+				m_ReportType = a_Report[2];
+			}
+			break;
+		}
+		case ortIR:
+		{
+			if (a_Size >= 2)
+			{
+				m_IsIRClockEnabled = ((a_Report[1] & 0x04) != 0);
+			}
+			break;
+		}
+		case ortIR2:
+		{
+			if (a_Size >= 2)
+			{
+				m_IsIRLogicEnabled = ((a_Report[1] & 0x04) != 0);
+			}
+			break;
+		}
+		case ortStatus:
+		{
+			unsigned char reply[7] =
+			{
+				irtStatus,
+				0x00, 0x00,
+				static_cast<unsigned char>(m_Leds | ((m_IsIRClockEnabled && m_IsIRLogicEnabled) ? 0x08 : 0x00)),
+				0x00, 0x00,
+				0xc0,  // Battery level
+			};
+			queueReport(reply, sizeof(reply));
+			break;
+		}
+		case ortWriteMemory:
+		{
+			if (a_Size < 6)
+			{
+				break;
+			}
+			int address = ((a_Report[1] & 0xfe) << 24) | (a_Report[2] << 16) | (a_Report[3] << 8) | a_Report[4];
+			size_t size = std::min<size_t>(a_Report[5], a_Size - 6);
+			std::lock_guard<std::mutex> lock(m_CS);
+			for (size_t i = 0; i < size; ++i)
+			{
+				writeMemory(address + static_cast<int>(i), a_Report[6 + i]);
+			}
+			break;
+		}
+		case ortReadMemory:
+		{
+			if (a_Size < 7)
+			{
+				break;
+			}
+			int address = ((a_Report[1] & 0xfe) << 24) | (a_Report[2] << 16) | (a_Report[3] << 8) | a_Report[4];
+			int size = (a_Report[5] << 8) | a_Report[6];
+			queueReadDataReplies(address, size);
+			break;
+		}
+	}
+}
+
+
+
+
+
+void SimulatedWiimote::queueReadDataReplies(int a_Address, int a_Size)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+
+	// The data is sent in chunks of up to 16 bytes:
+	for (int offset = 0; offset < a_Size; offset += 16)
+	{
+		int chunkSize = std::min(16, a_Size - offset);
+		int chunkAddress = a_Address + offset;
+		QueuedReport r;
+		memset(r.m_Data, 0, sizeof(r.m_Data));
+		r.m_Size = REPORT_SIZE;
+		r.m_Data[0] = irtReadData;
+		r.m_Data[4] = static_cast<unsigned char>((chunkAddress >> 8) & 0xff);
+		r.m_Data[5] = static_cast<unsigned char>(chunkAddress & 0xff);
+		unsigned char error = 0;
+		for (int i = 0; i < chunkSize; ++i)
+		{
+			if (!readMemory(chunkAddress + i, r.m_Data[6 + i]))
+			{
+				error = READ_ERROR_NONEXISTENT;
+				break;
+			}
+		}
+		r.m_Data[3] = static_cast<unsigned char>(((chunkSize - 1) << 4) | error);
+		m_QueuedReports.push_back(r);
+		if (error != 0)
+		{
+			// The real Wiimote aborts the entire read on error
+			break;
+		}
+	}
+	m_HasQueuedReports = true;
+	m_CV.notify_all();
+}
+
+
+
+
+
+void SimulatedWiimote::queueReport(const unsigned char * a_Report, size_t a_Size)
+{
+	QueuedReport r;
+	memset(r.m_Data, 0, sizeof(r.m_Data));
+	r.m_Size = std::min(a_Size, sizeof(r.m_Data));
+	memcpy(r.m_Data, a_Report, r.m_Size);
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_QueuedReports.push_back(r);
+		m_HasQueuedReports = true;
+	}
+	m_CV.notify_all();
+}
+
+
+
+
+
+void SimulatedWiimote::writeMemory(int a_Address, unsigned char a_Value)
+{
+	if ((a_Address & 0x04000000) != 0)
+	{
+		// Register space; only the IR camera registers are simulated, writes to the others are ignored:
+		if ((a_Address & 0x00ffff00) == 0x00b00000)
+		{
+			m_IRRegisters[a_Address & 0xff] = a_Value;
+			if ((a_Address & 0xff) == IR_REGISTER_MODE)
+			{
+				m_IRMode = a_Value;
+			}
+		}
+		return;
+	}
+	auto offset = static_cast<size_t>(a_Address & 0xffff);
+	if (offset < m_Eeprom.size())
+	{
+		m_Eeprom[offset] = a_Value;
+	}
+}
+
+
+
+
+
+bool SimulatedWiimote::readMemory(int a_Address, unsigned char & a_Value)
+{
+	if ((a_Address & 0x04000000) != 0)
+	{
+		if ((a_Address & 0x00ffff00) == 0x00b00000)
+		{
+			a_Value = m_IRRegisters[a_Address & 0xff];
+			return true;
+		}
+		return false;
+	}
+	auto offset = static_cast<size_t>(a_Address & 0xffff);
+	if (offset < m_Eeprom.size())
+	{
+		a_Value = m_Eeprom[offset];
+		return true;
+	}
+	return false;
+}
+
+
+
+
+
+size_t SimulatedWiimote::composeStreamedReport(unsigned char * a_Report, double a_Time)
+{
+	auto reportType = m_ReportType.load();
+	memset(a_Report, 0, REPORT_SIZE);
+	a_Report[0] = reportType;
+
+	// Buttons: none pressed. Accelerometer: at rest, lying flat:
+	a_Report[3] = 0x80;
+	a_Report[4] = 0x80;
+	a_Report[5] = 0x9a;
+	switch (reportType)
+	{
+		case irtButtons:      return 3;
+		case irtButtonsAccel: return 6;
+		case irtIRAccel:      break;
+		default:              return 0;  // Not simulated
+	}
+
+	// The IR data; dots that are not visible are reported as all-ones:
+	memset(a_Report + 6, 0xff, 12);
+	if (!m_IsIRClockEnabled || !m_IsIRLogicEnabled)
+	{
+		return 18;
+	}
+	Dot dots[4];
+	evaluateScript(a_Time, dots);
+	int x[4], y[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		x[i] = dots[i].m_IsPresent ? std::min(1023, std::max(0, static_cast<int>(dots[i].m_X))) : 0x3ff;
+		y[i] = dots[i].m_IsPresent ? std::min(1023, std::max(0, static_cast<int>(dots[i].m_Y))) : 0x3ff;
+	}
+	switch (m_IRMode.load())
+	{
+		case irModeBasic:
+		{
+			// Two 5-byte pairs of dots:
+			for (int pair = 0; pair < 2; ++pair)
+			{
+				auto p = a_Report + 6 + 5 * pair;
+				int d1 = 2 * pair, d2 = 2 * pair + 1;
+				p[0] = static_cast<unsigned char>(x[d1] & 0xff);
+				p[1] = static_cast<unsigned char>(y[d1] & 0xff);
+				p[2] = static_cast<unsigned char>(((y[d1] >> 8) << 6) | ((x[d1] >> 8) << 4) | ((y[d2] >> 8) << 2) | (x[d2] >> 8));
+				p[3] = static_cast<unsigned char>(x[d2] & 0xff);
+				p[4] = static_cast<unsigned char>(y[d2] & 0xff);
+			}
+			break;
+		}
+		case irModeExtended:
+		{
+			// Three bytes per dot, the dot size being fixed:
+			for (int d = 0; d < 4; ++d)
+			{
+				if (!dots[d].m_IsPresent)
+				{
+					continue;
+				}
+				auto p = a_Report + 6 + 3 * d;
+				p[0] = static_cast<unsigned char>(x[d] & 0xff);
+				p[1] = static_cast<unsigned char>(y[d] & 0xff);
+				p[2] = static_cast<unsigned char>(((y[d] >> 8) << 6) | ((x[d] >> 8) << 4) | 0x03);
+			}
+			break;
+		}
+	}
+	return 18;
+}
+
+
+
+
+
+void SimulatedWiimote::evaluateScript(double a_Time, Dot * a_Dots) const
+{
+	memset(a_Dots, 0, 4 * sizeof(Dot));
+	if (m_Script.empty())
+	{
+		return;
+	}
+
+	// Loop the script:
+	double length = m_Script.back().m_Time;
+	double t = (length > 0) ? std::fmod(a_Time, length) : 0;
+
+	// Find the keyframes surrounding the time:
+	auto itr = std::upper_bound(m_Script.begin(), m_Script.end(), t,
+		[](double a_Time, const Keyframe & a_Keyframe)
+		{
+			return (a_Time < a_Keyframe.m_Time);
+		}
+	);
+	if (itr == m_Script.begin())
+	{
+		memcpy(a_Dots, itr->m_Dots, sizeof(itr->m_Dots));
+		return;
+	}
+	const auto & prev = *(itr - 1);
+	if (itr == m_Script.end())
+	{
+		memcpy(a_Dots, prev.m_Dots, sizeof(prev.m_Dots));
+		return;
+	}
+
+	// Interpolate:
+	const auto & next = *itr;
+	double span = next.m_Time - prev.m_Time;
+	double ratio = (span > 0) ? (t - prev.m_Time) / span : 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		a_Dots[i].m_IsPresent = prev.m_Dots[i].m_IsPresent;
+		a_Dots[i].m_X = prev.m_Dots[i].m_X + (next.m_Dots[i].m_X - prev.m_Dots[i].m_X) * ratio;
+		a_Dots[i].m_Y = prev.m_Dots[i].m_Y + (next.m_Dots[i].m_Y - prev.m_Dots[i].m_Y) * ratio;
+	}
+}
+
+
+
+
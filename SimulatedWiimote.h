@@ -0,0 +1,203 @@
+// SimulatedWiimote.h
+
+// Declares the SimulatedWiimote class representing an in-process stand-in for a real Wiimote controller
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Transport.h"
+
+
+
+
+
+/** A Transport that simulates a Wiimote, without any hardware.
+Answers the memory reads (so that Wiimote::readCalibration() succeeds), honours the ortType, ortIR, ortIR2,
+ortLEDs and ortWriteMemory output reports, and streams the input reports in the requested format,
+with the IR dots following a script.
+The reports are generated in a per-instance thread, at the configured rate (or as fast as possible). */
+class SimulatedWiimote:
+	public Transport
+{
+public:
+	/** A single IR dot, as seen by the simulated camera. */
+	struct Dot
+	{
+		bool m_IsPresent;
+
+		/** The coords, in the camera space (0 .. 1023, 0 .. 767). */
+		double m_X, m_Y;
+	};
+
+	/** A single keyframe of the IR script: the state of all the 4 dots at the specified time. */
+	struct Keyframe
+	{
+		/** The time of the keyframe, in seconds since the start of the script. */
+		double m_Time;
+
+		Dot m_Dots[4];
+	};
+
+	/** The script for the IR dots. The keyframes are sorted by their time.
+	The dots' coords are linearly interpolated between the keyframes; a dot is present only while it is present in the earlier keyframe.
+	The script loops after its last keyframe. An empty script has no dots at all. */
+	typedef std::vector<Keyframe> Script;
+
+
+	SimulatedWiimote();
+
+	/** Stops the simulation, if still running. */
+	virtual ~SimulatedWiimote();
+
+	/** Sets the interval between two consecutive streamed input reports.
+	A real Wiimote uses 10 ms (100 Hz); zero means "as fast as possible".
+	Can be called at any time. */
+	void setReportInterval(std::chrono::microseconds a_Interval);
+
+	/** Sets the script for the IR dots.
+	Must be called before startReading(). */
+	void setScript(Script a_Script);
+
+	/** Sets the identity reported by getStableId(). By default it is empty, so the simulated device is not cached.
+	Must be called before connecting. */
+	void setStableId(const std::string & a_StableId) { m_StableId = a_StableId; }
+
+	/** Returns the number of input reports sent so far (both streamed and replies). */
+	uint64_t getNumReportsSent() const { return m_NumReportsSent; }
+
+	/** Returns a script in which the first dot runs around a circle, taking a_Period seconds per loop.
+	The circle is approximated by a_NumSteps linear segments. */
+	static Script makeCircleScript(double a_CenterX, double a_CenterY, double a_Radius, double a_Period, int a_NumSteps);
+
+	/** Returns a script in which the first dot draws a_NumStrokes horizontal strokes across the camera view,
+	each taking a_StrokeDuration seconds, separated by a_GapDuration seconds with no dot visible (pen up). */
+	static Script makeStrokesScript(int a_NumStrokes, double a_StrokeDuration, double a_GapDuration);
+
+	// Transport overrides:
+	virtual void startReading(ReportCallback a_OnReport, ErrorCallback a_OnError) override;
+	virtual void close() override;
+	virtual bool isOpen() const override;
+	virtual bool write(const void * a_Buffer, size_t a_Size) override;
+	virtual bool setOutputReport(const void * a_Buffer, size_t a_Size) override;
+	virtual std::chrono::microseconds getMinWriteInterval() const override;
+	virtual std::string getStableId() const override;
+
+protected:
+
+	/** The size of the input and output reports. */
+	static const size_t REPORT_SIZE = 22;
+
+	/** A single report queued for sending from the simulation thread. */
+	struct QueuedReport
+	{
+		unsigned char m_Data[REPORT_SIZE];
+		size_t m_Size;
+	};
+
+
+	/** The callback for the incoming reports. */
+	ReportCallback m_OnReport;
+
+	/** The callback for the read failure. Never called, the simulation doesn't fail. */
+	ErrorCallback m_OnError;
+
+	/** The IR dot script. */
+	Script m_Script;
+
+	/** The identity reported by getStableId(). */
+	std::string m_StableId;
+
+	/** The interval between two streamed reports, in microseconds. */
+	std::atomic<int64_t> m_ReportIntervalUsec;
+
+	/** The simulated EEPROM contents (address space 0x00). */
+	std::vector<unsigned char> m_Eeprom;
+
+	/** The simulated IR camera registers (address space 0x04b000xx). */
+	unsigned char m_IRRegisters[256];
+
+	/** The input report type requested by ortType; zero if none requested yet. */
+	std::atomic<unsigned char> m_ReportType;
+
+	/** If true, the reports are streamed continuously; if false, only when their contents change. */
+	std::atomic<bool> m_IsContinuous;
+
+	/** The state of the IR camera clock (ortIR) and logic (ortIR2). */
+	std::atomic<bool> m_IsIRClockEnabled, m_IsIRLogicEnabled;
+
+	/** The IR camera mode, as written into the IR camera's mode register. */
+	std::atomic<unsigned char> m_IRMode;
+
+	/** The LED bits, as set by the last ortLEDs. */
+	std::atomic<unsigned char> m_Leds;
+
+	/** Protects m_QueuedReports and m_IRRegisters / m_Eeprom against multithreaded access. */
+	std::mutex m_CS;
+
+	/** Notified when there's a new queued report, or the simulation should terminate. */
+	std::condition_variable m_CV;
+
+	/** The replies to the output reports, waiting to be sent by the simulation thread. Protected by m_CS. */
+	std::vector<QueuedReport> m_QueuedReports;
+
+	/** Set whenever m_QueuedReports is non-empty, so that the simulation thread needn't lock m_CS on each report. */
+	std::atomic<bool> m_HasQueuedReports;
+
+	/** The thread running the simulation. */
+	std::thread m_Thread;
+
+	/** Flag indicating that the simulation thread should terminate as soon as possible. */
+	std::atomic<bool> m_ShouldTerminate;
+
+	/** True until close() is called. */
+	std::atomic<bool> m_IsOpen;
+
+	/** The number of input reports sent so far. */
+	std::atomic<uint64_t> m_NumReportsSent;
+
+
+	/** Generates the reports and sends them to m_OnReport.
+	Executed in m_Thread. */
+	void thrSimulate();
+
+	/** Sends all the queued reports to m_OnReport. */
+	void sendQueuedReports();
+
+	/** Processes a single output report written by the client. */
+	void processOutputReport(const unsigned char * a_Report, size_t a_Size);
+
+	/** Queues the irtReadData replies for the specified memory read request. */
+	void queueReadDataReplies(int a_Address, int a_Size);
+
+	/** Queues the specified report for sending from the simulation thread. */
+	void queueReport(const unsigned char * a_Report, size_t a_Size);
+
+	/** Writes a single byte into the simulated memory. */
+	void writeMemory(int a_Address, unsigned char a_Value);
+
+	/** Reads a single byte from the simulated memory into a_Value.
+	Returns false if the address doesn't exist. */
+	bool readMemory(int a_Address, unsigned char & a_Value);
+
+	/** Composes the streamed input report for the specified script time, of the type requested by ortType.
+	Returns the report size, or 0 if no report should be streamed. */
+	size_t composeStreamedReport(unsigned char * a_Report, double a_Time);
+
+	/** Fills in a_Dots with the state of the dots at the specified script time. */
+	void evaluateScript(double a_Time, Dot * a_Dots) const;
+};
+
+
+
+
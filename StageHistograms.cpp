@@ -0,0 +1,194 @@
+// StageHistograms.cpp
+
+// Implements the StageHistograms class representing the process-wide latency histograms of the report processing stages, per device and aggregated
+
+
+
+
+
+#include "Globals.h"
+#include "StageHistograms.h"
+
+
+
+
+
+StageHistograms & StageHistograms::get()
+{
+	static StageHistograms singleton;
+	return singleton;
+}
+
+
+
+
+
+StageHistograms::StageHistograms()
+{
+	std::fill(std::begin(m_IsUsed), std::end(m_IsUsed), false);
+}
+
+
+
+
+
+int StageHistograms::addDevice(const std::string & a_Name)
+{
+	std::lock_guard<std::mutex> lock(m_CS);
+	for (int i = 0; i < MAX_DEVICES; ++i)
+	{
+		if (!m_IsUsed[i])
+		{
+			m_IsUsed[i] = true;
+			m_Names[i] = a_Name;
+			for (auto & h: m_Devices[i])
+			{
+				h.reset();
+			}
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+
+
+
+void StageHistograms::setDeviceName(int a_Device, const std::string & a_Name)
+{
+	if ((a_Device < 0) || (a_Device >= MAX_DEVICES))
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_Names[a_Device] = a_Name;
+}
+
+
+
+
+
+void StageHistograms::removeDevice(int a_Device)
+{
+	if ((a_Device < 0) || (a_Device >= MAX_DEVICES))
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_CS);
+	m_IsUsed[a_Device] = false;
+}
+
+
+
+
+
+StageHistograms::Snapshot StageHistograms::getAggregateSnapshot() const
+{
+	Snapshot res;
+	res.m_Name = "all";
+	for (int s = 0; s < NUM_STAGES; ++s)
+	{
+		res.m_Stages[s] = m_Aggregate[s].getSnapshot();
+	}
+	return res;
+}
+
+
+
+
+
+std::vector<StageHistograms::Snapshot> StageHistograms::getDeviceSnapshots() const
+{
+	std::vector<Snapshot> res;
+	std::lock_guard<std::mutex> lock(m_CS);
+	for (int i = 0; i < MAX_DEVICES; ++i)
+	{
+		if (!m_IsUsed[i])
+		{
+			continue;
+		}
+		res.push_back(Snapshot());
+		auto & snapshot = res.back();
+		snapshot.m_Name = m_Names[i];
+		for (int s = 0; s < NUM_STAGES; ++s)
+		{
+			snapshot.m_Stages[s] = m_Devices[i][s].getSnapshot();
+		}
+	}
+	return res;
+}
+
+
+
+
+
+void StageHistograms::reset()
+{
+	for (auto & h: m_Aggregate)
+	{
+		h.reset();
+	}
+	for (auto & device: m_Devices)
+	{
+		for (auto & h: device)
+		{
+			h.reset();
+		}
+	}
+}
+
+
+
+
+
+std::string StageHistograms::format() const
+{
+	std::string res;
+	formatSnapshot(res, getAggregateSnapshot());
+	for (const auto & snapshot: getDeviceSnapshots())
+	{
+		formatSnapshot(res, snapshot);
+	}
+	return res;
+}
+
+
+
+
+
+const char * StageHistograms::getStageName(Stage a_Stage)
+{
+	switch (a_Stage)
+	{
+		case hsRead:     return "read";
+		case hsParse:    return "parse";
+		case hsDispatch: return "dispatch";
+		case hsWarp:     return "warp";
+		case hsInject:   return "inject";
+	}
+	return "unknown";
+}
+
+
+
+
+
+void StageHistograms::formatSnapshot(std::string & a_Dst, const Snapshot & a_Snapshot)
+{
+	AppendPrintf(a_Dst, "%s:\n", a_Snapshot.m_Name.c_str());
+	for (int s = 0; s < NUM_STAGES; ++s)
+	{
+		const auto & h = a_Snapshot.m_Stages[s];
+		AppendPrintf(a_Dst, "  %-8s: %8llu samples, p50 %9.2f us, p90 %9.2f us, p99 %9.2f us, p99.9 %9.2f us, max %9.2f us\n",
+			getStageName(static_cast<Stage>(s)),
+			static_cast<unsigned long long>(h.getCount()),
+			h.getPercentileUsec(0.5), h.getPercentileUsec(0.9), h.getPercentileUsec(0.99), h.getPercentileUsec(0.999),
+			h.getMaxUsec()
+		);
+	}
+}
+
+
+
+
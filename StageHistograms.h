@@ -0,0 +1,132 @@
+// StageHistograms.h
+
+// Declares the StageHistograms class representing the process-wide latency histograms of the report processing stages, per device and aggregated
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include <mutex>
+#include "LatencyHistogram.h"
+
+
+
+
+
+/** Keeps a LatencyHistogram of the duration of each processing stage, for each device and for all of them together,
+so that it can be seen where the latency goes while the app is running, not only in the benchmarks.
+The devices (Wiimotes) register themselves upon creation and get a slot, which travels in the LatencyTrace of
+their reports (LatencyTrace::m_Device) so that the later stages know whom to attribute their durations to.
+All the memory is allocated upfront, recording is wait-free and the snapshots don't stop the recording. */
+class StageHistograms
+{
+public:
+	/** The measured stages, each is the duration of a single step of the report's processing. */
+	enum Stage
+	{
+		hsRead = 0,  ///< From the read's completion in the transport to the start of the parsing
+		hsParse,     ///< Wiimote::parseIncomingPacket()
+		hsDispatch,  ///< From the end of the parsing to calling the callbacks (publishing the sample)
+		hsWarp,      ///< The consumer's processing, up to the warped position (tracking, Warper::warp(), filtering)
+		hsInject,    ///< Emitting a batch of mouse events into the OS (the OutputSink's send())
+		hsMax = hsInject,
+	};
+
+	static const int NUM_STAGES = hsMax + 1;
+
+	/** The maximum number of devices that get their own histograms; the others are only counted in the aggregate. */
+	static const int MAX_DEVICES = 16;
+
+
+	/** The snapshots of all the stages' histograms of a single device, or of the aggregate. */
+	struct Snapshot
+	{
+		/** The name of the device, "all" for the aggregate. */
+		std::string m_Name;
+
+		LatencyHistogram::Snapshot m_Stages[NUM_STAGES];
+	};
+
+
+	/** Returns the process-wide instance. */
+	static StageHistograms & get();
+
+	/** Registers a new device and returns its slot, to be used with record() and put into its LatencyTraces.
+	Returns -1 if all the slots are taken; the device's durations then go only into the aggregate. */
+	int addDevice(const std::string & a_Name);
+
+	/** Sets the name of a registered device, shown in the snapshots. Ignored for -1. */
+	void setDeviceName(int a_Device, const std::string & a_Name);
+
+	/** Frees the device's slot for reuse. The durations of its reports still in flight may be attributed to the
+	slot's next device. Ignored for -1. */
+	void removeDevice(int a_Device);
+
+	/** Counts a single duration of the specified stage, for the device (if not -1) and the aggregate. Wait-free. */
+	void record(int a_Device, Stage a_Stage, Clock::duration a_Duration)
+	{
+		m_Aggregate[a_Stage].record(a_Duration);
+		if ((a_Device >= 0) && (a_Device < MAX_DEVICES))
+		{
+			m_Devices[a_Device][a_Stage].record(a_Duration);
+		}
+	}
+
+	/** Counts a single duration of the specified stage only for the device, not in the aggregate; for the durations
+	shared by several devices, which are counted in the aggregate just once (with a_Device -1). Wait-free. */
+	void recordDevice(int a_Device, Stage a_Stage, Clock::duration a_Duration)
+	{
+		if ((a_Device >= 0) && (a_Device < MAX_DEVICES))
+		{
+			m_Devices[a_Device][a_Stage].record(a_Duration);
+		}
+	}
+
+	/** Returns the snapshot of all the devices together. */
+	Snapshot getAggregateSnapshot() const;
+
+	/** Returns the snapshots of each registered device. */
+	std::vector<Snapshot> getDeviceSnapshots() const;
+
+	/** Zeroes all the histograms, e.g. to start a new measurement. */
+	void reset();
+
+	/** Returns a multi-line human-readable report of the aggregate and per-device percentiles, for logging. */
+	std::string format() const;
+
+	/** Returns the (short, English) name of the stage, for logging and reports. */
+	static const char * getStageName(Stage a_Stage);
+
+protected:
+
+	/** Protects the device registration (m_IsUsed and m_Names); not used for recording. */
+	mutable std::mutex m_CS;
+
+	/** The histograms of all the devices together. */
+	LatencyHistogram m_Aggregate[NUM_STAGES];
+
+	/** The histograms of each device slot. */
+	LatencyHistogram m_Devices[MAX_DEVICES][NUM_STAGES];
+
+	/** Whether each slot is taken by a device. */
+	bool m_IsUsed[MAX_DEVICES];
+
+	/** The names of the devices in the slots. */
+	std::string m_Names[MAX_DEVICES];
+
+
+	StageHistograms();
+
+	/** Appends the percentiles of each stage of the snapshot to a_Dst. */
+	static void formatSnapshot(std::string & a_Dst, const Snapshot & a_Snapshot);
+};
+
+
+
+
@@ -12,6 +12,9 @@
 #ifdef _MSC_VER
 	// Under MSVC, link to WinSock2 (needed by RawBEToUTF8's byteswapping)
 	#pragma comment(lib, "ws2_32.lib")
+#else
+	// htons() for the byteswapping:
+	#include <arpa/inet.h>
 #endif
 
 
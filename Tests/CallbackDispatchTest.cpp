@@ -0,0 +1,201 @@
+// CallbackDispatchTest.cpp
+
+// Tests the Wiimote's callback dispatch: the interest masks, and changing the callbacks from within and during the dispatch
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <thread>
+#include <atomic>
+#include "Wiimote.h"
+
+
+
+
+
+/** The size of the reports fed into the Wiimote. */
+static const size_t REPORT_SIZE = 22;
+
+
+
+
+
+/** Returns an irtIRAccel report with a single IR dot at the specified X and the specified buttons' byte. */
+static std::vector<unsigned char> makeReport(int a_DotX, unsigned char a_Buttons)
+{
+	std::vector<unsigned char> res(REPORT_SIZE, 0);
+	res[0] = Wiimote::irtIRAccel;
+	res[2] = a_Buttons;
+	std::fill(res.begin() + 6, res.begin() + 18, 0xff);
+	res[6] = static_cast<unsigned char>(a_DotX);
+	res[7] = 0x10;
+	res[8] = static_cast<unsigned char>(((a_DotX >> 8) & 0x03) << 4);
+	return res;
+}
+
+
+
+
+
+/** Feeds the report into the Wiimote. */
+static void feed(Wiimote & a_Wiimote, const std::vector<unsigned char> & a_Report)
+{
+	a_Wiimote.replayReport(a_Report.data(), a_Report.size(), Wiimote::irrmExtended, Clock::now());
+}
+
+
+
+
+
+static void testInterestMasks()
+{
+	Wiimote wiimote;
+	wiimote.startReplay("CallbackDispatchTest", Wiimote::AccelCalibration());
+	int numIR = 0, numButtons = 0, numEvery = 0, numAll = 0;
+	Wiimote::Callback irCallback      = [&numIR](Wiimote &, const Wiimote::Sample &)      { numIR += 1; };
+	Wiimote::Callback buttonsCallback = [&numButtons](Wiimote &, const Wiimote::Sample &) { numButtons += 1; };
+	Wiimote::Callback everyCallback   = [&numEvery](Wiimote &, const Wiimote::Sample &)   { numEvery += 1; };
+	Wiimote::Callback allCallback     = [&numAll](Wiimote &, const Wiimote::Sample &)     { numAll += 1; };
+	wiimote.addCallback(&irCallback, Wiimote::cmIR);
+	wiimote.addCallback(&buttonsCallback, Wiimote::cmButtons);
+	wiimote.addCallback(&everyCallback, Wiimote::cmIR | Wiimote::cmEveryReport);
+	wiimote.addCallback(&allCallback);
+
+	feed(wiimote, makeReport(100, 0));  // The first report changes everything
+	feed(wiimote, makeReport(100, 0));  // No change
+	feed(wiimote, makeReport(101, 0));  // IR
+	feed(wiimote, makeReport(101, 0x08));  // Buttons
+	feed(wiimote, makeReport(102, 0x00));  // Both
+	CHECK_EQUAL(numIR, 3);
+	CHECK_EQUAL(numButtons, 3);
+	CHECK_EQUAL(numEvery, 5);
+	CHECK_EQUAL(numAll, 4);
+
+	// Changing the interest:
+	wiimote.setCallbackInterest(&irCallback, Wiimote::cmButtons);
+	wiimote.setCallbackInterest(&everyCallback, Wiimote::cmIR);
+	feed(wiimote, makeReport(103, 0));     // IR
+	feed(wiimote, makeReport(103, 0x08));  // Buttons
+	feed(wiimote, makeReport(103, 0x08));  // No change
+	CHECK_EQUAL(numIR, 4);
+	CHECK_EQUAL(numButtons, 4);
+	CHECK_EQUAL(numEvery, 6);
+	CHECK_EQUAL(numAll, 6);
+
+	// A removed callback is not called anymore:
+	wiimote.removeCallback(&allCallback);
+	wiimote.removeCallback(&buttonsCallback);
+	feed(wiimote, makeReport(104, 0));
+	CHECK_EQUAL(numAll, 6);
+	CHECK_EQUAL(numButtons, 4);
+	CHECK_EQUAL(numIR, 5);
+	CHECK_EQUAL(numEvery, 7);
+	wiimote.removeCallback(&irCallback);
+	wiimote.removeCallback(&everyCallback);
+	feed(wiimote, makeReport(105, 0x08));
+	CHECK_EQUAL(numIR, 5);
+	CHECK_EQUAL(numEvery, 7);
+}
+
+
+
+
+
+static void testChangesFromCallback()
+{
+	Wiimote wiimote;
+	wiimote.startReplay("CallbackDispatchTest", Wiimote::AccelCalibration());
+
+	// A callback that removes itself and adds another one; both take effect from the next report on:
+	int numSelfRemoving = 0, numAdded = 0;
+	Wiimote::Callback added = [&numAdded](Wiimote &, const Wiimote::Sample &) { numAdded += 1; };
+	Wiimote::Callback selfRemoving;
+	selfRemoving = [&](Wiimote & a_Wiimote, const Wiimote::Sample &)
+	{
+		numSelfRemoving += 1;
+		a_Wiimote.removeCallback(&selfRemoving);
+		a_Wiimote.addCallback(&added, Wiimote::cmEveryReport);
+	};
+	wiimote.addCallback(&selfRemoving, Wiimote::cmEveryReport);
+	feed(wiimote, makeReport(100, 0));
+	CHECK_EQUAL(numSelfRemoving, 1);
+	CHECK_EQUAL(numAdded, 0);
+	feed(wiimote, makeReport(100, 0));
+	feed(wiimote, makeReport(100, 0));
+	CHECK_EQUAL(numSelfRemoving, 1);
+	CHECK_EQUAL(numAdded, 2);
+	wiimote.removeCallback(&added);
+}
+
+
+
+
+
+static void testRemoveDuringDispatch()
+{
+	// While a thread keeps dispatching, another one adds and removes a callback; once removeCallback() returns,
+	// the callback must not be running nor called again:
+	Wiimote wiimote;
+	wiimote.startReplay("CallbackDispatchTest", Wiimote::AccelCalibration());
+	std::atomic<bool> isDone(false);
+	std::atomic<bool> isRemoved(false);
+	std::atomic<int> numCalledAfterRemove(0);
+	std::atomic<uint64_t> numCalls(0);
+	Wiimote::Callback callback = [&](Wiimote &, const Wiimote::Sample &)
+	{
+		numCalls += 1;
+		if (isRemoved.load())
+		{
+			numCalledAfterRemove += 1;
+		}
+		std::this_thread::yield();
+		if (isRemoved.load())
+		{
+			numCalledAfterRemove += 1;
+		}
+	};
+	Wiimote::Callback other = [](Wiimote &, const Wiimote::Sample &) {};
+	wiimote.addCallback(&other, Wiimote::cmEveryReport);
+	std::thread reader([&]()
+		{
+			auto report = makeReport(100, 0);
+			while (!isDone.load())
+			{
+				feed(wiimote, report);
+			}
+		}
+	);
+	for (int i = 0; i < 2000; ++i)
+	{
+		isRemoved = false;
+		wiimote.addCallback(&callback, Wiimote::cmEveryReport);
+		std::this_thread::yield();
+		wiimote.removeCallback(&callback);
+		isRemoved = true;
+	}
+	isDone = true;
+	reader.join();
+	CHECK_EQUAL(numCalledAfterRemove.load(), 0);
+	CHECK(numCalls.load() > 0);
+	wiimote.removeCallback(&other);
+}
+
+
+
+
+
+static void runTests()
+{
+	testInterestMasks();
+	testChangesFromCallback();
+	testRemoveDuringDispatch();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,228 @@
+// DeviceCacheTest.cpp
+
+// Tests the DeviceCache's file: the round trip of the entries, the missing and corrupt files, and the writes going
+// through a temporary file, so that a failed write leaves the previous file intact
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "DeviceCache.h"
+
+
+
+
+
+/** The folder for the cache files, in the current folder. */
+static const char * FOLDER_NAME = "DeviceCacheTest.tmp";
+
+
+
+
+
+/** Returns an entry with the values derived from a_Seed, so that the entries differ in all the fields. */
+static DeviceCache::Entry makeEntry(int a_Seed)
+{
+	DeviceCache::Entry res;
+	res.m_UseAltWrite = ((a_Seed % 2) != 0);
+	Wiimote::AccelCalibration cal =
+	{
+		static_cast<unsigned char>(0x80 + a_Seed), static_cast<unsigned char>(0x81 + a_Seed), static_cast<unsigned char>(0x82 + a_Seed),
+		static_cast<unsigned char>(0x9a + a_Seed), static_cast<unsigned char>(0x9b + a_Seed), static_cast<unsigned char>(0x9c + a_Seed)
+	};
+	res.m_AccelCalibration = cal;
+	res.m_IRReportingMode = ((a_Seed % 2) != 0) ? Wiimote::irrmBasic : Wiimote::irrmExtended;
+	return res;
+}
+
+
+
+
+
+/** Checks that the cache has the entry made from a_Seed under the specified key. */
+static void checkEntry(const DeviceCache & a_Cache, const std::string & a_Key, int a_Seed)
+{
+	DeviceCache::Entry entry;
+	if (!a_Cache.get(a_Key, entry))
+	{
+		fprintf(stderr, "Missing the entry \"%s\"\n", a_Key.c_str());
+		CHECK(!"Missing entry");
+		return;
+	}
+	auto expected = makeEntry(a_Seed);
+	CHECK_EQUAL(entry.m_UseAltWrite, expected.m_UseAltWrite);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_X0, expected.m_AccelCalibration.m_X0);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_Y0, expected.m_AccelCalibration.m_Y0);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_Z0, expected.m_AccelCalibration.m_Z0);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_XG, expected.m_AccelCalibration.m_XG);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_YG, expected.m_AccelCalibration.m_YG);
+	CHECK_EQUAL(entry.m_AccelCalibration.m_ZG, expected.m_AccelCalibration.m_ZG);
+	CHECK_EQUAL(entry.m_IRReportingMode, expected.m_IRReportingMode);
+}
+
+
+
+
+
+/** Returns true if the specified file exists (and is readable). */
+static bool fileExists(const std::string & a_FileName)
+{
+	auto f = fopen(a_FileName.c_str(), "r");
+	if (f == nullptr)
+	{
+		return false;
+	}
+	fclose(f);
+	return true;
+}
+
+
+
+
+
+/** Overwrites the specified file with the specified contents. */
+static void writeFile(const std::string & a_FileName, const char * a_Contents)
+{
+	auto f = fopen(a_FileName.c_str(), "w");
+	CHECK(f != nullptr);
+	if (f != nullptr)
+	{
+		fputs(a_Contents, f);
+		fclose(f);
+	}
+}
+
+
+
+
+
+static void testRoundTrip(const std::string & a_FileName)
+{
+	// No file yet, an empty cache:
+	{
+		DeviceCache cache(a_FileName);
+		CHECK(!cache.load());
+		DeviceCache::Entry entry;
+		CHECK(!cache.get("dev1", entry));
+
+		// Each change is saved right away, through the temporary file:
+		cache.set("dev1", makeEntry(1));
+		cache.set("Bluetooth 00:1f:32:aa:bb:cc", makeEntry(2));
+		cache.set("dev3", makeEntry(3));
+		cache.set("dev1", makeEntry(4));
+		cache.invalidate("dev3");
+		cache.invalidate("no such device");
+		CHECK(fileExists(a_FileName));
+		CHECK(!fileExists(a_FileName + ".tmp"));
+	}
+
+	// Another instance reads the same entries back:
+	DeviceCache cache(a_FileName);
+	CHECK(cache.load());
+	checkEntry(cache, "dev1", 4);
+	checkEntry(cache, "Bluetooth 00:1f:32:aa:bb:cc", 2);
+	DeviceCache::Entry entry;
+	CHECK(!cache.get("dev3", entry));
+
+	// A stale temporary file (from a crash during a write) is simply overwritten:
+	writeFile(a_FileName + ".tmp", "garbage");
+	cache.set("dev5", makeEntry(5));
+	CHECK(!fileExists(a_FileName + ".tmp"));
+	DeviceCache reloaded(a_FileName);
+	CHECK(reloaded.load());
+	checkEntry(reloaded, "dev5", 5);
+	checkEntry(reloaded, "dev1", 4);
+}
+
+
+
+
+
+static void testFailedWrite(const std::string & a_FolderName, const std::string & a_FileName)
+{
+	// When the temporary file cannot be written (here, a folder is in its way), the previous file stays intact:
+	DeviceCache cache(a_FileName);
+	CHECK(cache.load());
+	auto tmpFolderName = a_FolderName + "DeviceCache.txt.tmp";
+	createTestFolder(tmpFolderName);
+	cache.set("dev6", makeEntry(6));
+	cache.invalidate("dev1");
+	checkEntry(cache, "dev6", 6);
+	removeTestFolder(tmpFolderName);
+
+	DeviceCache reloaded(a_FileName);
+	CHECK(reloaded.load());
+	checkEntry(reloaded, "dev1", 4);
+	checkEntry(reloaded, "dev5", 5);
+	DeviceCache::Entry entry;
+	CHECK(!reloaded.get("dev6", entry));
+}
+
+
+
+
+
+static void testCorruptFile(const std::string & a_FileName)
+{
+	DeviceCache cache(a_FileName);
+	CHECK(cache.load());
+	DeviceCache::Entry entry;
+	CHECK(cache.get("dev1", entry));
+
+	// A file of another format, an unknown version, a broken line or an empty file are all ignored, whole:
+	const char * corruptFiles[] =
+	{
+		"Something else entirely\n",
+		"WiiWhiteboard device cache v2\ndev1\t0\t128 129 130 154 155 156\t3\n",
+		"WiiWhiteboard device cache v1\ndev1\t0\t128 129 130 154 155 156\t3\ndev2\t0\t128 129\t3\n",
+		"WiiWhiteboard device cache v1\ndev1\tx\t128 129 130 154 155 156\t3\n",
+		"",
+	};
+	for (auto contents: corruptFiles)
+	{
+		writeFile(a_FileName, contents);
+		CHECK(!cache.load());
+		CHECK(!cache.get("dev1", entry));
+		CHECK(!cache.get("dev2", entry));
+	}
+
+	// The empty lines are fine:
+	writeFile(a_FileName, "WiiWhiteboard device cache v1\n\ndev1\t1\t129 130 131 155 156 157\t1\n\n");
+	CHECK(cache.load());
+	checkEntry(cache, "dev1", 1);
+
+	// A corrupt file gets replaced by the next change:
+	writeFile(a_FileName, "Something else entirely\n");
+	CHECK(!cache.load());
+	cache.set("dev2", makeEntry(2));
+	DeviceCache reloaded(a_FileName);
+	CHECK(reloaded.load());
+	checkEntry(reloaded, "dev2", 2);
+}
+
+
+
+
+
+static void runTests()
+{
+	auto folder = createTestFolder(FOLDER_NAME);
+	auto fileName = folder + "DeviceCache.txt";
+	remove(fileName.c_str());
+	remove((fileName + ".tmp").c_str());
+
+	testRoundTrip(fileName);
+	testFailedWrite(folder, fileName);
+	testCorruptFile(fileName);
+
+	CHECK(remove(fileName.c_str()) == 0);
+	removeTestFolder(FOLDER_NAME);
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,237 @@
+// FlightRecorderTest.cpp
+
+// Tests the FlightRecorder's anomaly detection, the dump rate limiting and the contents of the dumps
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "FlightRecorder.h"
+
+
+
+
+
+/** The folder into which the dumps are written, in the current folder. */
+static const char * DUMP_FOLDER_NAME = "FlightRecorderTest.tmp";
+
+/** The interval between the consecutive reports, as at the Wiimote's 100 Hz. */
+static const std::chrono::milliseconds REPORT_INTERVAL(10);
+
+/** The minimum interval between two automatic dumps, for the test. */
+static const std::chrono::milliseconds MIN_DUMP_INTERVAL(500);
+
+
+
+
+
+/** Feeds the recorder with the reports and events of a single Wiimote, timed from a common base. */
+class Feeder
+{
+public:
+	Feeder(FlightRecorder & a_Recorder, Clock::time_point a_StartTime):
+		m_Recorder(a_Recorder),
+		m_Time(a_StartTime),
+		m_NumReports(0)
+	{
+	}
+
+
+	/** Adds a report, numbered so that it can be found in the dumps, a_Gap after the previous one. */
+	void addReport(std::chrono::milliseconds a_Gap = REPORT_INTERVAL, bool a_IsParsed = true)
+	{
+		m_Time += a_Gap;
+		auto report = makeReport(m_NumReports++);
+		auto state = Wiimote::State();
+		m_Recorder.addReport(report.data(), report.size(), Wiimote::irrmExtended, m_Time, a_IsParsed, state);
+	}
+
+
+	/** Adds a report followed by the specified number of pen-downs (and ups) produced from it. */
+	void addClicks(int a_NumClicks)
+	{
+		addReport();
+		std::vector<MouseEvent> events;
+		for (int i = 0; i < a_NumClicks; ++i)
+		{
+			MouseEvent down = {MouseEvent::metLeftDown, 1000 + i, 2000, 0};
+			MouseEvent up = {MouseEvent::metLeftUp, 1000 + i, 2000, 0};
+			events.push_back(down);
+			events.push_back(up);
+		}
+		m_Recorder.addEvents(events.data(), events.size(), m_Time);
+	}
+
+
+	/** Returns the report of the specified number: an irtIRAccel report with the number in the accel bytes. */
+	static std::vector<unsigned char> makeReport(int a_Num)
+	{
+		std::vector<unsigned char> res(22, 0xff);
+		res[0] = Wiimote::irtIRAccel;
+		res[1] = 0;
+		res[2] = 0;
+		res[3] = static_cast<unsigned char>(a_Num >> 8);
+		res[4] = static_cast<unsigned char>(a_Num);
+		res[5] = 0x5a;
+		return res;
+	}
+
+
+protected:
+	FlightRecorder & m_Recorder;
+	Clock::time_point m_Time;
+	int m_NumReports;
+};
+
+
+
+
+
+/** Waits until the recorder has written the specified number of dumps, at most a few seconds.
+Returns the recorder's stats at that point. */
+static FlightRecorder::Stats waitForDumps(const FlightRecorder & a_Recorder, uint64_t a_NumDumps)
+{
+	auto deadline = Clock::now() + std::chrono::seconds(5);
+	for (;;)
+	{
+		auto stats = a_Recorder.getStats();
+		if ((stats.m_NumDumps >= a_NumDumps) || (Clock::now() > deadline))
+		{
+			return stats;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+}
+
+
+
+
+
+/** Returns the contents of the specified file, empty if it cannot be read. */
+static std::string readFile(const std::string & a_FileName)
+{
+	std::ifstream f(a_FileName);
+	std::stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+
+
+
+
+/** Returns true if the dump contains the line of the report of the specified number. */
+static bool hasReport(const std::string & a_Dump, int a_Num)
+{
+	std::string hex;
+	for (auto b: Feeder::makeReport(a_Num))
+	{
+		AppendPrintf(hex, "%02x", b);
+	}
+	return (a_Dump.find(" report 3 " + hex) != std::string::npos);
+}
+
+
+
+
+
+static void testAnomalies()
+{
+	auto folder = createTestFolder(DUMP_FOLDER_NAME);
+	std::vector<std::string> dumpFileNames;
+	{
+		FlightRecorder recorder;
+		recorder.setName("FlightRecorderTest");
+		FlightRecorder::Config config;
+		config.m_PostTriggerDelay = std::chrono::milliseconds(50);
+		config.m_MinDumpInterval = MIN_DUMP_INTERVAL;
+		config.m_MaxReportGap = std::chrono::milliseconds(100);
+		config.m_ClickStormCount = 8;
+		config.m_ClickStormWindow = std::chrono::milliseconds(1000);
+		recorder.setConfig(config);
+		recorder.setDumpFolder(folder);
+
+		// Two seconds of regular reports, the last of them arriving right now; no anomaly:
+		Feeder feeder(recorder, Clock::now() - 200 * REPORT_INTERVAL);
+		for (int i = 0; i < 200; ++i)
+		{
+			feeder.addReport();
+		}
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 0);
+
+		// A report gap triggers a dump, which contains the reports from before the anomaly:
+		auto firstTriggerTime = Clock::now();
+		feeder.addReport(std::chrono::milliseconds(150));
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 1);
+
+		// An unparseable report and a click storm right after are only counted:
+		feeder.addReport(REPORT_INTERVAL, false);
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 2);
+		feeder.addClicks(7);
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 2);
+		feeder.addClicks(1);
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 3);
+		auto stats = waitForDumps(recorder, 1);
+		CHECK_EQUAL(stats.m_NumDumps, 1);
+		dumpFileNames.push_back(stats.m_LastDumpFileName);
+		CHECK(stats.m_LastDumpFileName.compare(0, folder.size(), folder) == 0);
+		auto dump = readFile(stats.m_LastDumpFileName);
+		CHECK(dump.find("Reason: Gap of") != std::string::npos);
+		CHECK(hasReport(dump, 0));
+		CHECK(hasReport(dump, 199));
+		CHECK(hasReport(dump, 200));
+
+		// No other dump within the min dump interval, however many anomalies:
+		feeder.addReport(REPORT_INTERVAL, false);
+		std::this_thread::sleep_until(firstTriggerTime + MIN_DUMP_INTERVAL / 2);
+		feeder.addReport(REPORT_INTERVAL, false);
+		CHECK_EQUAL(recorder.getStats().m_NumTriggers, 5);
+		CHECK_EQUAL(recorder.getStats().m_NumDumps, 1);
+
+		// After the interval, another anomaly (the storm still going on) gets its own dump, with the earlier anomalies in it:
+		std::this_thread::sleep_until(firstTriggerTime + MIN_DUMP_INTERVAL + std::chrono::milliseconds(50));
+		feeder.addClicks(1);
+		stats = waitForDumps(recorder, 2);
+		CHECK_EQUAL(stats.m_NumTriggers, 6);
+		CHECK_EQUAL(stats.m_NumDumps, 2);
+		dumpFileNames.push_back(stats.m_LastDumpFileName);
+		dump = readFile(stats.m_LastDumpFileName);
+		CHECK(dump.find("Reason: Click storm") != std::string::npos);
+		CHECK(dump.find(" | unparsed") != std::string::npos);
+		CHECK(dump.find(" event 0 down 1006 2000") != std::string::npos);
+		CHECK(dump.find(" event 0 up 1000 2000") != std::string::npos);
+		CHECK(hasReport(dump, 0));
+
+		// A dump on demand is not rate-limited:
+		auto fileName = recorder.dump("On demand");
+		CHECK(!fileName.empty());
+		dumpFileNames.push_back(fileName);
+		CHECK_EQUAL(recorder.getStats().m_NumDumps, 3);
+	}
+
+	for (const auto & fileName: dumpFileNames)
+	{
+		CHECK(remove(fileName.c_str()) == 0);
+	}
+	removeTestFolder(DUMP_FOLDER_NAME);
+}
+
+
+
+
+
+static void runTests()
+{
+	testAnomalies();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,239 @@
+// HidrawReactorTest.cpp
+
+// Tests reading several HidDevices through the shared HidrawReactor, using socketpairs as stand-ins for hidraw nodes
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "HidDevice.h"
+
+
+
+
+
+/** The number of the devices read concurrently. */
+static const int NUM_DEVICES = 4;
+
+/** The number of the reports written into each device in each round. */
+static const int NUM_REPORTS = 200;
+
+/** The size of the reports, as sent by a Wiimote in the IR mode. */
+static const size_t REPORT_SIZE = 22;
+
+
+
+
+
+/** A single report as received by a device's callback. */
+struct Received
+{
+	int m_Device;
+	int m_SeqNum;
+	size_t m_Size;
+	std::thread::id m_Thread;
+};
+
+
+
+
+
+/** The reports received by all the devices, in the order of their delivery. */
+static std::mutex g_CS;
+static std::vector<Received> g_Received;
+
+/** The number of the read errors reported by each device. */
+static std::atomic<int> g_NumErrors[NUM_DEVICES];
+
+
+
+
+
+/** Writes the reports with the specified sequence numbers into each of the socketpairs' writing ends, interleaved.
+Devices with a negative FD are skipped. */
+static void writeReports(const int (&a_WriteFDs)[NUM_DEVICES], int a_FirstSeqNum, int a_NumReports)
+{
+	for (int seq = a_FirstSeqNum; seq < a_FirstSeqNum + a_NumReports; ++seq)
+	{
+		for (int d = 0; d < NUM_DEVICES; ++d)
+		{
+			if (a_WriteFDs[d] < 0)
+			{
+				continue;
+			}
+			unsigned char report[REPORT_SIZE];
+			memset(report, 0, sizeof(report));
+			report[0] = 0x33;
+			report[1] = static_cast<unsigned char>(d);
+			report[2] = static_cast<unsigned char>(seq & 0xff);
+			report[3] = static_cast<unsigned char>(seq >> 8);
+			CHECK_EQUAL(::write(a_WriteFDs[d], report, sizeof(report)), static_cast<ssize_t>(sizeof(report)));
+		}
+	}
+}
+
+
+
+
+
+/** Waits until the condition holds, up to a few seconds. Returns the condition's final value. */
+static bool waitFor(std::function<bool ()> a_Condition)
+{
+	auto end = Clock::now() + std::chrono::seconds(5);
+	while (!a_Condition())
+	{
+		if (Clock::now() > end)
+		{
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+
+
+
+
+/** Returns the number of the reports received so far. */
+static size_t getNumReceived()
+{
+	std::lock_guard<std::mutex> lock(g_CS);
+	return g_Received.size();
+}
+
+
+
+
+
+/** Checks that the received reports came from a single thread other than this one, each device's in the order written,
+the devices with a negative FD not at all. a_NumReports is the number of the reports expected from each device. */
+static void checkReceived(const int (&a_WriteFDs)[NUM_DEVICES], int a_NumReports)
+{
+	std::lock_guard<std::mutex> lock(g_CS);
+	if (g_Received.empty())
+	{
+		CHECK(!"Nothing received");
+		return;
+	}
+	auto thread = g_Received[0].m_Thread;
+	CHECK(thread != std::this_thread::get_id());
+	int nextSeqNum[NUM_DEVICES] = {};
+	for (const auto & r: g_Received)
+	{
+		CHECK(r.m_Thread == thread);
+		CHECK_EQUAL(r.m_Size, REPORT_SIZE);
+		if ((r.m_Device < 0) || (r.m_Device >= NUM_DEVICES))
+		{
+			CHECK(!"Bad device");
+			continue;
+		}
+		CHECK(a_WriteFDs[r.m_Device] >= 0);
+		CHECK_EQUAL(r.m_SeqNum, nextSeqNum[r.m_Device]);
+		nextSeqNum[r.m_Device] = r.m_SeqNum + 1;
+	}
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		CHECK_EQUAL(nextSeqNum[d], (a_WriteFDs[d] < 0) ? 0 : a_NumReports);
+	}
+}
+
+
+
+
+
+static void runTests()
+{
+	// Attach the reading ends of the socketpairs to the devices:
+	HidDevice devices[NUM_DEVICES];
+	int writeFDs[NUM_DEVICES];
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0)
+		{
+			CHECK(!"socketpair() failed");
+			return;
+		}
+		writeFDs[d] = fds[1];
+		CHECK(devices[d].attach(fds[0]));
+		CHECK(devices[d].isOpen());
+		g_NumErrors[d] = 0;
+		devices[d].startReading(
+			[d](const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime)
+			{
+				UNUSED(a_ArrivalTime);
+				Received r;
+				r.m_Device = (a_Size > 1) ? a_Report[1] : -1;
+				r.m_SeqNum = (a_Size > 3) ? (a_Report[2] | (a_Report[3] << 8)) : -1;
+				r.m_Size = a_Size;
+				r.m_Thread = std::this_thread::get_id();
+				CHECK_EQUAL(r.m_Device, d);
+				std::lock_guard<std::mutex> lock(g_CS);
+				g_Received.push_back(r);
+			},
+			[d]()
+			{
+				g_NumErrors[d] += 1;
+			}
+		);
+	}
+
+	// All the reports of all the devices are delivered, in order, on the single reactor thread:
+	writeReports(writeFDs, 0, NUM_REPORTS);
+	CHECK(waitFor([]() { return getNumReceived() >= NUM_DEVICES * NUM_REPORTS; }));
+	checkReceived(writeFDs, NUM_REPORTS);
+
+	// Closing the other end of one device fails (and removes) only that device:
+	const int closedDevice = 1;
+	::close(writeFDs[closedDevice]);
+	writeFDs[closedDevice] = -1;
+	CHECK(waitFor([]() { return (g_NumErrors[closedDevice] > 0); }));
+	{
+		std::lock_guard<std::mutex> lock(g_CS);
+		g_Received.clear();
+	}
+	writeReports(writeFDs, 0, NUM_REPORTS);
+	CHECK(waitFor([]() { return getNumReceived() >= (NUM_DEVICES - 1) * NUM_REPORTS; }));
+	checkReceived(writeFDs, NUM_REPORTS);
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		CHECK_EQUAL(g_NumErrors[d].load(), (d == closedDevice) ? 1 : 0);
+	}
+
+	// Closing a device on our side unregisters it, the rest keep working:
+	devices[0].close();
+	CHECK(!devices[0].isOpen());
+	::close(writeFDs[0]);
+	writeFDs[0] = -1;
+	{
+		std::lock_guard<std::mutex> lock(g_CS);
+		g_Received.clear();
+	}
+	writeReports(writeFDs, 0, NUM_REPORTS);
+	CHECK(waitFor([]() { return getNumReceived() >= (NUM_DEVICES - 2) * NUM_REPORTS; }));
+	checkReceived(writeFDs, NUM_REPORTS);
+	CHECK_EQUAL(g_NumErrors[0].load(), 0);
+
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		devices[d].close();
+		if (writeFDs[d] >= 0)
+		{
+			::close(writeFDs[d]);
+		}
+	}
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,257 @@
+// InputInjectorTest.cpp
+
+// Tests the InputInjector's ordering, move coalescing and button overflow while the sink is stalled
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <mutex>
+#include <condition_variable>
+#include "InputInjector.h"
+
+
+
+
+
+/** A sink that records the events and can be stalled, to simulate an OS call that takes long. */
+class StallingSink:
+	public OutputSink
+{
+public:
+	StallingSink():
+		m_IsStalled(false),
+		m_IsInSend(false)
+	{
+	}
+
+
+	/** Makes the next send() calls wait until resume() is called. */
+	void stall()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_IsStalled = true;
+	}
+
+
+	/** Lets the stalled send() calls continue. */
+	void resume()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_IsStalled = false;
+		m_CV.notify_all();
+	}
+
+
+	/** Waits until a send() call is stalled. */
+	void waitForStalledSend()
+	{
+		std::unique_lock<std::mutex> lock(m_CS);
+		m_CV.wait(lock, [this]() { return m_IsInSend; });
+	}
+
+
+	/** Returns all the events sent so far. */
+	std::vector<MouseEvent> getEvents()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		return m_Events;
+	}
+
+
+	// OutputSink overrides:
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) override
+	{
+		std::unique_lock<std::mutex> lock(m_CS);
+		m_Events.insert(m_Events.end(), a_Events, a_Events + a_Count);
+		m_IsInSend = true;
+		m_CV.notify_all();
+		m_CV.wait(lock, [this]() { return !m_IsStalled; });
+		m_IsInSend = false;
+
+		// Pretend a single OS call per batch, as UinputSink makes:
+		return 1;
+	}
+
+
+protected:
+	std::mutex m_CS;
+	std::condition_variable m_CV;
+	bool m_IsStalled;
+	bool m_IsInSend;
+	std::vector<MouseEvent> m_Events;
+};
+
+
+
+
+
+/** Returns an event of the specified type, for the specified pen; the source is encoded in Y, the number in X. */
+static MouseEvent makeEvent(MouseEvent::Type a_Type, int a_Source, int a_Num, int a_PenId = 0)
+{
+	MouseEvent res;
+	res.m_Type = a_Type;
+	res.m_X = a_Num;
+	res.m_Y = a_Source;
+	res.m_PenId = a_PenId;
+	return res;
+}
+
+
+
+
+
+/** Waits until all the events posted so far have been injected or dropped. */
+static void waitForInjected(const InputInjector & a_Injector)
+{
+	for (;;)
+	{
+		auto stats = a_Injector.getStats();
+		if (stats.m_NumInjected + stats.m_NumMovesDropped >= stats.m_NumPosted)
+		{
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+
+
+
+
+static void testButtonOverflow()
+{
+	auto sink = std::make_shared<StallingSink>();
+	InputInjector injector(sink);
+	const int NUM_SOURCES = 3;
+	const int NUM_BUTTONS = static_cast<int>(InputInjector::BUTTON_QUEUE_CAPACITY) * 3;
+	int sources[NUM_SOURCES];
+	for (auto & src: sources)
+	{
+		src = injector.addSource();
+		CHECK(src >= 0);
+	}
+
+	// Stall the injection thread in the sink:
+	sink->stall();
+	auto first = makeEvent(MouseEvent::metMove, -1, -1);
+	injector.post(sources[0], &first, 1, LatencyTrace());
+	sink->waitForStalledSend();
+
+	// Post many more button transitions than the queue holds, interleaved with moves; none of this may wait
+	// for the stalled injection thread (it would deadlock the test):
+	for (int i = 0; i < NUM_BUTTONS; ++i)
+	{
+		for (int s = 0; s < NUM_SOURCES; ++s)
+		{
+			MouseEvent events[2] =
+			{
+				makeEvent((i % 2 == 0) ? MouseEvent::metLeftDown : MouseEvent::metLeftUp, s, i),
+				makeEvent(MouseEvent::metMove, s, 100000 + i, 1),
+			};
+			injector.post(sources[s], events, 2, LatencyTrace());
+		}
+	}
+	auto stats = injector.getStats();
+	CHECK(stats.m_NumButtonQueueFull > 0);
+	CHECK_EQUAL(stats.m_NumPosted, 1 + 2 * NUM_SOURCES * NUM_BUTTONS);
+
+	// Let the injection catch up; then the overflow lists are drained and the queue is used again:
+	sink->resume();
+	waitForInjected(injector);
+	auto numOverflown = injector.getStats().m_NumButtonQueueFull;
+	for (int s = 0; s < NUM_SOURCES; ++s)
+	{
+		auto evt = makeEvent(MouseEvent::metLeftDown, s, NUM_BUTTONS);
+		injector.post(sources[s], &evt, 1, LatencyTrace());
+	}
+	injector.stop();
+	stats = injector.getStats();
+	CHECK_EQUAL(stats.m_NumButtonQueueFull, numOverflown);
+	CHECK_EQUAL(stats.m_NumInjected + stats.m_NumMovesDropped, stats.m_NumPosted);
+	CHECK_EQUAL(stats.m_ButtonQueueDepth, 0);
+
+	// No transition was lost and each source's are in order, with each source's moves never overtaking its buttons:
+	int nextButton[NUM_SOURCES] = {};
+	for (const auto & e: sink->getEvents())
+	{
+		if ((e.m_Y < 0) || (e.m_Y >= NUM_SOURCES))
+		{
+			continue;
+		}
+		if (e.m_Type == MouseEvent::metMove)
+		{
+			// The move posted after button i must come after it:
+			CHECK(e.m_X - 100000 < nextButton[e.m_Y]);
+			continue;
+		}
+		CHECK_EQUAL(e.m_X, nextButton[e.m_Y]);
+		CHECK(e.m_Type == ((e.m_X % 2 == 0) ? MouseEvent::metLeftDown : MouseEvent::metLeftUp));
+		nextButton[e.m_Y] = e.m_X + 1;
+	}
+	for (int s = 0; s < NUM_SOURCES; ++s)
+	{
+		CHECK_EQUAL(nextButton[s], NUM_BUTTONS + 1);
+	}
+}
+
+
+
+
+
+static void testMoveCoalescing()
+{
+	auto sink = std::make_shared<StallingSink>();
+	InputInjector injector(sink);
+	auto src = injector.addSource();
+
+	// While the injection is stalled, only the latest move of each pen is kept:
+	sink->stall();
+	auto first = makeEvent(MouseEvent::metMove, 0, 0);
+	injector.post(src, &first, 1, LatencyTrace());
+	sink->waitForStalledSend();
+	const int NUM_MOVES = 1000;
+	for (int i = 1; i <= NUM_MOVES; ++i)
+	{
+		MouseEvent events[2] = {makeEvent(MouseEvent::metMove, 0, i, 0), makeEvent(MouseEvent::metMove, 0, -i, 1)};
+		injector.post(src, events, 2, LatencyTrace());
+	}
+	sink->resume();
+	injector.stop();
+
+	auto events = sink->getEvents();
+	CHECK_EQUAL(events.size(), 3);
+	if (events.size() == 3)
+	{
+		CHECK_EQUAL(events[0].m_X, 0);
+		CHECK_EQUAL(events[1].m_X, NUM_MOVES);
+		CHECK_EQUAL(events[1].m_PenId, 0);
+		CHECK_EQUAL(events[2].m_X, -NUM_MOVES);
+		CHECK_EQUAL(events[2].m_PenId, 1);
+	}
+	auto stats = injector.getStats();
+	CHECK_EQUAL(stats.m_NumMovesDropped, 2 * (NUM_MOVES - 1));
+	CHECK_EQUAL(stats.m_NumInjected + stats.m_NumMovesDropped, stats.m_NumPosted);
+
+	// The OS calls are the sink's, one per batch here:
+	CHECK_EQUAL(stats.m_NumSyscalls, 2);
+	CHECK_EQUAL(stats.m_NumSyscallsSaved, stats.m_NumInjected - 2);
+}
+
+
+
+
+
+static void runTests()
+{
+	testButtonOverflow();
+	testMoveCoalescing();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,168 @@
+// LatencyHistogramTest.cpp
+
+// Tests the LatencyHistogram's bucketing (the index / bound round-trips, the clamping of the long durations)
+// and the percentiles of its snapshots
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "LatencyHistogram.h"
+
+
+
+
+
+/** The value (in nanoseconds) from which on all the durations are counted in the last bucket. */
+static const uint64_t MAX_VALUE_NSEC = static_cast<uint64_t>(1) << LatencyHistogram::MAX_VALUE_BITS;
+
+
+
+
+
+static void testBuckets()
+{
+	// The buckets are contiguous, each counts exactly the values between its bounds:
+	CHECK_EQUAL(LatencyHistogram::getBucketLowerBound(0), 0);
+	for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i)
+	{
+		auto lowerBound = LatencyHistogram::getBucketLowerBound(i);
+		auto width = LatencyHistogram::getBucketWidth(i);
+		CHECK(width > 0);
+		CHECK_EQUAL(LatencyHistogram::getBucketIndex(lowerBound), i);
+		CHECK_EQUAL(LatencyHistogram::getBucketIndex(lowerBound + width - 1), i);
+		if (i + 1 < LatencyHistogram::NUM_BUCKETS)
+		{
+			CHECK_EQUAL(LatencyHistogram::getBucketLowerBound(i + 1), lowerBound + width);
+		}
+
+		// The relative precision is 1 / SUB_BUCKETS:
+		if (lowerBound >= static_cast<uint64_t>(LatencyHistogram::SUB_BUCKETS))
+		{
+			CHECK(width * LatencyHistogram::SUB_BUCKETS <= lowerBound);
+		}
+	}
+
+	// Each power of two starts a new bucket, right after the one ending below it:
+	for (int bit = 0; bit < LatencyHistogram::MAX_VALUE_BITS; ++bit)
+	{
+		auto value = static_cast<uint64_t>(1) << bit;
+		auto idx = LatencyHistogram::getBucketIndex(value);
+		CHECK_EQUAL(LatencyHistogram::getBucketLowerBound(idx), value);
+		CHECK_EQUAL(LatencyHistogram::getBucketIndex(value - 1), idx - 1);
+		if (bit >= LatencyHistogram::SUB_BUCKET_BITS)
+		{
+			CHECK_EQUAL(LatencyHistogram::getBucketWidth(idx), value / LatencyHistogram::SUB_BUCKETS);
+			CHECK_EQUAL(idx % LatencyHistogram::SUB_BUCKETS, 0);
+		}
+	}
+
+	// The last bucket ends at 2^MAX_VALUE_BITS, the longer values are clamped into it:
+	auto last = LatencyHistogram::NUM_BUCKETS - 1;
+	CHECK_EQUAL(LatencyHistogram::getBucketLowerBound(last) + LatencyHistogram::getBucketWidth(last), MAX_VALUE_NSEC);
+	CHECK_EQUAL(LatencyHistogram::getBucketIndex(MAX_VALUE_NSEC - 1), last);
+	CHECK_EQUAL(LatencyHistogram::getBucketIndex(MAX_VALUE_NSEC), last);
+	CHECK_EQUAL(LatencyHistogram::getBucketIndex(MAX_VALUE_NSEC * 1000), last);
+	CHECK_EQUAL(LatencyHistogram::getBucketIndex(~static_cast<uint64_t>(0)), last);
+}
+
+
+
+
+
+static void testRecording()
+{
+	LatencyHistogram histogram;
+	CHECK_EQUAL(histogram.getSnapshot().getCount(), 0);
+	CHECK_EQUAL(histogram.getSnapshot().getPercentileUsec(0.5), 0);
+	CHECK_EQUAL(histogram.getSnapshot().getMaxUsec(), 0);
+
+	// Negative durations (clock adjustments, mismatched timestamps) count as zero:
+	histogram.record(std::chrono::microseconds(-5));
+	histogram.record(std::chrono::nanoseconds(0));
+	auto snapshot = histogram.getSnapshot();
+	CHECK_EQUAL(snapshot.getCount(), 2);
+	CHECK_EQUAL(snapshot.getMaxUsec(), 0);
+	CHECK_EQUAL(snapshot.getPercentileUsec(1), 0);
+
+	// The overly long durations are counted, in the last bucket:
+	histogram.record(std::chrono::hours(1));
+	snapshot = histogram.getSnapshot();
+	CHECK_EQUAL(snapshot.getCount(), 3);
+	CHECK(std::abs(snapshot.getMaxUsec() - (MAX_VALUE_NSEC - 1) / 1000.0) < 1e-3);
+
+	histogram.reset();
+	CHECK_EQUAL(histogram.getSnapshot().getCount(), 0);
+}
+
+
+
+
+
+static void testPercentiles()
+{
+	// 1 .. 1000 us, each once; each percentile is reported as the upper bound of its bucket,
+	// at most 1 / SUB_BUCKETS above the exact value:
+	LatencyHistogram histogram;
+	for (int us = 1; us <= 1000; ++us)
+	{
+		histogram.record(std::chrono::microseconds(us));
+	}
+	auto snapshot = histogram.getSnapshot();
+	CHECK_EQUAL(snapshot.getCount(), 1000);
+	const double fractions[] = {0, 0.001, 0.25, 0.5, 0.9, 0.99, 0.999, 1};
+	for (auto fraction: fractions)
+	{
+		auto exact = std::max(std::ceil(fraction * 1000), 1.0);
+		auto percentile = snapshot.getPercentileUsec(fraction);
+		CHECK(percentile >= exact);
+		CHECK(percentile < exact * (1 + 1.0 / LatencyHistogram::SUB_BUCKETS));
+	}
+	CHECK_EQUAL(snapshot.getPercentileUsec(2), snapshot.getPercentileUsec(1));
+	CHECK_EQUAL(snapshot.getMaxUsec() * 1000, snapshot.getPercentileUsec(1) * 1000);
+	CHECK(std::abs(snapshot.getMeanUsec() - 500.5) < 500.5 / LatencyHistogram::SUB_BUCKETS);
+
+	// A snapshot with another one added is the histogram of both; here, each value twice, so the same percentiles:
+	auto doubled = snapshot;
+	doubled.add(snapshot);
+	CHECK_EQUAL(doubled.getCount(), 2000);
+	for (auto fraction: fractions)
+	{
+		CHECK_EQUAL(doubled.getPercentileUsec(fraction) * 1000, snapshot.getPercentileUsec(fraction) * 1000);
+	}
+
+	// A skewed distribution: 99 % fast, 1 % slow; the tail shows only in the top percentiles:
+	LatencyHistogram skewed;
+	for (int i = 0; i < 990; ++i)
+	{
+		skewed.record(std::chrono::microseconds(100));
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		skewed.record(std::chrono::milliseconds(20));
+	}
+	snapshot = skewed.getSnapshot();
+	CHECK(snapshot.getPercentileUsec(0.5) < 110);
+	CHECK(snapshot.getPercentileUsec(0.99) < 110);
+	CHECK(snapshot.getPercentileUsec(0.991) >= 20000);
+	CHECK(snapshot.getMaxUsec() < 20000 * (1 + 1.0 / LatencyHistogram::SUB_BUCKETS));
+}
+
+
+
+
+
+static void runTests()
+{
+	testBuckets();
+	testRecording();
+	testPercentiles();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
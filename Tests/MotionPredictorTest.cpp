@@ -0,0 +1,235 @@
+// MotionPredictorTest.cpp
+
+// Tests the MotionPredictor's extrapolation of the pen's position, and the Processor's clamping of the predicted
+// positions to the calibrated screen quad
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "MotionPredictor.h"
+#include "Processor.h"
+#include "Calibration.h"
+#include "InputInjector.h"
+#include "CaptureSink.h"
+
+
+
+
+
+/** The interval between the samples, as at the camera's 100 Hz. */
+static const std::chrono::milliseconds SAMPLE_INTERVAL(10);
+
+/** The largest difference from the exact prediction allowed; only the floating point rounding. */
+static const double TOLERANCE = 1e-6;
+
+
+
+
+
+/** Returns the predictor config with the specified horizon and the default window. */
+static MotionPredictor::Config makeConfig(std::chrono::milliseconds a_Horizon)
+{
+	MotionPredictor::Config res;
+	res.m_Horizon = a_Horizon;
+	return res;
+}
+
+
+
+
+
+/** Checks that the predictor predicts the specified position. */
+static void checkPrediction(const MotionPredictor & a_Predictor, double a_X, double a_Y)
+{
+	double x = -1, y = -1;
+	CHECK(a_Predictor.predict(x, y));
+	if ((std::abs(x - a_X) > TOLERANCE) || (std::abs(y - a_Y) > TOLERANCE))
+	{
+		fprintf(stderr, "Predicted {%f, %f}, expected {%f, %f}\n", x, y, a_X, a_Y);
+		CHECK(!"Bad prediction");
+	}
+}
+
+
+
+
+
+static void testNotEnoughSamples()
+{
+	// Disabled by default; then the prediction is just the latest sample:
+	MotionPredictor disabled;
+	CHECK(!disabled.isEnabled());
+	auto time = Clock::now();
+	disabled.addSample(100, 200, time);
+	disabled.addSample(200, 300, time + SAMPLE_INTERVAL);
+	checkPrediction(disabled, 200, 300);
+
+	// No samples, no prediction:
+	MotionPredictor predictor(makeConfig(std::chrono::milliseconds(30)));
+	CHECK(predictor.isEnabled());
+	double x = -1, y = -1;
+	CHECK(!predictor.predict(x, y));
+	CHECK_EQUAL(x, -1);
+	CHECK_EQUAL(y, -1);
+
+	// A single sample has no velocity:
+	predictor.addSample(100, 200, time);
+	double vx, vy;
+	CHECK(!predictor.estimateVelocity(vx, vy));
+	checkPrediction(predictor, 100, 200);
+
+	// Neither do two samples at the same time (batched by the OS):
+	predictor.addSample(150, 250, time);
+	CHECK(!predictor.estimateVelocity(vx, vy));
+	checkPrediction(predictor, 150, 250);
+
+	// Nor a sample whose predecessors are all out of the window (the pen resting, then moved by a jump):
+	predictor.reset();
+	predictor.addSample(100, 200, time);
+	predictor.addSample(500, 600, time + predictor.getConfig().m_Window + SAMPLE_INTERVAL);
+	CHECK(!predictor.estimateVelocity(vx, vy));
+	checkPrediction(predictor, 500, 600);
+
+	// After a reset(), nothing again:
+	predictor.reset();
+	CHECK(!predictor.predict(x, y));
+}
+
+
+
+
+
+static void testConstantVelocity()
+{
+	// A pen moving at a constant velocity, sampled at irregular intervals; predicted exactly v * horizon ahead:
+	const double vx = 2000, vy = -500;
+	const auto horizon = std::chrono::milliseconds(30);
+	MotionPredictor predictor(makeConfig(horizon));
+	auto startTime = Clock::now();
+	const int intervalsUsec[] = {10000, 8000, 12000, 10000, 3000, 17000, 10000, 9000, 11000, 10000};
+	int64_t usec = 0;
+	for (int i = 0; i < 40; ++i)
+	{
+		auto t = usec / 1e6;
+		auto x = 1000 + vx * t;
+		auto y = 5000 + vy * t;
+		predictor.addSample(x, y, startTime + std::chrono::microseconds(usec));
+		if (i > 0)
+		{
+			double estX, estY;
+			CHECK(predictor.estimateVelocity(estX, estY));
+			CHECK(std::abs(estX - vx) < 1e-3);
+			CHECK(std::abs(estY - vy) < 1e-3);
+			checkPrediction(predictor, x + vx * 0.03, y + vy * 0.03);
+		}
+		usec += intervalsUsec[i % ARRAYCOUNT(intervalsUsec)];
+	}
+
+	// A resting pen that starts moving is predicted exactly once the window holds only the moving samples:
+	predictor.reset();
+	auto time = startTime;
+	for (int i = 0; i < 10; ++i)
+	{
+		predictor.addSample(300, 300, time);
+		time += SAMPLE_INTERVAL;
+	}
+	double x = 300;
+	auto numWindowSamples = static_cast<int>(predictor.getConfig().m_Window / SAMPLE_INTERVAL) + 1;
+	for (int i = 0; i < numWindowSamples; ++i)
+	{
+		x += vx * 0.01;
+		predictor.addSample(x, 300, time);
+		time += SAMPLE_INTERVAL;
+	}
+	checkPrediction(predictor, x + vx * 0.03, 300);
+}
+
+
+
+
+
+static void testClamping()
+{
+	// A Wiimote looking straight at the screen, each camera pixel is 80 screen units:
+	auto wiimote = std::make_shared<Wiimote>();
+	wiimote->startReplay("MotionPredictorTest", Wiimote::AccelCalibration());
+	std::vector<WiimotePtr> wiimotes;
+	wiimotes.push_back(wiimote);
+	Calibration calibration;
+	const int points[4][4] = {{100, 100, 0, 0}, {900, 100, 64000, 0}, {900, 700, 64000, 48000}, {100, 700, 0, 48000}};
+	for (int i = 0; i < 4; ++i)
+	{
+		calibration.setPoint(*wiimote, i, points[i][0], points[i][1], points[i][2], points[i][3]);
+	}
+	Warper warper;
+	warper.setCalibration(calibration);
+
+	// The pen moves right at 4 camera pixels (320 screen units) per frame, all the way to the quad's edge;
+	// the prediction of 35 ms ahead (1120 units) overshoots the edge on the last 4 frames:
+	auto sink = std::make_shared<CaptureSink>();
+	InputInjector injector(sink);
+	Processor::PredictionStats stats;
+	{
+		Processor processor(
+			warper, injector, wiimotes, wiimote.get(), PenDebouncer::Config(), PointFilterPtr(),
+			makeConfig(std::chrono::milliseconds(35))
+		);
+		auto time = Clock::now();
+		for (int x = 500; x <= 900; x += 4)
+		{
+			std::vector<unsigned char> report(22, 0xff);
+			report[0] = Wiimote::irtIRAccel;
+			report[1] = 0;
+			report[2] = 0;
+			report[3] = 0x80;
+			report[4] = 0x80;
+			report[5] = 0x9a;
+			report[6] = static_cast<unsigned char>(x);
+			report[7] = static_cast<unsigned char>(400);
+			report[8] = static_cast<unsigned char>((((400 >> 8) & 0x03) << 6) | (((x >> 8) & 0x03) << 4) | 0x03);
+			wiimote->replayReport(report.data(), report.size(), Wiimote::irrmExtended, time);
+			time += SAMPLE_INTERVAL;
+		}
+		stats = processor.getPredictionStats();
+	}
+	injector.stop();
+
+	// All the moves but the one at the pen-down are predicted (the first one has no velocity yet, so it stays):
+	CHECK_EQUAL(stats.m_NumPredicted, 100);
+	CHECK_EQUAL(stats.m_NumClamped, 4);
+
+	// The injector may coalesce the moves, but each one that got through is either 1120 units ahead of a frame's
+	// position, or clamped onto the quad's edge; the last one is the clamped one:
+	auto records = sink->getRecords();
+	for (const auto & r: records)
+	{
+		const auto & evt = r.m_Event;
+		CHECK(evt.m_X <= 64000);
+		CHECK_EQUAL(evt.m_Y, 24000);
+		if ((evt.m_Type == MouseEvent::metMove) && (evt.m_X > 32320) && (evt.m_X < 64000))
+		{
+			CHECK_EQUAL((evt.m_X - 1120) % 320, 0);
+		}
+	}
+	CHECK(!records.empty() && (records.back().m_Event.m_X == 64000));
+}
+
+
+
+
+
+static void runTests()
+{
+	testNotEnoughSamples();
+	testConstantVelocity();
+	testClamping();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,237 @@
+// OutputQueueTest.cpp
+
+// Tests the OutputQueue's ordering, pacing, coalescing and the resolution of its futures
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <mutex>
+#include <condition_variable>
+#include "OutputQueue.h"
+
+
+
+
+
+/** A writer that records the reports and their write times, and can be held inside a write. */
+class TestWriter
+{
+public:
+	TestWriter():
+		m_IsHeld(false),
+		m_IsInWrite(false)
+	{
+	}
+
+
+	/** Returns the Writer function for the OutputQueue. Reports starting with 0xee fail. */
+	OutputQueue::Writer getWriter()
+	{
+		return [this](const unsigned char * a_Report, size_t a_Size)
+		{
+			std::unique_lock<std::mutex> lock(m_CS);
+			m_Reports.push_back(std::vector<unsigned char>(a_Report, a_Report + a_Size));
+			m_Times.push_back(Clock::now());
+			m_IsInWrite = true;
+			m_CV.notify_all();
+			m_CV.wait(lock, [this]() { return !m_IsHeld; });
+			m_IsInWrite = false;
+			return ((a_Size == 0) || (a_Report[0] != 0xee));
+		};
+	}
+
+
+	/** Makes the next writes wait until release() is called. */
+	void hold()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_IsHeld = true;
+	}
+
+
+	/** Lets the held writes continue. */
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_IsHeld = false;
+		m_CV.notify_all();
+	}
+
+
+	/** Waits until a write is held. */
+	void waitForHeldWrite()
+	{
+		std::unique_lock<std::mutex> lock(m_CS);
+		m_CV.wait(lock, [this]() { return m_IsInWrite; });
+	}
+
+
+	/** Returns the first bytes of the reports written so far, in order. */
+	std::vector<unsigned char> getWrittenIds()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		std::vector<unsigned char> res;
+		for (const auto & r: m_Reports)
+		{
+			res.push_back(r.empty() ? 0 : r[0]);
+		}
+		return res;
+	}
+
+
+	/** Returns the times of the writes so far, in order. */
+	std::vector<Clock::time_point> getTimes()
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		return m_Times;
+	}
+
+
+protected:
+	std::mutex m_CS;
+	std::condition_variable m_CV;
+	bool m_IsHeld;
+	bool m_IsInWrite;
+	std::vector<std::vector<unsigned char>> m_Reports;
+	std::vector<Clock::time_point> m_Times;
+};
+
+
+
+
+
+/** Queues a report consisting of the single byte. */
+static std::future<bool> pushId(OutputQueue & a_Queue, unsigned char a_Id, int a_CoalesceKey = 0)
+{
+	return a_Queue.push(&a_Id, 1, a_CoalesceKey);
+}
+
+
+
+
+
+static void testOrderAndPacing()
+{
+	const std::chrono::milliseconds interval(5);
+	TestWriter writer;
+	OutputQueue queue(writer.getWriter(), interval);
+	std::vector<std::future<bool>> futures;
+	for (unsigned char i = 1; i <= 10; ++i)
+	{
+		futures.push_back(pushId(queue, i));
+	}
+	for (auto & f: futures)
+	{
+		CHECK(f.get());
+	}
+
+	// The reports are written in order, at least the interval apart:
+	auto ids = writer.getWrittenIds();
+	CHECK_EQUAL(ids.size(), 10);
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		CHECK_EQUAL(ids[i], i + 1);
+	}
+	auto times = writer.getTimes();
+	for (size_t i = 1; i < times.size(); ++i)
+	{
+		CHECK(times[i] - times[i - 1] >= interval);
+	}
+	CHECK_EQUAL(queue.getWriteIntervalStats().m_Count, 9);
+	CHECK_EQUAL(queue.getNumCoalesced(), 0);
+
+	// A shorter interval takes effect from the next write on:
+	queue.setInterval(std::chrono::microseconds(0));
+	CHECK(queue.getInterval() == std::chrono::microseconds(0));
+	CHECK(pushId(queue, 11).get());
+}
+
+
+
+
+
+static void testCoalescing()
+{
+	TestWriter writer;
+	OutputQueue queue(writer.getWriter(), std::chrono::microseconds(0));
+
+	// Hold the writer in the first write, so that the rest stays queued:
+	writer.hold();
+	auto first = pushId(queue, 1);
+	writer.waitForHeldWrite();
+	auto a = pushId(queue, 2);
+	auto b1 = pushId(queue, 3, 1);
+	auto c = pushId(queue, 0xee, 2);  // Fails
+	auto b2 = pushId(queue, 4, 1);    // Supersedes b1, goes after c
+	auto b3 = pushId(queue, 5, 1);    // Supersedes b2
+	writer.release();
+
+	CHECK(first.get());
+	CHECK(a.get());
+	CHECK(!c.get());
+	CHECK(b1.get());
+	CHECK(b2.get());
+	CHECK(b3.get());
+	auto ids = writer.getWrittenIds();
+	const unsigned char expected[] = {1, 2, 0xee, 5};
+	CHECK_EQUAL(ids.size(), ARRAYCOUNT(expected));
+	if (ids.size() == ARRAYCOUNT(expected))
+	{
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			CHECK_EQUAL(ids[i], expected[i]);
+		}
+	}
+	CHECK_EQUAL(queue.getNumCoalesced(), 2);
+}
+
+
+
+
+
+static void testStop()
+{
+	TestWriter writer;
+	OutputQueue queue(writer.getWriter(), std::chrono::microseconds(0));
+
+	// The reports still queued when stopping resolve to false, as do the ones pushed afterwards:
+	writer.hold();
+	auto first = pushId(queue, 1);
+	writer.waitForHeldWrite();
+	auto queued = pushId(queue, 2);
+	auto queued2 = pushId(queue, 3, 1);
+	std::thread releaser([&writer]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			writer.release();
+		}
+	);
+	queue.stop();
+	releaser.join();
+	CHECK(first.get());
+	CHECK(!queued.get());
+	CHECK(!queued2.get());
+	CHECK(!pushId(queue, 4).get());
+	CHECK_EQUAL(writer.getWrittenIds().size(), 1);
+	queue.stop();  // Safe to call again
+}
+
+
+
+
+
+static void runTests()
+{
+	testOrderAndPacing();
+	testCoalescing();
+	testStop();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,202 @@
+// ParseTest.cpp
+
+// Tests the parsing of the Wiimote input reports, in both the basic and the extended IR layouts
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "Wiimote.h"
+
+
+
+
+
+/** The size of the reports fed into the Wiimote, as read from the HID device. */
+static const size_t REPORT_SIZE = 22;
+
+
+
+
+
+/** Returns a report of the specified type with all the IR dots absent and no buttons pressed. */
+static std::vector<unsigned char> makeReport(Wiimote::InputReportType a_Type)
+{
+	std::vector<unsigned char> res(REPORT_SIZE, 0);
+	res[0] = static_cast<unsigned char>(a_Type);
+	std::fill(res.begin() + 6, res.begin() + 18, 0xff);
+	return res;
+}
+
+
+
+
+
+/** Feeds the report into the Wiimote, parsing it with the specified IR mode, and returns the resulting sample. */
+static Wiimote::Sample parse(Wiimote & a_Wiimote, const std::vector<unsigned char> & a_Report, Wiimote::IRReportingMode a_IRMode)
+{
+	a_Wiimote.replayReport(a_Report.data(), a_Report.size(), a_IRMode, Clock::now());
+	Wiimote::Sample res = Wiimote::Sample();
+	CHECK(a_Wiimote.getLatestSample(res));
+	return res;
+}
+
+
+
+
+
+static void testButtonsAndAccel()
+{
+	Wiimote wiimote;
+	wiimote.startReplay("ParseTest", Wiimote::AccelCalibration());
+
+	auto report = makeReport(Wiimote::irtIRAccel);
+	report[1] = 0x10 | 0x08;  // Plus, Up
+	report[2] = 0x08 | 0x80;  // A, Home
+	report[3] = 0x80;
+	report[4] = 0x81;
+	report[5] = 0x9a;
+	auto sample = parse(wiimote, report, Wiimote::irrmExtended);
+	const auto & buttons = sample.m_State.m_ButtonState;
+	CHECK(buttons.m_ButtonPlus);
+	CHECK(buttons.m_ButtonUp);
+	CHECK(buttons.m_ButtonA);
+	CHECK(buttons.m_ButtonHome);
+	CHECK(!buttons.m_ButtonB);
+	CHECK(!buttons.m_ButtonMinus);
+	CHECK(!buttons.m_ButtonOne);
+	CHECK(!buttons.m_ButtonTwo);
+	CHECK(!buttons.m_ButtonDown);
+	CHECK(!buttons.m_ButtonLeft);
+	CHECK(!buttons.m_ButtonRight);
+	CHECK_EQUAL(sample.m_State.m_AccelState.m_AccelX, 0x80);
+	CHECK_EQUAL(sample.m_State.m_AccelState.m_AccelY, 0x81);
+	CHECK_EQUAL(sample.m_State.m_AccelState.m_AccelZ, 0x9a);
+	CHECK(!sample.m_State.m_IRState.m_IsPresent1);
+	CHECK(!sample.m_State.m_IRState.m_IsPresent2);
+	CHECK(!sample.m_State.m_IRState.m_IsPresent3);
+	CHECK(!sample.m_State.m_IRState.m_IsPresent4);
+
+	// A buttons-and-accel report mustn't touch the IR state:
+	auto irReport = makeReport(Wiimote::irtIRAccel);
+	irReport[6] = 0x10;
+	irReport[7] = 0x20;
+	irReport[8] = 0x00;
+	parse(wiimote, irReport, Wiimote::irrmExtended);
+	auto accelReport = makeReport(Wiimote::irtButtonsAccel);
+	accelReport[2] = 0x04;  // B
+	sample = parse(wiimote, accelReport, Wiimote::irrmExtended);
+	CHECK(sample.m_State.m_ButtonState.m_ButtonB);
+	CHECK(sample.m_State.m_IRState.m_IsPresent1);
+	CHECK_EQUAL(sample.m_State.m_IRState.m_X1, 0x10);
+	CHECK_EQUAL(sample.m_State.m_IRState.m_Y1, 0x20);
+
+	// An unknown report is not parsed and doesn't publish a sample:
+	auto numPublished = sample.m_SeqNum + 1;
+	auto unknownReport = makeReport(Wiimote::irtIRAccel);
+	unknownReport[0] = 0x3f;
+	sample = parse(wiimote, unknownReport, Wiimote::irrmExtended);
+	CHECK_EQUAL(sample.m_SeqNum + 1, numPublished);
+}
+
+
+
+
+
+static void testExtendedIR()
+{
+	Wiimote wiimote;
+	wiimote.startReplay("ParseTest", Wiimote::AccelCalibration());
+
+	// Each dot is 3 bytes: X low, Y low, then (Y high << 6) | (X high << 4) | size; an absent dot is all 0xff.
+	auto report = makeReport(Wiimote::irtIRAccel);
+	const unsigned char ir[12] =
+	{
+		0xbc, 0xf4, 0x63,  // (700, 500), size 3
+		0xff, 0xff, 0xff,  // absent
+		0xff, 0xff, 0xbf,  // (1023, 767), size 15; not absent, the last byte isn't 0xff
+		0x00, 0x00, 0x01,  // (0, 0), size 1
+	};
+	std::copy(std::begin(ir), std::end(ir), report.begin() + 6);
+	auto sample = parse(wiimote, report, Wiimote::irrmExtended);
+	const auto & irState = sample.m_State.m_IRState;
+	CHECK_EQUAL(irState.m_ReportingMode, Wiimote::irrmExtended);
+	CHECK(irState.m_IsPresent1);
+	CHECK_EQUAL(irState.m_X1, 700);
+	CHECK_EQUAL(irState.m_Y1, 500);
+	CHECK(!irState.m_IsPresent2);
+	CHECK(irState.m_IsPresent3);
+	CHECK_EQUAL(irState.m_X3, 1023);
+	CHECK_EQUAL(irState.m_Y3, 767);
+	CHECK(irState.m_IsPresent4);
+	CHECK_EQUAL(irState.m_X4, 0);
+	CHECK_EQUAL(irState.m_Y4, 0);
+	CHECK((sample.m_Changes & Wiimote::cmIR) != 0);
+
+	// The very same report again changes nothing:
+	sample = parse(wiimote, report, Wiimote::irrmExtended);
+	CHECK_EQUAL(sample.m_Changes, 0);
+
+	// Moving a single dot is an IR change only:
+	report[6 + 3 * 3] = 0x05;
+	sample = parse(wiimote, report, Wiimote::irrmExtended);
+	CHECK_EQUAL(sample.m_Changes, Wiimote::cmIR);
+	CHECK_EQUAL(sample.m_State.m_IRState.m_X4, 5);
+}
+
+
+
+
+
+static void testBasicIR()
+{
+	Wiimote wiimote;
+	wiimote.startReplay("ParseTest", Wiimote::AccelCalibration());
+
+	// Two pairs of dots, 5 bytes each: X1 low, Y1 low, (Y1 high << 6) | (X1 high << 4) | (Y2 high << 2) | X2 high, X2 low, Y2 low.
+	// A dot is absent if both its low bytes are 0xff.
+	auto report = makeReport(Wiimote::irtIRAccel);
+	const unsigned char ir[10] =
+	{
+		0xbc, 0xf4, 0x68, 0x64, 0xff,  // (700, 500), (100, 767)
+		0xff, 0xff, 0x03, 0xff, 0x00,  // absent, (1023, 0)
+	};
+	std::copy(std::begin(ir), std::end(ir), report.begin() + 6);
+	auto sample = parse(wiimote, report, Wiimote::irrmBasic);
+	const auto & irState = sample.m_State.m_IRState;
+	CHECK_EQUAL(irState.m_ReportingMode, Wiimote::irrmBasic);
+	CHECK(irState.m_IsPresent1);
+	CHECK_EQUAL(irState.m_X1, 700);
+	CHECK_EQUAL(irState.m_Y1, 500);
+	CHECK(irState.m_IsPresent2);
+	CHECK_EQUAL(irState.m_X2, 100);
+	CHECK_EQUAL(irState.m_Y2, 767);
+	CHECK(!irState.m_IsPresent3);
+	CHECK(irState.m_IsPresent4);
+	CHECK_EQUAL(irState.m_X4, 1023);
+	CHECK_EQUAL(irState.m_Y4, 0);
+
+	// The same bytes mean something else in the extended layout, the mode set for the parsing must be used:
+	sample = parse(wiimote, report, Wiimote::irrmExtended);
+	CHECK_EQUAL(sample.m_State.m_IRState.m_ReportingMode, Wiimote::irrmExtended);
+	CHECK_EQUAL(sample.m_State.m_IRState.m_X2, 0x64 | (3 << 8));
+}
+
+
+
+
+
+static void runTests()
+{
+	testButtonsAndAccel();
+	testExtendedIR();
+	testBasicIR();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,213 @@
+// PenDebouncerTest.cpp
+
+// Tests the PenDebouncer's state machine: ignored glitches, bridged dropouts, the lifts and the frame / time hysteresis
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "PenDebouncer.h"
+
+
+
+
+
+/** Feeds the debouncer with frames at a fixed interval, the pen's position being the frame's number. */
+class Feeder
+{
+public:
+	Feeder(PenDebouncer & a_Debouncer, std::chrono::microseconds a_FrameInterval):
+		m_Debouncer(a_Debouncer),
+		m_FrameInterval(a_FrameInterval),
+		m_Time(Clock::now()),
+		m_FrameNum(0)
+	{
+	}
+
+
+	/** Feeds a single frame, returns the debouncer's action. */
+	PenDebouncer::Action feed(bool a_IsPresent)
+	{
+		m_FrameNum += 1;
+		auto res = m_Debouncer.update(a_IsPresent, m_FrameNum, 2 * m_FrameNum, m_Time);
+		m_Time += m_FrameInterval;
+		return res;
+	}
+
+
+	/** Feeds the specified number of frames of the same visibility, returns the number of frames that gave a_Action. */
+	int feedMany(bool a_IsPresent, int a_NumFrames, PenDebouncer::Action a_Action)
+	{
+		int res = 0;
+		for (int i = 0; i < a_NumFrames; ++i)
+		{
+			if (feed(a_IsPresent) == a_Action)
+			{
+				res += 1;
+			}
+		}
+		return res;
+	}
+
+
+	/** Returns the number of the last fed frame. */
+	int getFrameNum() const { return m_FrameNum; }
+
+
+protected:
+	PenDebouncer & m_Debouncer;
+	std::chrono::microseconds m_FrameInterval;
+	Clock::time_point m_Time;
+	int m_FrameNum;
+};
+
+
+
+
+
+/** The interval between the frames, as at the camera's 100 Hz. */
+static const std::chrono::microseconds FRAME_INTERVAL(10000);
+
+
+
+
+
+static void testDefaults()
+{
+	PenDebouncer debouncer;
+	Feeder feeder(debouncer, FRAME_INTERVAL);
+	CHECK(debouncer.isSettled());
+	CHECK(!debouncer.isDown());
+	CHECK_EQUAL(feeder.feed(false), PenDebouncer::actNone);
+
+	// A single-frame glitch only hovers, and is ignored:
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actMove);
+	CHECK(!debouncer.isSettled());
+	CHECK_EQUAL(feeder.feed(false), PenDebouncer::actNone);
+	CHECK(debouncer.isSettled());
+	CHECK(!debouncer.isDown());
+	CHECK_EQUAL(debouncer.getStats().m_NumGlitchesIgnored, 1);
+
+	// Seen for 2 frames, the pen goes down on the 2nd one, at its position:
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actMove);
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actDown);
+	CHECK_EQUAL(debouncer.getX(), feeder.getFrameNum());
+	CHECK_EQUAL(debouncer.getY(), 2 * feeder.getFrameNum());
+	CHECK(debouncer.isSettled());
+	CHECK(debouncer.isDown());
+	CHECK_EQUAL(feeder.feedMany(true, 10, PenDebouncer::actMove), 10);
+
+	// A dropout of 3 frames (20 ms since the first missing one) is bridged, the pen stays down:
+	auto lastSeen = feeder.getFrameNum();
+	CHECK_EQUAL(feeder.feedMany(false, 3, PenDebouncer::actNone), 3);
+	CHECK(!debouncer.isSettled());
+	CHECK(debouncer.isDown());
+	CHECK_EQUAL(debouncer.getX(), lastSeen);
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actMove);
+	CHECK(debouncer.isSettled());
+	CHECK_EQUAL(debouncer.getStats().m_NumDropoutsBridged, 1);
+
+	// A real lift gives exactly one up, on the 4th missing frame (30 ms after the first one), at the last seen position:
+	lastSeen = feeder.getFrameNum();
+	CHECK_EQUAL(feeder.feedMany(false, 3, PenDebouncer::actNone), 3);
+	CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+	CHECK_EQUAL(debouncer.getX(), lastSeen);
+	CHECK_EQUAL(debouncer.getY(), 2 * lastSeen);
+	CHECK(debouncer.isSettled());
+	CHECK(!debouncer.isDown());
+	CHECK_EQUAL(feeder.feedMany(false, 20, PenDebouncer::actNone), 20);
+
+	auto stats = debouncer.getStats();
+	CHECK_EQUAL(stats.m_NumGlitchesIgnored, 1);
+	CHECK_EQUAL(stats.m_NumDropoutsBridged, 1);
+	CHECK_EQUAL(stats.m_NumSuppressedTransitions, 4);
+}
+
+
+
+
+
+static void testFrameHysteresis()
+{
+	// Only the frame counts matter, however fast the frames come:
+	PenDebouncer::Config config;
+	config.m_MinDownFrames = 3;
+	config.m_MinDownTime = std::chrono::microseconds(0);
+	config.m_MinUpFrames = 3;
+	config.m_MinUpTime = std::chrono::microseconds(0);
+	PenDebouncer debouncer(config);
+	Feeder feeder(debouncer, std::chrono::microseconds(100));
+	CHECK_EQUAL(feeder.feedMany(true, 2, PenDebouncer::actMove), 2);
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actDown);
+	CHECK_EQUAL(feeder.feedMany(false, 2, PenDebouncer::actNone), 2);
+	CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+
+	// With both thresholds zero, the debouncer follows the raw visibility:
+	config.m_MinDownFrames = 0;
+	config.m_MinUpFrames = 0;
+	debouncer.setConfig(config);
+	CHECK_EQUAL(feeder.feed(true), PenDebouncer::actDown);
+	CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+	CHECK(debouncer.isSettled());
+}
+
+
+
+
+
+static void testTimeHysteresis()
+{
+	// Only the times matter, measured from the first frame of the pending state:
+	PenDebouncer::Config config;
+	config.m_MinDownFrames = 0;
+	config.m_MinDownTime = std::chrono::milliseconds(20);
+	config.m_MinUpFrames = 0;
+	config.m_MinUpTime = std::chrono::milliseconds(50);
+	{
+		// Fast frames: the number of frames follows from the times:
+		PenDebouncer debouncer(config);
+		Feeder feeder(debouncer, std::chrono::milliseconds(1));
+		CHECK_EQUAL(feeder.feedMany(true, 20, PenDebouncer::actMove), 20);
+		CHECK_EQUAL(feeder.feed(true), PenDebouncer::actDown);
+		CHECK_EQUAL(feeder.feedMany(false, 50, PenDebouncer::actNone), 50);
+		CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+	}
+	{
+		// Slow frames: the second frame of each pending state decides it:
+		PenDebouncer debouncer(config);
+		Feeder feeder(debouncer, std::chrono::milliseconds(60));
+		CHECK_EQUAL(feeder.feed(true), PenDebouncer::actMove);
+		CHECK_EQUAL(feeder.feed(true), PenDebouncer::actDown);
+		CHECK_EQUAL(feeder.feed(false), PenDebouncer::actNone);
+		CHECK(!debouncer.isSettled());
+		CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+	}
+	{
+		// Both thresholds must be reached; with the slow frames, the frame count decides:
+		config.m_MinUpFrames = 4;
+		PenDebouncer debouncer(config);
+		Feeder feeder(debouncer, std::chrono::milliseconds(60));
+		CHECK_EQUAL(feeder.feedMany(true, 2, PenDebouncer::actDown), 1);
+		CHECK_EQUAL(feeder.feedMany(false, 3, PenDebouncer::actNone), 3);
+		CHECK_EQUAL(feeder.feed(false), PenDebouncer::actUp);
+	}
+}
+
+
+
+
+
+static void runTests()
+{
+	testDefaults();
+	testFrameHysteresis();
+	testTimeHysteresis();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
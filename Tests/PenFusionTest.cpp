@@ -0,0 +1,362 @@
+// PenFusionTest.cpp
+
+// Tests the PenFusion's merging of the pens seen by two Wiimotes: the merges, the bridged occlusions,
+// the splitting of the drifting pens and the weighted average; and the interleaving of the two sources' streams,
+// with the estimation of their latency offset
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <thread>
+#include "PenFusion.h"
+#include "InputInjector.h"
+#include "CaptureSink.h"
+
+
+
+
+
+/** The interval between the reports of each source, as at the camera's 100 Hz. */
+static const std::chrono::microseconds REPORT_INTERVAL(10000);
+
+
+
+
+
+/** A fusion of two Wiimotes posting into a CaptureSink, fed with synthetic observations timed from a common base. */
+class FusionRig
+{
+public:
+	explicit FusionRig(const PenFusion::Config & a_Config):
+		m_Sink(std::make_shared<CaptureSink>()),
+		m_Injector(m_Sink),
+		m_Fusion(m_Warper, m_Injector, PenDebouncer::Config(), PointFilterPtr(), MotionPredictor::Config(), a_Config),
+		m_BaseTime(Clock::now())
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			m_Wiimotes[i].startReplay(Printf("PenFusionTest%d", i), Wiimote::AccelCalibration());
+			m_Sources[i] = m_Fusion.addSource(&m_Wiimotes[i]);
+		}
+	}
+
+
+	/** Feeds the source's report, with its single pen at the specified position (or absent if a_Weight is zero),
+	arriving at a_Time since the base. */
+	void feed(int a_Source, std::chrono::microseconds a_Time, double a_X, double a_Y, double a_Weight = 1)
+	{
+		PenFusion::Observation pens[PenFusion::MAX_PENS] = {};
+		if (a_Weight > 0)
+		{
+			pens[0].m_IsPresent = true;
+			pens[0].m_X = a_X;
+			pens[0].m_Y = a_Y;
+			pens[0].m_Weight = a_Weight;
+		}
+		LatencyTrace trace;
+		trace.m_Times[LatencyTrace::stArrival] = m_BaseTime + std::chrono::duration_cast<Clock::duration>(a_Time);
+		m_Fusion.update(m_Sources[a_Source], pens, trace);
+	}
+
+
+	/** Feeds the source's report without any pen. */
+	void feedNone(int a_Source, std::chrono::microseconds a_Time)
+	{
+		feed(a_Source, a_Time, 0, 0, 0);
+	}
+
+
+	/** Stops the injector and returns all the events it has injected. */
+	std::vector<MouseEvent> finish()
+	{
+		m_Injector.stop();
+		std::vector<MouseEvent> res;
+		for (const auto & r: m_Sink->getRecords())
+		{
+			res.push_back(r.m_Event);
+		}
+		return res;
+	}
+
+
+	PenFusion & getFusion() { return m_Fusion; }
+
+
+protected:
+	Warper m_Warper;
+	std::shared_ptr<CaptureSink> m_Sink;
+	InputInjector m_Injector;
+	PenFusion m_Fusion;
+	Wiimote m_Wiimotes[2];
+	int m_Sources[2];
+	Clock::time_point m_BaseTime;
+};
+
+
+
+
+
+/** Returns the fusion config for the tests of the membership, with the offset estimation off, so that the times are exact. */
+static PenFusion::Config membershipConfig()
+{
+	PenFusion::Config res;
+	res.m_ShouldEstimateOffsets = false;
+	return res;
+}
+
+
+
+
+
+/** Returns the number of the events of the specified type and pen. */
+static int countEvents(const std::vector<MouseEvent> & a_Events, MouseEvent::Type a_Type, int a_PenId)
+{
+	return static_cast<int>(std::count_if(a_Events.begin(), a_Events.end(),
+		[=](const MouseEvent & a_Event) { return (a_Event.m_Type == a_Type) && (a_Event.m_PenId == a_PenId); }
+	));
+}
+
+
+
+
+
+static void testMergeAndWeights()
+{
+	// Two sources seeing the same resting pen, the second one in more detail; they report at alternating phases:
+	FusionRig rig(membershipConfig());
+	std::chrono::microseconds time(0);
+	for (int i = 0; i < 20; ++i)
+	{
+		rig.feed(0, time, 10000, 20000, 1);
+		rig.feed(1, time + REPORT_INTERVAL / 2, 10400, 20200, 3);
+		time += REPORT_INTERVAL;
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		rig.feedNone(0, time);
+		rig.feedNone(1, time + REPORT_INTERVAL / 2);
+		time += REPORT_INTERVAL;
+	}
+	auto stats = rig.getFusion().getStats();
+	auto events = rig.finish();
+
+	// A single fused pen, a single click:
+	CHECK_EQUAL(stats.m_NumMerges, 1);
+	CHECK(stats.m_NumFusedReports >= 38);
+	CHECK_EQUAL(stats.m_NumReports, 60);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftDown, 0), 1);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftUp, 0), 1);
+	for (int p = 1; p < PenFusion::MAX_PENS; ++p)
+	{
+		CHECK_EQUAL(countEvents(events, MouseEvent::metMove, p), 0);
+	}
+
+	// The pen goes down once both see it, at the weighted average, three quarters of the way to the second source:
+	auto down = std::find_if(events.begin(), events.end(), [](const MouseEvent & a_Event) { return (a_Event.m_Type == MouseEvent::metLeftDown); });
+	CHECK(down != events.end());
+	if (down != events.end())
+	{
+		CHECK_EQUAL(down->m_X, 10300);
+		CHECK_EQUAL(down->m_Y, 20150);
+	}
+}
+
+
+
+
+
+static void testOcclusion()
+{
+	// A pen moving slowly, seen by both sources; the second one loses it for a while, then sees it again:
+	FusionRig rig(membershipConfig());
+	std::chrono::microseconds time(0);
+	for (int i = 0; i < 60; ++i)
+	{
+		double x = 10000 + 50 * i;
+		rig.feed(0, time, x, 30000);
+		if ((i < 20) || (i >= 40))
+		{
+			rig.feed(1, time + REPORT_INTERVAL / 2, x + 25, 30000);
+		}
+		else
+		{
+			rig.feedNone(1, time + REPORT_INTERVAL / 2);
+		}
+		time += REPORT_INTERVAL;
+	}
+	auto stats = rig.getFusion().getStats();
+	auto events = rig.finish();
+
+	// The occlusion neither lifts the pen nor starts another one; the second source rejoins the pen:
+	CHECK_EQUAL(stats.m_NumOcclusionsBridged, 1);
+	CHECK_EQUAL(stats.m_NumMerges, 2);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftDown, 0), 1);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftUp, 0), 0);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metMove, 1), 0);
+}
+
+
+
+
+
+static void testDriftSplit()
+{
+	// The second (lighter) source's pen drifts away from the first one's; within twice the merge distance it stays
+	// merged, beyond it leaves and becomes another pen:
+	auto config = membershipConfig();
+	FusionRig rig(config);
+	std::chrono::microseconds time(0);
+	double drift = 0;
+	for (int i = 0; i < 80; ++i)
+	{
+		rig.feed(0, time, 20000, 20000, 2);
+		rig.feed(1, time + REPORT_INTERVAL / 2, 20000 + drift, 20000, 1);
+		CHECK_EQUAL(rig.getFusion().getStats().m_NumMerges, 1);
+		drift += 100;
+		time += REPORT_INTERVAL;
+	}
+	auto stats = rig.getFusion().getStats();
+	auto events = rig.finish();
+	CHECK_EQUAL(stats.m_NumMerges, 1);
+	CHECK(stats.m_NumFusedReports < stats.m_NumReports - 40);
+
+	// The first pen stays down at the first source's position, the drifted one goes down as the second pen:
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftDown, 0), 1);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftUp, 0), 0);
+	CHECK_EQUAL(countEvents(events, MouseEvent::metLeftDown, 1), 1);
+	auto lastOfPen1 = std::find_if(events.rbegin(), events.rend(), [](const MouseEvent & a_Event) { return (a_Event.m_PenId == 1); });
+	CHECK(lastOfPen1 != events.rend());
+	if (lastOfPen1 != events.rend())
+	{
+		CHECK(lastOfPen1->m_X > 20000 + 2 * config.m_MergeDistance);
+	}
+	auto lastOfPen0 = std::find_if(events.rbegin(), events.rend(), [](const MouseEvent & a_Event) { return (a_Event.m_PenId == 0); });
+	CHECK(lastOfPen0 != events.rend());
+	if (lastOfPen0 != events.rend())
+	{
+		CHECK_EQUAL(lastOfPen0->m_X, 20000);
+	}
+}
+
+
+
+
+
+static void testOffsetEstimation()
+{
+	// Two sources at interleaved phases, the second one's reports arriving 3 ms later after being taken than the
+	// first one's; a pen moving steadily, fast enough for the estimation:
+	const std::chrono::microseconds skew(3000);
+	PenFusion::Config config;
+	config.m_Mode = PenFusion::fmInterleave;
+	FusionRig rig(config);
+	const double speed = 15000;  // Normalized screen coords per second
+	std::chrono::microseconds time(0);
+	for (int i = 0; i < 300; ++i)
+	{
+		auto time1 = time + REPORT_INTERVAL / 2;
+		rig.feed(0, time, 5000 + speed * std::chrono::duration<double>(time).count(), 30000);
+		rig.feed(1, time1 + skew, 5000 + speed * std::chrono::duration<double>(time1).count(), 30000);
+		time += REPORT_INTERVAL;
+	}
+	auto offset = rig.getFusion().getSourceOffset(1);
+	auto stats = rig.getFusion().getStats();
+	auto events = rig.finish();
+
+	// The offset converges to the skew, after which the reports are fused in the order they were taken:
+	CHECK(std::abs((offset - skew).count()) <= 200);
+	CHECK_EQUAL(rig.getFusion().getSourceOffset(0).count(), 0);
+	CHECK_EQUAL(stats.m_NumReports, 600);
+	CHECK_EQUAL(stats.m_NumOutOfOrder, 0);
+
+	// The interleaved stream of fresh measurements moves steadily forward, without jumping back and forth
+	// between the two sources' views:
+	int numMoves = 0;
+	int lastX = 0;
+	for (const auto & e: events)
+	{
+		CHECK_EQUAL(e.m_PenId, 0);
+		if (e.m_Type != MouseEvent::metMove)
+		{
+			continue;
+		}
+		CHECK(e.m_X >= lastX);
+		lastX = e.m_X;
+		numMoves += 1;
+	}
+	CHECK(numMoves > 0);
+}
+
+
+
+
+
+static void testOutOfOrder()
+{
+	// A report taken before the last fused one is counted, and fused at the last fused one's time:
+	FusionRig rig(membershipConfig());
+	rig.feed(0, std::chrono::milliseconds(10), 10000, 10000);
+	rig.feed(1, std::chrono::milliseconds(25), 10100, 10000);
+	rig.feed(0, std::chrono::milliseconds(20), 10000, 10000);
+	rig.feed(1, std::chrono::milliseconds(35), 10100, 10000);
+	auto stats = rig.getFusion().getStats();
+	rig.finish();
+	CHECK_EQUAL(stats.m_NumReports, 4);
+	CHECK_EQUAL(stats.m_NumOutOfOrder, 1);
+	CHECK_EQUAL(stats.m_NumFusedReports, 3);
+}
+
+
+
+
+
+static void testReportRate()
+{
+	// Fed in real time, two sources at interleaved phases give a fused stream of twice a single source's report rate:
+	const std::chrono::milliseconds duration(300);
+	FusionRig single(membershipConfig());
+	FusionRig dual(membershipConfig());
+	auto startTime = Clock::now();
+	std::chrono::microseconds time(0);
+	while (time < duration)
+	{
+		std::this_thread::sleep_until(startTime + time);
+		single.feed(0, time, 20000, 20000);
+		dual.feed(0, time, 20000, 20000);
+		std::this_thread::sleep_until(startTime + time + REPORT_INTERVAL / 2);
+		dual.feed(1, time + REPORT_INTERVAL / 2, 20000, 20000);
+		time += REPORT_INTERVAL;
+	}
+	auto singleStats = single.getFusion().getStats();
+	auto dualStats = dual.getFusion().getStats();
+	single.finish();
+	dual.finish();
+	CHECK_EQUAL(dualStats.m_NumReports, 2 * singleStats.m_NumReports);
+	CHECK(singleStats.m_ReportsPerSec > 50);
+	CHECK(singleStats.m_ReportsPerSec <= 110);
+	auto ratio = dualStats.m_ReportsPerSec / singleStats.m_ReportsPerSec;
+	CHECK((ratio > 1.8) && (ratio < 2.2));
+}
+
+
+
+
+
+static void runTests()
+{
+	testMergeAndWeights();
+	testOcclusion();
+	testDriftSplit();
+	testOffsetEstimation();
+	testOutOfOrder();
+	testReportRate();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
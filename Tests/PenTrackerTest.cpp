@@ -0,0 +1,326 @@
+// PenTrackerTest.cpp
+
+// Tests the PenTracker's association of the IR dots into pens: stable IDs across the camera's slot reshuffles,
+// the gating, the pen ID reuse, ending the tracks and the resulting down / up sequence
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <random>
+#include "PenTracker.h"
+#include "PenDebouncer.h"
+
+
+
+
+
+/** The interval between the frames, as at the camera's 100 Hz. */
+static const std::chrono::milliseconds FRAME_INTERVAL(10);
+
+
+
+
+
+/** A single dot in a camera slot. */
+struct SlotDot
+{
+	bool m_IsPresent;
+	int m_X, m_Y;
+};
+
+/** The slot contents for a frame without any dots. */
+static const SlotDot NO_DOT = {false, 0, 0};
+
+
+
+
+
+/** Returns the IR state with the specified dots in the camera's slots. */
+static Wiimote::IRState makeIR(const SlotDot & a_Slot1, const SlotDot & a_Slot2 = NO_DOT, const SlotDot & a_Slot3 = NO_DOT, const SlotDot & a_Slot4 = NO_DOT)
+{
+	Wiimote::IRState res;
+	res.m_X1 = a_Slot1.m_X; res.m_Y1 = a_Slot1.m_Y; res.m_IsPresent1 = a_Slot1.m_IsPresent;
+	res.m_X2 = a_Slot2.m_X; res.m_Y2 = a_Slot2.m_Y; res.m_IsPresent2 = a_Slot2.m_IsPresent;
+	res.m_X3 = a_Slot3.m_X; res.m_Y3 = a_Slot3.m_Y; res.m_IsPresent3 = a_Slot3.m_IsPresent;
+	res.m_X4 = a_Slot4.m_X; res.m_Y4 = a_Slot4.m_Y; res.m_IsPresent4 = a_Slot4.m_IsPresent;
+	res.m_ReportingMode = Wiimote::irrmExtended;
+	return res;
+}
+
+
+
+
+
+/** Returns a present dot at the specified position. */
+static SlotDot dot(int a_X, int a_Y)
+{
+	SlotDot res = {true, a_X, a_Y};
+	return res;
+}
+
+
+
+
+
+/** Checks that the specified pen is present at the specified position. */
+static void checkPen(const PenTracker::Observation (& a_Pens)[PenTracker::MAX_PENS], int a_PenId, int a_X, int a_Y)
+{
+	CHECK(a_Pens[a_PenId].m_IsPresent);
+	if (a_Pens[a_PenId].m_IsPresent)
+	{
+		CHECK_EQUAL(a_Pens[a_PenId].m_X, a_X);
+		CHECK_EQUAL(a_Pens[a_PenId].m_Y, a_Y);
+	}
+}
+
+
+
+
+
+/** Returns the number of the present pens in the observations. */
+static int countPresent(const PenTracker::Observation (& a_Pens)[PenTracker::MAX_PENS])
+{
+	int res = 0;
+	for (const auto & pen: a_Pens)
+	{
+		res += pen.m_IsPresent ? 1 : 0;
+	}
+	return res;
+}
+
+
+
+
+
+static void testSlotSwaps()
+{
+	// Two pens moving towards each other, reported in different slots in each frame; each keeps its ID:
+	PenTracker tracker;
+	auto time = Clock::now();
+	PenTracker::Observation pens[PenTracker::MAX_PENS];
+	for (int i = 0; i < 50; ++i)
+	{
+		auto a = dot(100 + 5 * i, 300);
+		auto b = dot(900 - 5 * i, 400 + 2 * i);
+		switch (i % 3)
+		{
+			case 0: tracker.update(makeIR(a, b), time, pens); break;
+			case 1: tracker.update(makeIR(b, NO_DOT, a), time, pens); break;
+			case 2: tracker.update(makeIR(NO_DOT, NO_DOT, NO_DOT, b), time, pens); break;  // a is missing
+		}
+		if ((i % 3) != 2)
+		{
+			checkPen(pens, 0, a.m_X, a.m_Y);
+		}
+		else
+		{
+			CHECK(!pens[0].m_IsPresent);
+		}
+		checkPen(pens, 1, b.m_X, b.m_Y);
+		CHECK_EQUAL(countPresent(pens), ((i % 3) == 2) ? 1 : 2);
+		time += FRAME_INTERVAL;
+	}
+	auto stats = tracker.getStats();
+	CHECK_EQUAL(stats.m_NumTracksStarted, 2);
+	CHECK(stats.m_NumSlotSwaps >= 40);
+	CHECK_EQUAL(stats.m_NumDotsIgnored, 0);
+}
+
+
+
+
+
+static void testGatingAndIdReuse()
+{
+	PenTracker::Config config;
+	config.m_GateDistance = 100;
+	config.m_MaxMissingTime = std::chrono::milliseconds(100);
+	PenTracker tracker(config);
+	auto time = Clock::now();
+	PenTracker::Observation pens[PenTracker::MAX_PENS];
+
+	// A resting pen:
+	for (int i = 0; i < 5; ++i)
+	{
+		tracker.update(makeIR(dot(500, 500)), time, pens);
+		time += FRAME_INTERVAL;
+	}
+	checkPen(pens, 0, 500, 500);
+
+	// A dot beyond the gate is another pen, with the lowest free ID, while the first one is briefly missing:
+	tracker.update(makeIR(dot(500 + 150, 500)), time, pens);
+	CHECK(!pens[0].m_IsPresent);
+	checkPen(pens, 1, 650, 500);
+	time += FRAME_INTERVAL;
+
+	// A dot within the gate of the missing pen continues it, even in the other slot:
+	tracker.update(makeIR(dot(655, 500), dot(510, 505)), time, pens);
+	checkPen(pens, 0, 510, 505);
+	checkPen(pens, 1, 655, 500);
+	time += FRAME_INTERVAL;
+
+	// Pen 0 missing for less than the max missing time keeps its ID:
+	for (int i = 0; i < 9; ++i)
+	{
+		tracker.update(makeIR(dot(655, 500)), time, pens);
+		CHECK(!pens[0].m_IsPresent);
+		time += FRAME_INTERVAL;
+	}
+	CHECK(tracker.hasTracks());
+	tracker.update(makeIR(dot(510, 505), dot(655, 500)), time, pens);
+	checkPen(pens, 0, 510, 505);
+	checkPen(pens, 1, 655, 500);
+	time += FRAME_INTERVAL;
+	CHECK_EQUAL(tracker.getStats().m_NumTracksStarted, 2);
+
+	// Pen 0 missing for longer ends; the dot reappearing there starts a new track, with the freed lowest ID:
+	for (int i = 0; i < 12; ++i)
+	{
+		tracker.update(makeIR(NO_DOT, dot(655, 500)), time, pens);
+		time += FRAME_INTERVAL;
+	}
+	tracker.update(makeIR(dot(900, 100), dot(655, 500)), time, pens);
+	checkPen(pens, 0, 900, 100);
+	checkPen(pens, 1, 655, 500);
+	CHECK_EQUAL(tracker.getStats().m_NumTracksStarted, 3);
+	time += FRAME_INTERVAL;
+
+	// Once all the pens are gone for long enough, there are no tracks:
+	for (int i = 0; i < 12; ++i)
+	{
+		tracker.update(makeIR(NO_DOT), time, pens);
+		CHECK_EQUAL(countPresent(pens), 0);
+		time += FRAME_INTERVAL;
+	}
+	CHECK(!tracker.hasTracks());
+	tracker.update(makeIR(NO_DOT, NO_DOT, dot(300, 300)), time, pens);
+	checkPen(pens, 0, 300, 300);
+}
+
+
+
+
+
+static void testFourPens()
+{
+	// Four pens moving in parallel, shuffled into random slots in each frame; each keeps its ID:
+	PenTracker tracker;
+	auto time = Clock::now();
+	PenTracker::Observation pens[PenTracker::MAX_PENS];
+	std::mt19937 rng(7);
+	int order[4] = {0, 1, 2, 3};
+	for (int i = 0; i < 200; ++i)
+	{
+		SlotDot dots[4];
+		for (int p = 0; p < 4; ++p)
+		{
+			dots[p] = dot(100 + 200 * p + i, 200 + i);
+		}
+		if (i > 0)
+		{
+			// The first frame has the pens in order, so that they get the IDs in order:
+			std::shuffle(std::begin(order), std::end(order), rng);
+		}
+		tracker.update(makeIR(dots[order[0]], dots[order[1]], dots[order[2]], dots[order[3]]), time, pens);
+		for (int p = 0; p < 4; ++p)
+		{
+			checkPen(pens, p, dots[p].m_X, dots[p].m_Y);
+		}
+		time += FRAME_INTERVAL;
+	}
+	CHECK_EQUAL(tracker.getStats().m_NumTracksStarted, 4);
+
+	// With all four IDs taken, one of them only briefly missing, a new dot outside all the gates is ignored:
+	tracker.update(makeIR(dot(300, 400), dot(1000, 700), dot(500, 400), dot(700, 400)), time, pens);
+	CHECK_EQUAL(countPresent(pens), 3);
+	CHECK(!pens[3].m_IsPresent);
+	CHECK_EQUAL(tracker.getStats().m_NumDotsIgnored, 1);
+}
+
+
+
+
+
+static void testDownUpSequence()
+{
+	// The tracker's pens fed into per-pen debouncers, as the Processor does: the slot swaps and a brief dropout
+	// must give exactly one down and one up per pen, in this order:
+	PenTracker tracker;
+	PenDebouncer debouncers[PenTracker::MAX_PENS];
+	int numDowns[PenTracker::MAX_PENS] = {};
+	int numUps[PenTracker::MAX_PENS] = {};
+	auto time = Clock::now();
+	PenTracker::Observation pens[PenTracker::MAX_PENS];
+	auto feed = [&](const Wiimote::IRState & a_IR)
+	{
+		tracker.update(a_IR, time, pens);
+		for (int p = 0; p < PenTracker::MAX_PENS; ++p)
+		{
+			switch (debouncers[p].update(pens[p].m_IsPresent, pens[p].m_X, pens[p].m_Y, time))
+			{
+				case PenDebouncer::actDown:
+				{
+					CHECK_EQUAL(numDowns[p], numUps[p]);
+					numDowns[p] += 1;
+					break;
+				}
+				case PenDebouncer::actUp:
+				{
+					CHECK_EQUAL(numUps[p] + 1, numDowns[p]);
+					numUps[p] += 1;
+					break;
+				}
+				default: break;
+			}
+		}
+		time += FRAME_INTERVAL;
+	};
+	for (int i = 0; i < 40; ++i)
+	{
+		auto a = dot(200 + 3 * i, 200);
+		auto b = dot(700, 600 - 3 * i);
+		if (i == 20)
+		{
+			feed(makeIR(b));  // A single-frame dropout of a, with b taking its slot
+		}
+		else if ((i % 2) == 0)
+		{
+			feed(makeIR(a, b));
+		}
+		else
+		{
+			feed(makeIR(b, a));
+		}
+	}
+	for (int i = 0; i < 20; ++i)
+	{
+		feed(makeIR(NO_DOT));
+	}
+	CHECK_EQUAL(numDowns[0], 1);
+	CHECK_EQUAL(numUps[0], 1);
+	CHECK_EQUAL(numDowns[1], 1);
+	CHECK_EQUAL(numUps[1], 1);
+	CHECK_EQUAL(numDowns[2] + numDowns[3], 0);
+	CHECK_EQUAL(debouncers[0].getStats().m_NumDropoutsBridged, 1);
+}
+
+
+
+
+
+static void runTests()
+{
+	testSlotSwaps();
+	testGatingAndIdReuse();
+	testFourPens();
+	testDownUpSequence();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,209 @@
+// PointFilterTest.cpp
+
+// Tests the pen position filters (OneEuroFilter, KalmanFilter) on synthetic noisy input: the jitter reduction,
+// the lag at a constant speed, the reported worst-case latency and the restarts after a reset or a gap in the samples
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <random>
+#include "OneEuroFilter.h"
+#include "KalmanFilter.h"
+
+
+
+
+
+/** The interval between the samples, as at the camera's 100 Hz. */
+static const std::chrono::milliseconds SAMPLE_INTERVAL(10);
+
+/** The amplitude of the synthetic jitter, in IR camera pixels; the noise is uniform in +- this. */
+static const double JITTER = 2;
+
+/** The number of samples skipped before measuring, so that the filters settle. */
+static const int NUM_SETTLE_SAMPLES = 50;
+
+
+
+
+
+/** The statistics of the filtered positions' errors, from the true positions, along the X axis. */
+struct ErrorStats
+{
+	/** The mean error (true - filtered); positive when the filter lags behind a pen moving to the right. */
+	double m_Mean;
+
+	/** The standard deviation of the error. */
+	double m_StdDev;
+};
+
+
+
+
+
+/** Feeds the filter with a_NumSamples samples of a pen at (a_StartX + a_Speed * t, 300) plus the jitter, starting at a_Time.
+Returns the error stats of both the raw and the filtered positions, after the settling samples. Advances a_Time past the last sample. */
+static void runRamp(
+	PointFilter & a_Filter, double a_StartX, double a_Speed, int a_NumSamples, Clock::time_point & a_Time,
+	ErrorStats & a_RawErrors, ErrorStats & a_FilteredErrors
+)
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<double> noise(-JITTER, JITTER);
+	double rawSum = 0, rawSumSq = 0, filteredSum = 0, filteredSumSq = 0;
+	int n = 0;
+	for (int i = 0; i < a_NumSamples; ++i)
+	{
+		auto trueX = a_StartX + a_Speed * std::chrono::duration<double>(SAMPLE_INTERVAL * i).count();
+		auto x = trueX + noise(rng);
+		auto y = 300 + noise(rng);
+		auto rawError = trueX - x;
+		a_Filter.process(x, y, a_Time);
+		a_Time += SAMPLE_INTERVAL;
+		if (i < NUM_SETTLE_SAMPLES)
+		{
+			continue;
+		}
+		auto filteredError = trueX - x;
+		rawSum += rawError;
+		rawSumSq += rawError * rawError;
+		filteredSum += filteredError;
+		filteredSumSq += filteredError * filteredError;
+		n += 1;
+	}
+	a_RawErrors.m_Mean = rawSum / n;
+	a_RawErrors.m_StdDev = std::sqrt(rawSumSq / n - a_RawErrors.m_Mean * a_RawErrors.m_Mean);
+	a_FilteredErrors.m_Mean = filteredSum / n;
+	a_FilteredErrors.m_StdDev = std::sqrt(filteredSumSq / n - a_FilteredErrors.m_Mean * a_FilteredErrors.m_Mean);
+}
+
+
+
+
+
+/** Checks that the filter smooths a resting pen's jitter, without moving it. */
+static void checkRest(PointFilter & a_Filter)
+{
+	auto time = Clock::now();
+	ErrorStats raw, filtered;
+	runRamp(a_Filter, 500, 0, 500, time, raw, filtered);
+	CHECK(filtered.m_StdDev < raw.m_StdDev / 2);
+	CHECK(std::abs(filtered.m_Mean) < 0.5);
+}
+
+
+
+
+
+/** Checks that the first sample after a reset() and after a long gap passes through unfiltered,
+while a sample after a shorter gap is still filtered. */
+static void checkRestarts(PointFilter & a_Filter)
+{
+	auto time = Clock::now();
+	ErrorStats raw, filtered;
+	runRamp(a_Filter, 100, 300, 100, time, raw, filtered);
+
+	// After a reset(), the pen starts anew wherever it is:
+	a_Filter.reset();
+	double x = 900, y = 700;
+	a_Filter.process(x, y, time);
+	CHECK_EQUAL(x, 900);
+	CHECK_EQUAL(y, 700);
+
+	// A sample after a gap shorter than the restart limit is filtered; a jump gets smoothed:
+	time += std::chrono::milliseconds(200);
+	x = 100;
+	y = 100;
+	a_Filter.process(x, y, time);
+	CHECK((x > 100) && (y > 100));
+
+	// After a longer gap, the filter restarts:
+	time += std::chrono::milliseconds(300);
+	x = 500;
+	y = 50;
+	a_Filter.process(x, y, time);
+	CHECK_EQUAL(x, 500);
+	CHECK_EQUAL(y, 50);
+}
+
+
+
+
+
+static void testOneEuro()
+{
+	// The worst-case latency is the time constant at the default 3 Hz minimum cutoff, about 53 ms:
+	OneEuroFilter filter;
+	CHECK(std::abs(filter.getMaxAddedLatency().count() - 53052) < 100);
+	CHECK_EQUAL(filter.clone()->getMaxAddedLatency().count(), filter.getMaxAddedLatency().count());
+
+	checkRest(*filter.clone());
+	checkRestarts(*filter.clone());
+
+	// At a constant speed, the speed-adapted low-pass lags behind the pen, by less than the worst case:
+	auto moving = filter.clone();
+	auto time = Clock::now();
+	ErrorStats raw, filtered;
+	const double speed = 300;
+	runRamp(*moving, 100, speed, 300, time, raw, filtered);
+	CHECK(filtered.m_Mean > speed * 0.005);
+	CHECK(filtered.m_Mean < speed * std::chrono::duration<double>(filter.getMaxAddedLatency()).count());
+	auto lag = moving->getLagStats();
+	CHECK(lag.m_Count > 200);
+	CHECK(lag.m_MeanUsec < filter.getMaxAddedLatency().count());
+}
+
+
+
+
+
+static void testKalman()
+{
+	// The worst-case latency of the defaults, at the nominal 100 Hz, is about 14 ms:
+	KalmanFilter filter;
+	auto maxLatency = filter.getMaxAddedLatency();
+	CHECK((maxLatency >= std::chrono::milliseconds(12)) && (maxLatency <= std::chrono::milliseconds(16)));
+
+	// Less measurement noise lets the filter follow the pen closer:
+	KalmanFilter::Params params;
+	params.m_MeasurementNoise = 1;
+	KalmanFilter lessNoise(params);
+	CHECK(lessNoise.getMaxAddedLatency() < maxLatency);
+
+	checkRest(*filter.clone());
+	checkRestarts(*filter.clone());
+
+	// At a constant speed, the constant-velocity model has next to no lag, and still smooths the jitter:
+	auto moving = filter.clone();
+	auto time = Clock::now();
+	ErrorStats raw, filtered;
+	runRamp(*moving, 100, 300, 300, time, raw, filtered);
+	CHECK(std::abs(filtered.m_Mean) < 0.2);
+	CHECK(filtered.m_StdDev < raw.m_StdDev);
+
+	// It lags far less than the One-Euro filter at the same speed:
+	OneEuroFilter oneEuro;
+	auto oneEuroTime = Clock::now();
+	ErrorStats oneEuroRaw, oneEuroFiltered;
+	runRamp(oneEuro, 100, 300, 300, oneEuroTime, oneEuroRaw, oneEuroFiltered);
+	CHECK(std::abs(filtered.m_Mean) * 5 < oneEuroFiltered.m_Mean);
+}
+
+
+
+
+
+static void runTests()
+{
+	testOneEuro();
+	testKalman();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
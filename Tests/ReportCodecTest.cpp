@@ -0,0 +1,180 @@
+// ReportCodecTest.cpp
+
+// Tests the ReportCodec's delta coding of the reports and its record headers, round-tripping them
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <random>
+#include "ReportCodec.h"
+
+
+
+
+
+/** The size of the Wiimote reports. */
+static const size_t REPORT_SIZE = 22;
+
+
+
+
+
+/** Encodes the report against the reference, decodes it back and checks that it's the same.
+Returns the size of the code. */
+static size_t roundTrip(const unsigned char * a_Report, const unsigned char * a_Reference, size_t a_Size)
+{
+	std::vector<unsigned char> code(ReportCodec::getMaxCodedSize(a_Size));
+	auto codeSize = ReportCodec::encodeReport(a_Report, a_Reference, a_Size, code.data());
+	CHECK(codeSize <= code.size());
+	std::vector<unsigned char> decoded(a_Size, 0xcc);
+	CHECK(ReportCodec::decodeReport(code.data(), codeSize, a_Reference, a_Size, decoded.data()));
+	CHECK(memcmp(decoded.data(), a_Report, a_Size) == 0);
+
+	// Decoding in place, over the reference, gives the same:
+	std::vector<unsigned char> inPlace(a_Reference, a_Reference + a_Size);
+	CHECK(ReportCodec::decodeReport(code.data(), codeSize, inPlace.data(), a_Size, inPlace.data()));
+	CHECK(memcmp(inPlace.data(), a_Report, a_Size) == 0);
+	return codeSize;
+}
+
+
+
+
+
+static void testReports()
+{
+	unsigned char reference[REPORT_SIZE];
+	unsigned char report[REPORT_SIZE];
+	memset(reference, 0, sizeof(reference));
+	reference[0] = 0x33;
+	std::fill(reference + 6, reference + 18, 0xff);
+
+	// An unchanged report codes into a couple of bytes:
+	memcpy(report, reference, sizeof(report));
+	CHECK(roundTrip(report, reference, sizeof(report)) <= 2);
+
+	// A single moving dot codes into much less than the report:
+	report[6] = 0x12;
+	report[7] = 0x34;
+	report[8] = 0x05;
+	CHECK(roundTrip(report, reference, sizeof(report)) < sizeof(report) / 2);
+
+	// A completely different report still fits in getMaxCodedSize():
+	for (size_t i = 0; i < sizeof(report); ++i)
+	{
+		report[i] = static_cast<unsigned char>(~reference[i]);
+	}
+	roundTrip(report, reference, sizeof(report));
+
+	// Random changes of random sizes, including the sizes spanning more than a single token's count:
+	std::mt19937 rng(1);
+	for (int i = 0; i < 1000; ++i)
+	{
+		size_t size = 1 + rng() % 300;
+		std::vector<unsigned char> ref(size), rep(size);
+		for (auto & b: ref)
+		{
+			b = static_cast<unsigned char>(rng());
+		}
+		auto changeProbability = rng() % 100;
+		for (size_t j = 0; j < size; ++j)
+		{
+			rep[j] = (rng() % 100 < changeProbability) ? static_cast<unsigned char>(rng()) : ref[j];
+		}
+		roundTrip(rep.data(), ref.data(), size);
+	}
+}
+
+
+
+
+
+static void testCorruptCode()
+{
+	// A code decoding past the report's size must be rejected, not overflow:
+	unsigned char reference[REPORT_SIZE];
+	unsigned char report[REPORT_SIZE];
+	memset(reference, 0, sizeof(reference));
+	for (size_t i = 0; i < sizeof(report); ++i)
+	{
+		report[i] = static_cast<unsigned char>(i + 1);
+	}
+	std::vector<unsigned char> code(ReportCodec::getMaxCodedSize(sizeof(report)));
+	auto codeSize = ReportCodec::encodeReport(report, reference, sizeof(report), code.data());
+	std::vector<unsigned char> decoded(sizeof(report) - 1);
+	CHECK(!ReportCodec::decodeReport(code.data(), codeSize, reference, decoded.size(), decoded.data()));
+
+	// A truncated code doesn't decode the whole report:
+	CHECK(!ReportCodec::decodeReport(code.data(), codeSize - 1, reference, sizeof(report), decoded.data()));
+}
+
+
+
+
+
+static void testVarIntsAndHeaders()
+{
+	const uint64_t values[] = {0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0xffffffffull, 0xffffffffffffffffull};
+	for (auto value: values)
+	{
+		unsigned char buf[10];
+		auto size = ReportCodec::writeVarInt(value, buf);
+		CHECK(size <= sizeof(buf));
+		const unsigned char * pos = buf;
+		uint64_t decoded = 0;
+		CHECK(ReportCodec::readVarInt(pos, buf + size, decoded));
+		CHECK(decoded == value);
+		CHECK(pos == buf + size);
+
+		// A truncated number is rejected:
+		pos = buf;
+		CHECK(!ReportCodec::readVarInt(pos, buf + size - 1, decoded));
+	}
+
+	const int64_t deltas[] = {0, 1, -1, 8000, -8000, 123456789012ll};
+	for (auto delta: deltas)
+	{
+		ReportCodec::RecordHeader header = ReportCodec::RecordHeader();
+		header.m_Type = 2;
+		header.m_Device = 5;
+		header.m_TimeDelta = delta;
+		header.m_Size = static_cast<size_t>((delta < 0) ? -delta : delta) % 1000;
+		std::vector<unsigned char> buf(ReportCodec::MAX_RECORD_HEADER_SIZE + header.m_Size);
+		auto size = ReportCodec::writeRecordHeader(header, buf.data());
+		const unsigned char * pos = buf.data();
+		ReportCodec::RecordHeader decoded = ReportCodec::RecordHeader();
+		CHECK(ReportCodec::readRecordHeader(pos, buf.data() + size + header.m_Size, decoded));
+		CHECK(pos == buf.data() + size);
+		CHECK_EQUAL(decoded.m_Type, 2);
+		CHECK_EQUAL(decoded.m_Device, 5);
+		CHECK(decoded.m_TimeDelta == delta);
+		CHECK(decoded.m_Size == header.m_Size);
+
+		// A record whose payload doesn't fit in the data is rejected:
+		if (header.m_Size > 0)
+		{
+			pos = buf.data();
+			CHECK(!ReportCodec::readRecordHeader(pos, buf.data() + size + header.m_Size - 1, decoded));
+		}
+	}
+}
+
+
+
+
+
+static void runTests()
+{
+	testReports();
+	testCorruptCode();
+	testVarIntsAndHeaders();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,272 @@
+// ReportLogTest.cpp
+
+// Tests writing a capture with ReportLog and reading it back with ReportReplay: the delta-coded reports, the devices,
+// the calibration and seeking, both with a closed capture and with one whose writer didn't close it
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <fstream>
+#include <random>
+#include "ReportLog.h"
+#include "ReportReplay.h"
+#include "Calibration.h"
+
+
+
+
+
+/** The size of the captured reports. */
+static const size_t REPORT_SIZE = 22;
+
+/** The interval between the consecutive reports of each device, in microseconds. */
+static const int64_t REPORT_INTERVAL_USEC = 10000;
+
+/** The number of reports captured from each device; several seconds' worth, so that there are several sync points. */
+static const int NUM_REPORTS = 550;
+
+/** The number of the captured devices. */
+static const int NUM_DEVICES = 2;
+
+/** The names of the capture files, created in the current folder (the build folder, under ctest). */
+static const char * CAPTURE_FILE_NAME = "ReportLogTest.capture";
+static const char * UNCLOSED_FILE_NAME = "ReportLogTest.unclosed.capture";
+
+
+
+
+
+/** A single report as fed into the capture. */
+struct Captured
+{
+	int m_Device;
+	int64_t m_TimeUsec;
+	Wiimote::IRReportingMode m_IRMode;
+	std::vector<unsigned char> m_Data;
+};
+
+
+
+
+
+/** Returns the reports of all the devices, interleaved, as a realistic session: a pen moving around,
+sometimes out of sight, with the accelerometer jittering. The first device uses the extended IR mode,
+the second one the basic mode. */
+static std::vector<Captured> makeSession()
+{
+	std::vector<Captured> res;
+	std::mt19937 rng(3);
+	int x[NUM_DEVICES] = {300, 600};
+	int y[NUM_DEVICES] = {400, 200};
+	for (int i = 0; i < NUM_REPORTS; ++i)
+	{
+		for (int d = 0; d < NUM_DEVICES; ++d)
+		{
+			Captured c;
+			c.m_Device = d;
+			c.m_TimeUsec = i * REPORT_INTERVAL_USEC + d * 1000;
+			c.m_IRMode = (d == 0) ? Wiimote::irrmExtended : Wiimote::irrmBasic;
+			c.m_Data.assign(REPORT_SIZE, 0);
+			c.m_Data[0] = Wiimote::irtIRAccel;
+			c.m_Data[2] = ((i / 100) % 2 == 0) ? 0x00 : 0x08;
+			c.m_Data[3] = static_cast<unsigned char>(0x80 + rng() % 3);
+			c.m_Data[4] = 0x80;
+			c.m_Data[5] = static_cast<unsigned char>(0x9a + rng() % 2);
+			std::fill(c.m_Data.begin() + 6, c.m_Data.begin() + 18, 0xff);
+			x[d] = std::min(std::max(x[d] + static_cast<int>(rng() % 11) - 5, 0), 1023);
+			y[d] = std::min(std::max(y[d] + static_cast<int>(rng() % 11) - 5, 0), 767);
+			if ((i % 50) < 40)
+			{
+				c.m_Data[6] = static_cast<unsigned char>(x[d]);
+				c.m_Data[7] = static_cast<unsigned char>(y[d]);
+				c.m_Data[8] = static_cast<unsigned char>((((y[d] >> 8) & 0x03) << 6) | (((x[d] >> 8) & 0x03) << 4) | 0x03);
+			}
+			res.push_back(c);
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Captures the session into the specified log, through the Wiimotes' logging; sets a calibration of the first Wiimote.
+If a_CopyFileName is not empty, the capture file is copied there before closing the log. */
+static void capture(const std::vector<Captured> & a_Session, const std::string & a_FileName, const std::string & a_CopyFileName)
+{
+	ReportLog log;
+	CHECK(log.create(a_FileName));
+	auto startTime = Clock::now();
+	Wiimote wiimotes[NUM_DEVICES];
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		Wiimote::AccelCalibration accelCalibration = {0x80, 0x81, 0x82, static_cast<unsigned char>(0x9a + d), 0x9b, 0x9c};
+		wiimotes[d].startReplay(Printf("Wiimote%d", d), accelCalibration);
+		wiimotes[d].setReportLog(&log);
+		CHECK_EQUAL(wiimotes[d].getReportLogDevice(), d);
+	}
+	Calibration calibration;
+	const int points[4][4] = {{100, 100, 0, 0}, {900, 100, 65535, 0}, {900, 700, 65535, 65535}, {100, 700, 0, 65535}};
+	for (int i = 0; i < 4; ++i)
+	{
+		calibration.setPoint(wiimotes[0], i, points[i][0], points[i][1], points[i][2], points[i][3]);
+	}
+	log.addCalibration(calibration);
+
+	for (const auto & c: a_Session)
+	{
+		auto arrivalTime = startTime + std::chrono::microseconds(c.m_TimeUsec);
+		wiimotes[c.m_Device].replayReport(c.m_Data.data(), c.m_Data.size(), c.m_IRMode, arrivalTime);
+	}
+
+	// The delta coding keeps the capture well smaller than the reports, even with the dot and the accelerometer
+	// changing in nearly every report:
+	CHECK(log.getNumBytes() < log.getNumReportBytes() * 2 / 3);
+	CHECK_EQUAL(log.getNumReportBytes(), a_Session.size() * REPORT_SIZE);
+
+	if (!a_CopyFileName.empty())
+	{
+		// Copy the file as it is on the disk while the log is still open, as if the app crashed here:
+		std::ifstream src(a_FileName, std::ios::binary);
+		std::ofstream dst(a_CopyFileName, std::ios::binary | std::ios::trunc);
+		dst << src.rdbuf();
+	}
+	log.close();
+}
+
+
+
+
+
+/** Checks that the replay's reports, from the current position on, are the session's from a_First on.
+a_Offset is the time of the session's start in the capture (the log starts a little before the session). */
+static void checkReports(ReportReplay & a_Replay, const std::vector<Captured> & a_Session, size_t a_First, int64_t a_Offset)
+{
+	ReportReplay::Report report;
+	size_t idx = a_First;
+	while (a_Replay.readReport(report))
+	{
+		if (idx >= a_Session.size())
+		{
+			CHECK(!"Too many reports");
+			return;
+		}
+		const auto & expected = a_Session[idx];
+		CHECK_EQUAL(report.m_Device, expected.m_Device);
+		CHECK_EQUAL(report.m_IRMode, expected.m_IRMode);
+		CHECK(std::abs(report.m_Time.count() - a_Offset - expected.m_TimeUsec) <= 1);
+		CHECK((report.m_Size == expected.m_Data.size()) && (memcmp(report.m_Data, expected.m_Data.data(), report.m_Size) == 0));
+		idx += 1;
+	}
+	CHECK_EQUAL(idx, a_Session.size());
+	CHECK_EQUAL(a_Replay.getNumSkipped(), 0);
+}
+
+
+
+
+
+/** Checks the whole replay of the capture, the metadata and seeking in it. */
+static void checkReplay(const std::string & a_FileName, const std::vector<Captured> & a_Session)
+{
+	ReportReplay replay;
+	if (!replay.open(a_FileName))
+	{
+		CHECK(!"Cannot open the capture");
+		return;
+	}
+
+	// The devices and the calibration:
+	const auto & wiimotes = replay.getWiimotes();
+	CHECK_EQUAL(wiimotes.size(), NUM_DEVICES);
+	if (wiimotes.size() != NUM_DEVICES)
+	{
+		return;
+	}
+	for (int d = 0; d < NUM_DEVICES; ++d)
+	{
+		auto accelCalibration = wiimotes[d]->getCurrentState().m_AccelCalibration;
+		CHECK_EQUAL(accelCalibration.m_X0, 0x80);
+		CHECK_EQUAL(accelCalibration.m_XG, 0x9a + d);
+		CHECK_EQUAL(accelCalibration.m_ZG, 0x9c);
+	}
+	CHECK((replay.getCalibration() != nullptr) && replay.getCalibration()->isUsable());
+	CHECK(replay.getDuration() >= std::chrono::microseconds(a_Session.back().m_TimeUsec));
+
+	// All the reports, from the start:
+	ReportReplay::Report report;
+	if (!replay.readReport(report))
+	{
+		CHECK(!"No reports in the capture");
+		return;
+	}
+	auto offset = report.m_Time.count();
+	CHECK((offset >= 0) && (offset < 1000000));
+	replay.rewind();
+	checkReports(replay, a_Session, 0, offset);
+
+	// Seeking lands on a sync point at or before the requested time, from which on the reports decode the same:
+	const int64_t seekTimes[] = {2500000, 4000000, 0, 10000000};
+	for (auto seekTime: seekTimes)
+	{
+		auto startTime = replay.seek(std::chrono::microseconds(seekTime)).count();
+		CHECK(startTime <= seekTime);
+		CHECK(startTime > std::min<int64_t>(seekTime, a_Session.back().m_TimeUsec) - 2 * ReportLog::SYNC_INTERVAL_USEC);
+		if (!replay.readReport(report))
+		{
+			CHECK(!"No reports after the sync point");
+			continue;
+		}
+		CHECK(report.m_Time.count() >= startTime);
+		size_t first = 0;
+		while ((first < a_Session.size()) && (a_Session[first].m_TimeUsec + offset + 1 < report.m_Time.count()))
+		{
+			++first;
+		}
+		replay.rewind();
+		checkReports(replay, a_Session, first, offset);
+	}
+
+	// The whole replay feeds all the reports into the Wiimotes:
+	replay.seek(std::chrono::microseconds(0));
+	uint64_t numSamples = 0;
+	Wiimote::Callback callback = [&numSamples](Wiimote &, const Wiimote::Sample &) { numSamples += 1; };
+	for (const auto & w: wiimotes)
+	{
+		w->addCallback(&callback, Wiimote::cmEveryReport);
+	}
+	auto stats = replay.run(ReportReplay::rsAsFastAsPossible);
+	CHECK_EQUAL(stats.m_NumReports, a_Session.size());
+	CHECK_EQUAL(stats.m_NumSkipped, 0);
+	CHECK_EQUAL(numSamples, a_Session.size());
+	for (const auto & w: wiimotes)
+	{
+		w->removeCallback(&callback);
+	}
+}
+
+
+
+
+
+static void runTests()
+{
+	auto session = makeSession();
+	capture(session, CAPTURE_FILE_NAME, UNCLOSED_FILE_NAME);
+	checkReplay(CAPTURE_FILE_NAME, session);
+
+	// A capture that wasn't closed has no trailer, the reader rebuilds the index by scanning:
+	checkReplay(UNCLOSED_FILE_NAME, session);
+	remove(CAPTURE_FILE_NAME);
+	remove(UNCLOSED_FILE_NAME);
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,188 @@
+// SampleRingTest.cpp
+
+// Tests the SampleRing's publishing of the recent samples, alone and with concurrent readers
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include <thread>
+#include <atomic>
+#include "SampleRing.h"
+
+
+
+
+
+/** A sample whose fields are all derived from its number, so that a torn copy is detected.
+Its size is not a multiple of 8 bytes, to exercise the ring's partial last word. */
+struct TestSample
+{
+	uint32_t m_Num;
+	uint32_t m_Inverted;
+	uint32_t m_Tripled;
+	uint16_t m_Low;
+	uint8_t m_Xor;
+
+
+	static TestSample make(uint32_t a_Num)
+	{
+		TestSample res;
+		res.m_Num = a_Num;
+		res.m_Inverted = ~a_Num;
+		res.m_Tripled = a_Num * 3;
+		res.m_Low = static_cast<uint16_t>(a_Num);
+		res.m_Xor = static_cast<uint8_t>(a_Num ^ (a_Num >> 8));
+		return res;
+	}
+
+
+	bool isConsistent() const
+	{
+		auto expected = make(m_Num);
+		return (
+			(m_Inverted == expected.m_Inverted) &&
+			(m_Tripled == expected.m_Tripled) &&
+			(m_Low == expected.m_Low) &&
+			(m_Xor == expected.m_Xor)
+		);
+	}
+};
+
+
+
+
+
+static void testSingleThreaded()
+{
+	SampleRing<TestSample, 4> ring;
+	TestSample sample;
+	CHECK(!ring.getLatest(sample));
+	TestSample recent[8];
+	CHECK_EQUAL(ring.getRecent(recent, 8), 0);
+	CHECK_EQUAL(ring.getNumPushed(), 0);
+
+	ring.push(TestSample::make(1));
+	CHECK(ring.getLatest(sample));
+	CHECK_EQUAL(sample.m_Num, 1);
+	CHECK_EQUAL(ring.getRecent(recent, 8), 1);
+	CHECK_EQUAL(recent[0].m_Num, 1);
+
+	for (uint32_t i = 2; i <= 10; ++i)
+	{
+		ring.push(TestSample::make(i));
+	}
+	CHECK_EQUAL(ring.getNumPushed(), 10);
+	CHECK(ring.getLatest(sample));
+	CHECK_EQUAL(sample.m_Num, 10);
+	CHECK(sample.isConsistent());
+
+	// Only the last N samples are kept, the oldest one first:
+	CHECK_EQUAL(ring.getRecent(recent, 8), 4);
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		CHECK_EQUAL(recent[i].m_Num, 7 + i);
+		CHECK(recent[i].isConsistent());
+	}
+	CHECK_EQUAL(ring.getRecent(recent, 2), 2);
+	CHECK_EQUAL(recent[0].m_Num, 9);
+	CHECK_EQUAL(recent[1].m_Num, 10);
+}
+
+
+
+
+
+static void testConcurrentReaders()
+{
+	// A single producer publishes as fast as it can, while the readers check that they never see a torn sample,
+	// that the latest sample never goes back, and that the recent samples are consecutive:
+	const uint32_t NUM_SAMPLES = 2000000;
+	const int NUM_READERS = 3;
+	const uint64_t MIN_READS = 100000;
+	SampleRing<TestSample, 8> ring;
+	std::atomic<bool> isDone(false);
+	std::atomic<int> numTorn(0), numBackwards(0), numGaps(0);
+	std::atomic<uint64_t> numReads(0);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < NUM_READERS; ++r)
+	{
+		readers.push_back(std::thread([&, r]()
+			{
+				uint32_t lastNum = 0;
+				while (!isDone.load())
+				{
+					TestSample sample;
+					if (ring.getLatest(sample))
+					{
+						numReads.fetch_add(1, std::memory_order_relaxed);
+						if (!sample.isConsistent())
+						{
+							numTorn += 1;
+						}
+						if (sample.m_Num < lastNum)
+						{
+							numBackwards += 1;
+						}
+						lastNum = sample.m_Num;
+					}
+					if (r == 0)
+					{
+						// One of the readers reads the recent samples as well:
+						TestSample recent[8];
+						auto count = ring.getRecent(recent, 8);
+						for (size_t i = 0; i < count; ++i)
+						{
+							if (!recent[i].isConsistent())
+							{
+								numTorn += 1;
+							}
+							if ((i > 0) && (recent[i].m_Num != recent[i - 1].m_Num + 1))
+							{
+								numGaps += 1;
+							}
+						}
+					}
+				}
+			}
+		));
+	}
+
+	// Keep publishing until the readers have had a fair chance, even if they got started late:
+	uint32_t numPushed = 0;
+	while ((numPushed < NUM_SAMPLES) || (numReads.load(std::memory_order_relaxed) < MIN_READS))
+	{
+		numPushed += 1;
+		ring.push(TestSample::make(numPushed));
+	}
+	isDone = true;
+	for (auto & t: readers)
+	{
+		t.join();
+	}
+	CHECK_EQUAL(numTorn.load(), 0);
+	CHECK_EQUAL(numBackwards.load(), 0);
+	CHECK_EQUAL(numGaps.load(), 0);
+	CHECK(numReads.load() >= MIN_READS);
+	TestSample sample;
+	CHECK(ring.getLatest(sample));
+	CHECK_EQUAL(sample.m_Num, numPushed);
+}
+
+
+
+
+
+static void runTests()
+{
+	testSingleThreaded();
+	testConcurrentReaders();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
@@ -0,0 +1,89 @@
+// Test.h
+
+// Declares the checking macros shared by the tests in the Tests folder
+
+
+
+
+
+#pragma once
+
+#ifndef _WIN32
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+
+
+
+/** The number of the checks that have failed so far in this test executable. */
+extern int g_NumFailedChecks;
+
+/** Checks that the condition holds, reports the failure (and continues) if it doesn't.
+Unlike assert(), this works in the optimized builds (with NDEBUG) as well. */
+#define CHECK(X) \
+	do \
+	{ \
+		if (!(X)) \
+		{ \
+			fprintf(stderr, "%s(%d): Check failed: %s\n", __FILE__, __LINE__, #X); \
+			g_NumFailedChecks += 1; \
+		} \
+	} while (false)
+
+/** Checks that the two integers (or enums) are equal, printing both of them if they aren't. */
+#define CHECK_EQUAL(X, Y) \
+	do \
+	{ \
+		auto valX = static_cast<long long>(X); \
+		auto valY = static_cast<long long>(Y); \
+		if (valX != valY) \
+		{ \
+			fprintf(stderr, "%s(%d): Check failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, #X, #Y, valX, valY); \
+			g_NumFailedChecks += 1; \
+		} \
+	} while (false)
+
+/** Creates a folder of the specified name in the current folder (the build folder, under ctest), for the test's
+temporary files. Returns the folder's name with the trailing path separator. */
+inline std::string createTestFolder(const std::string & a_Name)
+{
+	#ifdef _WIN32
+		CreateDirectoryA(a_Name.c_str(), nullptr);
+		return a_Name + "\\";
+	#else
+		mkdir(a_Name.c_str(), 0755);
+		return a_Name + "/";
+	#endif
+}
+
+/** Removes the folder created by createTestFolder(); it must be empty by then. */
+inline void removeTestFolder(const std::string & a_Name)
+{
+	#ifdef _WIN32
+		RemoveDirectoryA(a_Name.c_str());
+	#else
+		rmdir(a_Name.c_str());
+	#endif
+}
+
+/** Defines g_NumFailedChecks and the test's main(), which runs the specified function and returns non-zero
+if any check has failed, for ctest. */
+#define TEST_MAIN(FN) \
+	int g_NumFailedChecks = 0; \
+	int main() \
+	{ \
+		FN(); \
+		if (g_NumFailedChecks > 0) \
+		{ \
+			fprintf(stderr, "%d check(s) failed\n", g_NumFailedChecks); \
+			return 1; \
+		} \
+		printf("All checks passed\n"); \
+		return 0; \
+	}
+
+
+
+
@@ -0,0 +1,159 @@
+// WarperTest.cpp
+
+// Tests warping the Wiimote IR coords into the screen coords with known calibrations
+
+
+
+
+
+#include "Globals.h"
+#include "Test.h"
+#include "Calibration.h"
+#include "Warper.h"
+#include "Wiimote.h"
+
+
+
+
+
+/** The largest difference from the exact result allowed, in the normalized screen coords.
+The warping is done in floats, which keep about 7 significant digits. */
+static const int TOLERANCE = 2;
+
+
+
+
+
+/** Checks that the Wiimote point is warped to the expected screen point, within TOLERANCE. */
+static void checkWarp(const Warper & a_Warper, Wiimote & a_Wiimote, int a_WiimoteX, int a_WiimoteY, int a_ScreenX, int a_ScreenY)
+{
+	Warper::Point wiimotePoint = {a_WiimoteX, a_WiimoteY};
+	auto res = a_Warper.warp(a_Wiimote, wiimotePoint);
+	if ((std::abs(res.m_X - a_ScreenX) > TOLERANCE) || (std::abs(res.m_Y - a_ScreenY) > TOLERANCE))
+	{
+		fprintf(stderr, "Warping {%d, %d} gave {%d, %d}, expected {%d, %d}\n",
+			a_WiimoteX, a_WiimoteY, res.m_X, res.m_Y, a_ScreenX, a_ScreenY
+		);
+		CHECK(!"Bad warp");
+	}
+}
+
+
+
+
+
+/** Calibrates the Wiimote with the camera quad mapped onto the whole screen, in the calibration order. */
+static void calibrate(Calibration & a_Calibration, Wiimote & a_Wiimote, const int (&a_CameraQuad)[4][2])
+{
+	const int screen[4][2] = {{0, 0}, {65535, 0}, {65535, 65535}, {0, 65535}};
+	for (int i = 0; i < 4; ++i)
+	{
+		a_Calibration.setPoint(a_Wiimote, i, a_CameraQuad[i][0], a_CameraQuad[i][1], screen[i][0], screen[i][1]);
+	}
+}
+
+
+
+
+
+static void testAffine()
+{
+	// A camera looking straight at the screen, the warping is just scaling:
+	Wiimote wiimote;
+	Calibration calibration;
+	const int quad[4][2] = {{0, 0}, {1000, 0}, {1000, 750}, {0, 750}};
+	calibrate(calibration, wiimote, quad);
+	Warper warper;
+	warper.setCalibration(calibration);
+	CHECK_EQUAL(warper.getWarpableWiimotes().size(), 1);
+
+	checkWarp(warper, wiimote, 0,    0,   0,     0);
+	checkWarp(warper, wiimote, 1000, 750, 65535, 65535);
+	checkWarp(warper, wiimote, 500,  375, 32768, 32768);
+	checkWarp(warper, wiimote, 250,  600, 16384, 52428);
+
+	// The points outside the calibrated area extrapolate linearly:
+	checkWarp(warper, wiimote, 1100, -75, 72089, -6554);
+}
+
+
+
+
+
+static void testKeystoned()
+{
+	// A realistic camera view of the screen, skewed by the camera's angle:
+	Wiimote wiimote;
+	Calibration calibration;
+	const int quad[4][2] = {{131, 94}, {905, 122}, {872, 701}, {158, 664}};
+	calibrate(calibration, wiimote, quad);
+	Warper warper;
+	warper.setCalibration(calibration);
+
+	// The calibration points map onto the screen corners:
+	checkWarp(warper, wiimote, 131, 94,  0,     0);
+	checkWarp(warper, wiimote, 905, 122, 65535, 0);
+	checkWarp(warper, wiimote, 872, 701, 65535, 65535);
+	checkWarp(warper, wiimote, 158, 664, 0,     65535);
+
+	// A perspective keeps the straight lines, so the crossing of the quad's diagonals maps onto the screen's center
+	// (unlike the quad's centroid):
+	double d1x = 872 - 131, d1y = 701 - 94;
+	double d2x = 158 - 905, d2y = 664 - 122;
+	double t = ((905 - 131) * d2y - (122 - 94) * d2x) / (d1x * d2y - d1y * d2x);
+	auto res = warper.warp(wiimote, 131 + t * d1x, 94 + t * d1y);
+	CHECK(std::abs(res.m_X - 32768) <= TOLERANCE);
+	CHECK(std::abs(res.m_Y - 32768) <= TOLERANCE);
+
+	// A Wiimote without a calibration cannot be warped:
+	Wiimote uncalibrated;
+	auto warpable = warper.getWarpableWiimotes();
+	CHECK_EQUAL(warpable.size(), 1);
+	CHECK(warpable[0] == &wiimote);
+}
+
+
+
+
+
+static void testTwoWiimotes()
+{
+	// Each Wiimote uses its own warping; the two halves of the screen overlap in the middle:
+	Wiimote left, right;
+	Calibration calibration;
+	const int screenLeft[4][2]  = {{0,     0}, {36000, 0}, {36000, 65535}, {0,     65535}};
+	const int screenRight[4][2] = {{30000, 0}, {65535, 0}, {65535, 65535}, {30000, 65535}};
+	const int camera[4][2] = {{100, 100}, {900, 100}, {900, 700}, {100, 700}};
+	for (int i = 0; i < 4; ++i)
+	{
+		calibration.setPoint(left,  i, camera[i][0], camera[i][1], screenLeft[i][0],  screenLeft[i][1]);
+		calibration.setPoint(right, i, camera[i][0], camera[i][1], screenRight[i][0], screenRight[i][1]);
+	}
+	Warper warper;
+	warper.setCalibration(calibration);
+	checkWarp(warper, left,  500, 400, 18000, 32768);
+	checkWarp(warper, right, 500, 400, 47768, 32768);
+	auto groups = warper.getOverlappingGroups();
+	CHECK_EQUAL(groups.size(), 1);
+	if (groups.size() == 1)
+	{
+		CHECK_EQUAL(groups[0].size(), 2);
+	}
+}
+
+
+
+
+
+static void runTests()
+{
+	testAffine();
+	testKeystoned();
+	testTwoWiimotes();
+}
+
+TEST_MAIN(runTests)
+
+
+
+
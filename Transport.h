@@ -0,0 +1,70 @@
+// Transport.h
+
+// Declares the Transport interface representing the link through which a Wiimote's reports are exchanged
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "LatencyTrace.h"
+
+
+
+
+
+/** The link through which the Wiimote class exchanges the reports with the controller.
+Implemented by HidDevice (the real OS device) and SimulatedWiimote (an in-process stand-in). */
+class Transport
+{
+public:
+	/** The callback used to deliver incoming input reports, the report ID being the first byte.
+	a_ArrivalTime is the time at which the transport received the report, stamped as close to the OS read as possible.
+	Called from the transport's reading context (thread), the same context for all reports. */
+	typedef std::function<void (const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime)> ReportCallback;
+
+	/** The callback used to signal that the reading has failed (device disconnected etc.); no more reports will follow. */
+	typedef std::function<void ()> ErrorCallback;
+
+
+	virtual ~Transport() {}
+
+	/** Starts delivering the incoming reports to the specified callbacks.
+	The transport must already be open. May only be called once. */
+	virtual void startReading(ReportCallback a_OnReport, ErrorCallback a_OnError) = 0;
+
+	/** Stops reading and closes the transport.
+	Once this returns, the callbacks given to startReading() are not called anymore.
+	Safe to call on a transport that is not open. */
+	virtual void close() = 0;
+
+	/** Returns true if the transport is open. */
+	virtual bool isOpen() const = 0;
+
+	/** Writes a single output report (the report ID being the first byte) using the default method.
+	Returns true on success. */
+	virtual bool write(const void * a_Buffer, size_t a_Size) = 0;
+
+	/** Writes a single output report using the alternate method, for drivers that don't support the default one.
+	Returns true on success. */
+	virtual bool setOutputReport(const void * a_Buffer, size_t a_Size) = 0;
+
+	/** Returns the minimum interval between two consecutive output reports that the transport needs. */
+	virtual std::chrono::microseconds getMinWriteInterval() const = 0;
+
+	/** Returns an identity of the device that stays the same across reconnects and restarts (such as the BT address),
+	used as the key for caching the per-device settings.
+	Returns an empty string if there's no such identity; the device is not cached then. */
+	virtual std::string getStableId() const = 0;
+};
+
+typedef std::unique_ptr<Transport> TransportPtr;
+
+
+
+
@@ -0,0 +1,86 @@
+// UinputSink.h
+
+// Declares the UinputSink class representing the output of the pointer events into the Linux input via a uinput device
+
+
+
+
+
+#pragma once
+
+
+
+
+
+#include "OutputSink.h"
+
+
+
+
+
+/** Creates a virtual input device through /dev/uinput and emits the pointer events through it.
+In the pointer mode, the device is an absolute pointer with a left button (like a graphics tablet) and all the pens
+drive the single pointer. In the multitouch mode, the device is a direct-touch screen (type B multitouch protocol)
+and each pen is a separate contact, touching between its LeftDown and LeftUp; moves of a pen that isn't touching
+are ignored, since a touchscreen has no hover.
+Each batch is written with a single write() call. Needs write access to /dev/uinput. */
+class UinputSink:
+	public OutputSink
+{
+public:
+	enum Mode
+	{
+		modePointer,
+		modeMultitouch,
+	};
+
+
+	UinputSink();
+
+	/** Destroys the virtual device, if created. */
+	virtual ~UinputSink();
+
+	/** Creates the virtual device in the specified mode.
+	Returns true on success, false on failure (logged). */
+	bool open(Mode a_Mode);
+
+	/** Destroys the virtual device. Safe to call when not open. */
+	void close();
+
+	/** Returns true if the virtual device has been created. */
+	bool isOpen() const { return (m_FD >= 0); }
+
+	// OutputSink overrides:
+	virtual size_t send(const MouseEvent * a_Events, size_t a_Count) override;
+
+protected:
+
+	/** The FD of the opened /dev/uinput, -1 if not open. */
+	int m_FD;
+
+	/** The mode in which the device was created. */
+	Mode m_Mode;
+
+	/** The tracking ID of each pen's current contact (multitouch mode), -1 if the pen isn't touching. */
+	int m_TrackingIds[MouseEvent::MAX_PENS];
+
+	/** The tracking ID for the next new contact. */
+	int m_NextTrackingId;
+
+	/** The input_event structs of the batch being sent, kept between the batches to avoid reallocating. */
+	std::vector<unsigned char> m_Buffer;
+
+
+	/** Appends a single input_event to m_Buffer. */
+	void addEvent(int a_Type, int a_Code, int a_Value);
+
+	/** Appends the input_events for a single pointer event in the pointer mode. */
+	void addPointerEvent(const MouseEvent & a_Event);
+
+	/** Appends the input_events for a single pointer event in the multitouch mode. */
+	void addMultitouchEvent(const MouseEvent & a_Event);
+};
+
+
+
+
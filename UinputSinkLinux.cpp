@@ -0,0 +1,276 @@
+// UinputSinkLinux.cpp
+
+// Implements the UinputSink class representing the output of the pointer events into the Linux input via a uinput device
+
+
+
+
+
+#include "Globals.h"
+#include "UinputSink.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include <cerrno>
+
+
+
+
+
+/** The maximum coordinate value, matching the normalized MouseEvent coords. */
+static const int MAX_COORD = 65535;
+
+
+
+
+
+UinputSink::UinputSink():
+	m_FD(-1),
+	m_Mode(modePointer),
+	m_NextTrackingId(0)
+{
+	for (auto & id: m_TrackingIds)
+	{
+		id = -1;
+	}
+}
+
+
+
+
+
+UinputSink::~UinputSink()
+{
+	close();
+}
+
+
+
+
+
+bool UinputSink::open(Mode a_Mode)
+{
+	close();
+	m_FD = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (m_FD < 0)
+	{
+		auto err = errno;
+		LOG("Cannot open /dev/uinput: %d (%s)", err, strerror(err));
+		return false;
+	}
+	m_Mode = a_Mode;
+
+	// Declare the capabilities:
+	struct uinput_user_dev dev;
+	memset(&dev, 0, sizeof(dev));
+	bool isSuccess = (
+		(ioctl(m_FD, UI_SET_EVBIT, EV_SYN) == 0) &&
+		(ioctl(m_FD, UI_SET_EVBIT, EV_KEY) == 0) &&
+		(ioctl(m_FD, UI_SET_EVBIT, EV_ABS) == 0) &&
+		(ioctl(m_FD, UI_SET_ABSBIT, ABS_X) == 0) &&
+		(ioctl(m_FD, UI_SET_ABSBIT, ABS_Y) == 0)
+	);
+	dev.absmax[ABS_X] = MAX_COORD;
+	dev.absmax[ABS_Y] = MAX_COORD;
+	if (a_Mode == modePointer)
+	{
+		snprintf(dev.name, sizeof(dev.name), "WiiWhiteboard pointer");
+		isSuccess = isSuccess && (ioctl(m_FD, UI_SET_KEYBIT, BTN_LEFT) == 0);
+	}
+	else
+	{
+		snprintf(dev.name, sizeof(dev.name), "WiiWhiteboard touchscreen");
+		isSuccess = (
+			isSuccess &&
+			(ioctl(m_FD, UI_SET_KEYBIT, BTN_TOUCH) == 0) &&
+			(ioctl(m_FD, UI_SET_ABSBIT, ABS_MT_SLOT) == 0) &&
+			(ioctl(m_FD, UI_SET_ABSBIT, ABS_MT_TRACKING_ID) == 0) &&
+			(ioctl(m_FD, UI_SET_ABSBIT, ABS_MT_POSITION_X) == 0) &&
+			(ioctl(m_FD, UI_SET_ABSBIT, ABS_MT_POSITION_Y) == 0) &&
+			(ioctl(m_FD, UI_SET_PROPBIT, INPUT_PROP_DIRECT) == 0)
+		);
+		dev.absmax[ABS_MT_SLOT] = MouseEvent::MAX_PENS - 1;
+		dev.absmax[ABS_MT_TRACKING_ID] = 65535;
+		dev.absmax[ABS_MT_POSITION_X] = MAX_COORD;
+		dev.absmax[ABS_MT_POSITION_Y] = MAX_COORD;
+	}
+	dev.id.bustype = BUS_VIRTUAL;
+	dev.id.vendor = 0x057e;  // Nintendo, the pens are seen by the Wiimotes
+	dev.id.product = 0x0306;
+	dev.id.version = 1;
+
+	// Create the device:
+	isSuccess = (
+		isSuccess &&
+		(write(m_FD, &dev, sizeof(dev)) == static_cast<ssize_t>(sizeof(dev))) &&
+		(ioctl(m_FD, UI_DEV_CREATE) == 0)
+	);
+	if (!isSuccess)
+	{
+		auto err = errno;
+		LOG("Cannot create the uinput device: %d (%s)", err, strerror(err));
+		::close(m_FD);
+		m_FD = -1;
+		return false;
+	}
+	for (auto & id: m_TrackingIds)
+	{
+		id = -1;
+	}
+	return true;
+}
+
+
+
+
+
+void UinputSink::close()
+{
+	if (m_FD < 0)
+	{
+		return;
+	}
+	ioctl(m_FD, UI_DEV_DESTROY);
+	::close(m_FD);
+	m_FD = -1;
+}
+
+
+
+
+
+size_t UinputSink::send(const MouseEvent * a_Events, size_t a_Count)
+{
+	if (m_FD < 0)
+	{
+		return 0;
+	}
+	m_Buffer.clear();
+	for (size_t i = 0; i < a_Count; ++i)
+	{
+		if (m_Mode == modePointer)
+		{
+			addPointerEvent(a_Events[i]);
+		}
+		else
+		{
+			addMultitouchEvent(a_Events[i]);
+		}
+	}
+	if (m_Buffer.empty())
+	{
+		return 0;
+	}
+	if (write(m_FD, m_Buffer.data(), m_Buffer.size()) != static_cast<ssize_t>(m_Buffer.size()))
+	{
+		LOG("Failed to write the uinput events: %d (%s)", errno, strerror(errno));
+	}
+	return 1;
+}
+
+
+
+
+
+void UinputSink::addEvent(int a_Type, int a_Code, int a_Value)
+{
+	struct input_event evt;
+	memset(&evt, 0, sizeof(evt));  // The kernel stamps the time itself
+	evt.type = static_cast<__u16>(a_Type);
+	evt.code = static_cast<__u16>(a_Code);
+	evt.value = a_Value;
+	auto bytes = reinterpret_cast<const unsigned char *>(&evt);
+	m_Buffer.insert(m_Buffer.end(), bytes, bytes + sizeof(evt));
+}
+
+
+
+
+
+void UinputSink::addPointerEvent(const MouseEvent & a_Event)
+{
+	addEvent(EV_ABS, ABS_X, a_Event.m_X);
+	addEvent(EV_ABS, ABS_Y, a_Event.m_Y);
+	switch (a_Event.m_Type)
+	{
+		case MouseEvent::metMove:     break;
+		case MouseEvent::metLeftDown: addEvent(EV_KEY, BTN_LEFT, 1); break;
+		case MouseEvent::metLeftUp:   addEvent(EV_KEY, BTN_LEFT, 0); break;
+	}
+	addEvent(EV_SYN, SYN_REPORT, 0);
+}
+
+
+
+
+
+void UinputSink::addMultitouchEvent(const MouseEvent & a_Event)
+{
+	auto pen = a_Event.m_PenId;
+	if ((pen < 0) || (pen >= MouseEvent::MAX_PENS))
+	{
+		return;
+	}
+	auto & trackingId = m_TrackingIds[pen];
+	bool wasAnyTouching = std::any_of(std::begin(m_TrackingIds), std::end(m_TrackingIds), [](int a_Id) { return (a_Id >= 0); });
+	switch (a_Event.m_Type)
+	{
+		case MouseEvent::metMove:
+		{
+			if (trackingId < 0)
+			{
+				return;  // No hover on a touchscreen
+			}
+			addEvent(EV_ABS, ABS_MT_SLOT, pen);
+			break;
+		}
+		case MouseEvent::metLeftDown:
+		{
+			if (trackingId >= 0)
+			{
+				return;  // Already touching
+			}
+			trackingId = m_NextTrackingId;
+			m_NextTrackingId = (m_NextTrackingId + 1) & 0xffff;
+			addEvent(EV_ABS, ABS_MT_SLOT, pen);
+			addEvent(EV_ABS, ABS_MT_TRACKING_ID, trackingId);
+			if (!wasAnyTouching)
+			{
+				addEvent(EV_KEY, BTN_TOUCH, 1);
+			}
+			break;
+		}
+		case MouseEvent::metLeftUp:
+		{
+			if (trackingId < 0)
+			{
+				return;  // Not touching
+			}
+			trackingId = -1;
+			addEvent(EV_ABS, ABS_MT_SLOT, pen);
+			addEvent(EV_ABS, ABS_MT_TRACKING_ID, -1);
+			if (std::none_of(std::begin(m_TrackingIds), std::end(m_TrackingIds), [](int a_Id) { return (a_Id >= 0); }))
+			{
+				addEvent(EV_KEY, BTN_TOUCH, 0);
+			}
+			addEvent(EV_SYN, SYN_REPORT, 0);
+			return;
+		}
+	}
+	addEvent(EV_ABS, ABS_MT_POSITION_X, a_Event.m_X);
+	addEvent(EV_ABS, ABS_MT_POSITION_Y, a_Event.m_Y);
+
+	// The single-touch emulation, for the clients that don't understand multitouch, follows the first touching pen:
+	auto firstTouching = std::find_if(std::begin(m_TrackingIds), std::end(m_TrackingIds), [](int a_Id) { return (a_Id >= 0); });
+	if (firstTouching == &trackingId)
+	{
+		addEvent(EV_ABS, ABS_X, a_Event.m_X);
+		addEvent(EV_ABS, ABS_Y, a_Event.m_Y);
+	}
+	addEvent(EV_SYN, SYN_REPORT, 0);
+}
+
+
+
+
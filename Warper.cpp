@@ -180,14 +180,15 @@ void Warper::Matrix::multiplyBy(const Warper::Matrix & a_Other)
 
 
 
-POINT Warper::Matrix::project(POINT a_Src) const
+Warper::Point Warper::Matrix::project(Point a_Src) const
 {
-	auto res = project(static_cast<Number>(a_Src.x), static_cast<Number>(a_Src.y));
-	return
+	auto res = project(static_cast<Number>(a_Src.m_X), static_cast<Number>(a_Src.m_Y));
+	Point pt =
 	{
-		static_cast<LONG>(res.first),
-		static_cast<LONG>(res.second)
+		static_cast<int>(res.first),
+		static_cast<int>(res.second)
 	};
+	return pt;
 }
 
 
@@ -225,6 +226,7 @@ Warper::Warper()
 void Warper::setCalibration(const Calibration & a_Calibration)
 {
 	m_Matrices.clear();
+	m_ScreenQuads.clear();
 	for (const auto & mapping: a_Calibration.getMappings())
 	{
 		if (!mapping.second.isUsable())
@@ -249,6 +251,13 @@ void Warper::setCalibration(const Calibration & a_Calibration)
 			static_cast<Matrix::Number>(points[3].m_ScreenX), static_cast<Matrix::Number>(points[3].m_ScreenY)
 		);
 		matrix.multiplyBy(helper);
+
+		auto & quad = m_ScreenQuads[mapping.first];
+		for (int i = 0; i < 4; ++i)
+		{
+			quad.m_X[i] = points[i].m_ScreenX;
+			quad.m_Y[i] = points[i].m_ScreenY;
+		}
 	}  // for mapping - a_Calibration[]
 }
 
@@ -269,17 +278,177 @@ std::vector<const Wiimote *> Warper::getWarpableWiimotes() const
 
 
 
-POINT Warper::warp(Wiimote & a_Wiimote, POINT a_WiimotePoint) const
+Warper::Point Warper::warp(Wiimote & a_Wiimote, Point a_WiimotePoint) const
+{
+	return warp(a_Wiimote, static_cast<double>(a_WiimotePoint.m_X), static_cast<double>(a_WiimotePoint.m_Y));
+}
+
+
+
+
+
+Warper::Point Warper::warp(Wiimote & a_Wiimote, double a_WiimoteX, double a_WiimoteY) const
+{
+	const auto itr = m_Matrices.find(&a_Wiimote);
+	assert(itr != m_Matrices.end());
+	auto res = itr->second.project(static_cast<Matrix::Number>(a_WiimoteX), static_cast<Matrix::Number>(a_WiimoteY));
+	Point pt =
+	{
+		static_cast<int>(std::floor(res.first  + static_cast<Matrix::Number>(0.5))),
+		static_cast<int>(std::floor(res.second + static_cast<Matrix::Number>(0.5)))
+	};
+	return pt;
+}
+
+
+
+
+
+bool Warper::clampToScreenQuad(const Wiimote & a_Wiimote, double & a_ScreenX, double & a_ScreenY) const
+{
+	const auto itr = m_ScreenQuads.find(&a_Wiimote);
+	if (itr == m_ScreenQuads.end())
+	{
+		return false;
+	}
+	const auto & quad = itr->second;
+
+	// The point is inside the (convex) quad if it is on the same side of all four edges,
+	// whichever the orientation of the calibration points:
+	bool hasLeft = false, hasRight = false;
+	for (int i = 0; i < 4; ++i)
+	{
+		auto j = (i + 1) % 4;
+		auto cross = (quad.m_X[j] - quad.m_X[i]) * (a_ScreenY - quad.m_Y[i]) - (quad.m_Y[j] - quad.m_Y[i]) * (a_ScreenX - quad.m_X[i]);
+		hasLeft = hasLeft || (cross > 0);
+		hasRight = hasRight || (cross < 0);
+	}
+	if (!hasLeft || !hasRight)
+	{
+		return false;
+	}
+
+	// Outside, find the nearest point on the edges:
+	double bestX = quad.m_X[0], bestY = quad.m_Y[0];
+	double bestDist = -1;
+	for (int i = 0; i < 4; ++i)
+	{
+		auto j = (i + 1) % 4;
+		auto dx = quad.m_X[j] - quad.m_X[i];
+		auto dy = quad.m_Y[j] - quad.m_Y[i];
+		auto len2 = dx * dx + dy * dy;
+		auto t = (len2 > 0) ? (((a_ScreenX - quad.m_X[i]) * dx + (a_ScreenY - quad.m_Y[i]) * dy) / len2) : 0;
+		t = std::min(std::max(t, 0.0), 1.0);
+		auto x = quad.m_X[i] + t * dx;
+		auto y = quad.m_Y[i] + t * dy;
+		auto dist = (x - a_ScreenX) * (x - a_ScreenX) + (y - a_ScreenY) * (y - a_ScreenY);
+		if ((bestDist < 0) || (dist < bestDist))
+		{
+			bestDist = dist;
+			bestX = x;
+			bestY = y;
+		}
+	}
+	a_ScreenX = bestX;
+	a_ScreenY = bestY;
+	return true;
+}
+
+
+
+
+
+double Warper::getLocalScale(const Wiimote & a_Wiimote, double a_WiimoteX, double a_WiimoteY) const
 {
-	
 	const auto itr = m_Matrices.find(&a_Wiimote);
 	assert(itr != m_Matrices.end());
-	auto res = itr->second.project(static_cast<Matrix::Number>(a_WiimotePoint.x), static_cast<Matrix::Number>(a_WiimotePoint.y));
-	return
+	const auto & matrix = itr->second;
+
+	// The area of the camera pixel's image, from the projection's derivatives (by finite differences):
+	auto x = static_cast<Matrix::Number>(a_WiimoteX);
+	auto y = static_cast<Matrix::Number>(a_WiimoteY);
+	auto p0 = matrix.project(x, y);
+	auto px = matrix.project(x + 1, y);
+	auto py = matrix.project(x, y + 1);
+	double dxdx = px.first - p0.first;
+	double dydx = px.second - p0.second;
+	double dxdy = py.first - p0.first;
+	double dydy = py.second - p0.second;
+	return std::sqrt(std::abs(dxdx * dydy - dxdy * dydx));
+}
+
+
+
+
+
+std::vector<std::vector<const Wiimote *>> Warper::getOverlappingGroups() const
+{
+	// The bounding boxes of the quads:
+	struct Box
 	{
-		static_cast<LONG>(std::floor(res.first  + static_cast<Matrix::Number>(0.5))),
-		static_cast<LONG>(std::floor(res.second + static_cast<Matrix::Number>(0.5)))
+		const Wiimote * m_Wiimote;
+		double m_MinX, m_MinY, m_MaxX, m_MaxY;
 	};
+	std::vector<Box> boxes;
+	for (const auto & q: m_ScreenQuads)
+	{
+		const auto & quad = q.second;
+		Box box = {q.first, quad.m_X[0], quad.m_Y[0], quad.m_X[0], quad.m_Y[0]};
+		for (int i = 1; i < 4; ++i)
+		{
+			box.m_MinX = std::min(box.m_MinX, quad.m_X[i]);
+			box.m_MinY = std::min(box.m_MinY, quad.m_Y[i]);
+			box.m_MaxX = std::max(box.m_MaxX, quad.m_X[i]);
+			box.m_MaxY = std::max(box.m_MaxY, quad.m_Y[i]);
+		}
+		boxes.push_back(box);
+	}
+
+	// Assign each Wiimote a group number, merging the groups of any two overlapping Wiimotes:
+	std::vector<size_t> group(boxes.size());
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		group[i] = i;
+	}
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		for (size_t j = i + 1; j < boxes.size(); ++j)
+		{
+			const auto & a = boxes[i];
+			const auto & b = boxes[j];
+			auto isOverlapping = (a.m_MinX < b.m_MaxX) && (b.m_MinX < a.m_MaxX) && (a.m_MinY < b.m_MaxY) && (b.m_MinY < a.m_MaxY);
+			if (!isOverlapping || (group[i] == group[j]))
+			{
+				continue;
+			}
+			auto from = group[j];
+			for (auto & g: group)
+			{
+				if (g == from)
+				{
+					g = group[i];
+				}
+			}
+		}
+	}
+
+	std::vector<std::vector<const Wiimote *>> res;
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		if (group[i] != i)
+		{
+			continue;
+		}
+		res.push_back(std::vector<const Wiimote *>());
+		for (size_t j = 0; j < boxes.size(); ++j)
+		{
+			if (group[j] == i)
+			{
+				res.back().push_back(boxes[j].m_Wiimote);
+			}
+		}
+	}
+	return res;
 }
 
 
@@ -28,6 +28,13 @@ class Wiimote;
 class Warper
 {
 public:
+	/** A point in integral coords. Used both for the Wiimote IR camera coords and the screen coords (normalized to 0 .. 65535). */
+	struct Point
+	{
+		int m_X, m_Y;
+	};
+
+
 	Warper();
 
 	/** Calculates the projection matrices for each usable Wiimote in the specified Calibration. */
@@ -38,7 +45,27 @@ public:
 
 	/** Warps the specified point using the specified Wiimote's warping.
 	Assumes the Wiimote has a valid warping (asserts). */
-	POINT warp(Wiimote & a_Wiimote, POINT a_WiimotePoint) const;
+	Point warp(Wiimote & a_Wiimote, Point a_WiimotePoint) const;
+
+	/** Warps the specified sub-pixel Wiimote point (such as a filtered one) using the specified Wiimote's warping.
+	Assumes the Wiimote has a valid warping (asserts). */
+	Point warp(Wiimote & a_Wiimote, double a_WiimoteX, double a_WiimoteY) const;
+
+	/** Moves the specified screen point (normalized screen coords) onto the screen quad calibrated for the Wiimote,
+	if it lies outside of it, to the nearest point of the quad's boundary.
+	Used for the points that haven't been warped from a real Wiimote point, such as the predicted ones.
+	Returns true if the point was moved, false if it was already inside (or the Wiimote has no warping). */
+	bool clampToScreenQuad(const Wiimote & a_Wiimote, double & a_ScreenX, double & a_ScreenY) const;
+
+	/** Returns the local scale of the specified Wiimote's warping at the specified Wiimote point: the size of
+	a single IR camera pixel on the screen (normalized screen coords per camera pixel), as the square root of its area.
+	The smaller the scale, the more precise the Wiimote is at that location.
+	Assumes the Wiimote has a valid warping (asserts). */
+	double getLocalScale(const Wiimote & a_Wiimote, double a_WiimoteX, double a_WiimoteY) const;
+
+	/** Returns the groups of the Wiimotes that are calibrated for the same screen area, meaning that their
+	screen quads overlap (their bounding boxes, to be exact). The Wiimotes not overlapping any other form their own groups. */
+	std::vector<std::vector<const Wiimote *>> getOverlappingGroups() const;
 
 // TODO
 // protected:
@@ -77,7 +104,7 @@ public:
 		void multiplyBy(const Matrix & a_Other);
 
 		/** Returns the coords of the specified point projected by this matrix. */
-		POINT project(POINT a_Src) const;
+		Point project(Point a_Src) const;
 
 		std::pair<Number, Number> project(Number a_X, Number a_Y) const;
 
@@ -108,10 +135,23 @@ public:
 
 	typedef std::map<const Wiimote *, Params> ParamsMap;
 
+	/** The screen coords of the four calibration points, in the calibration order (around the quad). */
+	struct Quad
+	{
+		double m_X[4];
+		double m_Y[4];
+	};
+
+	/** Maps a specific Wiimote to the screen quad that it has been calibrated for. */
+	typedef std::map<const Wiimote *, Quad> QuadMap;
+
 
 	/** Individual Wiimotes' projection matrices. */
 	MatrixMap m_Matrices;
 
 	ParamsMap m_Params;
+
+	/** Individual Wiimotes' calibrated screen quads. */
+	QuadMap m_ScreenQuads;
 };
 
@@ -8,7 +8,11 @@
 
 #include "Globals.h"
 #include "Wiimote.h"
-#include <hidsdi.h>
+#include "HidDevice.h"
+#include "DeviceCache.h"
+#include "ReportLog.h"
+#include "FlightRecorder.h"
+#include "StageHistograms.h"
 
 
 
@@ -41,12 +45,24 @@ enum
 
 
 Wiimote::Wiimote():
-	m_Handle(INVALID_HANDLE_VALUE),
-	m_ShouldTerminate(false),
-	m_CurrentState(),
+	m_ParseState(),
+	m_IRReportingMode(irrmOff),
+	m_Leds(0),
+	m_IsRumbleEnabled(false),
+	m_AccelCalibration(0),
+	m_Subscribers(new SubscriberTable),
+	m_CombinedInterest(0),
+	m_DispatchSeq(0),
+	m_DispatchThread(std::thread::id()),
+	m_HasRetiredSubscribers(false),
+	m_LastPublishedState(),
+	m_HasPublished(false),
 	m_UseAltWrite(false),
-	m_WriteEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr)),
-	m_LastWriteTime(std::chrono::system_clock::now())
+	m_DeviceCache(nullptr),
+	m_ReportLog(nullptr),
+	m_ReportLogDevice(-1),
+	m_FlightRecorder(new FlightRecorder),
+	m_HistogramsDevice(StageHistograms::get().addDevice("(not connected)"))
 {
 }
 
@@ -56,14 +72,22 @@ Wiimote::Wiimote():
 
 Wiimote::~Wiimote()
 {
-	// Notify the Reader thread to terminate, and wait for it to do so:
-	if (m_Handle != INVALID_HANDLE_VALUE)
+	// Stop writing, then reading; no more callbacks once this returns:
+	if (m_OutputQueue != nullptr)
 	{
-		m_ShouldTerminate = true;
-		CancelIoEx(m_Handle, nullptr);
-		CloseHandle(m_Handle);
-		m_ReadThread.join();
+		m_OutputQueue->stop();
 	}
+	if (m_Transport != nullptr)
+	{
+		m_Transport->close();
+	}
+
+	delete m_Subscribers.load();
+	for (auto table: m_RetiredSubscribers)
+	{
+		delete table;
+	}
+	StageHistograms::get().removeDevice(m_HistogramsDevice);
 }
 
 
@@ -72,73 +96,208 @@ Wiimote::~Wiimote()
 
 bool Wiimote::connect(const Wiimote::Id & a_Id, Wiimote::Callback * a_InitialCallback)
 {
-	assert(m_Handle == INVALID_HANDLE_VALUE);  // Not connected yet
-
-	// Open the OS handle:
-	auto path = WPathFromId(a_Id);
-	// Need to use OVERLAPPED IO, because in non-OVERLAPPED we get deadlocked by the OS if the Wiimote breaks the bluetooth connection
-	m_Handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
-	if (m_Handle == INVALID_HANDLE_VALUE)
+	// Open the OS device:
+	std::unique_ptr<HidDevice> device(new HidDevice);
+	if (!device->open(a_Id))
 	{
-		auto gle = GetLastError();
-		LOG("Wiimote \"%s\": failed to open OS handle: %d (0x%x)", a_Id.c_str(), gle, gle);
+		LOG("Wiimote \"%s\": failed to open the device", a_Id.c_str());
 		return false;
 	}
+	return connect(std::move(device), a_Id, a_InitialCallback);
+}
+
+
+
+
+
+bool Wiimote::connect(TransportPtr a_Transport, const Wiimote::Id & a_Id, Wiimote::Callback * a_InitialCallback)
+{
+	assert(m_Transport == nullptr);  // Not connected yet
+	assert(a_Transport != nullptr);
+
+	m_Id = a_Id;
+	m_FlightRecorder->setName(a_Id);
+	StageHistograms::get().setDeviceName(m_HistogramsDevice, a_Id);
+	m_Transport = std::move(a_Transport);
+	m_OutputQueue.reset(new OutputQueue(
+		[this](const unsigned char * a_Report, size_t a_Size)
+		{
+			return writeToTransport(a_Report, a_Size);
+		},
+		m_Transport->getMinWriteInterval()
+	));
 
 	// Insert the initial callback into the list of callbacks:
 	if (a_InitialCallback != nullptr)
 	{
-		m_Callbacks.push_back(a_InitialCallback);
+		addCallback(a_InitialCallback, cmAll);
 	}
 
 	// Start the async reading:
-	m_ReadThread = std::thread(&Wiimote::thrRead, this);
+	m_Transport->startReading(
+		[this](const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime)
+		{
+			onReport(a_Report, a_Size, a_ArrivalTime);
+		},
+		[this]()
+		{
+			LOG("Wiimote \"%s\": Failed to read data, the device has probably been disconnected", m_Id.c_str());
+		}
+	);
 
 	// Try to read the calibration data:
-	auto isSuccess = readCalibration();
-	if (!isSuccess)
+	if (!detectWriteMethod())
+	{
+		LOG("Wiimote \"%s\": failed to read calibration data", a_Id.c_str());
+		m_StableId.clear();  // Don't cache anything about a device that doesn't work
+		m_OutputQueue->stop();
+		m_Transport->close();
+		return false;
+	}
+	updateDeviceCache();
+	return true;
+}
+
+
+
+
+
+bool Wiimote::detectWriteMethod()
+{
+	// If the device is in the cache, try its remembered settings first:
+	if (m_DeviceCache != nullptr)
+	{
+		m_StableId = m_Transport->getStableId();
+	}
+	DeviceCache::Entry cached;
+	if (!m_StableId.empty() && m_DeviceCache->get(m_StableId, cached))
 	{
-		m_UseAltWrite = true;  // Use an alternate write method
-		isSuccess = readCalibration();
-		if (!isSuccess)
+		m_UseAltWrite = cached.m_UseAltWrite;
+
+		// The device may still be streaming IR reports from the previous session, parse them right away:
+		m_IRReportingMode = cached.m_IRReportingMode;
+		if (readCalibration())
 		{
-			LOG("Wiimote \"%s\": failed to read calibration data", a_Id.c_str());
-			m_ShouldTerminate = true;
-			CancelIoEx(m_Handle, nullptr);
-			CloseHandle(m_Handle);
-			m_Handle = INVALID_HANDLE_VALUE;
-			m_ReadThread.join();
-			return false;
+			if (m_AccelCalibration.load() != packAccelCalibration(cached.m_AccelCalibration))
+			{
+				LOG("Wiimote \"%s\": the calibration doesn't match the cached one, updating the cache", m_Id.c_str());
+				m_DeviceCache->invalidate(m_StableId);
+			}
+			return true;
 		}
+		LOG("Wiimote \"%s\": the cached write method doesn't work, invalidating the cache", m_Id.c_str());
+		m_DeviceCache->invalidate(m_StableId);
+		m_IRReportingMode = irrmOff;
 	}
 
-	return true;
+	// Probe the default write method, then the alternate one:
+	m_UseAltWrite = false;
+	if (readCalibration())
+	{
+		return true;
+	}
+	m_UseAltWrite = true;
+	return readCalibration();
 }
 
 
 
 
 
+void Wiimote::updateDeviceCache()
+{
+	if ((m_DeviceCache == nullptr) || m_StableId.empty())
+	{
+		return;
+	}
+	DeviceCache::Entry entry;
+	entry.m_UseAltWrite = m_UseAltWrite;
+	entry.m_AccelCalibration = unpackAccelCalibration(m_AccelCalibration.load());
+	entry.m_IRReportingMode = static_cast<IRReportingMode>(m_IRReportingMode.load());
+	m_DeviceCache->set(m_StableId, entry);
+}
+
+
+
+
+
+void Wiimote::setReportLog(ReportLog * a_Log)
+{
+	// Stop logging into the previous log before registering in the new one, the device index is not atomic:
+	m_ReportLog.store(nullptr, std::memory_order_release);
+	m_ReportLogDevice = -1;
+	if (a_Log == nullptr)
+	{
+		return;
+	}
+	auto device = a_Log->addDevice(m_StableId.empty() ? m_Id : m_StableId, unpackAccelCalibration(m_AccelCalibration.load()));
+	if (device < 0)
+	{
+		LOG("Wiimote \"%s\": cannot add the device to the report log", m_Id.c_str());
+		return;
+	}
+	m_ReportLogDevice = device;
+	m_ReportLog.store(a_Log, std::memory_order_release);
+}
+
+
+
+
+
+void Wiimote::startReplay(const Id & a_Id, const AccelCalibration & a_AccelCalibration)
+{
+	assert(m_Transport == nullptr);  // Replaying into a connected Wiimote would mix the reports
+	m_Id = a_Id;
+	m_FlightRecorder->setName(a_Id);
+	StageHistograms::get().setDeviceName(m_HistogramsDevice, a_Id);
+	m_AccelCalibration = packAccelCalibration(a_AccelCalibration);
+}
+
+
+
+
+
+void Wiimote::replayReport(const unsigned char * a_Report, size_t a_Size, IRReportingMode a_IRMode, Clock::time_point a_ArrivalTime)
+{
+	m_IRReportingMode.store(a_IRMode, std::memory_order_relaxed);
+	onReport(a_Report, a_Size, a_ArrivalTime);
+}
+
+
+
+
+
+#ifdef _WIN32
 Wiimote::Id Wiimote::IdFromWPath(LPCWSTR a_DevicePath)
 {
 	char pathUtf8[12000];
 	WideCharToMultiByte(CP_UTF8, 0, a_DevicePath, -1, pathUtf8, ARRAYCOUNT(pathUtf8), nullptr, nullptr);
 	return pathUtf8;
 }
+#endif  // _WIN32
 
 
 
 
 
-std::wstring Wiimote::WPathFromId(const Id & a_Id)
+Wiimote::State Wiimote::getCurrentState() const
 {
-	WCHAR pathUtf16[12000];
-	auto res = MultiByteToWideChar(CP_UTF8, 0, a_Id.c_str(), static_cast<int>(a_Id.size()), pathUtf16, ARRAYCOUNT(pathUtf16));
-	if (res >= 0)
+	Sample sample;
+	if (!getLatestSample(sample))
 	{
-		pathUtf16[res] = 0;
+		// Nothing parsed yet, return the settings only:
+		State res = State();
+		res.m_IRState.m_ReportingMode = static_cast<IRReportingMode>(m_IRReportingMode.load());
+		res.m_AccelCalibration = unpackAccelCalibration(m_AccelCalibration.load());
+		auto leds = m_Leds.load();
+		res.m_Led1 = ((leds & 0x01) != 0);
+		res.m_Led2 = ((leds & 0x02) != 0);
+		res.m_Led3 = ((leds & 0x04) != 0);
+		res.m_Led4 = ((leds & 0x08) != 0);
+		res.m_IsRumbleEnabled = m_IsRumbleEnabled.load();
+		return res;
 	}
-	return pathUtf16;
+	return sample.m_State;
 }
 
 
@@ -147,21 +306,41 @@ std::wstring Wiimote::WPathFromId(const Id & a_Id)
 
 Wiimote::IRState Wiimote::getCurrentIRState() const
 {
-	std::lock_guard<std::mutex> lock(m_CS);
-	return m_CurrentState.m_IRState;
+	Sample sample;
+	if (!getLatestSample(sample))
+	{
+		IRState res = IRState();
+		res.m_ReportingMode = static_cast<IRReportingMode>(m_IRReportingMode.load());
+		return res;
+	}
+	return sample.m_State.m_IRState;
+}
+
+
+
+
+
+bool Wiimote::getLatestSample(Sample & a_Sample) const
+{
+	return m_Samples.getLatest(a_Sample);
+}
+
+
+
+
+
+size_t Wiimote::getRecentSamples(Sample * a_Samples, size_t a_MaxCount) const
+{
+	return m_Samples.getRecent(a_Samples, a_MaxCount);
 }
 
 
 
 
 
-void Wiimote::setLeds(bool a_Led1, bool a_Led2, bool a_Led3, bool a_Led4)
+std::future<bool> Wiimote::setLeds(bool a_Led1, bool a_Led2, bool a_Led3, bool a_Led4)
 {
-	std::lock_guard<std::mutex> lock (m_CS);
-	m_CurrentState.m_Led1 = a_Led1;
-	m_CurrentState.m_Led2 = a_Led2;
-	m_CurrentState.m_Led3 = a_Led3;
-	m_CurrentState.m_Led4 = a_Led4;
+	m_Leds = (a_Led1 ? 0x01 : 0x00) | (a_Led2 ? 0x02 : 0x00) | (a_Led3 ? 0x04 : 0x00) | (a_Led4 ? 0x08 : 0x00);
 
 	unsigned char req[2] =
 	{
@@ -174,14 +353,14 @@ void Wiimote::setLeds(bool a_Led1, bool a_Led2, bool a_Led3, bool a_Led4)
 			getRumbleBit()
 		)
 	};
-	writeReport(req, 2);
+	return writeReport(req, 2, ortLEDs);
 }
 
 
 
 
 
-void Wiimote::setReportType(InputReportType a_Type, bool a_Continuous)
+std::future<bool> Wiimote::setReportType(InputReportType a_Type, bool a_Continuous)
 {
 	switch (a_Type)
 	{
@@ -208,17 +387,50 @@ void Wiimote::setReportType(InputReportType a_Type, bool a_Continuous)
 		static_cast<unsigned char>((a_Continuous ? 0x04 : 0x00) | getRumbleBit()),
 		static_cast<unsigned char>(a_Type),
 	};
-	writeReport(req, 3);
+	return writeReport(req, 3, ortType);
 }
 
 
 
 
 
-void Wiimote::addCallback(Callback * a_Callback)
+void Wiimote::setWriteInterval(std::chrono::microseconds a_Interval)
 {
-	std::lock_guard<std::mutex> lock (m_CS);
-	m_Callbacks.push_back(a_Callback);
+	assert(m_OutputQueue != nullptr);  // Must be connected
+	m_OutputQueue->setInterval(a_Interval);
+}
+
+
+
+
+
+void Wiimote::addCallback(Callback * a_Callback, unsigned a_InterestMask)
+{
+	modifySubscribers([a_Callback, a_InterestMask](SubscriberTable & a_Table)
+		{
+			Subscriber sub = {a_Callback, a_InterestMask};
+			a_Table.push_back(sub);
+		}
+	);
+}
+
+
+
+
+
+void Wiimote::setCallbackInterest(Callback * a_Callback, unsigned a_InterestMask)
+{
+	modifySubscribers([a_Callback, a_InterestMask](SubscriberTable & a_Table)
+		{
+			for (auto & sub: a_Table)
+			{
+				if (sub.m_Callback == a_Callback)
+				{
+					sub.m_InterestMask = a_InterestMask;
+				}
+			}
+		}
+	);
 }
 
 
@@ -227,33 +439,76 @@ void Wiimote::addCallback(Callback * a_Callback)
 
 void Wiimote::removeCallback(Callback * a_Callback)
 {
-	std::lock_guard<std::mutex> lock (m_CS);
-	m_Callbacks.remove(a_Callback);
+	modifySubscribers([a_Callback](SubscriberTable & a_Table)
+		{
+			a_Table.erase(
+				std::remove_if(a_Table.begin(), a_Table.end(), [a_Callback](const Subscriber & a_Sub) { return (a_Sub.m_Callback == a_Callback); }),
+				a_Table.end()
+			);
+		}
+	);
 }
 
 
 
 
 
-void Wiimote::enableIR(IRReportingMode a_Mode)
+void Wiimote::modifySubscribers(const std::function<void (SubscriberTable &)> & a_Modifier)
 {
-	unsigned char rumbleBit;
+	// Publish the modified copy:
+	const SubscriberTable * oldTable;
 	{
 		std::lock_guard<std::mutex> lock(m_CS);
-		rumbleBit = getRumbleBit();
+		std::unique_ptr<SubscriberTable> newTable(new SubscriberTable(*m_Subscribers.load()));
+		a_Modifier(*newTable);
+		unsigned combined = 0;
+		for (const auto & sub: *newTable)
+		{
+			combined |= sub.m_InterestMask;
+		}
+		oldTable = m_Subscribers.exchange(newTable.release());
+		m_CombinedInterest = combined;
+
+		// If called from within a callback, the dispatch is using the old table right now; have it free the table when done:
+		if (m_DispatchThread.load() == std::this_thread::get_id())
+		{
+			m_RetiredSubscribers.push_back(oldTable);
+			m_HasRetiredSubscribers = true;
+			return;
+		}
 	}
 
-	char req1[2] =
+	// Wait for the dispatch in progress (if any), which may still be using the old table, to finish:
+	auto seq = m_DispatchSeq.load();
+	if ((seq & 1) != 0)
+	{
+		while (m_DispatchSeq.load() == seq)
+		{
+			std::this_thread::yield();
+		}
+	}
+	delete oldTable;
+}
+
+
+
+
+
+std::future<bool> Wiimote::enableIR(IRReportingMode a_Mode)
+{
+	auto rumbleBit = getRumbleBit();
+
+	unsigned char req1[2] =
 	{
 		ortIR,
-		0x04 | rumbleBit,
+		static_cast<unsigned char>(0x04 | rumbleBit),
 	};
 	writeReport(req1, 2);
 
-	char req2[2] =
+	unsigned char req2[2] =
 	{
 		ortIR2,
-		0x04 | rumbleBit,
+		static_cast<unsigned char>(0x04 | rumbleBit),
 	};
 	writeReport(req2, 2);
 
@@ -265,25 +520,23 @@ void Wiimote::enableIR(IRReportingMode a_Mode)
 	writeData(REGISTER_IR_SENSITIVITY_1, sensitivity1, sizeof(sensitivity1));
 	writeData(REGISTER_IR_SENSITIVITY_2, sensitivity2, sizeof(sensitivity2));
 
-	writeData(REGISTER_IR_MODE, static_cast<unsigned char>(a_Mode));
+	auto res = writeData(REGISTER_IR_MODE, static_cast<unsigned char>(a_Mode));
 
 	// Store the new mode, so that the parser can use it:
-	std::lock_guard<std::mutex> lock(m_CS);
-	m_CurrentState.m_IRState.m_ReportingMode = a_Mode;
+	m_IRReportingMode = a_Mode;
+	updateDeviceCache();
+	return res;
 }
 
 
 
 
 
-void Wiimote::disableIR()
+std::future<bool> Wiimote::disableIR()
 {
-	unsigned char rumbleBit;
-	{
-		std::lock_guard<std::mutex> lock(m_CS);
-		m_CurrentState.m_IRState.m_ReportingMode = irrmOff;
-		rumbleBit = getRumbleBit();
-	}
+	m_IRReportingMode = irrmOff;
+	updateDeviceCache();
+	auto rumbleBit = getRumbleBit();
 
 	unsigned char req[2] =
 	{
@@ -293,7 +546,7 @@ void Wiimote::disableIR()
 	writeReport(req, 2);
 
 	req[0] = ortIR2;
-	writeReport(req, 2);
+	return writeReport(req, 2);
 }
 
 
@@ -302,7 +555,9 @@ void Wiimote::disableIR()
 
 bool Wiimote::parseIncomingPacket(const unsigned char * a_Packet)
 {
-	std::lock_guard<std::mutex> lock(m_CS);
+	// Pick up the settings changed by the other threads:
+	m_ParseState.m_IRState.m_ReportingMode = static_cast<IRReportingMode>(m_IRReportingMode.load(std::memory_order_relaxed));
+
 	auto reportType = a_Packet[0];
 	switch (reportType)
 	{
@@ -339,6 +594,7 @@ bool Wiimote::parseIncomingPacket(const unsigned char * a_Packet)
 		case irtReadData:
 		{
 			parseButtons(a_Packet);
+			std::lock_guard<std::mutex> lock(m_CS);
 			parseReadData(a_Packet);
 			break;
 		}
@@ -361,9 +617,9 @@ bool Wiimote::parseIncomingPacket(const unsigned char * a_Packet)
 
 void Wiimote::parseAccel(const unsigned char * a_Packet)
 {
-	m_CurrentState.m_AccelState.m_AccelX = static_cast<unsigned char>(a_Packet[3]) | ((a_Packet[1] & 0x60) << 8);
-	m_CurrentState.m_AccelState.m_AccelY = static_cast<unsigned char>(a_Packet[4]) | ((a_Packet[2] & 0x20) << 8);
-	m_CurrentState.m_AccelState.m_AccelZ = static_cast<unsigned char>(a_Packet[5]) | ((a_Packet[2] & 0x40) << 8);
+	m_ParseState.m_AccelState.m_AccelX = static_cast<unsigned char>(a_Packet[3]) | ((a_Packet[1] & 0x60) << 8);
+	m_ParseState.m_AccelState.m_AccelY = static_cast<unsigned char>(a_Packet[4]) | ((a_Packet[2] & 0x20) << 8);
+	m_ParseState.m_AccelState.m_AccelZ = static_cast<unsigned char>(a_Packet[5]) | ((a_Packet[2] & 0x40) << 8);
 }
 
 
@@ -372,17 +628,17 @@ void Wiimote::parseAccel(const unsigned char * a_Packet)
 
 void Wiimote::parseButtons(const unsigned char * a_Packet)
 {
-	m_CurrentState.m_ButtonState.m_ButtonA     = (a_Packet[2] & 0x08) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonB     = (a_Packet[2] & 0x04) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonMinus = (a_Packet[2] & 0x10) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonHome  = (a_Packet[2] & 0x80) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonPlus  = (a_Packet[1] & 0x10) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonOne   = (a_Packet[2] & 0x02) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonTwo   = (a_Packet[2] & 0x01) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonUp    = (a_Packet[1] & 0x08) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonDown  = (a_Packet[1] & 0x04) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonLeft  = (a_Packet[1] & 0x01) != 0;
-	m_CurrentState.m_ButtonState.m_ButtonRight = (a_Packet[1] & 0x02) != 0;
+	m_ParseState.m_ButtonState.m_ButtonA     = (a_Packet[2] & 0x08) != 0;
+	m_ParseState.m_ButtonState.m_ButtonB     = (a_Packet[2] & 0x04) != 0;
+	m_ParseState.m_ButtonState.m_ButtonMinus = (a_Packet[2] & 0x10) != 0;
+	m_ParseState.m_ButtonState.m_ButtonHome  = (a_Packet[2] & 0x80) != 0;
+	m_ParseState.m_ButtonState.m_ButtonPlus  = (a_Packet[1] & 0x10) != 0;
+	m_ParseState.m_ButtonState.m_ButtonOne   = (a_Packet[2] & 0x02) != 0;
+	m_ParseState.m_ButtonState.m_ButtonTwo   = (a_Packet[2] & 0x01) != 0;
+	m_ParseState.m_ButtonState.m_ButtonUp    = (a_Packet[1] & 0x08) != 0;
+	m_ParseState.m_ButtonState.m_ButtonDown  = (a_Packet[1] & 0x04) != 0;
+	m_ParseState.m_ButtonState.m_ButtonLeft  = (a_Packet[1] & 0x01) != 0;
+	m_ParseState.m_ButtonState.m_ButtonRight = (a_Packet[1] & 0x02) != 0;
 }
 
 
@@ -391,37 +647,43 @@ void Wiimote::parseButtons(const unsigned char * a_Packet)
 
 void Wiimote::parseIR(const unsigned char * a_Packet)
 {
-	m_CurrentState.m_IRState.m_X1 = static_cast<int>(a_Packet[6])  | (((a_Packet[8] >> 4) & 0x03) << 8);
-	m_CurrentState.m_IRState.m_Y1 = static_cast<int>(a_Packet[7])  | (((a_Packet[8] >> 6) & 0x03) << 8);
+	m_ParseState.m_IRState.m_X1 = static_cast<int>(a_Packet[6])  | (((a_Packet[8] >> 4) & 0x03) << 8);
+	m_ParseState.m_IRState.m_Y1 = static_cast<int>(a_Packet[7])  | (((a_Packet[8] >> 6) & 0x03) << 8);
 
-	switch(m_CurrentState.m_IRState.m_ReportingMode)
+	switch(m_ParseState.m_IRState.m_ReportingMode)
 	{
 		case irrmBasic:
 		{
-			m_CurrentState.m_IRState.m_X2 = a_Packet[9]  | (((a_Packet[8]  >> 0) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y2 = a_Packet[10] | (((a_Packet[8]  >> 2) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_X3 = a_Packet[11] | (((a_Packet[13] >> 4) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y3 = a_Packet[12] | (((a_Packet[13] >> 6) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_X4 = a_Packet[14] | (((a_Packet[13] >> 0) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y4 = a_Packet[15] | (((a_Packet[13] >> 2) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_IsPresent1 = !((a_Packet[6]  == 0xff) && (a_Packet[7]  == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent2 = !((a_Packet[9]  == 0xff) && (a_Packet[10] == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent3 = !((a_Packet[11] == 0xff) && (a_Packet[12] == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent4 = !((a_Packet[14] == 0xff) && (a_Packet[15] == 0xff));
+			m_ParseState.m_IRState.m_X2 = a_Packet[9]  | (((a_Packet[8]  >> 0) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y2 = a_Packet[10] | (((a_Packet[8]  >> 2) & 0x03) << 8);
+			m_ParseState.m_IRState.m_X3 = a_Packet[11] | (((a_Packet[13] >> 4) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y3 = a_Packet[12] | (((a_Packet[13] >> 6) & 0x03) << 8);
+			m_ParseState.m_IRState.m_X4 = a_Packet[14] | (((a_Packet[13] >> 0) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y4 = a_Packet[15] | (((a_Packet[13] >> 2) & 0x03) << 8);
+			m_ParseState.m_IRState.m_IsPresent1 = !((a_Packet[6]  == 0xff) && (a_Packet[7]  == 0xff));
+			m_ParseState.m_IRState.m_IsPresent2 = !((a_Packet[9]  == 0xff) && (a_Packet[10] == 0xff));
+			m_ParseState.m_IRState.m_IsPresent3 = !((a_Packet[11] == 0xff) && (a_Packet[12] == 0xff));
+			m_ParseState.m_IRState.m_IsPresent4 = !((a_Packet[14] == 0xff) && (a_Packet[15] == 0xff));
 			break;
 		}
 		case irrmExtended:
 		{
-			m_CurrentState.m_IRState.m_X2 = a_Packet[9]  | (((a_Packet[11] >> 4) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y2 = a_Packet[10] | (((a_Packet[11] >> 6) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_X3 = a_Packet[12] | (((a_Packet[14] >> 4) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y3 = a_Packet[13] | (((a_Packet[14] >> 6) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_X4 = a_Packet[15] | (((a_Packet[17] >> 4) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_Y4 = a_Packet[16] | (((a_Packet[17] >> 6) & 0x03) << 8);
-			m_CurrentState.m_IRState.m_IsPresent1 = !((a_Packet[6]  == 0xff) && (a_Packet[7]  == 0xff) && (a_Packet[8]  == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent2 = !((a_Packet[9]  == 0xff) && (a_Packet[10] == 0xff) && (a_Packet[11] == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent3 = !((a_Packet[12] == 0xff) && (a_Packet[13] == 0xff) && (a_Packet[14] == 0xff));
-			m_CurrentState.m_IRState.m_IsPresent4 = !((a_Packet[15] == 0xff) && (a_Packet[16] == 0xff) && (a_Packet[17] == 0xff));
+			m_ParseState.m_IRState.m_X2 = a_Packet[9]  | (((a_Packet[11] >> 4) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y2 = a_Packet[10] | (((a_Packet[11] >> 6) & 0x03) << 8);
+			m_ParseState.m_IRState.m_X3 = a_Packet[12] | (((a_Packet[14] >> 4) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y3 = a_Packet[13] | (((a_Packet[14] >> 6) & 0x03) << 8);
+			m_ParseState.m_IRState.m_X4 = a_Packet[15] | (((a_Packet[17] >> 4) & 0x03) << 8);
+			m_ParseState.m_IRState.m_Y4 = a_Packet[16] | (((a_Packet[17] >> 6) & 0x03) << 8);
+			m_ParseState.m_IRState.m_IsPresent1 = !((a_Packet[6]  == 0xff) && (a_Packet[7]  == 0xff) && (a_Packet[8]  == 0xff));
+			m_ParseState.m_IRState.m_IsPresent2 = !((a_Packet[9]  == 0xff) && (a_Packet[10] == 0xff) && (a_Packet[11] == 0xff));
+			m_ParseState.m_IRState.m_IsPresent3 = !((a_Packet[12] == 0xff) && (a_Packet[13] == 0xff) && (a_Packet[14] == 0xff));
+			m_ParseState.m_IRState.m_IsPresent4 = !((a_Packet[15] == 0xff) && (a_Packet[16] == 0xff) && (a_Packet[17] == 0xff));
+			break;
+		}
+		case irrmOff:
+		case irrmFull:
+		{
+			// No IR data in the irtIRAccel layout (the full mode comes in the interleaved reports, which are not parsed)
 			break;
 		}
 	}
@@ -433,32 +695,39 @@ void Wiimote::parseIR(const unsigned char * a_Packet)
 
 void Wiimote::parseReadData(const unsigned char * a_Packet)
 {
-	char * buf;
-	short left;
-	std::condition_variable * cv;
-	std::tie(buf, left, cv) = m_ReadDataRequests.front();
-	if ((a_Packet[3] & 0x07) != 0)
+	if (m_ReadDataRequests.empty())
+	{
+		LOG("Wiimote \"%s\": Received unsolicited data, ignoring", m_Id.c_str());
+		return;
+	}
+	auto req = m_ReadDataRequests.front();
+	if ((a_Packet[3] & 0x0f) != 0)
 	{
 		// The ReadData requet failed device-side, remove the request from the queue:
 		LOG("Request to read data has failed device-side");
 		m_ReadDataRequests.pop_front();
-		cv->notify_all();
+		req->m_IsDone = true;
+		req->m_CV.notify_all();
+		return;
 	}
 
-	// Copy the received data to the buffer:
+	// Copy the received data to the buffer (the data follows the 2-byte address of the chunk):
 	auto dataSize = (a_Packet[3] >> 4) + 1;
-	memcpy(buf, a_Packet + 4, std::min<short>(dataSize, left));
+	memcpy(req->m_Buffer, a_Packet + 6, std::min<short>(dataSize, req->m_Left));
 
 	// If the entire read operation was satisfied, remove it from the queue:
-	if (dataSize >= left)
+	if (dataSize >= req->m_Left)
 	{
 		m_ReadDataRequests.pop_front();
-		cv->notify_all();
+		req->m_IsDone = true;
+		req->m_IsSuccess = true;
+		req->m_CV.notify_all();
 	}
 	else
 	{
-		// More data expected, update the counter:
-		std::get<1>(m_ReadDataRequests.front()) = left - dataSize;
+		// More data expected, update the buffer pointer and the counter:
+		req->m_Buffer += dataSize;
+		req->m_Left -= dataSize;
 	}
 }
 
@@ -466,41 +735,60 @@ void Wiimote::parseReadData(const unsigned char * a_Packet)
 
 
 
-void Wiimote::thrRead()
+void Wiimote::onReport(const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime)
 {
-	auto evtRead = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-	while (!m_ShouldTerminate)
+	auto log = m_ReportLog.load(std::memory_order_acquire);
+	if (log != nullptr)
 	{
-		unsigned char buffer[22];
-		DWORD br = 0;
-		OVERLAPPED ovl;
-		memset(&ovl, 0, sizeof(ovl));
-		ovl.hEvent = evtRead;
-		if (!ReadFile(m_Handle, &buffer, sizeof(buffer), &br, &ovl))
-		{
-			auto gle = GetLastError();
-			if (gle != ERROR_IO_PENDING)
-			{
-				LOG("Wiimote \"%s\": ReadFile() failed: %d (0x%x)", m_Id.c_str(), gle, gle);
-				return;
-			}
-			if (!GetOverlappedResult(m_Handle, &ovl, &br, TRUE))
-			{
-				auto gle = GetLastError();
-				LOG("Wiimote \"%s\": Failed to wait for read data: %d (0x%x)", m_Id.c_str(), gle, gle);
-				return;
-			}
-		}
-		if (br != sizeof(buffer))
-		{
-			auto gle = GetLastError();
-			LOG("Wiimote \"%s\": Wrong amount of data read. Exp %u, got %u.", m_Id.c_str(), static_cast<unsigned>(sizeof(buffer)), br);
-			return;
-		}
-		if (parseIncomingPacket(buffer))
-		{
-			notifyStateChange();
-		}
+		log->addReport(m_ReportLogDevice, m_IRReportingMode.load(std::memory_order_relaxed), a_Report, a_Size, a_ArrivalTime);
+	}
+
+	if (m_LastArrivalTime != Clock::time_point())
+	{
+		m_ReportIntervals.add(a_ArrivalTime - m_LastArrivalTime);
+	}
+	m_LastArrivalTime = a_ArrivalTime;
+
+	if ((a_Size == 0) || (a_Size > REPORT_SIZE))
+	{
+		LOG("Wiimote \"%s\": Wrong report size: %u", m_Id.c_str(), static_cast<unsigned>(a_Size));
+		m_FlightRecorder->trigger(Printf("Wrong report size: %u", static_cast<unsigned>(a_Size)));
+		return;
+	}
+
+	// Some OSes (hidraw) report only the actual report length, zero-pad the rest:
+	unsigned char buffer[REPORT_SIZE];
+	memcpy(buffer, a_Report, a_Size);
+	memset(buffer + a_Size, 0, sizeof(buffer) - a_Size);
+	auto & histograms = StageHistograms::get();
+	auto parseStart = Clock::now();
+	auto isParsed = parseIncomingPacket(buffer);
+	auto parseEnd = Clock::now();
+	histograms.record(m_HistogramsDevice, StageHistograms::hsRead, parseStart - a_ArrivalTime);
+	histograms.record(m_HistogramsDevice, StageHistograms::hsParse, parseEnd - parseStart);
+	m_FlightRecorder->addReport(buffer, a_Size, m_IRReportingMode.load(std::memory_order_relaxed), a_ArrivalTime, isParsed, m_ParseState);
+	if (isParsed)
+	{
+		// Publish the new state for the consumers:
+		Sample sample;
+		sample.m_Trace.m_Times[LatencyTrace::stArrival] = a_ArrivalTime;
+		sample.m_Trace.m_Times[LatencyTrace::stParsed] = parseEnd;
+		sample.m_Trace.m_Device = m_HistogramsDevice;
+		sample.m_State = m_ParseState;
+		sample.m_State.m_AccelCalibration = unpackAccelCalibration(m_AccelCalibration.load(std::memory_order_relaxed));
+		auto leds = m_Leds.load(std::memory_order_relaxed);
+		sample.m_State.m_Led1 = ((leds & 0x01) != 0);
+		sample.m_State.m_Led2 = ((leds & 0x02) != 0);
+		sample.m_State.m_Led3 = ((leds & 0x04) != 0);
+		sample.m_State.m_Led4 = ((leds & 0x08) != 0);
+		sample.m_State.m_IsRumbleEnabled = m_IsRumbleEnabled.load(std::memory_order_relaxed);
+		sample.m_SeqNum = m_Samples.getNumPushed();
+		sample.m_Changes = m_HasPublished ? diffStates(m_LastPublishedState, sample.m_State) : static_cast<unsigned>(cmAll);
+		m_Samples.push(sample);
+		m_LastPublishedState = sample.m_State;
+		m_HasPublished = true;
+
+		notifyStateChange(sample);
 	}
 }
 
@@ -508,27 +796,104 @@ void Wiimote::thrRead()
 
 
 
-void Wiimote::notifyStateChange()
+unsigned Wiimote::diffStates(const State & a_Old, const State & a_New)
 {
-	// Make a copy of the callback list:
-	std::list<Callback *> callbacks;
+	unsigned res = 0;
+	const auto & oldIR = a_Old.m_IRState;
+	const auto & newIR = a_New.m_IRState;
+	if (
+		(oldIR.m_X1 != newIR.m_X1) || (oldIR.m_Y1 != newIR.m_Y1) ||
+		(oldIR.m_X2 != newIR.m_X2) || (oldIR.m_Y2 != newIR.m_Y2) ||
+		(oldIR.m_X3 != newIR.m_X3) || (oldIR.m_Y3 != newIR.m_Y3) ||
+		(oldIR.m_X4 != newIR.m_X4) || (oldIR.m_Y4 != newIR.m_Y4) ||
+		(oldIR.m_IsPresent1 != newIR.m_IsPresent1) || (oldIR.m_IsPresent2 != newIR.m_IsPresent2) ||
+		(oldIR.m_IsPresent3 != newIR.m_IsPresent3) || (oldIR.m_IsPresent4 != newIR.m_IsPresent4) ||
+		(oldIR.m_ReportingMode != newIR.m_ReportingMode)
+	)
 	{
-		std::lock_guard<std::mutex> lock(m_CS);
-		callbacks = m_Callbacks;
+		res |= cmIR;
+	}
+
+	const auto & oldBtn = a_Old.m_ButtonState;
+	const auto & newBtn = a_New.m_ButtonState;
+	if (
+		(oldBtn.m_ButtonA != newBtn.m_ButtonA) || (oldBtn.m_ButtonB != newBtn.m_ButtonB) ||
+		(oldBtn.m_ButtonHome != newBtn.m_ButtonHome) ||
+		(oldBtn.m_ButtonMinus != newBtn.m_ButtonMinus) || (oldBtn.m_ButtonPlus != newBtn.m_ButtonPlus) ||
+		(oldBtn.m_ButtonOne != newBtn.m_ButtonOne) || (oldBtn.m_ButtonTwo != newBtn.m_ButtonTwo) ||
+		(oldBtn.m_ButtonUp != newBtn.m_ButtonUp) || (oldBtn.m_ButtonDown != newBtn.m_ButtonDown) ||
+		(oldBtn.m_ButtonLeft != newBtn.m_ButtonLeft) || (oldBtn.m_ButtonRight != newBtn.m_ButtonRight)
+	)
+	{
+		res |= cmButtons;
+	}
+
+	const auto & oldAccel = a_Old.m_AccelState;
+	const auto & newAccel = a_New.m_AccelState;
+	if (
+		(oldAccel.m_AccelX != newAccel.m_AccelX) ||
+		(oldAccel.m_AccelY != newAccel.m_AccelY) ||
+		(oldAccel.m_AccelZ != newAccel.m_AccelZ)
+	)
+	{
+		res |= cmAccel;
+	}
+	return res;
+}
+
+
+
+
+
+void Wiimote::notifyStateChange(Sample & a_Sample)
+{
+	// Bail out early (without locking) if no callback is interested:
+	auto events = a_Sample.m_Changes | cmEveryReport;
+	if ((m_CombinedInterest.load(std::memory_order_relaxed) & events) == 0)
+	{
+		return;
 	}
 
-	// Call the callbacks from the list:
-	for (auto & cb: callbacks)
+	// Enter the dispatch; the table loaded after this is guaranteed to stay alive until leaving:
+	m_DispatchThread = std::this_thread::get_id();
+	m_DispatchSeq.fetch_add(1);
+	const auto & subscribers = *m_Subscribers.load();
+
+	// Call the interested callbacks:
+	a_Sample.m_Trace.mark(LatencyTrace::stDispatched);
+	StageHistograms::get().record(
+		a_Sample.m_Trace.m_Device, StageHistograms::hsDispatch,
+		a_Sample.m_Trace.m_Times[LatencyTrace::stDispatched] - a_Sample.m_Trace.m_Times[LatencyTrace::stParsed]
+	);
+	for (const auto & sub: subscribers)
 	{
+		if ((sub.m_InterestMask & events) == 0)
+		{
+			continue;
+		}
 		try
 		{
-			(*cb)(*this);
+			(*sub.m_Callback)(*this, a_Sample);
 		}
 		catch (const std::exception & exc)
 		{
 			LOG("Wiimote \"%s\": Failed to call callback: %s", m_Id.c_str(), exc.what());
 		}
 	}
+
+	// Leave the dispatch, free the tables replaced by the callbacks:
+	m_DispatchThread = std::thread::id();
+	m_DispatchSeq.fetch_add(1);
+	if (m_HasRetiredSubscribers.load())
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		for (auto table: m_RetiredSubscribers)
+		{
+			delete table;
+		}
+		m_RetiredSubscribers.clear();
+		m_HasRetiredSubscribers = false;
+	}
 }
 
 
@@ -542,12 +907,14 @@ bool Wiimote::readCalibration()
 		return false;
 	}
 
-	m_CurrentState.m_AccelCalibration.m_X0 = buf[0];
-	m_CurrentState.m_AccelCalibration.m_Y0 = buf[1];
-	m_CurrentState.m_AccelCalibration.m_Z0 = buf[2];
-	m_CurrentState.m_AccelCalibration.m_XG = buf[4];
-	m_CurrentState.m_AccelCalibration.m_YG = buf[5];
-	m_CurrentState.m_AccelCalibration.m_ZG = buf[6];
+	AccelCalibration calibration;
+	calibration.m_X0 = buf[0];
+	calibration.m_Y0 = buf[1];
+	calibration.m_Z0 = buf[2];
+	calibration.m_XG = buf[4];
+	calibration.m_YG = buf[5];
+	calibration.m_ZG = buf[6];
+	m_AccelCalibration = packAccelCalibration(calibration);
 	return true;
 }
 
@@ -556,8 +923,18 @@ bool Wiimote::readCalibration()
 
 bool Wiimote::readData(int a_Address, short a_Size, char * a_Buffer)
 {
-	// Write the output report:
-	std::unique_lock<std::mutex> lock(m_CS);
+	// Queue the read request before writing, so that the reply cannot arrive before it is queued:
+	ReadDataRequest request;
+	request.m_Buffer = a_Buffer;
+	request.m_Left = a_Size;
+	request.m_IsDone = false;
+	request.m_IsSuccess = false;
+	{
+		std::lock_guard<std::mutex> lock(m_CS);
+		m_ReadDataRequests.push_back(&request);
+	}
+
+	// Write the output report (without holding m_CS, so that the incoming reports can be parsed meanwhile):
 	unsigned char req[7] =
 	{
 		ortReadMemory,
@@ -568,21 +945,23 @@ bool Wiimote::readData(int a_Address, short a_Size, char * a_Buffer)
 		static_cast<unsigned char>((a_Size & 0xff00) >> 8),
 		static_cast<unsigned char>(a_Size & 0xff),
 	};
-	if (!writeReport(req, 7))
+	auto isWritten = writeReport(req, 7).get();
+
+	// Wait for completion:
+	std::unique_lock<std::mutex> lock(m_CS);
+	if (!isWritten)
 	{
 		LOG("Wiimote \"%s\": readData() failed to write request", m_Id.c_str());
-		return false;
 	}
-
-	// Add the read request to the queue and wait for completion:
-	std::condition_variable cv;
-	m_ReadDataRequests.emplace_back(a_Buffer, a_Size, &cv);
-	auto status = cv.wait_for(lock, std::chrono::seconds(1));
-	if (status == std::cv_status::no_timeout)
+	else if (request.m_CV.wait_for(lock, std::chrono::seconds(1), [&request]() { return request.m_IsDone; }))
 	{
-		return true;
+		return request.m_IsSuccess;
+	}
+	else
+	{
+		LOG("Wiimote \"%s\": readData() timed out", m_Id.c_str());
 	}
-	LOG("Wiimote \"%s\": readData() timed out", m_Id.c_str());
+	m_ReadDataRequests.remove(&request);
 	return false;
 }
 
@@ -590,7 +969,7 @@ bool Wiimote::readData(int a_Address, short a_Size, char * a_Buffer)
 
 
 
-bool Wiimote::writeData(int a_Address, unsigned char a_Value)
+std::future<bool> Wiimote::writeData(int a_Address, unsigned char a_Value)
 {
 	return writeData(a_Address, &a_Value, 1);
 }
@@ -599,7 +978,7 @@ bool Wiimote::writeData(int a_Address, unsigned char a_Value)
 
 
 
-bool Wiimote::writeData(int a_Address, const void * a_Values, unsigned char a_Size)
+std::future<bool> Wiimote::writeData(int a_Address, const void * a_Values, unsigned char a_Size)
 {
 	assert(a_Size <= REPORT_SIZE - 6);
 	unsigned char req[REPORT_SIZE] =
@@ -619,60 +998,33 @@ bool Wiimote::writeData(int a_Address, const void * a_Values, unsigned char a_Si
 
 
 
-bool Wiimote::writeReport(const void * a_Buffer, size_t a_Size)
+std::future<bool> Wiimote::writeReport(const void * a_Buffer, size_t a_Size, int a_CoalesceKey)
 {
-	std::lock_guard<std::mutex> lock(m_CSWrite);
-	auto sinceLastWrite = std::chrono::system_clock::now() - m_LastWriteTime;
-	if (sinceLastWrite < std::chrono::milliseconds(100))
-	{
-		auto toSleepTS = std::chrono::milliseconds(100) - sinceLastWrite;
-		auto toSleepMS = std::chrono::duration_cast<std::chrono::milliseconds>(toSleepTS);
-		auto toSleep = static_cast<DWORD>(toSleepMS.count());
-		LOG("Wiimote \"%s\": Sleeping for %u milliseconds before writing", m_Id.c_str(), toSleep);
-		Sleep(toSleep);
-	}
-	m_LastWriteTime = std::chrono::system_clock::now();
+	assert(a_Size <= REPORT_SIZE);
+	assert(m_OutputQueue != nullptr);  // Must be connected
+	return m_OutputQueue->push(a_Buffer, a_Size, a_CoalesceKey);
+}
+
+
+
 
-	char buf[REPORT_SIZE];
-	memset(buf, 0, sizeof(buf));
-	memcpy(buf, a_Buffer, std::min(a_Size, sizeof(buf)));
+
+bool Wiimote::writeToTransport(const unsigned char * a_Report, size_t a_Size)
+{
+	bool res;
 	if (m_UseAltWrite)
 	{
-		auto res = !!HidD_SetOutputReport(m_Handle, buf, sizeof(buf));
-		if (!res)
-		{
-			auto gle = GetLastError();
-			LOG("Wiimote \"%s\": Failed to SetOutputReport: %d (0x%x)", m_Id.c_str(), gle, gle);
-		}
-		return res;
+		res = m_Transport->setOutputReport(a_Report, a_Size);
 	}
-
-	// Write using WriteFile:
-	DWORD bw;
-	OVERLAPPED ovl;
-	memset(&ovl, 0, sizeof(ovl));
-	ovl.hEvent = m_WriteEvent;
-	if (!WriteFile(m_Handle, buf, static_cast<DWORD>(sizeof(buf)), &bw, &ovl))
+	else
 	{
-		auto gle = GetLastError();
-		if (gle != ERROR_IO_PENDING)
-		{
-			LOG("Wiimote \"%s\": Failed to WriteFile: %d (0x%x)", m_Id.c_str(), gle, gle);
-			return false;
-		}
-		if (!GetOverlappedResult(m_Handle, &ovl, &bw, TRUE))
-		{
-			auto gle = GetLastError();
-			LOG("Wiimote \"%s\": Failed to GetOverlappedResult: %d (0x%x)", m_Id.c_str(), gle, gle);
-			return false;
-		}
+		res = m_Transport->write(a_Report, a_Size);
 	}
-	if (bw != sizeof(buf))
+	if (!res)
 	{
-		LOG("Wiimote \"%s\": Failed to write buffer, %u bytes written out of %u", m_Id.c_str(), bw, static_cast<unsigned>(sizeof(buf)));
-		return false;
+		LOG("Wiimote \"%s\": Failed to write output report 0x%02x", m_Id.c_str(), a_Report[0]);
 	}
-	return true;
+	return res;
 }
 
 
@@ -681,7 +1033,38 @@ bool Wiimote::writeReport(const void * a_Buffer, size_t a_Size)
 
 unsigned char Wiimote::getRumbleBit() const
 {
-	return m_CurrentState.m_IsRumbleEnabled ? 0x01 : 0x00;
+	return m_IsRumbleEnabled.load(std::memory_order_relaxed) ? 0x01 : 0x00;
+}
+
+
+
+
+
+uint64_t Wiimote::packAccelCalibration(const AccelCalibration & a_Calibration)
+{
+	return
+		(static_cast<uint64_t>(a_Calibration.m_X0) <<  0) |
+		(static_cast<uint64_t>(a_Calibration.m_Y0) <<  8) |
+		(static_cast<uint64_t>(a_Calibration.m_Z0) << 16) |
+		(static_cast<uint64_t>(a_Calibration.m_XG) << 24) |
+		(static_cast<uint64_t>(a_Calibration.m_YG) << 32) |
+		(static_cast<uint64_t>(a_Calibration.m_ZG) << 40);
+}
+
+
+
+
+
+Wiimote::AccelCalibration Wiimote::unpackAccelCalibration(uint64_t a_Packed)
+{
+	AccelCalibration res;
+	res.m_X0 = static_cast<unsigned char>(a_Packed >>  0);
+	res.m_Y0 = static_cast<unsigned char>(a_Packed >>  8);
+	res.m_Z0 = static_cast<unsigned char>(a_Packed >> 16);
+	res.m_XG = static_cast<unsigned char>(a_Packed >> 24);
+	res.m_YG = static_cast<unsigned char>(a_Packed >> 32);
+	res.m_ZG = static_cast<unsigned char>(a_Packed >> 40);
+	return res;
 }
 
 
@@ -15,6 +15,19 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include "Transport.h"
+#include "SampleRing.h"
+#include "OutputQueue.h"
+
+
+
+
+
+// fwd:
+class DeviceCache;
+class ReportLog;
+class FlightRecorder;
 
 
 
@@ -30,11 +43,6 @@ public:
 	typedef std::vector<Wiimote::Id> Ids;
 
 
-	/** Interface that the clients of this class use to get notified of changes in the Wiimote state.
-	The parameter is the wiimote for which the callback is being called. */
-	typedef std::function<void (Wiimote &)> Callback;
-
-
 	/** The input report type, received from the Wiimote. */
 	enum InputReportType
 	{
@@ -58,6 +66,20 @@ public:
 	};
 
 
+	/** The parts of the state that a sample may change, and that the callbacks may be interested in.
+	Used as bitmasks, both for Sample::m_Changes and for the callbacks' interest masks. */
+	enum ChangeMask
+	{
+		cmIR      = 0x01,
+		cmButtons = 0x02,
+		cmAccel   = 0x04,
+		cmAll     = cmIR | cmButtons | cmAccel,
+
+		/** Interest only: call the callback for every parsed report, even if nothing has changed. */
+		cmEveryReport = 0x80,
+	};
+
+
 	/** Representation of the state of all the buttons. */
 	struct ButtonState
 	{
@@ -118,9 +140,36 @@ public:
 	};
 
 
+	/** A single parsed report, as published to the consumers. */
+	struct Sample
+	{
+		/** The state of the Wiimote after parsing the report. */
+		State m_State;
+
+		/** The sequence number of the report, counting from 0 for the first report parsed. */
+		uint64_t m_SeqNum;
+
+		/** The timestamps of the report's processing stages; arrival and parsing are always recorded. */
+		LatencyTrace m_Trace;
+
+		/** The parts of the state (ChangeMask bits) that have changed since the previous sample. */
+		unsigned m_Changes;
+	};
+
+
+	/** Interface that the clients of this class use to get notified of changes in the Wiimote state.
+	The parameters are the wiimote for which the callback is being called, and the sample that has just been parsed,
+	with its trace stamped up to LatencyTrace::stDispatched. The downstream stages may copy the trace and stamp their own stages. */
+	typedef std::function<void (Wiimote &, const Sample &)> Callback;
+
+
+	/** The number of the most recent samples kept for the consumers (see getRecentSamples()). */
+	static const size_t NUM_KEPT_SAMPLES = 16;
+
+
 	// Identification of the Wiimote
-	static const USHORT VendorID = 0x057e;
-	static const USHORT ProductID = 0x0306;
+	static const unsigned short VendorID = 0x057e;
+	static const unsigned short ProductID = 0x0306;
 
 
 	/** Creates a new empty Wiimote instance. */
@@ -128,91 +177,237 @@ public:
 	
 	~Wiimote();
 
-	/** Connects to the specified Wiimote Id.
+	/** Sets the cache of the per-device settings to use while connecting (may be nullptr for none).
+	Must be called before connect(). */
+	void setDeviceCache(DeviceCache * a_DeviceCache) { m_DeviceCache = a_DeviceCache; }
+
+	/** Starts appending all the incoming reports into the specified log (nullptr to stop), registering this Wiimote
+	as a new device in it. The log must outlive the Wiimote, a report may still be in flight after replacing the log.
+	Should be called once connected, so that the device's identity and calibration are known. */
+	void setReportLog(ReportLog * a_Log);
+
+	/** Returns the index of this Wiimote in its report log, -1 if not logging. */
+	int getReportLogDevice() const { return m_ReportLogDevice; }
+
+	/** Returns the flight recorder remembering this Wiimote's recent reports and the output events produced from them.
+	The output events are recorded by the consumers, from within the callbacks. */
+	FlightRecorder & getFlightRecorder() const { return *m_FlightRecorder; }
+
+	/** Prepares a Wiimote that is not connected for replaying the reports captured from a real one.
+	a_Id is used only for identifying the Wiimote in the logs. */
+	void startReplay(const Id & a_Id, const AccelCalibration & a_AccelCalibration);
+
+	/** Processes a single captured report as if it has just arrived at a_ArrivalTime, parsing it with the specified
+	IR reporting mode and notifying the callbacks. Must only be used on a Wiimote prepared by startReplay(),
+	from a single thread. */
+	void replayReport(const unsigned char * a_Report, size_t a_Size, IRReportingMode a_IRMode, Clock::time_point a_ArrivalTime);
+
+	/** Connects to the specified Wiimote Id, through the OS's HID device.
 	Returns true if the connection succeeded.
 	a_InitialCallback may be filled to provide the callback from the very beginning of the object's lifetime. */
 	bool connect(const Id & a_Id, Callback * a_InitialCallback);
 
-	/** Converts the UTF-16 device path used by the OS into a Wiimote Id. */
-	static Id IdFromWPath(LPCWSTR a_DevicePath);
+	/** Connects to a Wiimote through the specified (already open) transport, such as a SimulatedWiimote.
+	a_Id is used only for identifying the Wiimote in the logs.
+	Returns true if the connection succeeded. */
+	bool connect(TransportPtr a_Transport, const Id & a_Id, Callback * a_InitialCallback);
 
-	/** Converts the Wiimote Id into a UTF-16 device path used by the OS. */
-	static std::wstring WPathFromId(const Id & a_Id);
+	#ifdef _WIN32
+		/** Converts the UTF-16 device path used by the OS into a Wiimote Id. */
+		static Id IdFromWPath(LPCWSTR a_DevicePath);
+	#endif
 
-	/** Returns the current state of the controller. */
+	/** Returns the current state of the controller. Lock-free. */
 	State getCurrentState() const;
 
-	/** Returns the current IR camera state. */
+	/** Returns the current IR camera state. Lock-free. */
 	IRState getCurrentIRState() const;
 
-	/** Sets the LEDs to the specified states. */
-	void setLeds(bool a_Led1, bool a_Led2, bool a_Led3, bool a_Led4);
+	/** Returns the statistics of the intervals between the consecutive incoming reports (the report rate and jitter). */
+	DurationStats::Summary getReportIntervalStats() const { return m_ReportIntervals.getSummary(); }
 
-	/** Sets the reporting mode to the specified type.
-	Asks the Wiimote to send reports of the specified type. */
-	void setReportType(InputReportType a_Type, bool a_Continuous);
+	/** Copies the most recent sample into a_Sample. Lock-free.
+	Returns false if no report has been parsed yet. */
+	bool getLatestSample(Sample & a_Sample) const;
+
+	/** Copies up to a_MaxCount (at most NUM_KEPT_SAMPLES) most recent samples into a_Samples, the oldest one first. Lock-free.
+	Returns the number of samples copied. */
+	size_t getRecentSamples(Sample * a_Samples, size_t a_MaxCount) const;
 
-	/** Adds the specified callback to the container of callbacks called for detected changes. */
-	void addCallback(Callback * a_Callback);
+	/** Sets the LEDs to the specified states.
+	Doesn't wait for the output report to be written; returns the future that resolves to the write's result.
+	Supersedes any earlier LED change that hasn't been written yet. */
+	std::future<bool> setLeds(bool a_Led1, bool a_Led2, bool a_Led3, bool a_Led4);
 
-	/** Removes the specified callback from the container of callbacks called for detected changes. */
+	/** Sets the reporting mode to the specified type.
+	Asks the Wiimote to send reports of the specified type.
+	Doesn't wait for the output reports to be written; returns the future that resolves to the result of the last one
+	(the reports are written in order, so all the others have been written by then). */
+	std::future<bool> setReportType(InputReportType a_Type, bool a_Continuous);
+
+	/** Sets the minimum interval between two consecutive output reports; the default is given by the transport.
+	Must be connected. */
+	void setWriteInterval(std::chrono::microseconds a_Interval);
+
+	/** Returns the queue of the output reports, for inspecting its statistics.
+	Returns nullptr if not connected. */
+	const OutputQueue * getOutputQueue() const { return m_OutputQueue.get(); }
+
+	/** Adds the specified callback to the container of callbacks called for detected changes.
+	a_InterestMask is a combination of ChangeMask bits; the callback is called only for the samples
+	that have changed any of the parts it is interested in (or for every report, with cmEveryReport). */
+	void addCallback(Callback * a_Callback, unsigned a_InterestMask = cmAll);
+
+	/** Changes the interest mask of an already added callback. */
+	void setCallbackInterest(Callback * a_Callback, unsigned a_InterestMask);
+
+	/** Removes the specified callback from the container of callbacks called for detected changes.
+	Once this returns, the callback is not called anymore (waits for a dispatch in progress to finish).
+	When called from within a callback of this Wiimote, the removal takes effect from the next report. */
 	void removeCallback(Callback * a_Callback);
 
 
 protected:
 
-	/** Type used for storing read data requests. The DataRead packets read from the Wiimote will get stored in "first" and then "second" will be notified. */
-	typedef std::tuple<char *, short, std::condition_variable *> ReadDataRequest;
+	/** A single request for reading data from the Wiimote.
+	The DataRead packets read from the Wiimote get stored in m_Buffer, and once all the data is read (or the read fails), m_CV is notified. */
+	struct ReadDataRequest
+	{
+		/** Where to store the next chunk of the data. */
+		char * m_Buffer;
+
+		/** The number of bytes still to be read. */
+		short m_Left;
+
+		/** Set once the request has been completed (successfully or not). */
+		bool m_IsDone;
+
+		/** Set if the request has completed successfully. */
+		bool m_IsSuccess;
+
+		/** Notified once the request has been completed. */
+		std::condition_variable m_CV;
+	};
 
 	/** The Id of the controller. */
 	Id m_Id;
 
-	/** OS handle for the Wiimote device. */
-	HANDLE m_Handle;
+	/** The transport through which the Wiimote is accessed. */
+	TransportPtr m_Transport;
 
-	/** Flag indicating that the read thread should terminate as soon as possible. */
-	bool m_ShouldTerminate;
-
-	/** Mutex protecting the m_CurrentState and m_ReadDataRequests against multithreaded access. */
+	/** Mutex serializing the changes to m_Subscribers, and protecting m_RetiredSubscribers and m_ReadDataRequests against multithreaded access.
+	Never taken on the path of the regular (non-ReadData) reports. */
 	mutable std::mutex m_CS;
 
-	/** Current state of the controller.
+	/** The state being updated by the parser.
+	Accessed only from the transport's reading context. */
+	State m_ParseState;
+
+	/** The parsed samples, published for the consumers. Written only from the transport's reading context. */
+	SampleRing<Sample, NUM_KEPT_SAMPLES> m_Samples;
+
+	/** The IR reporting mode set by enableIR() / disableIR(), used by the parser. */
+	std::atomic<int> m_IRReportingMode;
+
+	/** The LED states set by setLeds(), bit 0 for LED1 through bit 3 for LED4. */
+	std::atomic<int> m_Leds;
+
+	/** The rumble state, as sent in each output report. */
+	std::atomic<bool> m_IsRumbleEnabled;
+
+	/** The accelerometer calibration read by readCalibration(), packed into a single number (see packAccelCalibration()). */
+	std::atomic<uint64_t> m_AccelCalibration;
+
+	/** The arrival time of the previous report, used for measuring the report intervals.
+	Accessed only from the transport's reading context. */
+	Clock::time_point m_LastArrivalTime;
+
+	/** The intervals between the consecutive incoming reports. */
+	DurationStats m_ReportIntervals;
+
+	/** A single callback, together with the parts of the state it's interested in. */
+	struct Subscriber
+	{
+		Callback * m_Callback;
+
+		/** The ChangeMask bits the callback is interested in. */
+		unsigned m_InterestMask;
+	};
+
+	/** A snapshot of all the callbacks. Never modified once published in m_Subscribers, replaced as a whole instead. */
+	typedef std::vector<Subscriber> SubscriberTable;
+
+	/** Callbacks that should be called whenever the state changes.
+	The dispatch reads the table without locking or allocating; the changes copy it, modify the copy and swap it in (under m_CS),
+	then free the old table once the dispatch can no longer be using it (see m_DispatchSeq). */
+	std::atomic<const SubscriberTable *> m_Subscribers;
+
+	/** The union of the interest masks of all the callbacks in m_Subscribers, so that the reports that don't interest
+	anyone can be skipped right away. */
+	std::atomic<unsigned> m_CombinedInterest;
+
+	/** Incremented by the dispatch upon both entering and leaving, so it's odd while a dispatch is in progress.
+	A replaced SubscriberTable may be freed once this is even, or has changed since the table was replaced. */
+	std::atomic<uint64_t> m_DispatchSeq;
+
+	/** The thread running the dispatch in progress, so that a callback changing the callbacks doesn't wait for itself. */
+	std::atomic<std::thread::id> m_DispatchThread;
+
+	/** The tables replaced from within a callback, to be freed by the dispatch once it finishes.
 	Protected against multithreaded access by m_CS. */
-	State m_CurrentState;
+	std::vector<const SubscriberTable *> m_RetiredSubscribers;
 
-	/** The thread used for reading from the Wiimote. */
-	std::thread m_ReadThread;
+	/** Set when m_RetiredSubscribers is non-empty, so that the dispatch needn't lock m_CS to check. */
+	std::atomic<bool> m_HasRetiredSubscribers;
 
-	/** Callbacks that should be called whenever the state changes. */
-	std::list<Callback *> m_Callbacks;
+	/** The state in the previously published sample, for detecting the changes.
+	Accessed only from the transport's reading context. */
+	State m_LastPublishedState;
+
+	/** Set once the first sample has been published. Accessed only from the transport's reading context. */
+	bool m_HasPublished;
 
 	/** Indicates whether writes to the Wiimote should use an alternate method.
 	Auto-detected at start time. */
-	bool m_UseAltWrite;
+	std::atomic<bool> m_UseAltWrite;
 
-	/** FIFO queue of requests for reading data from the Wiimote.
+	/** FIFO queue of requests for reading data from the Wiimote. The requests are owned by the readData() calls waiting for them.
 	Whenever an irtReadData report comes in, the front request is filled with the data and its condvar notified if all data was read.
 	Protected against multithreaded access with m_CS*/
-	std::list<ReadDataRequest> m_ReadDataRequests;
+	std::list<ReadDataRequest *> m_ReadDataRequests;
+
+	/** The cache of the per-device settings, nullptr if not used. */
+	DeviceCache * m_DeviceCache;
+
+	/** The log into which the incoming reports are appended, nullptr if not logging. */
+	std::atomic<ReportLog *> m_ReportLog;
+
+	/** The index of this Wiimote in m_ReportLog, -1 if not logging. Written before m_ReportLog. */
+	int m_ReportLogDevice;
 
-	/** Mutex serializing write operations. */
-	std::mutex m_CSWrite;
+	/** The always-on recorder of the recent reports. */
+	std::unique_ptr<FlightRecorder> m_FlightRecorder;
 
-	/** The event used for IO completion in write operations. */
-	HANDLE m_WriteEvent;
+	/** The slot of this Wiimote in StageHistograms, -1 if it has none (only counted in the aggregate). */
+	int m_HistogramsDevice;
 
-	/** The time when the last write operation was started.
-	Access serialized by m_CSWrite. */
-	std::chrono::system_clock::time_point m_LastWriteTime;
+	/** The stable identity of the device, as reported by the transport; the key into m_DeviceCache.
+	Empty if the device is not cached. */
+	std::string m_StableId;
 
+	/** The queue of the output reports, pacing them as the transport needs. Created upon connecting. */
+	std::unique_ptr<OutputQueue> m_OutputQueue;
 
-	/** Enables the IR reporting in the specified format on the Wiimote. */
-	void enableIR(IRReportingMode a_Mode);
 
-	/** Disables the IR reporting on the Wiimote. */
-	void disableIR();
+	/** Enables the IR reporting in the specified format on the Wiimote.
+	Returns the future for the last output report written. */
+	std::future<bool> enableIR(IRReportingMode a_Mode);
 
-	/** Parses the packet received from the Wiimote and updates m_CurrentState accordingly.
+	/** Disables the IR reporting on the Wiimote.
+	Returns the future for the last output report written. */
+	std::future<bool> disableIR();
+
+	/** Parses the packet received from the Wiimote and updates m_ParseState accordingly.
 	Returns true if the packet was parsed successfully (state has been updated). */
 	bool parseIncomingPacket(const unsigned char * a_Packet);
 
@@ -228,13 +423,29 @@ protected:
 	/** Parses the irtReadData input report packet. */
 	void parseReadData(const unsigned char * a_Packet);
 
-	/** Reads data incoming from the Wiimote.
-	Executed in m_ReadThread. */
-	void thrRead();
+	/** Processes a single input report received from the device at the specified time.
+	Called from the transport's reading context (see Transport::ReportCallback). */
+	void onReport(const unsigned char * a_Report, size_t a_Size, Clock::time_point a_ArrivalTime);
+
+	/** Returns the ChangeMask bits of the parts of the state that differ between the two states. */
+	static unsigned diffStates(const State & a_Old, const State & a_New);
+
+	/** Replaces m_Subscribers with a copy modified by a_Modifier, then frees the old table (or has the dispatch free it later).
+	Must not be called with m_CS held. */
+	void modifySubscribers(const std::function<void (SubscriberTable &)> & a_Modifier);
+
+	/** Notifies the interested callbacks that the internal state has been changed, as described by the sample.
+	Stamps the sample's trace with LatencyTrace::stDispatched.
+	Runs in the transport's reading context. */
+	void notifyStateChange(Sample & a_Sample);
 
-	/** Notifies all callbacks that the internal state has been changed.
-	Runs in m_ReadThread. */
-	void notifyStateChange();
+	/** Detects the write method that the device needs (m_UseAltWrite) and reads the calibration, effectively initializing it.
+	Tries the write method remembered in m_DeviceCache first, to avoid waiting for the other method to time out.
+	Returns true on success. */
+	bool detectWriteMethod();
+
+	/** Stores the current settings of the device into m_DeviceCache, if used. */
+	void updateDeviceCache();
 
 	/** Requests and reads the calibration from the Wiimote, effectively initializing it.
 	Returns true if the read succeeded, false on failure. */
@@ -245,17 +456,31 @@ protected:
 	Blocks until the read completes or times out. */
 	bool readData(int a_Address, short a_Size, char * a_Buffer);
 
-	/** Writes a single data byte to the specified address. */
-	bool writeData(int a_Address, unsigned char a_Value);
+	/** Writes a single data byte to the specified address.
+	Returns the future for the output report's write. */
+	std::future<bool> writeData(int a_Address, unsigned char a_Value);
+
+	/** Writes a sequence of bytes to the specified address.
+	Returns the future for the output report's write. */
+	std::future<bool> writeData(int a_Address, const void * a_Values, unsigned char a_Size);
 
-	/** Writes a sequence of bytes to the specified address. */
-	bool writeData(int a_Address, const void * a_Values, unsigned char a_Size);
+	/** Queues the specified output report for writing to the Wiimote.
+	a_CoalesceKey, if non-zero, lets the report supersede an earlier queued one with the same key (see OutputQueue::push()).
+	Returns the future for the report's write. */
+	std::future<bool> writeReport(const void * a_Buffer, size_t a_Size, int a_CoalesceKey = 0);
 
-	/** Writes the specified output report to the Wiimote. */
-	bool writeReport(const void * a_Buffer, size_t a_Size);
+	/** Writes the specified output report to the transport, using the detected write method.
+	Called from m_OutputQueue's thread. */
+	bool writeToTransport(const unsigned char * a_Report, size_t a_Size);
 
 	/** Returns the current state of the Rumble bit encoded in the output report format. */
 	unsigned char getRumbleBit() const;
+
+	/** Packs the accelerometer calibration into a single number, so that it can be stored in an atomic. */
+	static uint64_t packAccelCalibration(const AccelCalibration & a_Calibration);
+
+	/** Unpacks the accelerometer calibration packed by packAccelCalibration(). */
+	static AccelCalibration unpackAccelCalibration(uint64_t a_Packed);
 };
 
 typedef std::shared_ptr<Wiimote> WiimotePtr;
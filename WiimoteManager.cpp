@@ -1,94 +1,117 @@
 // WiimoteManager.cpp
 
-// Implements the WiimoteManager class representing the singleton that manages individual Wiimote instances
+// Implements the OS-independent parts of the WiimoteManager class representing the singleton that manages individual Wiimote instances
 
 
 
 
 
 #include "Globals.h"
-#include <hidclass.h>
-#include <hidsdi.h>
-#include <SetupAPI.h>
 #include "WiimoteManager.h"
-#include "HandleGuard.h"
+#include <thread>
+#include <atomic>
 
 
 
 
 
-WiimoteManager & WiimoteManager::get()
+std::vector<WiimoteManager::StartResult> WiimoteManager::startWiimotes(
+	const Wiimote::Ids & a_Ids,
+	const Initializer & a_Initializer,
+	size_t a_MaxParallel,
+	DeviceCache * a_DeviceCache,
+	const TransportFactory & a_TransportFactory
+)
 {
-	static WiimoteManager singleton;
-	return singleton;
-}
-
-
-
-
-
-WiimoteManager::WiimoteManager()
-{
-}
-
-
-
-
-
-WiimoteManager::~WiimoteManager()
-{
-}
-
+	auto startTime = Clock::now();
+	std::vector<StartResult> res(a_Ids.size());
 
-
-
-
-Wiimote::Ids WiimoteManager::enumWiimotes()
-{
-	// Enumerate all devices:
-	GUID hidGuid;
-	HidD_GetHidGuid(&hidGuid);
-	auto hDevInfo = SetupDiGetClassDevs(&hidGuid, nullptr, nullptr, DIGCF_DEVICEINTERFACE);
-	SP_DEVICE_INTERFACE_DATA diData;
-	diData.cbSize = sizeof(diData);
-	Wiimote::Ids res;
-	for (DWORD index = 0; SetupDiEnumDeviceInterfaces(hDevInfo, nullptr, &hidGuid, index, &diData); ++index)
+	// Each worker thread takes the next Id to start, until there are none left:
+	std::atomic<size_t> nextIndex(0);
+	auto worker = [&]()
 	{
-		// Get the device path:
-		DWORD size;
-		char buffer[4000];  // The fixed-size back-buffer for diDetail
-		SetupDiGetDeviceInterfaceDetailW(hDevInfo, &diData, nullptr, 0, &size, nullptr);
-		if (size > sizeof(buffer))
+		for (;;)
 		{
-			OutputDebugStringA("Device interface detail size too large for the fixed-size buffer\n");
-			continue;
-		}
-		auto diDetail = reinterpret_cast<SP_DEVICE_INTERFACE_DETAIL_DATA_W *>(&buffer);
-		diDetail->cbSize = sizeof(*diDetail);
-		if (!SetupDiGetDeviceInterfaceDetailW(hDevInfo, &diData, diDetail, size, nullptr, nullptr))
-		{
-			LOG("SetupDiGetDeviceInterfaceDetailW(#%d) failed: %d", index, GetLastError());
-			continue;
+			auto idx = nextIndex.fetch_add(1);
+			if (idx >= a_Ids.size())
+			{
+				return;
+			}
+			const auto & id = a_Ids[idx];
+			auto & result = res[idx];
+			result.m_Id = id;
+			auto initStartTime = Clock::now();
+			try
+			{
+				auto wiimote = std::make_shared<Wiimote>();
+				wiimote->setDeviceCache(a_DeviceCache);
+				bool isConnected;
+				if (a_TransportFactory != nullptr)
+				{
+					auto transport = a_TransportFactory(id);
+					isConnected = (transport != nullptr) && wiimote->connect(std::move(transport), id, nullptr);
+				}
+				else
+				{
+					isConnected = wiimote->connect(id, nullptr);
+				}
+				if (!isConnected)
+				{
+					LOG("Wiimote \"%s\": failed to connect", id.c_str());
+				}
+				else if ((a_Initializer != nullptr) && !a_Initializer(*wiimote, idx))
+				{
+					LOG("Wiimote \"%s\": failed to initialize", id.c_str());
+				}
+				else
+				{
+					result.m_Wiimote = wiimote;
+				}
+			}
+			catch (const std::exception & exc)
+			{
+				LOG("Wiimote \"%s\": failed to start: %s", id.c_str(), exc.what());
+			}
+			auto now = Clock::now();
+			result.m_TimeToReady = now - startTime;
+			result.m_InitDuration = now - initStartTime;
 		}
+	};
 
-		// Check the VID and PID identifiers:
-		HIDD_ATTRIBUTES attrib;
-		attrib.Size = sizeof(attrib);
-		HandleGuard handle(CreateFileW(diDetail->DevicePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr));
-		if (!HidD_GetAttributes(handle, &attrib))
-		{
-			LOG("Unavailable HID Device: path \"%s\".", Wiimote::IdFromWPath(diDetail->DevicePath).c_str());
-			continue;
-		}
-		LOG("HID device: VID 0x%04x, PID 0x%04x, path \"%s\"", attrib.VendorID, attrib.ProductID, Wiimote::IdFromWPath(diDetail->DevicePath).c_str());
-		if ((attrib.VendorID != Wiimote::VendorID) || (attrib.ProductID != Wiimote::ProductID))
+	// Run the workers, the current thread being one of them:
+	auto numWorkers = std::max<size_t>(1, std::min(a_MaxParallel, a_Ids.size()));
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < numWorkers; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto & thr: threads)
+	{
+		thr.join();
+	}
+
+	// Report the times:
+	Clock::duration total = Clock::duration::zero();
+	size_t numStarted = 0;
+	for (const auto & r: res)
+	{
+		LOG("Wiimote \"%s\": %s in %.1f ms (ready %.1f ms after the start)",
+			r.m_Id.c_str(),
+			(r.m_Wiimote != nullptr) ? "started" : "failed",
+			std::chrono::duration<double, std::milli>(r.m_InitDuration).count(),
+			std::chrono::duration<double, std::milli>(r.m_TimeToReady).count()
+		);
+		total = std::max(total, r.m_TimeToReady);
+		if (r.m_Wiimote != nullptr)
 		{
-			continue;
+			numStarted += 1;
 		}
-		LOG("  ^^ This is a Wiimote");
-		res.push_back(Wiimote::IdFromWPath(diDetail->DevicePath));
 	}
-
+	LOG("Started %u of %u Wiimotes, %u at a time, in %.1f ms",
+		static_cast<unsigned>(numStarted), static_cast<unsigned>(a_Ids.size()), static_cast<unsigned>(numWorkers),
+		std::chrono::duration<double, std::milli>(total).count()
+	);
 	return res;
 }
 
@@ -22,10 +22,47 @@
 class WiimoteManager
 {
 public:
+	/** The result of starting up a single Wiimote, see startWiimotes(). */
+	struct StartResult
+	{
+		Wiimote::Id m_Id;
+
+		/** The connected and initialized Wiimote; nullptr if it failed to start. */
+		WiimotePtr m_Wiimote;
+
+		/** The time from the start of the whole batch until this Wiimote was ready (or failed). */
+		Clock::duration m_TimeToReady;
+
+		/** The time this Wiimote's own connection and initialization took, excluding waiting for a free slot. */
+		Clock::duration m_InitDuration;
+	};
+
+	/** Initializes a single freshly connected Wiimote (LEDs, report type...); a_Index is the index of its Id.
+	Should wait for its output reports to be written and return true if the Wiimote is ready. */
+	typedef std::function<bool (Wiimote & a_Wiimote, size_t a_Index)> Initializer;
+
+	/** Creates the transport for the specified Id, returns nullptr on failure. */
+	typedef std::function<TransportPtr (const Wiimote::Id & a_Id)> TransportFactory;
+
+
     static WiimoteManager & get();
 
 		std::vector<Wiimote::Id> enumWiimotes();
 
+	/** Connects and initializes all the specified Wiimotes, at most a_MaxParallel of them at the same time.
+	Each Wiimote is connected, then given to a_Initializer. A Wiimote that fails doesn't affect the others.
+	a_DeviceCache, if given, is used by the Wiimotes to skip probing the settings remembered from the previous runs.
+	a_TransportFactory, if given, creates the transports (such as SimulatedWiimotes); otherwise the Ids are opened as OS HID devices.
+	Blocks until all the Wiimotes are ready or failed. Returns the results in the same order as a_Ids;
+	the time-to-ready of the whole set is the maximum of the m_TimeToReady values. */
+	std::vector<StartResult> startWiimotes(
+		const Wiimote::Ids & a_Ids,
+		const Initializer & a_Initializer,
+		size_t a_MaxParallel,
+		DeviceCache * a_DeviceCache = nullptr,
+		const TransportFactory & a_TransportFactory = nullptr
+	);
+
 protected:
     WiimoteManager();
     ~WiimoteManager();
@@ -0,0 +1,98 @@
+// WiimoteManagerLinux.cpp
+
+// Implements the WiimoteManager class representing the singleton that manages individual Wiimote instances, on top of Linux hidraw
+
+
+
+
+
+#include "Globals.h"
+#include "WiimoteManager.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+
+
+
+
+WiimoteManager & WiimoteManager::get()
+{
+	static WiimoteManager singleton;
+	return singleton;
+}
+
+
+
+
+
+WiimoteManager::WiimoteManager()
+{
+}
+
+
+
+
+
+WiimoteManager::~WiimoteManager()
+{
+}
+
+
+
+
+
+Wiimote::Ids WiimoteManager::enumWiimotes()
+{
+	Wiimote::Ids res;
+	auto dir = opendir("/dev");
+	if (dir == nullptr)
+	{
+		LOG("Cannot list the /dev folder: %d (%s)", errno, strerror(errno));
+		return res;
+	}
+
+	// Check the VID and PID of each hidraw node:
+	while (auto entry = readdir(dir))
+	{
+		if (strncmp(entry->d_name, "hidraw", 6) != 0)
+		{
+			continue;
+		}
+		AString path = AString("/dev/") + entry->d_name;
+		auto fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+		{
+			LOG("Unavailable HID Device: path \"%s\".", path.c_str());
+			continue;
+		}
+		hidraw_devinfo info;
+		auto ioctlRes = ioctl(fd, HIDIOCGRAWINFO, &info);
+		close(fd);
+		if (ioctlRes < 0)
+		{
+			LOG("Cannot query HID device info: path \"%s\".", path.c_str());
+			continue;
+		}
+		auto vendorID = static_cast<unsigned short>(info.vendor);
+		auto productID = static_cast<unsigned short>(info.product);
+		LOG("HID device: VID 0x%04x, PID 0x%04x, path \"%s\"", vendorID, productID, path.c_str());
+		if ((vendorID != Wiimote::VendorID) || (productID != Wiimote::ProductID))
+		{
+			continue;
+		}
+		LOG("  ^^ This is a Wiimote");
+		res.push_back(path);
+	}
+	closedir(dir);
+
+	// Sort, so that the Wiimotes get the same LED numbers across restarts:
+	std::sort(res.begin(), res.end());
+	return res;
+}
+
+
+
+